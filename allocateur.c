@@ -0,0 +1,359 @@
+#include "allocateur.h"
+
+/* Tailles des objets de chaque classe (multiples de 8, croissance d'environ
+   25% d'une classe a l'autre pour limiter la perte par objet) */
+static const size_t tailles_classes[SLAB_NB_CLASSES] = {
+    32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* Place occupee par l'entete d'un slab, arrondie pour aligner les objets */
+#define SLAB_ENTETE ((sizeof(slab)+15) & ~(size_t)15)
+
+/**
+ * @brief Initialise un allocateur.
+ *
+ * Aucun slab n'est reserve : ils sont obtenus du systeme au premier besoin.
+ *
+ * @param alloc un pointeur sur l'allocateur a initialiser.
+*/
+void init_allocateur(allocateur *alloc)
+{
+    unsigned int i, c;
+    
+    memset(alloc, 0, sizeof(allocateur));
+    
+    for(c=0; c<SLAB_NB_CLASSES; c++)
+        alloc->classes[c].taille_objet = tailles_classes[c];
+    
+    /* Table de correspondance taille -> plus petite classe suffisante */
+    for(i=0, c=0; i<=SLAB_OBJET_MAX/8; i++)
+    {
+        while(tailles_classes[c] < i*8)
+            c++;
+        alloc->classe_de[i] = c;
+    }
+}
+
+/**
+ * @brief Retire un slab de la liste dans laquelle il se trouve.
+ *
+ * @param tete un pointeur sur la tete de la liste.
+ * @param s le slab a retirer.
+*/
+static void retirer_slab(slab **tete, slab *s)
+{
+    if(s->prec!=NULL)
+        s->prec->next = s->next;
+    else
+        *tete = s->next;
+    
+    if(s->next!=NULL)
+        s->next->prec = s->prec;
+    
+    s->next = NULL;
+    s->prec = NULL;
+}
+
+/**
+ * @brief Insere un slab en tete d'une liste.
+ *
+ * @param tete un pointeur sur la tete de la liste.
+ * @param s le slab a inserer.
+*/
+static void inserer_slab(slab **tete, slab *s)
+{
+    s->prec = NULL;
+    s->next = *tete;
+    if(*tete!=NULL)
+        (*tete)->prec = s;
+    *tete = s;
+}
+
+/**
+ * @brief Libere une liste de slabs en les rendant au systeme.
+ *
+ * @param s le premier slab de la liste.
+*/
+static void rendre_slabs(slab *s)
+{
+    slab *suivant;
+    
+    for(; s!=NULL; s=suivant)
+    {
+        suivant = s->next;
+        munmap(s, SLAB_TAILLE);
+    }
+}
+
+/**
+ * @brief Rend au systeme tous les slabs d'un allocateur.
+ *
+ * Les objets alloues par malloc (trop grands) doivent avoir ete liberes.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+*/
+void delete_allocateur(allocateur *alloc)
+{
+    unsigned int c;
+    
+    for(c=0; c<SLAB_NB_CLASSES; c++)
+    {
+        rendre_slabs(alloc->classes[c].partiels);
+        rendre_slabs(alloc->classes[c].pleins);
+    }
+    
+    init_allocateur(alloc);
+}
+
+/**
+ * @brief Obtient un nouveau slab du systeme pour une classe.
+ *
+ * Le slab est aligne sur sa taille, ce qui permet de retrouver l'entete du
+ * slab a partir de l'adresse de n'importe lequel de ses objets.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @param c l'indice de la classe du slab.
+ * @return le slab cree, NULL en cas d'erreur.
+*/
+static slab *new_slab(allocateur *alloc, unsigned int c)
+{
+    char *brut, *debut;
+    slab *s;
+    
+    brut = mmap(NULL, 2*SLAB_TAILLE, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(brut == MAP_FAILED)
+    {
+        perror("Error mmap");
+        return NULL;
+    }
+    
+    /* Ne garde que la partie alignee de la zone obtenue */
+    debut = (char *)(((uintptr_t)brut+SLAB_TAILLE-1) & ~(uintptr_t)(SLAB_TAILLE-1));
+    if(debut > brut)
+        munmap(brut, debut-brut);
+    if(brut+2*SLAB_TAILLE > debut+SLAB_TAILLE)
+        munmap(debut+SLAB_TAILLE, brut+SLAB_TAILLE-debut);
+    
+    s = (slab *)debut;
+    s->next = NULL;
+    s->prec = NULL;
+    s->libres = NULL;
+    s->prochain = debut+SLAB_ENTETE;
+    s->utilises = 0;
+    s->capacite = (SLAB_TAILLE-SLAB_ENTETE)/alloc->classes[c].taille_objet;
+    s->classe = c;
+    
+    alloc->classes[c].nb_slabs++;
+    alloc->classes[c].vides++;
+    alloc->slabs_crees++;
+    
+    return s;
+}
+
+/**
+ * @brief Alloue un objet.
+ *
+ * L'objet est pris dans un slab de la plus petite classe pouvant le contenir.
+ * Les objets plus grands que SLAB_OBJET_MAX sont alloues par malloc.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @param taille la taille de l'objet.
+ * @return un pointeur sur l'objet alloue, NULL en cas d'erreur.
+*/
+void *allouer(allocateur *alloc, size_t taille)
+{
+    classe_slab *classe;
+    slab *s;
+    void *objet;
+    unsigned int c;
+    
+    if(taille > SLAB_OBJET_MAX)
+    {
+        objet = malloc(taille);
+        if(objet==NULL)
+        {
+            perror("Error malloc");
+            return NULL;
+        }
+        alloc->hors_slab++;
+        alloc->octets_hors_slab += taille;
+        alloc->octets_objets += taille;
+        return objet;
+    }
+    
+    c = alloc->classe_de[(taille+7)/8];
+    classe = &alloc->classes[c];
+    
+    if(classe->partiels==NULL)
+    {
+        s = new_slab(alloc, c);
+        if(s==NULL)
+            return NULL;
+        inserer_slab(&classe->partiels, s);
+    }
+    s = classe->partiels;
+    
+    /* Reutilise un objet libere, sinon prend le suivant jamais utilise */
+    if(s->libres!=NULL)
+    {
+        objet = s->libres;
+        s->libres = *(void **)objet;
+    }
+    else
+    {
+        objet = s->prochain;
+        s->prochain += classe->taille_objet;
+    }
+    
+    if(s->utilises==0)
+        classe->vides--;
+    s->utilises++;
+    classe->objets++;
+    alloc->octets_objets += classe->taille_objet;
+    
+    if(s->utilises==s->capacite)
+    {
+        retirer_slab(&classe->partiels, s);
+        inserer_slab(&classe->pleins, s);
+    }
+    
+    return objet;
+}
+
+/**
+ * @brief Libere un objet.
+ *
+ * Un slab devenu vide est rendu au systeme si la classe conserve deja
+ * suffisamment de slabs vides.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @param objet l'objet a liberer (peut etre NULL).
+ * @param taille la taille demandee lors de l'allocation de l'objet.
+*/
+void liberer(allocateur *alloc, void *objet, size_t taille)
+{
+    classe_slab *classe;
+    slab *s;
+    
+    if(objet==NULL)
+        return;
+    
+    if(taille > SLAB_OBJET_MAX)
+    {
+        free(objet);
+        alloc->hors_slab--;
+        alloc->octets_hors_slab -= taille;
+        alloc->octets_objets -= taille;
+        return;
+    }
+    
+    s = (slab *)((uintptr_t)objet & ~(uintptr_t)(SLAB_TAILLE-1));
+    classe = &alloc->classes[s->classe];
+    
+    if(s->utilises==s->capacite)
+    {
+        retirer_slab(&classe->pleins, s);
+        inserer_slab(&classe->partiels, s);
+    }
+    
+    *(void **)objet = s->libres;
+    s->libres = objet;
+    s->utilises--;
+    classe->objets--;
+    alloc->octets_objets -= classe->taille_objet;
+    
+    if(s->utilises==0)
+    {
+        if(classe->vides >= SLAB_VIDES_GARDES)
+        {
+            retirer_slab(&classe->partiels, s);
+            munmap(s, SLAB_TAILLE);
+            classe->nb_slabs--;
+            alloc->slabs_rendus++;
+        }
+        else
+        {
+            classe->vides++;
+        }
+    }
+}
+
+/**
+ * @brief Renvoie le nombre d'octets obtenus du systeme par l'allocateur.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @return la taille des slabs plus celle des objets alloues par malloc.
+*/
+size_t memoire_allocateur(allocateur *alloc)
+{
+    return (alloc->slabs_crees-alloc->slabs_rendus)*SLAB_TAILLE
+            + alloc->octets_hors_slab;
+}
+
+/**
+ * @brief Renvoie le nombre d'octets occupes par les objets alloues.
+ *
+ * Contrairement a memoire_allocateur, la place libre dans les slabs n'est pas
+ * comptee : cette valeur diminue des qu'un objet est libere.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @return la somme des tailles de classe des objets alloues.
+*/
+size_t objets_allocateur(allocateur *alloc)
+{
+    return alloc->octets_objets;
+}
+
+/**
+ * @brief Affiche l'occupation des slabs de chaque classe.
+ *
+ * Pour chaque classe utilisee : le nombre de slabs, le taux d'occupation
+ * global et la repartition des slabs par quart d'occupation.
+ *
+ * @param alloc un pointeur sur l'allocateur.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_allocateur(allocateur *alloc, FILE *f)
+{
+    unsigned long quarts[4], capacite;
+    unsigned int c, q;
+    classe_slab *classe;
+    slab *s, *listes[2];
+    int l;
+    
+    fprintf(f, "Slabs : %lu crees, %lu rendus, %lu Ko en usage "\
+               "(%lu Ko d'objets), %lu objets hors slab (%lu o)\n",
+            alloc->slabs_crees, alloc->slabs_rendus,
+            (unsigned long)memoire_allocateur(alloc)/1024,
+            (unsigned long)alloc->octets_objets/1024,
+            alloc->hors_slab, (unsigned long)alloc->octets_hors_slab);
+    
+    for(c=0; c<SLAB_NB_CLASSES; c++)
+    {
+        classe = &alloc->classes[c];
+        if(classe->nb_slabs==0)
+            continue;
+        
+        memset(quarts, 0, sizeof(quarts));
+        capacite = 0;
+        listes[0] = classe->partiels;
+        listes[1] = classe->pleins;
+        for(l=0; l<2; l++)
+        {
+            for(s=listes[l]; s!=NULL; s=s->next)
+            {
+                capacite += s->capacite;
+                q = 4*s->utilises/s->capacite;
+                quarts[q<4 ? q : 3]++;
+            }
+        }
+        
+        fprintf(f, "  %4lu o : %lu slabs, %lu/%lu objets (%lu%%), "\
+                   "occupation <25%% %lu, <50%% %lu, <75%% %lu, >=75%% %lu\n",
+                (unsigned long)classe->taille_objet, classe->nb_slabs,
+                classe->objets, capacite, 100*classe->objets/capacite,
+                quarts[0], quarts[1], quarts[2], quarts[3]);
+    }
+}
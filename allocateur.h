@@ -0,0 +1,74 @@
+#ifndef __ALLOCATEUR_H__
+#define __ALLOCATEUR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Taille d'un slab (puissance de 2, les slabs sont alignes sur leur taille) */
+#define SLAB_TAILLE (64*1024)
+
+/* Taille maximale d'un objet servi par les slabs (au dela : malloc) */
+#define SLAB_OBJET_MAX 2048
+
+/* Nombre de classes de taille */
+#define SLAB_NB_CLASSES 25
+
+/* Nombre de slabs vides conserves par classe avant d'en rendre au systeme */
+#define SLAB_VIDES_GARDES 1
+
+typedef struct slab{
+    struct slab *next;          // Slab suivant de la meme liste
+    struct slab *prec;          // Slab precedent de la meme liste
+    void *libres;               // Liste des objets liberes
+    char *prochain;             // Premier objet jamais alloue
+    unsigned int utilises;      // Nombre d'objets alloues
+    unsigned int capacite;      // Nombre d'objets que peut contenir le slab
+    unsigned int classe;        // Indice de la classe de taille du slab
+} slab;
+
+typedef struct classe_slab{
+    size_t taille_objet;        // Taille des objets de la classe
+    slab *partiels;             // Slabs ayant au moins un objet libre
+    slab *pleins;               // Slabs dont tous les objets sont alloues
+    unsigned long nb_slabs;     // Nombre de slabs de la classe
+    unsigned long vides;        // Nombre de slabs vides conserves
+    unsigned long objets;       // Nombre d'objets alloues
+} classe_slab;
+
+typedef struct allocateur{
+    classe_slab classes[SLAB_NB_CLASSES];
+    unsigned char classe_de[SLAB_OBJET_MAX/8+1]; // Classe pour chaque taille
+                                                 // (arrondie a 8 octets)
+    unsigned long slabs_crees;  // Nombre de slabs obtenus du systeme
+    unsigned long slabs_rendus; // Nombre de slabs rendus au systeme
+    unsigned long hors_slab;    // Nombre d'objets trop grands (malloc)
+    size_t octets_hors_slab;    // Octets alloues par malloc
+    size_t octets_objets;       // Octets occupes par les objets alloues
+                                // (taille de leur classe)
+} allocateur;
+
+/* Initialise un allocateur */
+void init_allocateur(allocateur *alloc);
+
+/* Rend au systeme tous les slabs d'un allocateur */
+void delete_allocateur(allocateur *alloc);
+
+/* Alloue un objet */
+void *allouer(allocateur *alloc, size_t taille);
+
+/* Libere un objet */
+void liberer(allocateur *alloc, void *objet, size_t taille);
+
+/* Renvoie le nombre d'octets obtenus du systeme par l'allocateur */
+size_t memoire_allocateur(allocateur *alloc);
+
+/* Renvoie le nombre d'octets occupes par les objets alloues */
+size_t objets_allocateur(allocateur *alloc);
+
+/* Affiche l'occupation des slabs de chaque classe */
+void afficher_stats_allocateur(allocateur *alloc, FILE *f);
+
+#endif
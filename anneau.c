@@ -0,0 +1,424 @@
+#include "anneau.h"
+
+/**
+ * @brief Calcule le code de hachage d'une suite d'octets (FNV-1a sur 64
+ *        bits).
+ *
+ * @param octets les octets.
+ * @param lg le nombre d'octets.
+ * @return le code de hachage.
+*/
+static uint64_t code_octets(const donnees *octets, taille lg)
+{
+    uint64_t code = 14695981039346656037ULL;
+    taille i;
+    
+    for(i=0; i<lg; i++)
+    {
+        code ^= octets[i];
+        code *= 1099511628211ULL;
+    }
+    
+    return code;
+}
+
+/**
+ * @brief Compare deux membres par leur extremite (pour qsort).
+ *
+ * @param x un pointeur sur le premier membre.
+ * @param y un pointeur sur le second membre.
+ * @return un entier negatif, nul ou positif selon l'ordre des membres.
+*/
+static int comparer_membres(const void *x, const void *y)
+{
+    const membre_anneau *a = x, *b = y;
+    
+    if(a->taille_cle!=b->taille_cle)
+        return a->taille_cle < b->taille_cle ? -1 : 1;
+    
+    return memcmp(a->cle, b->cle, a->taille_cle);
+}
+
+/**
+ * @brief Compare deux noeuds virtuels par leur position (pour qsort).
+ *
+ * A position egale, l'ordre des membres departage : l'anneau ne depend pas
+ * de l'ordre dans lequel les membres ont ete donnes.
+ *
+ * @param x un pointeur sur le premier noeud.
+ * @param y un pointeur sur le second noeud.
+ * @return un entier negatif, nul ou positif selon l'ordre des noeuds.
+*/
+static int comparer_points(const void *x, const void *y)
+{
+    const point_anneau *a = x, *b = y;
+    
+    if(a->jeton!=b->jeton)
+        return a->jeton < b->jeton ? -1 : 1;
+    if(a->membre!=b->membre)
+        return a->membre < b->membre ? -1 : 1;
+    
+    return 0;
+}
+
+/**
+ * @brief Initialise un anneau vide.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param virtuels le nombre de noeuds virtuels par membre.
+ * @param copies le nombre de proprietaires d'un hash.
+*/
+void init_anneau(anneau *a, unsigned int virtuels, unsigned int copies)
+{
+    memset(a, 0, sizeof(anneau));
+    a->virtuels = virtuels;
+    a->copies = copies;
+}
+
+/**
+ * @brief Libere la memoire attribuee a un anneau.
+ *
+ * L'anneau redevient vide et peut etre reconstruit.
+ *
+ * @param a un pointeur sur l'anneau.
+*/
+void delete_anneau(anneau *a)
+{
+    free(a->membres);
+    free(a->points);
+    a->membres = NULL;
+    a->points = NULL;
+    a->nb_membres = 0;
+    a->nb_points = 0;
+    a->empreinte = 0;
+}
+
+/**
+ * @brief Construit l'anneau d'un ensemble de membres.
+ *
+ * Les membres sont tries par extremite (les doublons ecartes), puis chacun
+ * place ses noeuds virtuels : le noeud j du membre d'extremite e est a la
+ * position melanger(code(e) ^ melanger(j)). L'empreinte de l'anneau resume
+ * ses parametres et ses membres : deux vues du meme anneau ont la meme
+ * empreinte. L'anneau precedent est libere.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param membres les membres.
+ * @param nb le nombre de membres.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int construire_anneau(anneau *a, const membre_anneau *membres,
+                        unsigned int nb)
+{
+    unsigned int i, j, n = 0;
+    uint64_t code, empreinte;
+    membre_anneau *tries;
+    point_anneau *points;
+    
+    tries = malloc((nb>0 ? nb : 1)*sizeof(membre_anneau));
+    points = malloc((nb>0 ? nb : 1)*a->virtuels*sizeof(point_anneau));
+    if(tries==NULL || points==NULL)
+    {
+        perror("Error malloc");
+        free(tries);
+        free(points);
+        return 180;
+    }
+    
+    memcpy(tries, membres, nb*sizeof(membre_anneau));
+    qsort(tries, nb, sizeof(membre_anneau), comparer_membres);
+    empreinte = melanger_merkle(((uint64_t)a->copies<<32)^a->virtuels);
+    for(i=0; i<nb; i++)
+    {
+        if(n==0 || comparer_membres(&tries[n-1], &tries[i])!=0)
+            tries[n++] = tries[i];
+    }
+    
+    for(i=0; i<n; i++)
+    {
+        code = code_octets(tries[i].cle, tries[i].taille_cle);
+        empreinte = melanger_merkle(empreinte^code);
+        for(j=0; j<a->virtuels; j++)
+        {
+            points[i*a->virtuels+j].jeton = melanger_merkle(code^
+                                                            melanger_merkle(j));
+            points[i*a->virtuels+j].membre = i;
+        }
+    }
+    qsort(points, n*a->virtuels, sizeof(point_anneau), comparer_points);
+    
+    delete_anneau(a);
+    a->membres = tries;
+    a->nb_membres = n;
+    a->points = points;
+    a->nb_points = n*a->virtuels;
+    a->empreinte = n>0 ? empreinte : 0;
+    
+    return 0;
+}
+
+/**
+ * @brief Renvoie la position d'un hash sur l'anneau.
+ *
+ * Un hash SHA-1 ou SHA-256 ecrit en hexadecimal a la position de la cle
+ * binaire equivalente, et le caractere de fin d'une chaine est ignore : la
+ * position ne depend pas de la forme sous laquelle le hash a ete envoye ou
+ * stocke (option -b du serveur).
+ *
+ * @param type_cle le type du hash ('h' ou 'b').
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @return la position du hash.
+*/
+uint64_t position_cle(donnees type_cle, const donnees *hash,
+                        taille taille_hash)
+{
+    donnees cle[TAILLE_CLE_SHA256];
+    taille taille_cle;
+    
+    if(type_cle=='h' && hex_vers_binaire((const char *)hash, taille_hash,
+                                         cle, &taille_cle)==0)
+        return melanger_merkle(code_octets(cle, taille_cle));
+    
+    if(type_cle=='h' && taille_hash>0 && hash[taille_hash-1]=='\0')
+        taille_hash--;
+    
+    return melanger_merkle(code_octets(hash, taille_hash));
+}
+
+/**
+ * @brief Renvoie les membres proprietaires d'une position.
+ *
+ * Ce sont les membres des noeuds virtuels qui suivent la position dans le
+ * sens croissant (en revenant au debut apres le dernier), sans repetition :
+ * le premier est le proprietaire principal, les suivants ses copies.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param position la position d'un hash (voir position_cle).
+ * @param membres un tableau d'au moins a->copies indices (valeur de retour
+ *        par effet de bord), dans l'ordre de preference.
+ * @return le nombre de proprietaires, le plus petit de a->copies et du
+ *         nombre de membres.
+*/
+unsigned int proprietaires(const anneau *a, uint64_t position,
+                            unsigned int *membres)
+{
+    unsigned int debut = 0, fin = a->nb_points, milieu, i, k, n = 0, voulus;
+    uint32_t m;
+    
+    voulus = a->copies < a->nb_membres ? a->copies : a->nb_membres;
+    
+    /* Premier noeud virtuel de position superieure ou egale */
+    while(debut < fin)
+    {
+        milieu = debut+(fin-debut)/2;
+        if(a->points[milieu].jeton < position)
+            debut = milieu+1;
+        else
+            fin = milieu;
+    }
+    
+    for(i=0; n<voulus && i<a->nb_points; i++)
+    {
+        m = a->points[(debut+i)%a->nb_points].membre;
+        for(k=0; k<n && membres[k]!=m; k++);
+        if(k==n)
+            membres[n++] = m;
+    }
+    
+    return n;
+}
+
+/**
+ * @brief Cherche un membre par son extremite.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param cle l'extremite du membre.
+ * @param taille_cle la taille de l'extremite.
+ * @return l'indice du membre, -1 s'il n'est pas dans l'anneau.
+*/
+int chercher_membre(const anneau *a, const donnees *cle, donnees taille_cle)
+{
+    membre_anneau cherche;
+    membre_anneau *trouve;
+    
+    if(taille_cle > sizeof(cherche.cle))
+        return -1;
+    cherche.taille_cle = taille_cle;
+    memcpy(cherche.cle, cle, taille_cle);
+    
+    trouve = bsearch(&cherche, a->membres, a->nb_membres,
+                     sizeof(membre_anneau), comparer_membres);
+    
+    return trouve==NULL ? -1 : (int)(trouve-a->membres);
+}
+
+/**
+ * @brief Remplit l'extremite et l'adresse d'un membre.
+ *
+ * @param m un pointeur sur le membre.
+ * @param adresse l'adresse du serveur (IPv4 ou IPv6).
+ * @param addrlen la longueur de l'adresse.
+ * @return 0 en cas de reussite, -1 si la famille d'adresse est inconnue.
+*/
+int membre_depuis_adresse(membre_anneau *m, const struct sockaddr *adresse,
+                            socklen_t addrlen)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in *) adresse;
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) adresse;
+    
+    memset(m, 0, sizeof(membre_anneau));
+    switch(adresse->sa_family)
+    {
+        case AF_INET:
+            memcpy(m->cle, &in->sin_addr, 4);
+            memcpy(m->cle+4, &in->sin_port, 2);
+            m->taille_cle = TAILLE_EXTREMITE_IPV4;
+            break;
+        case AF_INET6:
+            memcpy(m->cle, &in6->sin6_addr, 16);
+            memcpy(m->cle+16, &in6->sin6_port, 2);
+            m->taille_cle = TAILLE_EXTREMITE_IPV6;
+            break;
+        default:
+            return -1;
+    }
+    
+    if(addrlen > sizeof(m->adresse))
+        addrlen = sizeof(m->adresse);
+    memcpy(&m->adresse, adresse, addrlen);
+    m->addrlen = addrlen;
+    
+    return 0;
+}
+
+/**
+ * @brief Remplit l'extremite et l'adresse d'un membre a partir de son
+ *        extremite binaire (format des blocs 'e').
+ *
+ * @param m un pointeur sur le membre.
+ * @param ext l'extremite (adresse IP puis port, dans l'ordre du reseau).
+ * @param lg la taille de l'extremite.
+ * @return 0 en cas de reussite, -1 si la taille est invalide.
+*/
+int membre_depuis_extremite(membre_anneau *m, const donnees *ext, taille lg)
+{
+    struct sockaddr_in *in = (struct sockaddr_in *) &m->adresse;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &m->adresse;
+    
+    memset(m, 0, sizeof(membre_anneau));
+    if(lg==TAILLE_EXTREMITE_IPV4)
+    {
+        in->sin_family = AF_INET;
+        memcpy(&in->sin_addr, ext, 4);
+        m->addrlen = sizeof(*in);
+    }
+    else if(lg==TAILLE_EXTREMITE_IPV6)
+    {
+        in6->sin6_family = AF_INET6;
+        memcpy(&in6->sin6_addr, ext, 16);
+        m->addrlen = sizeof(*in6);
+    }
+    else
+        return -1;
+    
+    /* Le port est au meme endroit en IPv4 et en IPv6 */
+    memcpy(&in->sin_port, ext+lg-2, 2);
+    memcpy(m->cle, ext, lg);
+    m->taille_cle = lg;
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute la vue d'un anneau a un message.
+ *
+ * La vue est un bloc 'v' (parametres et empreinte de l'anneau) suivi de
+ * l'extremite de chaque membre (blocs 'e') : elle suffit a reconstruire
+ * l'anneau (voir lire_vue).
+ *
+ * @param m un pointeur sur le message.
+ * @param a un pointeur sur l'anneau.
+ * @return 0 en cas de reussite, CODE_MESSAGE_PLEIN si les membres ne
+ *         tiennent pas dans un datagramme, un autre code d'erreur sinon.
+*/
+int ecrire_vue(message *m, const anneau *a)
+{
+    int err;
+    unsigned int i;
+    donnees bloc[TAILLE_BLOC_VUE];
+    uint16_t virtuels = htons(a->virtuels);
+    uint64_t empreinte = htobe64(a->empreinte);
+    
+    bloc[0] = a->copies;
+    memcpy(bloc+1, &virtuels, sizeof(virtuels));
+    memcpy(bloc+3, &empreinte, sizeof(empreinte));
+    err=add_data(m, 'v', TAILLE_BLOC_VUE, bloc);
+    
+    for(i=0; i<a->nb_membres && err==0; i++)
+    {
+        if(m->lg_message+SIZEOF_ENTETE_BLOC+a->membres[i].taille_cle >
+           MAX_DATAGRAMME)
+            return CODE_MESSAGE_PLEIN;
+        err=add_data(m, 'e', a->membres[i].taille_cle, a->membres[i].cle);
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Construit l'anneau decrit par la vue d'un message.
+ *
+ * @param m un pointeur sur le message (voir ecrire_vue).
+ * @param a un pointeur sur l'anneau (initialise ici, a liberer par
+ *        delete_anneau).
+ * @return 0 en cas de reussite, -1 si la vue est invalide ou ne correspond
+ *         pas a son empreinte, un autre code d'erreur sinon.
+*/
+int lire_vue(message *m, anneau *a)
+{
+    int err;
+    unsigned int n = 0;
+    uint16_t virtuels;
+    uint64_t empreinte;
+    donnees type, *bloc;
+    taille lg;
+    membre_anneau *membres;
+    
+    if(message_get_bloc(m, "v", &type, &bloc, &lg)!=0 ||
+       lg!=TAILLE_BLOC_VUE)
+        return -1;
+    memcpy(&virtuels, bloc+1, sizeof(virtuels));
+    memcpy(&empreinte, bloc+3, sizeof(empreinte));
+    virtuels = ntohs(virtuels);
+    if(bloc[0]==0 || bloc[0]>ANNEAU_COPIES_MAX || virtuels==0 ||
+       virtuels>ANNEAU_VIRTUELS_MAX)
+        return -1;
+    init_anneau(a, virtuels, bloc[0]);
+    
+    /* Un membre occupe au moins un bloc de TAILLE_EXTREMITE_IPV4 octets */
+    membres = malloc((m->lg_message/(SIZEOF_ENTETE_BLOC+
+                                     TAILLE_EXTREMITE_IPV4)+1)*
+                     sizeof(membre_anneau));
+    if(membres==NULL)
+    {
+        perror("Error malloc");
+        return 180;
+    }
+    
+    while(message_get_bloc(NULL, "e", &type, &bloc, &lg)==0)
+    {
+        if(membre_depuis_extremite(&membres[n], bloc, lg)==0)
+            n++;
+    }
+    
+    err=construire_anneau(a, membres, n);
+    free(membres);
+    if(err==0 && a->empreinte!=be64toh(empreinte))
+    {
+        delete_anneau(a);
+        return -1;
+    }
+    
+    return err;
+}
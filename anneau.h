@@ -0,0 +1,94 @@
+#ifndef __ANNEAU_H__
+#define __ANNEAU_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <endian.h>
+
+#include "messages.h"
+#include "merkle.h"
+
+/* Nombre par defaut et maximal de noeuds virtuels par serveur */
+#define ANNEAU_VIRTUELS_DEFAUT 64
+#define ANNEAU_VIRTUELS_MAX 1024
+
+/* Nombre maximal de copies d'un hash (serveurs proprietaires) */
+#define ANNEAU_COPIES_MAX 8
+
+/* Taille d'un bloc 'v' : nombre de copies (1 octet), de noeuds virtuels
+   (2 octets) et empreinte de l'anneau (8 octets), dans l'ordre du reseau */
+#define TAILLE_BLOC_VUE 11
+
+/* Membre de l'anneau : un serveur, designe par son extremite binaire
+   (adresse IP puis port, 6 ou 18 octets) */
+typedef struct membre_anneau{
+    donnees cle[TAILLE_EXTREMITE_IPV6]; // Extremite du serveur
+    donnees taille_cle;         // Taille de l'extremite
+    struct sockaddr_storage adresse; // Adresse a laquelle le contacter
+    socklen_t addrlen;          // Longueur de l'adresse
+} membre_anneau;
+
+/* Noeud virtuel : position d'un membre sur l'anneau */
+typedef struct point_anneau{
+    uint64_t jeton;             // Position sur l'anneau
+    uint32_t membre;            // Indice du membre
+} point_anneau;
+
+/*
+ Anneau de hachage coherent : chaque membre y place ses noeuds virtuels a des
+ positions tirees de son extremite, et un hash appartient aux membres des
+ premiers noeuds virtuels qui suivent sa position (sans repetition). Les
+ positions ne dependent que des extremites : tous les serveurs (et les
+ clients) connaissant les memes membres calculent le meme anneau, et l'ajout
+ ou le retrait d'un membre ne deplace que les hash des intervalles voisins de
+ ses noeuds virtuels.
+*/
+typedef struct anneau{
+    membre_anneau *membres;     // Membres, tries par extremite
+    unsigned int nb_membres;    // Nombre de membres
+    point_anneau *points;       // Noeuds virtuels, tries par position
+    unsigned int nb_points;     // Nombre de noeuds virtuels
+    unsigned int virtuels;      // Noeuds virtuels par membre
+    unsigned int copies;        // Nombre de proprietaires d'un hash
+    uint64_t empreinte;         // Resume des membres et des parametres (0
+                                // pour un anneau vide)
+} anneau;
+
+/* Initialise un anneau vide */
+void init_anneau(anneau *a, unsigned int virtuels, unsigned int copies);
+
+/* Libere la memoire attribuee a un anneau */
+void delete_anneau(anneau *a);
+
+/* Construit l'anneau d'un ensemble de membres */
+int construire_anneau(anneau *a, const membre_anneau *membres,
+                        unsigned int nb);
+
+/* Renvoie la position d'un hash sur l'anneau */
+uint64_t position_cle(donnees type_cle, const donnees *hash,
+                        taille taille_hash);
+
+/* Renvoie les membres proprietaires d'une position */
+unsigned int proprietaires(const anneau *a, uint64_t position,
+                            unsigned int *membres);
+
+/* Cherche un membre par son extremite */
+int chercher_membre(const anneau *a, const donnees *cle, donnees taille_cle);
+
+/* Remplit l'extremite et l'adresse d'un membre */
+int membre_depuis_adresse(membre_anneau *m, const struct sockaddr *adresse,
+                            socklen_t addrlen);
+
+/* Remplit l'extremite et l'adresse d'un membre a partir de son extremite */
+int membre_depuis_extremite(membre_anneau *m, const donnees *ext, taille lg);
+
+/* Ajoute la vue d'un anneau a un message */
+int ecrire_vue(message *m, const anneau *a);
+
+/* Construit l'anneau decrit par la vue d'un message */
+int lire_vue(message *m, anneau *a);
+
+#endif
@@ -0,0 +1,262 @@
+#include "messages.h"
+
+#include <poll.h>
+#include <getopt.h>
+
+/* Delai (en millisecondes) sans reponse au bout duquel les requetes en vol
+   sont considerees perdues et relancees */
+#define BANC_DELAI_PERTE 50
+
+// Duree de la mesure en secondes (option -d).
+long duree = 5;
+
+// Nombre de requetes en vol (option -f).
+long fenetre = 64;
+
+// Nombre de hash stockes puis demandes (option -c).
+long nb_cles = 1000;
+
+/**
+ * @brief Affiche l'usage correct du programme.
+ *
+ * @param nom_prgm le nom du programme recupere via la ligne de commande.
+*/
+void print_usage(char *nom_prgm)
+{
+    fprintf(stderr, "Usage : %s [-d SECONDES] [-f REQUETES] [-c HASH] "\
+                    "IP PORT [PID_SERVEUR]\n", nom_prgm);
+    exit(1);
+}
+
+/**
+ * @brief Lit une option numerique strictement positive.
+ *
+ * @param texte l'argument de l'option.
+ * @param nom_prgm le nom du programme (pour l'usage).
+ * @return la valeur de l'option.
+*/
+long lire_nombre(char *texte, char *nom_prgm)
+{
+    char *fin;
+    long n = strtol(texte, &fin, 10);
+    
+    if(*texte<'0' || *texte>'9' || *fin!='\0' || n==0)
+        print_usage(nom_prgm);
+    
+    return n;
+}
+
+/**
+ * @brief Renvoie le temps CPU consomme par un processus.
+ *
+ * @param pid le processus (0 si inconnu).
+ * @return le temps CPU (utilisateur et systeme) en secondes, -1 s'il n'a
+ *         pas pu etre lu.
+*/
+double temps_cpu(pid_t pid)
+{
+    char chemin[64], ligne[1024], *fin_nom;
+    unsigned long utilisateur, systeme;
+    FILE *f;
+    
+    if(pid==0)
+        return -1;
+    
+    snprintf(chemin, sizeof(chemin), "/proc/%d/stat", (int) pid);
+    f = fopen(chemin, "r");
+    if(f==NULL)
+        return -1;
+    if(fgets(ligne, sizeof(ligne), f)==NULL)
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    
+    /* Le nom du processus (2e champ) peut contenir des espaces : les champs
+       suivants sont lus apres sa parenthese fermante */
+    fin_nom = strrchr(ligne, ')');
+    if(fin_nom==NULL || sscanf(fin_nom+2, "%*c %*d %*d %*d %*d %*d %*u "\
+                               "%*u %*u %*u %*u %lu %lu", &utilisateur,
+                               &systeme)!=2)
+        return -1;
+    
+    return (double)(utilisateur+systeme)/sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Renvoie le temps ecoule depuis une date.
+ *
+ * @param debut la date.
+ * @return le temps ecoule en secondes.
+*/
+double ecoule(struct timespec *debut)
+{
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return (t.tv_sec-debut->tv_sec)+(t.tv_nsec-debut->tv_nsec)/1e9;
+}
+
+/**
+ * @brief Cree les requetes du banc : un put et un get par hash.
+ *
+ * @param puts le tableau recevant les put.
+ * @param gets le tableau recevant les get.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int creer_requetes(message **puts, message **gets)
+{
+    int err;
+    long i;
+    char hash[32];
+    
+    for(i=0; i<nb_cles; i++)
+    {
+        snprintf(hash, sizeof(hash), "banc%ld", i);
+    
+        if((err=create_message(&puts[i], 'p', SIZEOF_ENTETE))!=0 ||
+           (err=add_data(puts[i], 'h', strlen(hash)+1, hash))!=0 ||
+           (err=add_data(puts[i], 'a', sizeof("10.0.0.1"), "10.0.0.1"))!=0)
+            return err;
+        prepare_message(puts[i]);
+    
+        if((err=create_message(&gets[i], 'g', SIZEOF_ENTETE))!=0 ||
+           (err=add_data(gets[i], 'h', strlen(hash)+1, hash))!=0)
+            return err;
+        prepare_message(gets[i]);
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Mesure le debit d'un serveur en get par seconde.
+ *
+ * Les hash sont d'abord stockes (put), puis le banc garde un nombre fixe de
+ * get en vol pendant la duree de la mesure : chaque reponse en relance un.
+ * Avec le pid du serveur, le debit est aussi rapporte au temps CPU consomme
+ * par celui-ci (requetes par seconde et par coeur occupe), ce qui permet de
+ * comparer les chemins de reception du serveur (-l 1 : un datagramme par
+ * appel systeme, comme une boucle recvfrom ; -l N : recvmmsg ; -u :
+ * io_uring) meme lorsque le banc partage les processeurs du serveur.
+ *
+ * @param argv les options, puis l'ip et le port du serveur et, facultatif,
+ *        le pid du serveur.
+*/
+int main(int argc, char * argv[])
+{
+    int sockfd, err, opt, demarre = FALSE;
+    long i, suivante = 0, reponses = 0, relances = 0;
+    double cpu_debut, cpu_fin, secondes;
+    pid_t pid = 0;
+    message **puts, **gets;
+    donnees reponse[MAX_MESS_SIZE];
+    struct addrinfo *head, *valide;
+    struct pollfd attente;
+    struct timespec debut;
+    
+    while((opt=getopt(argc, argv, "d:f:c:"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                duree = lire_nombre(optarg, argv[0]);
+                break;
+            case 'f':
+                fenetre = lire_nombre(optarg, argv[0]);
+                break;
+            case 'c':
+                nb_cles = lire_nombre(optarg, argv[0]);
+                break;
+            default:
+                print_usage(argv[0]);
+        }
+    }
+    if(argc-optind!=2 && argc-optind!=3)
+        print_usage(argv[0]);
+    if(argc-optind==3)
+        pid = lire_nombre(argv[optind+2], argv[0]);
+    
+    err=get_addr(CLIENT, argv[optind], argv[optind+1], &sockfd, &head,
+                 &valide);
+    if(err!=0)
+        exit(err);
+    
+    puts = calloc(nb_cles, sizeof(message *));
+    gets = calloc(nb_cles, sizeof(message *));
+    if(puts==NULL || gets==NULL)
+    {
+        perror("Error malloc");
+        exit(2);
+    }
+    if((err=creer_requetes(puts, gets))!=0)
+        exit(err);
+    
+    /* Stockage des hash, par paquets pour ne pas deborder la socket du
+       serveur */
+    for(i=0; i<nb_cles; i++)
+    {
+        sendto(sockfd, puts[i]->contenu, puts[i]->lg_message, 0,
+               valide->ai_addr, valide->ai_addrlen);
+        if(i%fenetre==fenetre-1)
+            usleep(1000);
+    }
+    usleep(100000);
+    
+    attente.fd = sockfd;
+    attente.events = POLLIN;
+    cpu_debut = temps_cpu(pid);
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+    
+    while(ecoule(&debut) < duree)
+    {
+        /* Remplit la fenetre au depart, ou apres une perte */
+        if(!demarre || poll(&attente, 1, BANC_DELAI_PERTE)==0)
+        {
+            if(demarre)
+                relances++;
+            demarre = TRUE;
+            for(i=0; i<fenetre; i++, suivante=(suivante+1)%nb_cles)
+                sendto(sockfd, gets[suivante]->contenu,
+                       gets[suivante]->lg_message, 0, valide->ai_addr,
+                       valide->ai_addrlen);
+            continue;
+        }
+    
+        /* Chaque reponse relance une requete */
+        while(recv(sockfd, reponse, sizeof(reponse), MSG_DONTWAIT)>0)
+        {
+            reponses++;
+            sendto(sockfd, gets[suivante]->contenu,
+                   gets[suivante]->lg_message, 0, valide->ai_addr,
+                   valide->ai_addrlen);
+            suivante = (suivante+1)%nb_cles;
+        }
+    }
+    
+    secondes = ecoule(&debut);
+    cpu_fin = temps_cpu(pid);
+    
+    printf("Requetes : %ld reponses en %.1f s (%.0f par seconde), %ld "\
+           "relances apres perte\n", reponses, secondes, reponses/secondes,
+           relances);
+    if(cpu_debut>=0 && cpu_fin>cpu_debut)
+        printf("Serveur : %.2f s de CPU (%.0f%% d'un coeur), %.0f requetes "\
+               "par seconde de CPU\n", cpu_fin-cpu_debut,
+               100*(cpu_fin-cpu_debut)/secondes,
+               reponses/(cpu_fin-cpu_debut));
+    
+    for(i=0; i<nb_cles; i++)
+    {
+        delete_message(puts[i]);
+        delete_message(gets[i]);
+    }
+    free(puts);
+    free(gets);
+    freeaddrinfo(head);
+    close(sockfd);
+    
+    return 0;
+}
@@ -1,4 +1,8 @@
+#include <limits.h>
+#include <fcntl.h>
+
 #include "messages.h"
+#include "anneau.h"
 
 /**
  * @brief Affiche l'usage correct du programme.
@@ -7,31 +11,46 @@
 */
 void print_usage(char *nom_prgm)
 {
-    fprintf(stderr, "Usages : %s IP PORT GET HASH \n"\
-                    "         %s IP PORT PUT HASH IP\n", nom_prgm, nom_prgm);
+    fprintf(stderr, "Usages : %s [-c FICHIER] IP PORT GET HASH \n"\
+                    "         %s [-c FICHIER] IP PORT PUT HASH IP\n",
+                    nom_prgm, nom_prgm);
     exit(1);
 }
 
 /**
  * @brief Affiche toutes les adresses IP contenues dans un message.
  *
+ * Les extremites binaires (bloc 'e') sont affichees sous forme textuelle.
+ *
  * @param m un pointeur sur le message a lire.
  * @return 0 en cas de reussite, 3 ou 4 si write rencontre un probleme.
 */
 int afficher_adresse_dispo(message *m)
 {
-    donnees *adresse;
+    donnees *adresse, type;
     taille taille_adresse;
+    char texte[TAILLE_TEXTE_EXTREMITE];
+    int lg;
 
     /* Passe une premiere fois le message en parametre et recupere
        la premiere adresse (l'absence d'adresse n'est pas consideree
        comme une erreur) */
-    if(message_get_a(m, &adresse, &taille_adresse)==-1)
+    if(message_get_bloc(m, "ae", &type, &adresse, &taille_adresse)==-1)
         return 0;
     
     /* Puis ecrit les adresses recuperees tant qu'il y en a */
     do
     {
+        if(type=='e')
+        {
+            lg=extremite_vers_texte(adresse, taille_adresse,
+                                    texte, sizeof(texte));
+            if(lg==-1)
+                continue;
+            adresse = (donnees *)texte;
+            taille_adresse = lg;
+        }
+        
         if(write(1, adresse, taille_adresse)==-1)
         {
             perror("Error write");
@@ -44,7 +63,287 @@ int afficher_adresse_dispo(message *m)
             return 4;
         }
     }
-    while(message_get_a(NULL, &adresse, &taille_adresse)!=-1);
+    while(message_get_bloc(NULL, "ae", &type, &adresse, &taille_adresse)!=-1);
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute une adresse dans un message.
+ *
+ * Une adresse IP (avec ou sans port) est envoyee sous forme d'extremite
+ * binaire (bloc 'e'), toute autre adresse est envoyee comme une chaine
+ * (bloc 'a').
+ *
+ * @param m un pointeur sur le message a remplir.
+ * @param adresse la chaine representant l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ajouter_adresse(message *m, char *adresse)
+{
+    donnees ext[TAILLE_EXTREMITE_IPV6];
+    taille taille_ext;
+    
+    if(texte_vers_extremite(adresse, strlen(adresse), ext, &taille_ext)==0)
+        return add_data(m, 'e', taille_ext, ext);
+    
+    return add_data(m, 'a', strlen(adresse)+1, adresse);
+}
+
+/**
+ * @brief Ajoute un hash dans un message.
+ *
+ * Un hash SHA-1 ou SHA-256 ecrit en hexadecimal est envoye sous forme
+ * binaire (bloc 'b'), tout autre hash est envoye comme une chaine (bloc 'h').
+ *
+ * @param m un pointeur sur le message a remplir.
+ * @param hash la chaine representant le hash.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ajouter_hash(message *m, char *hash)
+{
+    donnees cle[TAILLE_CLE_SHA256];
+    taille taille_cle;
+    
+    if(hex_vers_binaire(hash, strlen(hash), cle, &taille_cle)==0)
+        return add_data(m, 'b', taille_cle, cle);
+    
+    return add_data(m, 'h', strlen(hash)+1, hash);
+}
+
+/**
+ * @brief Charge la vue de l'anneau conservee dans un fichier cache.
+ *
+ * Le fichier contient le dernier message 'w' recu d'un serveur (voir
+ * enregistrer_vue). Un cache absent ou invalide n'est pas une erreur : le
+ * client s'adresse alors au serveur de la ligne de commande.
+ *
+ * @param fichier le chemin du cache.
+ * @param a un pointeur sur l'anneau (a liberer par delete_anneau).
+ * @return 0 si la vue est chargee, -1 s'il n'y en a pas, un code d'erreur
+ *         sinon.
+*/
+int charger_vue(const char *fichier, anneau *a)
+{
+    int err;
+    FILE *f;
+    message *m;
+    
+    f=fopen(fichier, "rb");
+    if(f==NULL)
+        return -1;
+    
+    err=create_message(&m, 'w', MAX_MESS_SIZE);
+    if(err!=0)
+    {
+        fclose(f);
+        return err;
+    }
+    
+    m->lg_message = fread(m->contenu, 1, m->lg_allouee, f);
+    fclose(f);
+    if(m->lg_message<SIZEOF_ENTETE || m->contenu[0]!='w')
+    {
+        delete_message(m);
+        return -1;
+    }
+    
+    err=lire_vue(m, a);
+    delete_message(m);
+    
+    return err;
+}
+
+/**
+ * @brief Conserve dans un fichier cache la vue de l'anneau envoyee par un
+ *        serveur.
+ *
+ * Le message est ecrit dans un fichier temporaire puis renomme : un autre
+ * client lisant le cache au meme moment n'en voit jamais une partie.
+ *
+ * @param fichier le chemin du cache.
+ * @param m un pointeur sur le message 'w' recu.
+ * @return 0 en cas de reussite, -1 sinon (le cache n'est pas modifie).
+*/
+int enregistrer_vue(const char *fichier, message *m)
+{
+    FILE *f;
+    char temporaire[PATH_MAX];
+    size_t ecrits;
+    
+    if(snprintf(temporaire, sizeof(temporaire), "%s.%d", fichier,
+                getpid()) >= (int)sizeof(temporaire))
+        return -1;
+    
+    f=fopen(temporaire, "wb");
+    if(f==NULL)
+    {
+        perror("Error fopen");
+        return -1;
+    }
+    
+    ecrits = fwrite(m->contenu, 1, m->lg_message, f);
+    if(fclose(f)!=0 || ecrits!=m->lg_message ||
+       rename(temporaire, fichier)==-1)
+    {
+        perror("Error cache");
+        unlink(temporaire);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Choisit le serveur proprietaire du hash d'une requete.
+ *
+ * C'est le proprietaire principal du hash dans la vue de l'anneau, si son
+ * adresse est de la meme famille que la socket du client.
+ *
+ * @param a un pointeur sur la vue de l'anneau.
+ * @param m un pointeur sur la requete.
+ * @param famille la famille d'adresse de la socket du client.
+ * @param adresse l'adresse du proprietaire (valeur de retour par effet de
+ *        bord).
+ * @param addrlen la longueur de l'adresse (valeur de retour par effet de
+ *        bord).
+ * @return 0 si un proprietaire est trouve, -1 sinon.
+*/
+int choisir_proprietaire(const anneau *a, message *m, int famille,
+                            struct sockaddr_storage *adresse,
+                            socklen_t *addrlen)
+{
+    unsigned int membres[ANNEAU_COPIES_MAX];
+    donnees type, *hash;
+    taille taille_hash;
+    const membre_anneau *p;
+    
+    if(message_get_bloc(m, "bh", &type, &hash, &taille_hash)==-1 ||
+       proprietaires(a, position_cle(type, hash, taille_hash), membres)==0)
+        return -1;
+    
+    p = &a->membres[membres[0]];
+    if(p->adresse.ss_family!=famille)
+        return -1;
+    
+    memcpy(adresse, &p->adresse, p->addrlen);
+    *addrlen = p->addrlen;
+    
+    return 0;
+}
+
+/**
+ * @brief Verifie qu'un message vient du serveur interroge ou d'un membre de
+ *        la vue de l'anneau.
+ *
+ * @param vue un pointeur sur la vue de l'anneau du client.
+ * @param destinataire l'adresse a laquelle la requete a ete envoyee.
+ * @param lg_destinataire la longueur de cette adresse.
+ * @param source l'adresse de l'emetteur du message.
+ * @param lg_source la longueur de cette adresse.
+ * @return TRUE (1) si l'emetteur est connu, FALSE (0) sinon.
+*/
+int source_connue(const anneau *vue, const struct sockaddr *destinataire,
+                    socklen_t lg_destinataire, const struct sockaddr *source,
+                    socklen_t lg_source)
+{
+    membre_anneau d, s;
+    
+    if(membre_depuis_adresse(&s, source, lg_source)==-1)
+        return FALSE;
+    
+    if(membre_depuis_adresse(&d, destinataire, lg_destinataire)==0 &&
+       d.taille_cle==s.taille_cle && memcmp(d.cle, s.cle, s.taille_cle)==0)
+        return TRUE;
+    
+    return chercher_membre(vue, s.cle, s.taille_cle)!=-1;
+}
+
+/**
+ * @brief Remplace la vue de l'anneau du client par celle d'un message 'w'.
+ *
+ * Seule une vue valide (conforme a son empreinte) est conservee, en memoire
+ * et dans le cache.
+ *
+ * @param fichier le chemin du cache.
+ * @param vue un pointeur sur la vue de l'anneau du client.
+ * @param m un pointeur sur le message 'w' reçu.
+*/
+void accepter_vue(const char *fichier, anneau *vue, message *m)
+{
+    anneau nouvelle;
+    
+    if(lire_vue(m, &nouvelle)!=0)
+        return;
+    
+    delete_anneau(vue);
+    *vue = nouvelle;
+    enregistrer_vue(fichier, m);
+}
+
+/**
+ * @brief Attend la reponse d'un serveur a un get.
+ *
+ * Les vues de l'anneau ('w') recues en chemin sont conservees dans le cache,
+ * y compris celles qui arrivent juste apres la reponse. Avec un cache, un
+ * message n'est pris en compte que s'il vient du serveur interroge ou d'un
+ * membre de la vue (voir source_connue) : une vue forgee ne peut pas
+ * detourner les requetes suivantes.
+ *
+ * @param sockfd la socket du client.
+ * @param fichier le chemin du cache (NULL si le client n'en a pas).
+ * @param vue un pointeur sur la vue de l'anneau du client (mise a jour par
+ *        effet de bord).
+ * @param destinataire l'adresse a laquelle la requete a ete envoyee.
+ * @param lg_destinataire la longueur de cette adresse.
+ * @param reponse la reponse ('r') recue (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, CODE_CANCEL_WAIT si le serveur ne repond
+ *         pas, un autre code d'erreur sinon.
+*/
+int attendre_reponse(int sockfd, const char *fichier, anneau *vue,
+                        const struct sockaddr *destinataire,
+                        socklen_t lg_destinataire, message **reponse)
+{
+    int err, drapeaux, connue;
+    message *m2;
+    struct sockaddr_storage source;
+    socklen_t lg_source = sizeof(source);
+    
+    for(;;)
+    {
+        err = recevoir_message(&m2, sockfd, (struct sockaddr *) &source,
+                               &lg_source);
+        if(err!=0)
+            return err;
+        connue = fichier==NULL ||
+                 source_connue(vue, destinataire, lg_destinataire,
+                               (struct sockaddr *) &source, lg_source);
+        lg_source = sizeof(source);
+        if(m2->type=='r' && connue)
+            break;
+        
+        if(m2->type=='w' && fichier!=NULL && connue)
+            accepter_vue(fichier, vue, m2);
+        delete_message(m2);
+    }
+    *reponse = m2;
+    
+    /* Vide sans attendre les messages deja arrives */
+    drapeaux = fcntl(sockfd, F_GETFL);
+    if(fichier==NULL || drapeaux==-1 ||
+       fcntl(sockfd, F_SETFL, drapeaux|O_NONBLOCK)==-1)
+        return 0;
+    while(recevoir_message(&m2, sockfd, (struct sockaddr *) &source,
+                           &lg_source)==0)
+    {
+        if(m2->type=='w' &&
+           source_connue(vue, destinataire, lg_destinataire,
+                         (struct sockaddr *) &source, lg_source))
+            accepter_vue(fichier, vue, m2);
+        lg_source = sizeof(source);
+        delete_message(m2);
+    }
+    fcntl(sockfd, F_SETFL, drapeaux);
     
     return 0;
 }
@@ -57,6 +356,12 @@ int afficher_adresse_dispo(message *m)
  * demander a un serveur a quelles adresses il est possible de telecharger les
  * donnees associees a un hash.
  *
+ * Avec l'option -c, le client conserve dans un fichier la vue de l'anneau
+ * des serveurs (mode anneau, option -c du serveur) et envoie chaque requete
+ * directement au proprietaire du hash, sans passer par un serveur qui la
+ * transmettrait. La vue est rafraichie quand un serveur en renvoie une autre.
+ *
+ * @param -c FICHIER le fichier cache de la vue de l'anneau.
  * @param argv[1] IP l'ip du serveur a contacter.
  * @param argv[2] PORT port du serveur avec lequel discuter.
  * @param argv[3] une commande, soit GET, soit PUT.
@@ -66,17 +371,34 @@ int afficher_adresse_dispo(message *m)
 */
 int main(int argc, char * argv[])
 {
-    int sockfd, err;
+    int sockfd, err, opt, proprietaire;
+    char *nom_prgm = argv[0], *fichier_vue = NULL;
     message *m, *m2;
 	struct addrinfo *head, *valide;
     struct timeval timeout = {CLIENT_TIMEOUT_SEC,CLIENT_TIMEOUT_MICROSEC};
+    struct sockaddr_storage adresse;
+    socklen_t addrlen;
+    anneau vue;
+    uint64_t empreinte;
+    
+    while((opt=getopt(argc, argv, "c:"))!=-1)
+    {
+        if(opt=='c')
+            fichier_vue = optarg;
+        else
+            print_usage(nom_prgm);
+    }
+    
+    /* Les arguments restants gardent leurs indices sans option */
+    argv += optind-1;
+    argc -= optind-1;
 
     if(argc == 5) /* Cas d'une commande get */
     {
         /* Teste si la commande n'est ni "get", ni "GET" */
         if((strcmp(argv[3],"get") != 0 && strcmp(argv[3],"GET") != 0))
         {
-            print_usage(argv[0]);
+            print_usage(nom_prgm);
         }
         
         /* Cree un nouveau message de type 'g' */
@@ -87,7 +409,16 @@ int main(int argc, char * argv[])
         }
         
         /* Ajoute dans le message le hash a demander */
-        err=add_data(m, 'h', strlen(argv[4])+1, argv[4]);
+        err=ajouter_hash(m, argv[4]);
+        if(err!=0)
+        {
+            delete_message(m);
+            exit(err);
+        }
+        
+        /* Bloc 'e' vide : indique au serveur que le client accepte les
+           extremites binaires dans la reponse */
+        err=add_data(m, 'e', 0, "");
         if(err!=0)
         {
             delete_message(m);
@@ -102,7 +433,7 @@ int main(int argc, char * argv[])
         /* Teste si la commande n'est ni "put", ni "PUT" */
         if((strcmp(argv[3],"put") != 0 && strcmp(argv[3],"PUT") != 0))
         {
-            print_usage(argv[0]);
+            print_usage(nom_prgm);
         }
         
         /* Cree un nouveau message de type 'p' */
@@ -113,7 +444,7 @@ int main(int argc, char * argv[])
         }
         
         /* Ajoute dans le message le hash associe a l'adresse */
-        err=add_data(m, 'h', strlen(argv[4])+1, argv[4]);
+        err=ajouter_hash(m, argv[4]);
         if(err!=0)
         {
             delete_message(m);
@@ -121,7 +452,7 @@ int main(int argc, char * argv[])
         }
         
         /* Ajoute dans le message l'adresse associee au hash */
-        err=add_data(m, 'a', strlen(argv[5])+1, argv[5]);
+        err=ajouter_adresse(m, argv[5]);
         if(err!=0)
         {
             delete_message(m);
@@ -135,33 +466,64 @@ int main(int argc, char * argv[])
     {
         /* Dans le cas ou le nombre d'arguments ne correspond 
            ni a une commande get ni a une commande put */
-        print_usage(argv[0]);
+        print_usage(nom_prgm);
+    }
+    
+    /* Avec un cache, un get porte l'empreinte de la vue de l'anneau du
+       client (nulle s'il n'en a pas) : un serveur qui n'a pas la meme vue,
+       ou qui n'est pas proprietaire du hash, repond avec la sienne */
+    init_anneau(&vue, ANNEAU_VIRTUELS_DEFAUT, 1);
+    if(fichier_vue!=NULL)
+    {
+        err=charger_vue(fichier_vue, &vue);
+        empreinte = htobe64(vue.empreinte);
+        if(err<=0 && m->type=='g')
+            err=add_data(m, 'v', sizeof(empreinte), &empreinte);
+        else if(err<0)
+            err=0;
+        if(err!=0)
+        {
+            delete_anneau(&vue);
+            delete_message(m);
+            exit(err);
+        }
+        prepare_message(m);
     }
     
     /* Recuperation d'une adresse valide pour contacter le serveur */
     err=get_addr(CLIENT, argv[1], argv[2], &sockfd, &head, &valide);
     if(err!=0)
     {
+        delete_anneau(&vue);
         delete_message(m);
         exit(err);
     }
+    memcpy(&adresse, valide->ai_addr, valide->ai_addrlen);
+    addrlen = valide->ai_addrlen;
 
-    /* Envoie la requete au serveur */
-    if(sendto(sockfd, m->contenu, m->lg_message, 0,
-              valide->ai_addr, valide->ai_addrlen) == -1)
+    /* La requete va directement au proprietaire du hash si le client
+       connait l'anneau, sinon au serveur de la ligne de commande */
+    proprietaire = choisir_proprietaire(&vue, m, valide->ai_family,
+                                        &adresse, &addrlen)==0;
+    
+    for(;;)
     {
-        perror("Error sendto");
-        close(sockfd);
-        freeaddrinfo(head);
-        delete_message(m);
-        exit(2);
-    }
+        /* Envoie la requete au serveur */
+        if(sendto(sockfd, m->contenu, m->lg_message, 0,
+                  (struct sockaddr *) &adresse, addrlen) == -1)
+        {
+            perror("Error sendto");
+            close(sockfd);
+            freeaddrinfo(head);
+            delete_message(m);
+            delete_anneau(&vue);
+            exit(2);
+        }
 
-    freeaddrinfo(head);
+        /* Si la commande est "PUT", le client n'attend pas de reponse */
+        if(m->type!='g')
+            break;
     
-    /* Si la commande est "GET", le client attend une reponse du serveur */
-    if(m->type=='g')
-    {
         /* Indique que l'attente d'un message s'arrete si le temps depasse
            celui specifie dans la structure timeout */
         if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO,
@@ -169,19 +531,36 @@ int main(int argc, char * argv[])
         {
             perror("Error setsockopt");
             close(sockfd);
+            freeaddrinfo(head);
             delete_message(m);
+            delete_anneau(&vue);
             exit(5);
         }
         
         /* Reception de la reponse du serveur */
-        err = recevoir_message(&m2, sockfd, NULL, NULL);
+        err = attendre_reponse(sockfd, fichier_vue, &vue,
+                               (struct sockaddr *) &adresse, addrlen, &m2);
+        
+        /* Un proprietaire qui ne repond pas a peut-etre quitte l'anneau :
+           le cache est oublie et la requete repart une fois vers le serveur
+           de la ligne de commande */
+        if(err==CODE_CANCEL_WAIT && proprietaire)
+        {
+            unlink(fichier_vue);
+            memcpy(&adresse, valide->ai_addr, valide->ai_addrlen);
+            addrlen = valide->ai_addrlen;
+            proprietaire = FALSE;
+            continue;
+        }
         if(err!=0)
         {
             if(err==CODE_CANCEL_WAIT)
                 fprintf(stderr, "Le serveur ne répond pas.\n");
             
             close(sockfd);
+            freeaddrinfo(head);
             delete_message(m);
+            delete_anneau(&vue);
             exit(err);
         }
         
@@ -193,14 +572,19 @@ int main(int argc, char * argv[])
 	        delete_message(m2);
 	        delete_message(m);
 	        close(sockfd);
+	        freeaddrinfo(head);
+	        delete_anneau(&vue);
 	        exit(err);
 	    }
 	    printf("\n");
 	    
 	    delete_message(m2);
+	    break;
     }
 
+    freeaddrinfo(head);
     delete_message(m);
+    delete_anneau(&vue);
     close(sockfd);
 
     return 0;
@@ -0,0 +1,426 @@
+#include "historique.h"
+
+#include <fcntl.h>
+
+/* Taille de l'entete d'un enregistrement de l'historique */
+#define HISTORIQUE_ENTETE 18
+
+/* Alignement des enregistrements */
+#define HISTORIQUE_ALIGNEMENT 8
+
+/* Entete d'un fichier de positions (suivi des positions) */
+typedef struct entete_positions{
+    char magique[4];            // POSITIONS_MAGIQUE
+    uint32_t version;           // POSITIONS_VERSION
+    uint32_t nb;                // Nombre de positions
+} entete_positions;
+
+/**
+ * @brief Initialise un historique vide.
+ *
+ * L'epoque est tiree au hasard (date a la nanoseconde et pid) : deux
+ * executions du serveur n'ont pas la meme.
+ *
+ * @param h un pointeur sur l'historique.
+ * @param taille la taille de l'anneau en octets (0 pour desactiver
+ *        l'historique).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_historique(historique *h, size_t taille)
+{
+    struct timespec t;
+    
+    memset(h, 0, sizeof(historique));
+    pthread_mutex_init(&h->verrou, NULL);
+    h->premiere = 1;
+    
+    clock_gettime(CLOCK_REALTIME, &t);
+    h->epoque = melanger_merkle(((uint64_t)t.tv_sec<<32)^t.tv_nsec^
+                                ((uint64_t)getpid()<<16));
+    
+    h->taille = taille - taille%HISTORIQUE_ALIGNEMENT;
+    if(h->taille==0)
+        return 0;
+    
+    h->anneau = malloc(h->taille);
+    if(h->anneau==NULL)
+    {
+        perror("Error malloc");
+        h->taille = 0;
+        return 170;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Libere la memoire attribuee a un historique.
+ *
+ * @param h un pointeur sur l'historique.
+*/
+void delete_historique(historique *h)
+{
+    free(h->anneau);
+    h->anneau = NULL;
+    h->taille = 0;
+    pthread_mutex_destroy(&h->verrou);
+}
+
+/**
+ * @brief Lit la longueur de l'enregistrement a une position de l'anneau.
+ *
+ * @param h un pointeur sur l'historique.
+ * @param position la position.
+ * @return la longueur de l'enregistrement, 0 si la fin de l'anneau est
+ *         laissee vide a partir de cette position.
+*/
+static uint32_t longueur(historique *h, uint64_t position)
+{
+    uint32_t lg;
+    
+    memcpy(&lg, h->anneau+position%h->taille, sizeof(lg));
+    
+    return lg;
+}
+
+/**
+ * @brief Passe l'enregistrement le plus ancien (ou la fin vide de
+ *        l'anneau).
+ *
+ * @param h un pointeur sur l'historique.
+*/
+static void oublier_ancien(historique *h)
+{
+    uint32_t lg = longueur(h, h->debut);
+    
+    if(lg==0)
+    {
+        h->debut += h->taille-h->debut%h->taille;
+        return;
+    }
+    
+    h->debut += lg;
+    h->premiere++;
+    h->ecrasees++;
+}
+
+/**
+ * @brief Ajoute une modification a l'historique.
+ *
+ * Les plus anciennes modifications sont ecrasees pour lui faire de la
+ * place. Une modification plus grande que l'anneau vide l'historique : son
+ * numero de sequence est consomme sans qu'elle puisse etre relue.
+ *
+ * @param h un pointeur sur l'historique.
+ * @param date la date de l'annonce de l'adresse.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+*/
+void historiser(historique *h, long int date, donnees type_cle,
+                donnees *hash, taille taille_hash, donnees type_adresse,
+                donnees *adresse, taille taille_adresse)
+{
+    uint32_t lg = HISTORIQUE_ENTETE+taille_hash+taille_adresse;
+    uint16_t tailles[2] = {taille_hash, taille_adresse};
+    int64_t date_64 = date;
+    size_t reste;
+    donnees *pos;
+    
+    if(h->anneau==NULL)
+        return;
+    lg += (HISTORIQUE_ALIGNEMENT-lg%HISTORIQUE_ALIGNEMENT)%
+          HISTORIQUE_ALIGNEMENT;
+    
+    pthread_mutex_lock(&h->verrou);
+    h->sequence++;
+    
+    if(lg > h->taille)
+    {
+        h->ecrasees += h->sequence-h->premiere;
+        h->debut = h->fin;
+        h->premiere = h->sequence+1;
+        pthread_mutex_unlock(&h->verrou);
+        return;
+    }
+    
+    /* Un enregistrement n'est jamais coupe par la fin de l'anneau */
+    reste = h->taille-h->fin%h->taille;
+    if(reste < lg)
+    {
+        while(h->fin+reste-h->debut > h->taille)
+            oublier_ancien(h);
+        memset(h->anneau+h->fin%h->taille, 0, sizeof(uint32_t));
+        h->fin += reste;
+    }
+    while(h->fin+lg-h->debut > h->taille)
+        oublier_ancien(h);
+    
+    pos = h->anneau+h->fin%h->taille;
+    memcpy(pos, &lg, sizeof(lg));
+    memcpy(pos+4, &tailles[0], sizeof(uint16_t));
+    pos[6] = type_cle;
+    pos[7] = type_adresse;
+    memcpy(pos+8, &date_64, sizeof(date_64));
+    memcpy(pos+16, &tailles[1], sizeof(uint16_t));
+    memcpy(pos+HISTORIQUE_ENTETE, hash, taille_hash);
+    memcpy(pos+HISTORIQUE_ENTETE+taille_hash, adresse, taille_adresse);
+    h->fin += lg;
+    
+    pthread_mutex_unlock(&h->verrou);
+}
+
+/**
+ * @brief Renvoie la position courante de l'historique : son epoque et la
+ *        sequence de sa derniere modification.
+ *
+ * @param h un pointeur sur l'historique.
+ * @return la position.
+*/
+position position_historique(historique *h)
+{
+    position p;
+    
+    pthread_mutex_lock(&h->verrou);
+    p.epoque = h->epoque;
+    p.sequence = h->sequence;
+    pthread_mutex_unlock(&h->verrou);
+    
+    return p;
+}
+
+/**
+ * @brief Cherche la premiere modification posterieure a une position.
+ *
+ * Les enregistrements sont parcourus depuis le plus ancien, sans verrou :
+ * l'historique ne doit plus etre modifie (copie d'un processus fils).
+ *
+ * @param h un pointeur sur l'historique.
+ * @param depuis la position d'un serveur dans cet historique.
+ * @param curseur la position de la modification dans l'anneau (valeur de
+ *        retour par effet de bord).
+ * @return 0 si toutes les modifications posterieures sont encore dans
+ *         l'historique, -1 si la position est d'une autre epoque ou si
+ *         l'anneau a deja ecrase certaines d'entre elles.
+*/
+int chercher_historique(historique *h, position depuis, uint64_t *curseur)
+{
+    uint64_t sequence;
+    uint32_t lg;
+    
+    if(h->anneau==NULL || depuis.epoque!=h->epoque ||
+       depuis.sequence > h->sequence || depuis.sequence+1 < h->premiere)
+        return -1;
+    
+    *curseur = h->debut;
+    for(sequence=h->premiere; sequence<=depuis.sequence; sequence++)
+    {
+        while((lg=longueur(h, *curseur))==0)
+            *curseur += h->taille-*curseur%h->taille;
+        *curseur += lg;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Lit la modification suivante de l'historique.
+ *
+ * @param h un pointeur sur l'historique.
+ * @param curseur la position de la modification dans l'anneau (avancee par
+ *        effet de bord).
+ * @param m la modification (valeur de retour par effet de bord, pointe dans
+ *        l'anneau).
+ * @return 0 en cas de reussite, -1 a la fin de l'historique.
+*/
+int lire_historique(historique *h, uint64_t *curseur, modification *m)
+{
+    uint32_t lg;
+    uint16_t taille_16;
+    int64_t date_64;
+    donnees *pos;
+    
+    if(*curseur < h->fin && longueur(h, *curseur)==0)
+        *curseur += h->taille-*curseur%h->taille;
+    if(*curseur >= h->fin)
+        return -1;
+    
+    pos = h->anneau+*curseur%h->taille;
+    memcpy(&lg, pos, sizeof(lg));
+    memcpy(&taille_16, pos+4, sizeof(taille_16));
+    m->taille_hash = taille_16;
+    m->type_cle = pos[6];
+    m->type_adresse = pos[7];
+    memcpy(&date_64, pos+8, sizeof(date_64));
+    m->date = date_64;
+    memcpy(&taille_16, pos+16, sizeof(taille_16));
+    m->taille_adresse = taille_16;
+    m->hash = pos+HISTORIQUE_ENTETE;
+    m->adresse = m->hash+m->taille_hash;
+    *curseur += lg;
+    
+    return 0;
+}
+
+/**
+ * @brief Affiche l'etat de l'historique.
+ *
+ * @param h un pointeur sur l'historique.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_historique(historique *h, FILE *f)
+{
+    pthread_mutex_lock(&h->verrou);
+    fprintf(f, "Historique : sequences %llu a %llu (%.1f Mo sur %.1f), "\
+            "%lu modifications ecrasees\n",
+            (unsigned long long) h->premiere,
+            (unsigned long long) h->sequence,
+            (h->fin-h->debut)/(1024.0*1024.0), h->taille/(1024.0*1024.0),
+            h->ecrasees);
+    pthread_mutex_unlock(&h->verrou);
+}
+
+/**
+ * @brief Renvoie le chemin du fichier de positions d'un instantane.
+ *
+ * @param instantane le chemin de l'instantane.
+ * @param suffixe ".positions", suivi de ".tmp" pour le fichier temporaire.
+ * @return le chemin (a liberer), NULL en cas d'erreur.
+*/
+static char *chemin_positions(const char *instantane, const char *suffixe)
+{
+    char *chemin = malloc(strlen(instantane)+strlen(suffixe)+1);
+    
+    if(chemin!=NULL)
+    {
+        strcpy(chemin, instantane);
+        strcat(chemin, suffixe);
+    }
+    
+    return chemin;
+}
+
+/**
+ * @brief Ecrit les positions d'un serveur dans l'historique des autres, a
+ *        cote de son instantane.
+ *
+ * Le fichier (instantane.positions) est ecrit apres l'instantane, par un
+ * fichier temporaire renomme : les positions ne sont jamais plus recentes
+ * que la table rechargee, et un serveur qui revient ne peut que recevoir
+ * des modifications qu'il a deja.
+ *
+ * @param instantane le chemin de l'instantane.
+ * @param positions les positions.
+ * @param nb le nombre de positions.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ecrire_positions(const char *instantane, position *positions,
+                        unsigned int nb)
+{
+    int fd, err = 0;
+    char *chemin, *temporaire;
+    entete_positions entete;
+    
+    chemin = chemin_positions(instantane, ".positions");
+    temporaire = chemin_positions(instantane, ".positions.tmp");
+    if(chemin==NULL || temporaire==NULL)
+    {
+        perror("Error malloc");
+        free(chemin);
+        free(temporaire);
+        return 171;
+    }
+    
+    fd = open(temporaire, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd==-1)
+    {
+        perror("Error open");
+        free(chemin);
+        free(temporaire);
+        return 172;
+    }
+    
+    memcpy(entete.magique, POSITIONS_MAGIQUE, sizeof(entete.magique));
+    entete.version = POSITIONS_VERSION;
+    entete.nb = nb;
+    if(write(fd, &entete, sizeof(entete))!=(ssize_t)sizeof(entete) ||
+       write(fd, positions, nb*sizeof(position))!=
+                                        (ssize_t)(nb*sizeof(position)) ||
+       fdatasync(fd)==-1)
+    {
+        perror("Error write");
+        err = 173;
+    }
+    close(fd);
+    
+    if(err==0 && rename(temporaire, chemin)==-1)
+    {
+        perror("Error rename");
+        err = 174;
+    }
+    if(err!=0)
+        unlink(temporaire);
+    
+    free(chemin);
+    free(temporaire);
+    
+    return err;
+}
+
+/**
+ * @brief Charge les positions ecrites a cote d'un instantane.
+ *
+ * Un fichier absent donne zero position.
+ *
+ * @param instantane le chemin de l'instantane.
+ * @param positions un tableau d'au moins POSITIONS_MAX positions.
+ * @param nb le nombre de positions chargees (valeur de retour par effet de
+ *        bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int charger_positions(const char *instantane, position *positions,
+                        unsigned int *nb)
+{
+    int fd, err = 0;
+    char *chemin;
+    entete_positions entete;
+    
+    *nb = 0;
+    chemin = chemin_positions(instantane, ".positions");
+    if(chemin==NULL)
+    {
+        perror("Error malloc");
+        return 171;
+    }
+    
+    fd = open(chemin, O_RDONLY);
+    free(chemin);
+    if(fd==-1)
+    {
+        if(errno==ENOENT)
+            return 0;
+        perror("Error open");
+        return 172;
+    }
+    
+    if(read(fd, &entete, sizeof(entete))!=(ssize_t)sizeof(entete) ||
+       memcmp(entete.magique, POSITIONS_MAGIQUE, sizeof(entete.magique))!=0
+       || entete.version!=POSITIONS_VERSION || entete.nb > POSITIONS_MAX ||
+       read(fd, positions, entete.nb*sizeof(position))!=
+                                        (ssize_t)(entete.nb*sizeof(position)))
+    {
+        fprintf(stderr, "Positions de l'instantane %s invalides\n",
+                instantane);
+        err = 175;
+    }
+    else
+    {
+        *nb = entete.nb;
+    }
+    close(fd);
+    
+    return err;
+}
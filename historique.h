@@ -0,0 +1,105 @@
+#ifndef __HISTORIQUE_H__
+#define __HISTORIQUE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stockage_serveur.h"
+
+/* Taille par defaut de l'anneau de l'historique, en megaoctets */
+#define HISTORIQUE_TAILLE_DEFAUT 4
+
+/* Identifiant place au debut d'un fichier de positions */
+#define POSITIONS_MAGIQUE "DHTP"
+
+/* Version du format des fichiers de positions */
+#define POSITIONS_VERSION 1
+
+/* Nombre maximal de positions presentees a un serveur */
+#define POSITIONS_MAX 64
+
+/*
+ Historique des modifications de la table d'un serveur : chaque couple
+ hash/adresse stocke (put, replication, anti-entropie) y reçoit un numero de
+ sequence croissant. L'anneau est borne : les plus anciennes modifications
+ sont ecrasees par les nouvelles.
+
+ Un enregistrement (aligne sur 8 octets, jamais coupe par la fin de
+ l'anneau : la place restante est alors laissee vide, marquee par une
+ longueur nulle) est forme, dans l'ordre des octets de la machine, de sa
+ longueur arrondie (4 octets), de la taille du hash (2 octets), du type de
+ cle (1 octet), du type d'adresse (1 octet), de la date (8 octets), de la
+ taille de l'adresse (2 octets), du hash puis de l'adresse.
+
+ L'epoque identifie une execution du serveur : les sequences d'une autre
+ execution ne designent pas les memes modifications.
+*/
+typedef struct historique{
+    donnees *anneau;            // Enregistrements (NULL si desactive)
+    size_t taille;              // Taille de l'anneau (multiple de 8)
+    uint64_t debut;             // Position du plus ancien enregistrement
+    uint64_t fin;               // Position du prochain octet a remplir
+    uint64_t premiere;          // Sequence du plus ancien enregistrement
+    uint64_t sequence;          // Sequence de la derniere modification (0 si
+                                // aucune)
+    uint64_t epoque;            // Identifiant de l'execution du serveur
+    unsigned long ecrasees;     // Modifications ecrasees par de plus recentes
+    pthread_mutex_t verrou;     // Protege l'anneau et les compteurs
+} historique;
+
+/* Modification lue dans l'historique (pointe dans l'anneau) */
+typedef struct modification{
+    long int date;              // Date de l'annonce de l'adresse
+    donnees type_cle;           // Type du hash
+    donnees *hash;              // Hash
+    taille taille_hash;         // Taille du hash
+    donnees type_adresse;       // Forme de l'adresse
+    donnees *adresse;           // Adresse
+    taille taille_adresse;      // Taille de l'adresse
+} modification;
+
+/* Position d'un serveur qui revient dans l'historique d'un autre : il en a
+   reçu les modifications jusqu'a la sequence donnee */
+typedef struct position{
+    uint64_t epoque;            // Execution du serveur qui tient l'historique
+    uint64_t sequence;          // Derniere sequence reçue
+} position;
+
+/* Initialise un historique (taille nulle : desactive) */
+int init_historique(historique *h, size_t taille);
+
+/* Libere la memoire attribuee a un historique */
+void delete_historique(historique *h);
+
+/* Ajoute une modification a l'historique */
+void historiser(historique *h, long int date, donnees type_cle,
+                donnees *hash, taille taille_hash, donnees type_adresse,
+                donnees *adresse, taille taille_adresse);
+
+/* Renvoie la position courante de l'historique */
+position position_historique(historique *h);
+
+/* Cherche la premiere modification posterieure a une position */
+int chercher_historique(historique *h, position depuis, uint64_t *curseur);
+
+/* Lit la modification suivante de l'historique */
+int lire_historique(historique *h, uint64_t *curseur, modification *m);
+
+/* Affiche l'etat de l'historique */
+void afficher_stats_historique(historique *h, FILE *f);
+
+/* Ecrit les positions d'un serveur a cote de son instantane */
+int ecrire_positions(const char *instantane, position *positions,
+                        unsigned int nb);
+
+/* Charge les positions ecrites a cote d'un instantane */
+int charger_positions(const char *instantane, position *positions,
+                        unsigned int *nb);
+
+#endif
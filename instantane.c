@@ -0,0 +1,439 @@
+#include "instantane.h"
+
+typedef struct tampon_ecriture{
+    int fd;                     // Fichier dans lequel ecrire
+    size_t lg;                  // Nombre d'octets en attente
+    uint64_t ecrits;            // Nombre total d'octets ecrits
+    donnees octets[INSTANTANE_TAMPON]; // Octets en attente d'ecriture
+} tampon_ecriture;
+
+/**
+ * @brief Ecrit dans le fichier les octets en attente dans le tampon.
+ *
+ * @param t un pointeur sur le tampon.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int vider_tampon(tampon_ecriture *t)
+{
+    size_t fait = 0;
+    ssize_t n;
+    
+    while(fait < t->lg)
+    {
+        n = write(t->fd, t->octets+fait, t->lg-fait);
+        if(n==-1)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        fait += n;
+    }
+    
+    t->lg = 0;
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute des octets au tampon, en le vidant s'il est plein.
+ *
+ * @param t un pointeur sur le tampon.
+ * @param data les octets a ecrire.
+ * @param lg le nombre d'octets a ecrire (au plus INSTANTANE_TAMPON, ce qui
+ *        suffit pour tout element dont la taille tient sur un taille).
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_octets(tampon_ecriture *t, const void *data, size_t lg)
+{
+    if(t->lg+lg > INSTANTANE_TAMPON && vider_tampon(t)==-1)
+        return -1;
+    
+    memcpy(t->octets+t->lg, data, lg);
+    t->lg += lg;
+    t->ecrits += lg;
+    
+    return 0;
+}
+
+/**
+ * @brief Ecrit un element de taille variable precede de son type et de sa
+ *        taille.
+ *
+ * @param t un pointeur sur le tampon.
+ * @param type le type de l'element.
+ * @param octets les octets de l'element.
+ * @param lg la taille de l'element.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_element(tampon_ecriture *t, donnees type,
+                            const donnees *octets, taille lg)
+{
+    if(ecrire_octets(t, &type, sizeof(type))==-1 ||
+       ecrire_octets(t, &lg, sizeof(lg))==-1)
+        return -1;
+    
+    return ecrire_octets(t, octets, lg);
+}
+
+/**
+ * @brief Ecrit les hash d'une table et leurs emplacements.
+ *
+ * @param dht un pointeur sur la table.
+ * @param decalage le decalage a ajouter aux identifiants de ses adresses.
+ * @param t un pointeur sur le tampon.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_hashs(table_hash *dht, uint32_t decalage,
+                            tampon_ecriture *t)
+{
+    l_hash *table;
+    l_emplacement *emp;
+    size_t curseur = 0;
+    uint32_t id, nb;
+    int64_t date;
+    
+    while((table=parcours_table(dht, &curseur))!=NULL)
+    {
+        for(nb=0, emp=table->dispo; emp!=NULL; emp=emp->next)
+            nb++;
+    
+        if(ecrire_element(t, table->type_cle, table->hash,
+                          table->taille_hash)==-1 ||
+           ecrire_octets(t, &nb, sizeof(nb))==-1)
+            return -1;
+    
+        for(emp=table->dispo; emp!=NULL; emp=emp->next)
+        {
+            id = emp->id_adresse+decalage;
+            date = emp->obsolescence;
+            if(ecrire_octets(t, &id, sizeof(id))==-1 ||
+               ecrire_octets(t, &date, sizeof(date))==-1)
+                return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ecrit le contenu des tables dans le fichier du tampon.
+ *
+ * Les tables (partitions d'une meme table) forment un seul instantane : les
+ * adresses de chaque table suivent celles de la precedente, et leurs
+ * identifiants sont decales d'autant.
+ *
+ * @param tables le tableau des tables a sauvegarder.
+ * @param nb_tables le nombre de tables.
+ * @param t un pointeur sur le tampon (fichier positionne au debut).
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_tables(table_hash *tables, unsigned int nb_tables,
+                            tampon_ecriture *t)
+{
+    entete_instantane entete;
+    dico_adresses *dico;
+    adresse_interne *a;
+    uint32_t id, decalage;
+    unsigned int k;
+    
+    memset(&entete, 0, sizeof(entete));
+    memcpy(entete.magique, INSTANTANE_MAGIQUE, sizeof(entete.magique));
+    entete.version = INSTANTANE_VERSION;
+    entete.date = time(NULL);
+    for(k=0; k<nb_tables; k++)
+    {
+        entete.nb_adresses += tables[k].adresses.nb_ids;
+        entete.nb_hash += tables[k].nb_hash;
+    }
+    
+    /* L'entete est reecrite une fois la taille connue */
+    if(ecrire_octets(t, &entete, sizeof(entete))==-1)
+        return -1;
+    
+    /* Les adresses gardent leur identifiant : les emplacements n'ont qu'a
+       ecrire l'identifiant de leur adresse */
+    for(k=0; k<nb_tables; k++)
+    {
+        dico = &tables[k].adresses;
+        for(id=0; id<dico->nb_ids; id++)
+        {
+            a = dico->adresses[id];
+            if((a==NULL && ecrire_element(t, 0, (donnees *)"", 0)==-1) ||
+               (a!=NULL && ecrire_element(t, a->type_adresse, a->octets,
+                                          a->taille_adresse)==-1))
+                return -1;
+        }
+    }
+    
+    for(k=0, decalage=0; k<nb_tables; k++)
+    {
+        if(ecrire_hashs(&tables[k], decalage, t)==-1)
+            return -1;
+        decalage += tables[k].adresses.nb_ids;
+    }
+    
+    if(vider_tampon(t)==-1)
+        return -1;
+    
+    entete.taille = t->ecrits;
+    if(pwrite(t->fd, &entete, sizeof(entete), 0)!=sizeof(entete))
+        return -1;
+    
+    return 0;
+}
+
+/**
+ * @brief Ecrit un instantane de la table dans un fichier.
+ *
+ * L'instantane est ecrit dans un fichier temporaire (chemin suivi de ".tmp"),
+ * synchronise sur le disque puis renomme : le fichier designe par chemin
+ * contient toujours un instantane complet. Seuls des appels systeme sont
+ * utilises, la fonction peut donc etre appelee dans un processus fils.
+ *
+ * @param dht un pointeur sur la table a sauvegarder.
+ * @param chemin le chemin du fichier d'instantane.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ecrire_instantane(table_hash *dht, const char *chemin)
+{
+    return ecrire_instantane_partitions(dht, 1, chemin);
+}
+
+/**
+ * @brief Ecrit un instantane d'une table partitionnee dans un fichier.
+ *
+ * Comme ecrire_instantane : l'instantane obtenu est celui d'une seule table
+ * contenant tous les hash des partitions.
+ *
+ * @param tables le tableau des partitions.
+ * @param nb_tables le nombre de partitions.
+ * @param chemin le chemin du fichier d'instantane.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ecrire_instantane_partitions(table_hash *tables, unsigned int nb_tables,
+                                    const char *chemin)
+{
+    tampon_ecriture *t;
+    char *temporaire;
+    int err = 0;
+    
+    temporaire = malloc(strlen(chemin)+5);
+    t = malloc(sizeof(tampon_ecriture));
+    if(temporaire==NULL || t==NULL)
+    {
+        perror("Error malloc");
+        free(temporaire);
+        free(t);
+        return 120;
+    }
+    strcpy(temporaire, chemin);
+    strcat(temporaire, ".tmp");
+    
+    t->lg = 0;
+    t->ecrits = 0;
+    t->fd = open(temporaire, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(t->fd==-1)
+    {
+        perror("Error open");
+        free(temporaire);
+        free(t);
+        return 121;
+    }
+    
+    if(ecrire_tables(tables, nb_tables, t)==-1 || fdatasync(t->fd)==-1)
+    {
+        perror("Error write");
+        err = 122;
+    }
+    
+    close(t->fd);
+    
+    if(err==0 && rename(temporaire, chemin)==-1)
+    {
+        perror("Error rename");
+        err = 123;
+    }
+    
+    if(err!=0)
+        unlink(temporaire);
+    
+    free(temporaire);
+    free(t);
+    
+    return err;
+}
+
+/**
+ * @brief Lit un element de taille variable de l'instantane.
+ *
+ * @param pos la position de lecture (avancee par effet de bord).
+ * @param fin la fin de l'instantane.
+ * @param type le type de l'element (valeur de retour par effet de bord).
+ * @param lg la taille de l'element (valeur de retour par effet de bord).
+ * @return un pointeur sur les octets de l'element, NULL si l'instantane est
+ *         tronque.
+*/
+static donnees *lire_element(donnees **pos, donnees *fin, donnees *type,
+                                taille *lg)
+{
+    donnees *octets;
+    
+    if(fin-*pos < (long)(sizeof(donnees)+sizeof(taille)))
+        return NULL;
+    
+    *type = **pos;
+    memcpy(lg, *pos+sizeof(donnees), sizeof(taille));
+    octets = *pos+sizeof(donnees)+sizeof(taille);
+    
+    if(fin-octets < *lg)
+        return NULL;
+    
+    *pos = octets+*lg;
+    
+    return octets;
+}
+
+/**
+ * @brief Charge dans la table un instantane precedemment ecrit.
+ *
+ * Le fichier est projete en memoire (mmap) et les adresses sont inserees
+ * directement depuis la projection. Les adresses dont la derniere annonce
+ * date de plus de TEMPS_OBSOLESCENCE secondes sont ignorees. L'absence du
+ * fichier n'est pas une erreur (la table reste vide).
+ *
+ * @param dht un pointeur sur la table a remplir.
+ * @param chemin le chemin du fichier d'instantane.
+ * @param chargees le nombre d'adresses chargees
+ *        (valeur de retour par effet de bord).
+ * @param ignorees le nombre d'adresses obsoletes ignorees
+ *        (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int charger_instantane(table_hash *dht, const char *chemin,
+                        unsigned long *chargees, unsigned long *ignorees)
+{
+    int fd, err = 0;
+    struct stat infos;
+    entete_instantane entete;
+    donnees *debut, *pos, *fin, *hash, **adresses, type_cle;
+    taille taille_hash, *tailles;
+    uint64_t i;
+    uint32_t nb, id;
+    int64_t date;
+    long int maintenant = time(NULL);
+    
+    *chargees = 0;
+    *ignorees = 0;
+    
+    fd = open(chemin, O_RDONLY);
+    if(fd==-1)
+    {
+        if(errno==ENOENT)
+            return 0;
+        perror("Error open");
+        return 124;
+    }
+    
+    if(fstat(fd, &infos)==-1 || infos.st_size < (off_t)sizeof(entete))
+    {
+        fprintf(stderr, "Instantane %s invalide\n", chemin);
+        close(fd);
+        return 125;
+    }
+    
+    debut = mmap(NULL, infos.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(debut==MAP_FAILED)
+    {
+        perror("Error mmap");
+        return 126;
+    }
+    madvise(debut, infos.st_size, MADV_SEQUENTIAL);
+    
+    memcpy(&entete, debut, sizeof(entete));
+    if(memcmp(entete.magique, INSTANTANE_MAGIQUE, sizeof(entete.magique))!=0
+       || entete.version!=INSTANTANE_VERSION
+       || entete.taille!=(uint64_t)infos.st_size
+       || entete.nb_adresses > UINT32_MAX)
+    {
+        fprintf(stderr, "Instantane %s invalide ou d'une autre version\n",
+                chemin);
+        munmap(debut, infos.st_size);
+        return 125;
+    }
+    
+    adresses = malloc(entete.nb_adresses*sizeof(donnees *)+1);
+    tailles = malloc(entete.nb_adresses*sizeof(taille)+1);
+    if(adresses==NULL || tailles==NULL)
+    {
+        perror("Error malloc");
+        free(adresses);
+        free(tailles);
+        munmap(debut, infos.st_size);
+        return 120;
+    }
+    
+    pos = debut+sizeof(entete);
+    fin = debut+infos.st_size;
+    
+    /* Les adresses sont reperees dans la projection (pointeur sur le type) */
+    for(i=0; i<entete.nb_adresses && err==0; i++)
+    {
+        adresses[i] = pos;
+        if(lire_element(&pos, fin, &type_cle, &tailles[i])==NULL)
+            err = 125;
+    }
+    
+    for(i=0; i<entete.nb_hash && err==0; i++)
+    {
+        hash = lire_element(&pos, fin, &type_cle, &taille_hash);
+        if(hash==NULL || fin-pos < (long)sizeof(nb))
+        {
+            err = 125;
+            break;
+        }
+        memcpy(&nb, pos, sizeof(nb));
+        pos += sizeof(nb);
+    
+        if((uint64_t)(fin-pos) < (uint64_t)nb*(sizeof(id)+sizeof(date)))
+        {
+            err = 125;
+            break;
+        }
+    
+        for(; nb>0; nb--, pos+=sizeof(id)+sizeof(date))
+        {
+            memcpy(&id, pos, sizeof(id));
+            memcpy(&date, pos+sizeof(id), sizeof(date));
+    
+            if(id>=entete.nb_adresses || adresses[id][0]==0)
+            {
+                err = 125;
+                break;
+            }
+    
+            if(maintenant-date > TEMPS_OBSOLESCENCE)
+            {
+                (*ignorees)++;
+                continue;
+            }
+    
+            err=add_hash(dht, type_cle, hash, taille_hash, adresses[id][0],
+                         adresses[id]+sizeof(donnees)+sizeof(taille),
+                         tailles[id], date);
+            if(err!=0)
+                break;
+            (*chargees)++;
+        }
+    }
+    
+    if(err==125)
+        fprintf(stderr, "Instantane %s tronque ou corrompu\n", chemin);
+    
+    free(adresses);
+    free(tailles);
+    munmap(debut, infos.st_size);
+    
+    return err;
+}
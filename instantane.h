@@ -0,0 +1,60 @@
+#ifndef __INSTANTANE_H__
+#define __INSTANTANE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stockage_serveur.h"
+
+/* Version du format des instantanes */
+#define INSTANTANE_VERSION 1
+
+/* Identifiant place au debut d'un fichier d'instantane */
+#define INSTANTANE_MAGIQUE "DHTI"
+
+/* Intervalle (en secondes) entre deux ecritures de l'instantane */
+#define INSTANTANE_PERIODE 60
+
+/* Taille du tampon d'ecriture */
+#define INSTANTANE_TAMPON (64*1024)
+
+/*
+ Format d'un instantane (entiers dans l'ordre des octets de la machine, sans
+ alignement) :
+ - l'entete ci-dessous ;
+ - nb_adresses adresses, indexees par leur position :
+   type (1 octet, 0 pour un identifiant libre), taille (2 octets), octets ;
+ - nb_hash hash :
+   type de cle (1 octet), taille (2 octets), cle, nombre d'adresses
+   (4 octets), puis pour chaque adresse : indice de l'adresse (4 octets) et
+   date de la derniere annonce (8 octets).
+*/
+typedef struct entete_instantane{
+    char magique[4];            // INSTANTANE_MAGIQUE
+    uint32_t version;           // INSTANTANE_VERSION
+    int64_t date;               // Date d'ecriture de l'instantane
+    uint64_t nb_adresses;       // Nombre d'adresses de la premiere section
+    uint64_t nb_hash;           // Nombre de hash de la seconde section
+    uint64_t taille;            // Taille totale du fichier
+} entete_instantane;
+
+/* Ecrit un instantane de la table dans un fichier */
+int ecrire_instantane(table_hash *dht, const char *chemin);
+
+/* Ecrit un instantane de toutes les partitions d'une table */
+int ecrire_instantane_partitions(table_hash *tables, unsigned int nb_tables,
+                                    const char *chemin);
+
+/* Charge dans la table un instantane precedemment ecrit */
+int charger_instantane(table_hash *dht, const char *chemin,
+                        unsigned long *chargees, unsigned long *ignorees);
+
+#endif
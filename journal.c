@@ -0,0 +1,854 @@
+#include "journal.h"
+
+/**
+ * @brief Poursuit le calcul d'une somme de controle FNV-1a sur 32 bits.
+ *
+ * @param somme la somme des octets precedents (2166136261 au depart).
+ * @param octets les octets a ajouter.
+ * @param lg le nombre d'octets.
+ * @return la somme mise a jour.
+*/
+static uint32_t somme_fnv(uint32_t somme, const donnees *octets, size_t lg)
+{
+    size_t i;
+    
+    for(i=0; i<lg; i++)
+    {
+        somme ^= octets[i];
+        somme *= 16777619U;
+    }
+    
+    return somme;
+}
+
+/**
+ * @brief Calcule la longueur et la somme de controle des donnees d'un
+ *        enregistrement donne en plusieurs morceaux.
+ *
+ * @param morceaux les morceaux de l'enregistrement.
+ * @param tailles la taille de chaque morceau.
+ * @param nb le nombre de morceaux.
+ * @param total la longueur des donnees (valeur de retour par effet de bord).
+ * @return la somme de controle des donnees.
+*/
+static uint32_t somme_morceaux(const void **morceaux, const size_t *tailles,
+                                int nb, uint32_t *total)
+{
+    uint32_t somme = 2166136261U;
+    int i;
+    
+    *total = 0;
+    for(i=0; i<nb; i++)
+    {
+        somme = somme_fnv(somme, morceaux[i], tailles[i]);
+        *total += tailles[i];
+    }
+    
+    return somme;
+}
+
+/**
+ * @brief Renvoie un chemin suivi d'un suffixe (a liberer par free).
+ *
+ * @param chemin le chemin.
+ * @param suffixe le suffixe a ajouter.
+ * @return le nouveau chemin, NULL si la memoire manque.
+*/
+static char *suffixer(const char *chemin, const char *suffixe)
+{
+    char *resultat = malloc(strlen(chemin)+strlen(suffixe)+1);
+    
+    if(resultat!=NULL)
+    {
+        strcpy(resultat, chemin);
+        strcat(resultat, suffixe);
+    }
+    
+    return resultat;
+}
+
+/**
+ * @brief Ecrit entierement une suite d'octets dans un fichier.
+ *
+ * @param fd le fichier.
+ * @param octets les octets a ecrire.
+ * @param lg le nombre d'octets.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_tout(int fd, const donnees *octets, size_t lg)
+{
+    ssize_t n;
+    
+    while(lg > 0)
+    {
+        n = write(fd, octets, lg);
+        if(n==-1)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        octets += n;
+        lg -= n;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ouvre un segment de journal en ajout, en ecrivant son entete s'il
+ *        est vide.
+ *
+ * @param chemin le chemin du segment.
+ * @return le descripteur du segment, -1 en cas d'erreur.
+*/
+static int ouvrir_segment(const char *chemin)
+{
+    donnees entete[8];
+    uint32_t version = JOURNAL_VERSION;
+    struct stat infos;
+    int fd;
+    
+    fd = open(chemin, O_WRONLY|O_APPEND|O_CREAT, 0644);
+    if(fd==-1)
+        return -1;
+    
+    if(fstat(fd, &infos)==-1)
+    {
+        close(fd);
+        return -1;
+    }
+    
+    if(infos.st_size==0)
+    {
+        memcpy(entete, JOURNAL_MAGIQUE, 4);
+        memcpy(entete+4, &version, sizeof(version));
+        if(ecrire_tout(fd, entete, sizeof(entete))==-1)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    return fd;
+}
+
+/**
+ * @brief Copie des octets dans l'anneau a partir d'une position.
+ *
+ * @param j un pointeur sur le journal.
+ * @param position la position du premier octet (non reduite).
+ * @param data les octets a copier.
+ * @param lg le nombre d'octets.
+*/
+static void copier_anneau(journal *j, uint64_t position, const void *data,
+                            size_t lg)
+{
+    size_t indice = position & (JOURNAL_TAILLE_ANNEAU-1);
+    size_t premier = JOURNAL_TAILLE_ANNEAU-indice;
+    
+    if(premier > lg)
+        premier = lg;
+    
+    memcpy(j->anneau+indice, data, premier);
+    memcpy(j->anneau, (const donnees *)data+premier, lg-premier);
+}
+
+/**
+ * @brief Place un enregistrement dans l'anneau du journal.
+ *
+ * L'appelant n'attend jamais le disque : il n'attend que si l'anneau est
+ * plein, c'est-a-dire si l'ecrivain a pris plus d'un anneau de retard.
+ *
+ * @param j un pointeur sur le journal.
+ * @param type le type de l'enregistrement.
+ * @param morceaux les morceaux des donnees de l'enregistrement.
+ * @param tailles la taille de chaque morceau.
+ * @param nb le nombre de morceaux.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int journaliser(journal *j, donnees type, const void **morceaux,
+                        const size_t *tailles, int nb)
+{
+    uint32_t total, somme;
+    uint64_t position;
+    size_t lg;
+    int i;
+    
+    somme = somme_morceaux(morceaux, tailles, nb, &total);
+    lg = JOURNAL_ENTETE_ENREGISTREMENT+total;
+    if(lg > JOURNAL_TAILLE_ANNEAU/2)
+        return 133;
+    
+    pthread_mutex_lock(&j->verrou);
+    
+    while(JOURNAL_TAILLE_ANNEAU-(j->fin-j->debut) < lg)
+    {
+        j->attentes++;
+        pthread_cond_signal(&j->reveil);
+        pthread_cond_wait(&j->place, &j->verrou);
+    }
+    
+    position = j->fin;
+    copier_anneau(j, position, &type, sizeof(type));
+    copier_anneau(j, position+1, &total, sizeof(total));
+    copier_anneau(j, position+5, &somme, sizeof(somme));
+    position += JOURNAL_ENTETE_ENREGISTREMENT;
+    for(i=0; i<nb; i++)
+    {
+        copier_anneau(j, position, morceaux[i], tailles[i]);
+        position += tailles[i];
+    }
+    
+    j->fin = position;
+    j->enregistrements++;
+    
+    pthread_mutex_unlock(&j->verrou);
+    
+    return 0;
+}
+
+/**
+ * @brief Ecrit une partie de l'anneau dans le segment courant.
+ *
+ * @param j un pointeur sur le journal.
+ * @param debut la position du premier octet a ecrire.
+ * @param fin la position suivant le dernier octet a ecrire.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_anneau(journal *j, uint64_t debut, uint64_t fin)
+{
+    size_t indice = debut & (JOURNAL_TAILLE_ANNEAU-1);
+    size_t lg = fin-debut, premier = JOURNAL_TAILLE_ANNEAU-indice;
+    
+    if(premier > lg)
+        premier = lg;
+    
+    if(ecrire_tout(j->fd, j->anneau+indice, premier)==-1 ||
+       ecrire_tout(j->fd, j->anneau, lg-premier)==-1)
+        return -1;
+    
+    return 0;
+}
+
+/**
+ * @brief Thread ecrivain du journal (validation groupee).
+ *
+ * Toutes les j->intervalle millisecondes, les enregistrements accumules dans
+ * l'anneau sont ecrits en une fois puis valides par un seul fdatasync. Un
+ * changement de segment demande est effectue apres l'ecriture des
+ * enregistrements qui le precedent.
+ *
+ * @param arg un pointeur sur le journal.
+ * @return NULL.
+*/
+static void *ecrivain_journal(void *arg)
+{
+    journal *j = arg;
+    struct timespec echeance;
+    uint64_t debut, limite;
+    int rotation, arret, erreur;
+    
+    pthread_mutex_lock(&j->verrou);
+    for(;;)
+    {
+        if(j->actif && !j->rotation)
+        {
+            clock_gettime(CLOCK_REALTIME, &echeance);
+            echeance.tv_sec += j->intervalle/1000;
+            echeance.tv_nsec += (j->intervalle%1000)*1000000;
+            if(echeance.tv_nsec >= 1000000000)
+            {
+                echeance.tv_sec++;
+                echeance.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&j->reveil, &j->verrou, &echeance);
+        }
+    
+        debut = j->debut;
+        rotation = j->rotation;
+        limite = rotation ? j->position_rotation : j->fin;
+        arret = !j->actif;
+        pthread_mutex_unlock(&j->verrou);
+    
+        /* Ecriture et validation sans tenir le verrou : les put continuent
+           de remplir l'anneau pendant ce temps */
+        erreur = 0;
+        if(limite > debut && j->fd!=-1)
+        {
+            if(ecrire_anneau(j, debut, limite)==-1 || fdatasync(j->fd)==-1)
+            {
+                perror("Error journal");
+                erreur = 1;
+            }
+        }
+    
+        if(rotation)
+        {
+            close(j->fd);
+            if(rename(j->chemin, j->ancien)==-1)
+            {
+                perror("Error rename");
+                erreur = 1;
+            }
+            j->fd = ouvrir_segment(j->chemin);
+            if(j->fd==-1)
+            {
+                perror("Error open");
+                erreur = 1;
+            }
+        }
+    
+        pthread_mutex_lock(&j->verrou);
+        if(limite > debut)
+        {
+            j->octets += limite-debut;
+            j->synchronisations++;
+        }
+        j->erreurs += erreur;
+        j->debut = limite;
+        if(rotation)
+            j->rotation = 0;
+        pthread_cond_broadcast(&j->place);
+    
+        if(arret && j->debut==j->fin && !j->rotation)
+            break;
+    }
+    pthread_mutex_unlock(&j->verrou);
+    
+    return NULL;
+}
+
+/**
+ * @brief Ouvre (ou cree) un journal et demarre son ecrivain.
+ *
+ * Les enregistrements sont ajoutes a la fin du segment courant.
+ *
+ * @param j un pointeur sur le journal a initialiser.
+ * @param chemin le chemin du segment courant (le segment precedent est
+ *        chemin.ancien).
+ * @param intervalle l'intervalle entre deux fdatasync, en millisecondes.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ouvrir_journal(journal *j, const char *chemin, long intervalle)
+{
+    sigset_t signaux, anciens;
+    int err;
+    
+    memset(j, 0, sizeof(journal));
+    j->intervalle = intervalle > 0 ? intervalle : 1;
+    j->actif = 1;
+    
+    j->chemin = suffixer(chemin, "");
+    j->ancien = suffixer(chemin, ".ancien");
+    j->anneau = malloc(JOURNAL_TAILLE_ANNEAU);
+    if(j->chemin==NULL || j->ancien==NULL || j->anneau==NULL)
+    {
+        perror("Error malloc");
+        free(j->chemin);
+        free(j->ancien);
+        free(j->anneau);
+        return 130;
+    }
+    
+    j->fd = ouvrir_segment(chemin);
+    if(j->fd==-1)
+    {
+        perror("Error open");
+        free(j->chemin);
+        free(j->ancien);
+        free(j->anneau);
+        return 131;
+    }
+    
+    pthread_mutex_init(&j->verrou, NULL);
+    pthread_cond_init(&j->reveil, NULL);
+    pthread_cond_init(&j->place, NULL);
+    
+    /* L'ecrivain ne doit recevoir aucun signal : ils interrompent les
+       attentes du thread principal */
+    sigfillset(&signaux);
+    pthread_sigmask(SIG_BLOCK, &signaux, &anciens);
+    err = pthread_create(&j->ecrivain, NULL, ecrivain_journal, j);
+    pthread_sigmask(SIG_SETMASK, &anciens, NULL);
+    if(err!=0)
+    {
+        errno = err;
+        perror("Error pthread_create");
+        close(j->fd);
+        free(j->chemin);
+        free(j->ancien);
+        free(j->anneau);
+        return 132;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ecrit les enregistrements en attente, arrete l'ecrivain et ferme
+ *        le journal.
+ *
+ * @param j un pointeur sur le journal.
+*/
+void fermer_journal(journal *j)
+{
+    pthread_mutex_lock(&j->verrou);
+    j->actif = 0;
+    pthread_cond_signal(&j->reveil);
+    pthread_mutex_unlock(&j->verrou);
+    
+    pthread_join(j->ecrivain, NULL);
+    
+    if(j->fd!=-1)
+        close(j->fd);
+    free(j->chemin);
+    free(j->ancien);
+    free(j->anneau);
+    pthread_mutex_destroy(&j->verrou);
+    pthread_cond_destroy(&j->reveil);
+    pthread_cond_destroy(&j->place);
+}
+
+/**
+ * @brief Journalise l'ajout d'une adresse a un hash.
+ *
+ * @param j un pointeur sur le journal.
+ * @param date la date de l'annonce.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse ('e' ou 'a').
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int journaliser_put(journal *j, long int date, donnees type_cle,
+                        donnees *hash, taille taille_hash,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse)
+{
+    int64_t date_enr = date;
+    const void *morceaux[7] = {&date_enr, &type_cle, &taille_hash, hash,
+                               &type_adresse, &taille_adresse, adresse};
+    size_t tailles[7] = {sizeof(date_enr), 1, sizeof(taille), taille_hash,
+                         1, sizeof(taille), taille_adresse};
+    
+    return journaliser(j, JOURNAL_PUT, morceaux, tailles, 7);
+}
+
+/**
+ * @brief Journalise le retrait d'un hash (eviction).
+ *
+ * @param j un pointeur sur le journal.
+ * @param date la date du retrait.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int journaliser_retrait(journal *j, long int date, donnees type_cle,
+                            donnees *hash, taille taille_hash)
+{
+    int64_t date_enr = date;
+    const void *morceaux[4] = {&date_enr, &type_cle, &taille_hash, hash};
+    size_t tailles[4] = {sizeof(date_enr), 1, sizeof(taille), taille_hash};
+    
+    return journaliser(j, JOURNAL_RETRAIT, morceaux, tailles, 4);
+}
+
+/**
+ * @brief Fait commencer un nouveau segment apres les enregistrements deja
+ *        recus.
+ *
+ * Appele au moment ou un instantane est pris : le segment courant devient
+ * le segment precedent (chemin.ancien), que l'instantane rendra inutile. Si
+ * un segment precedent existe encore (instantane precedent non abouti), il
+ * est garde et le segment courant continue.
+ *
+ * @param j un pointeur sur le journal.
+ * @return 0 si le changement est programme, -1 sinon.
+*/
+int pivoter_journal(journal *j)
+{
+    int err = -1;
+    
+    pthread_mutex_lock(&j->verrou);
+    if(!j->rotation && access(j->ancien, F_OK)==-1)
+    {
+        j->rotation = 1;
+        j->position_rotation = j->fin;
+        pthread_cond_signal(&j->reveil);
+        err = 0;
+    }
+    pthread_mutex_unlock(&j->verrou);
+    
+    return err;
+}
+
+/**
+ * @brief Supprime le segment precedent, couvert par un instantane.
+ *
+ * Attend d'abord la fin d'un changement de segment en cours.
+ *
+ * @param j un pointeur sur le journal.
+*/
+void oublier_ancien_journal(journal *j)
+{
+    pthread_mutex_lock(&j->verrou);
+    while(j->rotation)
+        pthread_cond_wait(&j->place, &j->verrou);
+    pthread_mutex_unlock(&j->verrou);
+    
+    unlink(j->ancien);
+}
+
+/**
+ * @brief Applique a la table un enregistrement du journal.
+ *
+ * @param dht un pointeur sur la table.
+ * @param type le type de l'enregistrement.
+ * @param data les donnees de l'enregistrement.
+ * @param lg la longueur des donnees.
+ * @param rejoues le nombre d'enregistrements appliques (incremente).
+ * @param ignores le nombre d'adresses obsoletes ignorees (incremente).
+ * @return 0 en cas de reussite, -1 si l'enregistrement est mal forme, un
+ *         code d'erreur sinon.
+*/
+static int appliquer(table_hash *dht, donnees type, donnees *data,
+                        uint32_t lg, unsigned long *rejoues,
+                        unsigned long *ignores)
+{
+    int64_t date;
+    donnees type_cle, type_adresse, *hash, *adresse;
+    taille taille_hash, taille_adresse;
+    l_hash *table;
+    int err;
+    
+    if(lg < sizeof(date)+1+sizeof(taille))
+        return -1;
+    
+    memcpy(&date, data, sizeof(date));
+    type_cle = data[sizeof(date)];
+    memcpy(&taille_hash, data+sizeof(date)+1, sizeof(taille));
+    hash = data+sizeof(date)+1+sizeof(taille);
+    if(lg < sizeof(date)+1+sizeof(taille)+taille_hash)
+        return -1;
+    
+    if(type==JOURNAL_RETRAIT)
+    {
+        table = get_hash(dht, type_cle, hash, taille_hash);
+        if(table!=NULL)
+            remove_hash(dht, table);
+        (*rejoues)++;
+        return 0;
+    }
+    
+    if(type!=JOURNAL_PUT ||
+       lg < sizeof(date)+2+2*sizeof(taille)+taille_hash)
+        return -1;
+    
+    type_adresse = hash[taille_hash];
+    memcpy(&taille_adresse, hash+taille_hash+1, sizeof(taille));
+    adresse = hash+taille_hash+1+sizeof(taille);
+    if(lg != sizeof(date)+2+2*sizeof(taille)+taille_hash+taille_adresse)
+        return -1;
+    
+    if(time(NULL)-date > TEMPS_OBSOLESCENCE)
+    {
+        (*ignores)++;
+        return 0;
+    }
+    
+    err=add_hash(dht, type_cle, hash, taille_hash, type_adresse, adresse,
+                 taille_adresse, date);
+    if(err!=0)
+        return err;
+    
+    (*rejoues)++;
+    
+    return 0;
+}
+
+/**
+ * @brief Rejoue un segment de journal sur la table.
+ *
+ * La lecture s'arrete au premier enregistrement incomplet ou dont la somme
+ * de controle est fausse (ecriture interrompue par un arret brutal).
+ *
+ * @param dht un pointeur sur la table.
+ * @param chemin le chemin du segment.
+ * @param rejoues le nombre d'enregistrements appliques (incremente).
+ * @param ignores le nombre d'adresses obsoletes ignorees (incremente).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int rejouer_segment(table_hash *dht, const char *chemin,
+                            unsigned long *rejoues, unsigned long *ignores)
+{
+    int fd, err = 0;
+    struct stat infos;
+    donnees *debut, *pos, *fin;
+    uint32_t version, lg, somme;
+    
+    fd = open(chemin, O_RDONLY);
+    if(fd==-1)
+    {
+        if(errno==ENOENT)
+            return 0;
+        perror("Error open");
+        return 134;
+    }
+    
+    if(fstat(fd, &infos)==-1 || infos.st_size < 8)
+    {
+        close(fd);
+        return 0;
+    }
+    
+    debut = mmap(NULL, infos.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(debut==MAP_FAILED)
+    {
+        perror("Error mmap");
+        return 135;
+    }
+    madvise(debut, infos.st_size, MADV_SEQUENTIAL);
+    
+    memcpy(&version, debut+4, sizeof(version));
+    if(memcmp(debut, JOURNAL_MAGIQUE, 4)!=0 || version!=JOURNAL_VERSION)
+    {
+        fprintf(stderr, "Journal %s invalide ou d'une autre version\n",
+                chemin);
+        munmap(debut, infos.st_size);
+        return 136;
+    }
+    
+    pos = debut+8;
+    fin = debut+infos.st_size;
+    while(fin-pos >= JOURNAL_ENTETE_ENREGISTREMENT)
+    {
+        memcpy(&lg, pos+1, sizeof(lg));
+        memcpy(&somme, pos+5, sizeof(somme));
+        if((uint64_t)(fin-pos-JOURNAL_ENTETE_ENREGISTREMENT) < lg ||
+           somme_fnv(2166136261U, pos+JOURNAL_ENTETE_ENREGISTREMENT, lg)
+                                                                    !=somme)
+            break;
+    
+        err=appliquer(dht, pos[0], pos+JOURNAL_ENTETE_ENREGISTREMENT, lg,
+                      rejoues, ignores);
+        if(err>0)
+            break;
+        err = 0;
+    
+        pos += JOURNAL_ENTETE_ENREGISTREMENT+lg;
+    }
+    
+    if(err==0 && pos!=fin)
+        fprintf(stderr, "Journal %s : fin incomplete ignoree (%ld octets)\n",
+                chemin, (long)(fin-pos));
+    
+    munmap(debut, infos.st_size);
+    
+    return err;
+}
+
+/**
+ * @brief Rejoue un journal sur la table.
+ *
+ * Le segment precedent (chemin.ancien), s'il existe encore, est rejoue avant
+ * le segment courant. Les adresses deja obsoletes sont ignorees. L'absence
+ * de journal n'est pas une erreur.
+ *
+ * @param dht un pointeur sur la table (typiquement deja remplie par
+ *        l'instantane).
+ * @param chemin le chemin du segment courant.
+ * @param rejoues le nombre d'enregistrements appliques
+ *        (valeur de retour par effet de bord).
+ * @param ignores le nombre d'adresses obsoletes ignorees
+ *        (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int rejouer_journal(table_hash *dht, const char *chemin,
+                        unsigned long *rejoues, unsigned long *ignores)
+{
+    char *ancien;
+    int err;
+    
+    *rejoues = 0;
+    *ignores = 0;
+    
+    ancien = suffixer(chemin, ".ancien");
+    if(ancien==NULL)
+    {
+        perror("Error malloc");
+        return 130;
+    }
+    
+    err=rejouer_segment(dht, ancien, rejoues, ignores);
+    free(ancien);
+    if(err!=0)
+        return err;
+    
+    return rejouer_segment(dht, chemin, rejoues, ignores);
+}
+
+/**
+ * @brief Ecrit un enregistrement dans un fichier.
+ *
+ * @param f le fichier.
+ * @param type le type de l'enregistrement.
+ * @param morceaux les morceaux des donnees.
+ * @param tailles la taille de chaque morceau.
+ * @param nb le nombre de morceaux.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_enregistrement(FILE *f, donnees type,
+                                    const void **morceaux,
+                                    const size_t *tailles, int nb)
+{
+    uint32_t total, somme;
+    int i;
+    
+    somme = somme_morceaux(morceaux, tailles, nb, &total);
+    if(fwrite(&type, 1, 1, f)!=1 ||
+       fwrite(&total, sizeof(total), 1, f)!=1 ||
+       fwrite(&somme, sizeof(somme), 1, f)!=1)
+        return -1;
+    
+    for(i=0; i<nb; i++)
+    {
+        if(tailles[i]>0 && fwrite(morceaux[i], tailles[i], 1, f)!=1)
+            return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Reecrit un journal ne contenant que l'etat courant de la table.
+ *
+ * Chaque adresse encore presente donne un seul put, a la date de sa
+ * derniere annonce. Le journal compacte est ecrit dans un fichier
+ * temporaire puis renomme, et le segment precedent est supprime.
+ *
+ * @param dht un pointeur sur la table.
+ * @param chemin le chemin du segment courant.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int compacter_journal(table_hash *dht, const char *chemin)
+{
+    FILE *f;
+    char *temporaire, *ancien;
+    uint32_t version = JOURNAL_VERSION;
+    size_t curseur = 0;
+    l_hash *table;
+    l_emplacement *emp;
+    adresse_interne *a;
+    int64_t date;
+    int err = 0;
+    const void *morceaux[7];
+    size_t tailles[7] = {sizeof(date), 1, sizeof(taille), 0,
+                         1, sizeof(taille), 0};
+    
+    temporaire = suffixer(chemin, ".tmp");
+    ancien = suffixer(chemin, ".ancien");
+    if(temporaire==NULL || ancien==NULL)
+    {
+        perror("Error malloc");
+        free(temporaire);
+        free(ancien);
+        return 130;
+    }
+    
+    f = fopen(temporaire, "w");
+    if(f==NULL)
+    {
+        perror("Error fopen");
+        free(temporaire);
+        free(ancien);
+        return 137;
+    }
+    
+    if(fwrite(JOURNAL_MAGIQUE, 4, 1, f)!=1 ||
+       fwrite(&version, sizeof(version), 1, f)!=1)
+        err = 138;
+    
+    while(err==0 && (table=parcours_table(dht, &curseur))!=NULL)
+    {
+        morceaux[1] = &table->type_cle;
+        morceaux[2] = &table->taille_hash;
+        morceaux[3] = table->hash;
+        tailles[3] = table->taille_hash;
+    
+        for(emp=table->dispo; emp!=NULL && err==0; emp=emp->next)
+        {
+            a = ADRESSE(dht, emp);
+            date = emp->obsolescence;
+            morceaux[0] = &date;
+            morceaux[4] = &a->type_adresse;
+            morceaux[5] = &a->taille_adresse;
+            morceaux[6] = a->octets;
+            tailles[6] = a->taille_adresse;
+            if(ecrire_enregistrement(f, JOURNAL_PUT, morceaux, tailles, 7)==-1)
+                err = 138;
+        }
+    }
+    
+    if(err==0 && (fflush(f)!=0 || fdatasync(fileno(f))==-1))
+        err = 138;
+    if(fclose(f)!=0 && err==0)
+        err = 138;
+    
+    if(err==0 && rename(temporaire, chemin)==-1)
+        err = 139;
+    
+    if(err!=0)
+    {
+        perror("Error journal");
+        unlink(temporaire);
+    }
+    else
+    {
+        unlink(ancien);
+    }
+    
+    free(temporaire);
+    free(ancien);
+    
+    return err;
+}
+
+/**
+ * @brief Supprime les segments d'un journal.
+ *
+ * Appele lorsqu'un instantane couvre tout ce que contenait le journal.
+ *
+ * @param chemin le chemin du segment courant.
+*/
+void supprimer_journal(const char *chemin)
+{
+    char *ancien = suffixer(chemin, ".ancien");
+    
+    unlink(chemin);
+    if(ancien!=NULL)
+        unlink(ancien);
+    free(ancien);
+}
+
+/**
+ * @brief Affiche les statistiques du journal.
+ *
+ * @param j un pointeur sur le journal.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_journal(journal *j, FILE *f)
+{
+    pthread_mutex_lock(&j->verrou);
+    fprintf(f, "Journal : %lu enregistrements, %lu Ko ecrits en %lu "\
+               "fdatasync, %lu o en attente, %lu attentes (anneau plein), "\
+               "%lu erreurs\n",
+            j->enregistrements, (unsigned long)(j->octets/1024),
+            j->synchronisations, (unsigned long)(j->fin-j->debut),
+            j->attentes, j->erreurs);
+    pthread_mutex_unlock(&j->verrou);
+}
@@ -0,0 +1,110 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stockage_serveur.h"
+
+/* Version du format du journal */
+#define JOURNAL_VERSION 1
+
+/* Identifiant place au debut d'un fichier de journal */
+#define JOURNAL_MAGIQUE "DHTJ"
+
+/* Taille de l'anneau des enregistrements en attente d'ecriture (puissance
+   de 2) */
+#define JOURNAL_TAILLE_ANNEAU (4*1024*1024)
+
+/* Intervalle par defaut (en millisecondes) entre deux fdatasync */
+#define JOURNAL_INTERVALLE_DEFAUT 10
+
+/* Types d'enregistrement */
+#define JOURNAL_PUT 'p'
+#define JOURNAL_RETRAIT 'r'
+
+/*
+ Format d'un journal : le magique puis la version (4 octets), suivis des
+ enregistrements. Un enregistrement est forme d'un type (1 octet), de la
+ longueur des donnees (4 octets), de leur somme de controle FNV-1a (4 octets)
+ puis des donnees :
+ - put : date (8 octets), type de cle (1 octet), taille de la cle (2 octets),
+   cle, type d'adresse (1 octet), taille de l'adresse (2 octets), adresse ;
+ - retrait (hash evince) : date (8 octets), type de cle (1 octet), taille de
+   la cle (2 octets), cle.
+ Les entiers sont dans l'ordre des octets de la machine. L'expiration n'est
+ pas journalisee : chaque put porte sa date et le rejeu ignore les adresses
+ deja obsoletes.
+*/
+#define JOURNAL_ENTETE_ENREGISTREMENT 9
+
+typedef struct journal{
+    int fd;                     // Segment courant du journal
+    char *chemin;               // Chemin du segment courant
+    char *ancien;               // Chemin du segment precedent (chemin.ancien)
+    donnees *anneau;            // Enregistrements en attente d'ecriture
+    uint64_t debut;             // Position du premier octet non ecrit
+    uint64_t fin;               // Position du prochain octet a remplir
+    long intervalle;            // Intervalle entre deux fdatasync (ms)
+    int actif;                  // 0 pour arreter l'ecrivain
+    int rotation;               // Changement de segment demande
+    uint64_t position_rotation; // Position a laquelle changer de segment
+    pthread_t ecrivain;         // Thread ecrivant l'anneau dans le fichier
+    pthread_mutex_t verrou;     // Protege les positions et les indicateurs
+    pthread_cond_t reveil;      // Reveille l'ecrivain avant l'intervalle
+    pthread_cond_t place;       // Signale la liberation de place (ou la fin
+                                // d'un changement de segment)
+    unsigned long enregistrements; // Nombre d'enregistrements journalises
+    unsigned long synchronisations; // Nombre de fdatasync effectues
+    unsigned long attentes;     // Nombre d'attentes sur un anneau plein
+    unsigned long erreurs;      // Nombre d'erreurs d'ecriture
+    uint64_t octets;            // Nombre d'octets ecrits
+} journal;
+
+/* Ouvre (ou cree) un journal et demarre son ecrivain */
+int ouvrir_journal(journal *j, const char *chemin, long intervalle);
+
+/* Ecrit les enregistrements en attente, arrete l'ecrivain et ferme le
+   journal */
+void fermer_journal(journal *j);
+
+/* Journalise l'ajout d'une adresse a un hash */
+int journaliser_put(journal *j, long int date, donnees type_cle,
+                        donnees *hash, taille taille_hash,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse);
+
+/* Journalise le retrait d'un hash */
+int journaliser_retrait(journal *j, long int date, donnees type_cle,
+                            donnees *hash, taille taille_hash);
+
+/* Fait commencer un nouveau segment apres les enregistrements deja recus */
+int pivoter_journal(journal *j);
+
+/* Supprime le segment precedent (couvert par un instantane) */
+void oublier_ancien_journal(journal *j);
+
+/* Rejoue un journal (segment precedent puis segment courant) sur la table */
+int rejouer_journal(table_hash *dht, const char *chemin,
+                        unsigned long *rejoues, unsigned long *ignores);
+
+/* Reecrit un journal ne contenant que l'etat courant de la table */
+int compacter_journal(table_hash *dht, const char *chemin);
+
+/* Supprime les segments d'un journal */
+void supprimer_journal(const char *chemin);
+
+/* Affiche les statistiques du journal */
+void afficher_stats_journal(journal *j, FILE *f);
+
+#endif
@@ -0,0 +1,443 @@
+#include "lots.h"
+
+#ifdef AVEC_URING
+#include "uring.h"
+#endif
+
+/**
+ * @brief Renvoie la classe de l'histogramme de remplissage d'un lot.
+ *
+ * @param nb le nombre de datagrammes du lot (au moins 1).
+ * @return la partie entiere du logarithme en base 2 de nb.
+*/
+static unsigned int classe_lot(unsigned int nb)
+{
+    unsigned int classe = 0;
+    
+    while(nb > 1 && classe < LOT_CLASSES-1)
+    {
+        nb >>= 1;
+        classe++;
+    }
+    
+    return classe;
+}
+
+/**
+ * @brief Alloue un lot de reception.
+ *
+ * Les tampons des datagrammes sont empruntes a la reserve du lot au moment
+ * de la reception. Un lot n'est utilise que par un thread : les messages qui
+ * en sont issus doivent etre liberes par ce thread.
+ *
+ * @param lot un pointeur sur le lot a initialiser.
+ * @param capacite le nombre maximal de datagrammes par lot.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_lot_reception(lot_reception *lot, unsigned int capacite)
+{
+    unsigned int i;
+    
+    memset(lot, 0, sizeof(lot_reception));
+    lot->capacite = capacite;
+    lot->entetes = calloc(capacite, sizeof(struct mmsghdr));
+    lot->vecteurs = calloc(capacite, sizeof(struct iovec));
+    lot->emetteurs = calloc(capacite, sizeof(sockaddr_in));
+    lot->tampons = calloc(capacite, sizeof(tampon_message *));
+    if(lot->entetes==NULL || lot->vecteurs==NULL || lot->emetteurs==NULL ||
+       lot->tampons==NULL)
+    {
+        perror("Error malloc");
+        delete_lot_reception(lot);
+        return 58;
+    }
+    
+    for(i=0; i<capacite; i++)
+    {
+        lot->vecteurs[i].iov_len = MAX_MESS_SIZE;
+        lot->entetes[i].msg_hdr.msg_iov = &lot->vecteurs[i];
+        lot->entetes[i].msg_hdr.msg_iovlen = 1;
+        lot->entetes[i].msg_hdr.msg_name = &lot->emetteurs[i];
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Libere un lot de reception et les tampons de sa reserve.
+ *
+ * @param lot un pointeur sur le lot.
+*/
+void delete_lot_reception(lot_reception *lot)
+{
+    unsigned int i;
+    
+    if(lot->tampons!=NULL)
+    {
+        for(i=0; i<lot->capacite; i++)
+        {
+            if(lot->tampons[i]!=NULL)
+                rendre_tampon(lot->tampons[i]);
+        }
+    }
+    
+    vider_reserve(&lot->reserve);
+    free(lot->entetes);
+    free(lot->vecteurs);
+    free(lot->emetteurs);
+    free(lot->tampons);
+    lot->entetes = NULL;
+    lot->vecteurs = NULL;
+    lot->emetteurs = NULL;
+    lot->tampons = NULL;
+}
+
+/**
+ * @brief Reçoit un lot de datagrammes.
+ *
+ * Les places du lot dont le tampon a ete cede a un message reçoivent un
+ * tampon de la reserve, puis l'appel attend l'arrivee d'un datagramme et
+ * lit, par le meme appel systeme (recvmmsg), ceux qui sont deja en attente,
+ * dans la limite de la capacite du lot. Chaque datagramme n'est lu qu'une
+ * fois, directement dans son tampon.
+ *
+ * @param lot un pointeur sur le lot (lot->nb recoit le nombre de
+ *        datagrammes lus).
+ * @param sfd l'identifiant de la socket.
+ * @param attendre FALSE pour ne lire que les datagrammes deja arrives (le
+ *        lot peut alors etre vide).
+ * @return 0 en cas de reussite, CODE_INTERRUP_SYSTEM si l'attente a ete
+ *         interrompue par un signal, un code d'erreur sinon.
+*/
+int recevoir_lot(lot_reception *lot, int sfd, int attendre)
+{
+    unsigned int i;
+    int nb;
+    
+    lot->nb = 0;
+    
+#ifdef AVEC_URING
+    /* Backend io_uring : les datagrammes deja arrives sont copies dans les
+       places du lot */
+    if(lot->uring!=NULL)
+    {
+        nb = recevoir_lot_uring(lot->uring, lot);
+        if(lot->nb > 0)
+        {
+            lot->appels++;
+            lot->datagrammes += lot->nb;
+            lot->remplissage[classe_lot(lot->nb)]++;
+        }
+        return nb;
+    }
+#endif
+    
+    for(i=0; i<lot->capacite; i++)
+    {
+        if(lot->tampons[i]==NULL)
+        {
+            lot->tampons[i] = emprunter_tampon(&lot->reserve);
+            if(lot->tampons[i]==NULL)
+                return 58;
+            lot->vecteurs[i].iov_base = lot->tampons[i]->octets;
+        }
+        lot->entetes[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        lot->entetes[i].msg_hdr.msg_flags = 0;
+    }
+    
+    nb = recvmmsg(sfd, lot->entetes, lot->capacite,
+                  attendre ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+    if(nb==-1 && !attendre && (errno==EAGAIN || errno==EWOULDBLOCK))
+        return 0;
+    if(nb==-1)
+    {
+        /* Interruption system (signal) */
+        if(errno==EINTR)
+            return CODE_INTERRUP_SYSTEM;
+        perror("Error recvmmsg");
+        return 59;
+    }
+    
+    lot->nb = nb;
+    lot->appels++;
+    lot->datagrammes += nb;
+    if(nb > 0)
+        lot->remplissage[classe_lot(nb)]++;
+    
+    return 0;
+}
+
+/**
+ * @brief Renvoie le message reçu dans un datagramme du lot.
+ *
+ * Le message est une vue sur le tampon du datagramme (sans copie) : le
+ * tampon est cede au message et sera rendu a la reserve par delete_message.
+ *
+ * @param retour un pointeur vers un pointeur sur un message
+ *        (valeur de retour par effet de bord).
+ * @param lot un pointeur sur le lot.
+ * @param i l'indice du datagramme dans le lot.
+ * @param emetteur une structure pouvant contenir l'adresse de l'emetteur
+ *        (valeur de retour par effet de bord).
+ * @param addrlen la taille de l'adresse de l'emetteur
+ *        (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, -1 si le datagramme est trop court pour
+ *         etre un message.
+*/
+int message_du_lot(message **retour, lot_reception *lot, unsigned int i,
+                    struct sockaddr *emetteur, socklen_t *addrlen)
+{
+    tampon_message *t = lot->tampons[i];
+    
+    if(vue_message(t, lot->entetes[i].msg_len)==-1)
+        return -1;
+    
+    lot->tampons[i] = NULL;
+    
+    memcpy(emetteur, &lot->emetteurs[i], lot->entetes[i].msg_hdr.msg_namelen);
+    *addrlen = lot->entetes[i].msg_hdr.msg_namelen;
+    
+    *retour = &t->m;
+    
+    return 0;
+}
+
+/**
+ * @brief Alloue un lot d'envoi vide.
+ *
+ * @param lot un pointeur sur le lot a initialiser.
+ * @param capacite le nombre maximal de datagrammes en attente ; le lot peut
+ *        garder deux fois plus de messages a liberer (une requete et sa
+ *        reponse par datagramme reçu).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_lot_envoi(lot_envoi *lot, unsigned int capacite)
+{
+    memset(lot, 0, sizeof(lot_envoi));
+    lot->capacite = capacite;
+    lot->entetes = calloc(capacite, sizeof(struct mmsghdr));
+    lot->vecteurs = calloc(capacite, sizeof(struct iovec));
+    lot->destinataires = calloc(capacite, sizeof(sockaddr_in));
+    lot->messages = calloc(2*capacite, sizeof(message *));
+    if(lot->entetes==NULL || lot->vecteurs==NULL ||
+       lot->destinataires==NULL || lot->messages==NULL)
+    {
+        perror("Error malloc");
+        delete_lot_envoi(lot);
+        return 58;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Libere un lot d'envoi et les messages qui lui ont ete confies.
+ *
+ * Les datagrammes encore en attente ne sont pas envoyes.
+ *
+ * @param lot un pointeur sur le lot.
+*/
+void delete_lot_envoi(lot_envoi *lot)
+{
+    unsigned int i;
+    
+    if(lot->messages!=NULL)
+    {
+        for(i=0; i<lot->nb_messages; i++)
+            delete_message(lot->messages[i]);
+    }
+    
+    free(lot->entetes);
+    free(lot->vecteurs);
+    free(lot->destinataires);
+    free(lot->messages);
+    lot->entetes = NULL;
+    lot->vecteurs = NULL;
+    lot->destinataires = NULL;
+    lot->messages = NULL;
+    lot->nb = 0;
+    lot->nb_messages = 0;
+}
+
+/**
+ * @brief Envoie les datagrammes en attente, sans liberer les messages.
+ *
+ * @param lot un pointeur sur le lot.
+ * @param sfd l'identifiant de la socket.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int envoyer_lot(lot_envoi *lot, int sfd)
+{
+    unsigned int fait = 0;
+    int nb;
+    
+    if(lot->nb==0)
+        return 0;
+    
+    lot->appels++;
+    lot->remplissage[classe_lot(lot->nb)]++;
+    
+#ifdef AVEC_URING
+    if(lot->uring!=NULL)
+    {
+        nb = envoyer_lot_uring(lot->uring, lot);
+        lot->nb = 0;
+        return nb;
+    }
+#endif
+    
+    while(fait < lot->nb)
+    {
+        nb = sendmmsg(sfd, lot->entetes+fait, lot->nb-fait, 0);
+        if(nb==-1)
+        {
+            if(errno==EINTR)
+                continue;
+            perror("Error sendmmsg");
+            lot->nb = 0;
+            return 60;
+        }
+        fait += nb;
+        lot->datagrammes += nb;
+    }
+    
+    lot->nb = 0;
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute un datagramme au lot d'envoi.
+ *
+ * Le contenu du message n'est pas copie : le message doit rester valide
+ * jusqu'a l'envoi (voir confier_message). Si le lot est plein, les
+ * datagrammes en attente sont d'abord envoyes.
+ *
+ * @param lot un pointeur sur le lot.
+ * @param sfd l'identifiant de la socket.
+ * @param m le message a envoyer (deja prepare).
+ * @param destinataire l'adresse du destinataire.
+ * @param addrlen la taille de l'adresse du destinataire.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ajouter_envoi(lot_envoi *lot, int sfd, message *m,
+                    const struct sockaddr *destinataire, socklen_t addrlen)
+{
+    int err;
+    struct msghdr *entete;
+    
+    if(lot->nb==lot->capacite && (err=envoyer_lot(lot, sfd))!=0)
+        return err;
+    
+    if(addrlen > sizeof(sockaddr_in))
+        addrlen = sizeof(sockaddr_in);
+    memcpy(&lot->destinataires[lot->nb], destinataire, addrlen);
+    
+    lot->vecteurs[lot->nb].iov_base = m->contenu;
+    lot->vecteurs[lot->nb].iov_len = m->lg_message;
+    
+    entete = &lot->entetes[lot->nb].msg_hdr;
+    memset(entete, 0, sizeof(struct msghdr));
+    entete->msg_name = &lot->destinataires[lot->nb];
+    entete->msg_namelen = addrlen;
+    entete->msg_iov = &lot->vecteurs[lot->nb];
+    entete->msg_iovlen = 1;
+    
+    lot->nb++;
+    
+    return 0;
+}
+
+/**
+ * @brief Confie un message au lot d'envoi, qui le liberera apres l'envoi.
+ *
+ * Si le lot garde deja autant de messages qu'il le peut, il est d'abord
+ * vide (voir vider_envois).
+ *
+ * @param lot un pointeur sur le lot.
+ * @param sfd l'identifiant de la socket.
+ * @param m le message (a ne plus utiliser par l'appelant).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int confier_message(lot_envoi *lot, int sfd, message *m)
+{
+    int err = 0;
+    
+    if(lot->nb_messages==2*lot->capacite)
+        err=vider_envois(lot, sfd);
+    
+    lot->messages[lot->nb_messages++] = m;
+    
+    return err;
+}
+
+/**
+ * @brief Envoie les datagrammes en attente (sendmmsg) et libere les messages
+ *        confies au lot.
+ *
+ * @param lot un pointeur sur le lot.
+ * @param sfd l'identifiant de la socket.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int vider_envois(lot_envoi *lot, int sfd)
+{
+    int err;
+    unsigned int i;
+    
+    err=envoyer_lot(lot, sfd);
+    
+    for(i=0; i<lot->nb_messages; i++)
+        delete_message(lot->messages[i]);
+    lot->nb_messages = 0;
+    
+    return err;
+}
+
+/**
+ * @brief Affiche un histogramme de remplissage des lots.
+ *
+ * @param remplissage l'histogramme.
+ * @param f le flux sur lequel ecrire.
+*/
+static void afficher_remplissage(unsigned long *remplissage, FILE *f)
+{
+    unsigned int i;
+    
+    fprintf(f, "    remplissage :");
+    for(i=0; i<LOT_CLASSES; i++)
+    {
+        if(remplissage[i]==0)
+            continue;
+        if(i==0)
+            fprintf(f, " 1 %lu,", remplissage[i]);
+        else
+            fprintf(f, " %u-%u %lu,", 1U<<i, (2U<<i)-1, remplissage[i]);
+    }
+    fprintf(f, "\n");
+}
+
+/**
+ * @brief Affiche les statistiques des lots de reception et d'envoi.
+ *
+ * @param reception un pointeur sur le lot de reception.
+ * @param envoi un pointeur sur le lot d'envoi.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_lots(lot_reception *reception, lot_envoi *envoi, FILE *f)
+{
+    fprintf(f, "Tampons de reception : %lu alloues, %lu disponibles, "\
+               "%lu emprunts\n", reception->reserve.nb_tampons,
+            reception->reserve.nb_libres, reception->reserve.emprunts);
+    
+    fprintf(f, "Reception : %lu datagrammes en %lu lots (%.1f par lot, "\
+               "capacite %u)\n", reception->datagrammes, reception->appels,
+            reception->appels ?
+                (double)reception->datagrammes/reception->appels : 0.0,
+            reception->capacite);
+    afficher_remplissage(reception->remplissage, f);
+    
+    fprintf(f, "Envoi : %lu datagrammes en %lu lots (%.1f par lot)\n",
+            envoi->datagrammes, envoi->appels,
+            envoi->appels ? (double)envoi->datagrammes/envoi->appels : 0.0);
+    afficher_remplissage(envoi->remplissage, f);
+}
@@ -0,0 +1,81 @@
+#ifndef __LOTS_H__
+#define __LOTS_H__
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "messages.h"
+
+struct uring;
+
+/* Nombre de datagrammes traites par lot par defaut, et nombre maximal */
+#define LOT_DEFAUT 32
+#define LOT_MAX 1024
+
+/* Nombre de classes de l'histogramme de remplissage des lots : la classe i
+   compte les lots de 2^i a 2^(i+1)-1 datagrammes */
+#define LOT_CLASSES 11
+
+typedef struct lot_reception{
+    unsigned int capacite;      // Nombre maximal de datagrammes par lot
+    unsigned int nb;            // Nombre de datagrammes du dernier lot
+    struct mmsghdr *entetes;    // Descripteurs passes a recvmmsg
+    struct iovec *vecteurs;     // Tampon de chaque datagramme
+    sockaddr_in *emetteurs;     // Adresse de l'emetteur de chaque datagramme
+    tampon_message **tampons;   // Tampon de chaque datagramme, emprunte a
+                                // la reserve (NULL si cede a un message)
+    reserve_tampons reserve;    // Tampons du lot, propres au thread qui le
+                                // reçoit
+    struct uring *uring;        // Backend io_uring (NULL pour recvmmsg)
+    unsigned long appels;       // Nombre de lots reçus
+    unsigned long datagrammes;  // Nombre total de datagrammes reçus
+    unsigned long remplissage[LOT_CLASSES]; // Histogramme des tailles de lot
+} lot_reception;
+
+typedef struct lot_envoi{
+    unsigned int capacite;      // Nombre maximal de datagrammes en attente
+    unsigned int nb;            // Nombre de datagrammes en attente
+    struct mmsghdr *entetes;    // Descripteurs passes a sendmmsg
+    struct iovec *vecteurs;     // Contenu de chaque datagramme
+    sockaddr_in *destinataires; // Destinataire de chaque datagramme
+    message **messages;         // Messages a liberer apres l'envoi
+    unsigned int nb_messages;   // Nombre de messages a liberer
+    struct uring *uring;        // Backend io_uring (NULL pour sendmmsg)
+    unsigned long appels;       // Nombre d'appels a sendmmsg
+    unsigned long datagrammes;  // Nombre total de datagrammes envoyes
+    unsigned long remplissage[LOT_CLASSES]; // Histogramme des tailles de lot
+} lot_envoi;
+
+/* Alloue un lot de reception */
+int init_lot_reception(lot_reception *lot, unsigned int capacite);
+
+/* Libere un lot de reception et rend ses tampons */
+void delete_lot_reception(lot_reception *lot);
+
+/* Reçoit un lot de datagrammes */
+int recevoir_lot(lot_reception *lot, int sfd, int attendre);
+
+/* Renvoie le message reçu dans un datagramme du lot */
+int message_du_lot(message **retour, lot_reception *lot, unsigned int i,
+                    struct sockaddr *emetteur, socklen_t *addrlen);
+
+/* Alloue un lot d'envoi vide */
+int init_lot_envoi(lot_envoi *lot, unsigned int capacite);
+
+/* Libere un lot d'envoi (les datagrammes en attente ne sont pas envoyes) */
+void delete_lot_envoi(lot_envoi *lot);
+
+/* Ajoute un datagramme au lot d'envoi */
+int ajouter_envoi(lot_envoi *lot, int sfd, message *m,
+                    const struct sockaddr *destinataire, socklen_t addrlen);
+
+/* Confie un message au lot d'envoi, qui le liberera apres l'envoi */
+int confier_message(lot_envoi *lot, int sfd, message *m);
+
+/* Envoie les datagrammes en attente et libere les messages confies */
+int vider_envois(lot_envoi *lot, int sfd);
+
+/* Affiche les statistiques des lots */
+void afficher_stats_lots(lot_reception *reception, lot_envoi *envoi, FILE *f);
+
+#endif
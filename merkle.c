@@ -0,0 +1,143 @@
+#include "merkle.h"
+
+/**
+ * @brief Initialise l'arbre de partitions vides.
+ *
+ * Toutes les feuilles sont nulles ; les noeuds internes sont calcules une
+ * fois, pour que deux serveurs vides aient le meme arbre.
+ *
+ * @param a un pointeur sur l'arbre.
+*/
+void init_merkle(arbre_merkle *a)
+{
+    memset(a, 0, sizeof(arbre_merkle));
+    memset(a->a_calculer, 0xff, sizeof(a->a_calculer));
+    calculer_merkle(a);
+    a->recalcules = 0;
+}
+
+/**
+ * @brief Melange un entier de 64 bits (finaliseur de splitmix64).
+ *
+ * @param x l'entier.
+ * @return l'entier melange.
+*/
+uint64_t melanger_merkle(uint64_t x)
+{
+    x ^= x>>30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x>>27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x>>31;
+    
+    return x;
+}
+
+/**
+ * @brief Marque un element d'un ensemble de bits.
+ *
+ * @param ensemble l'ensemble.
+ * @param i l'element.
+*/
+static void marquer(uint64_t *ensemble, uint32_t i)
+{
+    ensemble[i/64] |= 1ULL<<(i%64);
+}
+
+/**
+ * @brief Ajoute l'empreinte d'un couple a la feuille de sa cle.
+ *
+ * @param f les feuilles de la partition.
+ * @param code_cle le code de hachage de la cle.
+ * @param empreinte l'empreinte du couple hash/adresse.
+*/
+void ajouter_merkle(feuilles_merkle *f, uint64_t code_cle, uint64_t empreinte)
+{
+    uint32_t feuille = FEUILLE_MERKLE(code_cle);
+    
+    f->sommes[feuille] += empreinte;
+    marquer(f->modifiees, feuille);
+}
+
+/**
+ * @brief Retire l'empreinte d'un couple de la feuille de sa cle.
+ *
+ * @param f les feuilles de la partition.
+ * @param code_cle le code de hachage de la cle.
+ * @param empreinte l'empreinte du couple hash/adresse.
+*/
+void retirer_merkle(feuilles_merkle *f, uint64_t code_cle, uint64_t empreinte)
+{
+    uint32_t feuille = FEUILLE_MERKLE(code_cle);
+    
+    f->sommes[feuille] -= empreinte;
+    marquer(f->modifiees, feuille);
+}
+
+/**
+ * @brief Reporte dans l'arbre les feuilles modifiees d'une partition.
+ *
+ * Une feuille de l'arbre est la somme des feuilles des partitions : seule la
+ * variation depuis la publication precedente y est ajoutee. La partition
+ * doit etre verrouillee en ecriture.
+ *
+ * @param a un pointeur sur l'arbre.
+ * @param f les feuilles de la partition.
+*/
+void publier_merkle(arbre_merkle *a, feuilles_merkle *f)
+{
+    uint32_t mot, feuille;
+    uint64_t bits;
+    
+    for(mot=0; mot<MERKLE_MOTS(MERKLE_FEUILLES); mot++)
+    {
+        for(bits=f->modifiees[mot]; bits!=0; bits&=bits-1)
+        {
+            feuille = mot*64+__builtin_ctzll(bits);
+            a->noeuds[NOEUD_FEUILLE(feuille)] += f->sommes[feuille]-
+                                                 f->publiees[feuille];
+            f->publiees[feuille] = f->sommes[feuille];
+            marquer(a->a_calculer, NOEUD_FEUILLE(feuille));
+        }
+        f->modifiees[mot] = 0;
+    }
+}
+
+/**
+ * @brief Recalcule les noeuds internes au-dessus des feuilles modifiees.
+ *
+ * Les noeuds sont parcourus des derniers (les plus profonds) au premier (la
+ * racine) : un noeud est recalcule si l'un de ses fils l'a ete.
+ *
+ * @param a un pointeur sur l'arbre.
+*/
+void calculer_merkle(arbre_merkle *a)
+{
+    uint32_t i, g;
+    
+    for(i=MERKLE_FEUILLES-1; i-- > 0;)
+    {
+        g = 2*i+1;
+        if(!((a->a_calculer[g/64]>>(g%64))&1) &&
+           !((a->a_calculer[(g+1)/64]>>((g+1)%64))&1))
+            continue;
+    
+        a->noeuds[i] = melanger_merkle(a->noeuds[g]^
+                                       melanger_merkle(a->noeuds[g+1]+i));
+        marquer(a->a_calculer, i);
+        a->recalcules++;
+    }
+    
+    memset(a->a_calculer, 0, sizeof(a->a_calculer));
+}
+
+/**
+ * @brief Indique si un noeud est une feuille.
+ *
+ * @param noeud l'indice du noeud.
+ * @return TRUE (1) si le noeud est une feuille, 0 sinon.
+*/
+int est_feuille_merkle(uint32_t noeud)
+{
+    return noeud >= MERKLE_FEUILLES-1 && noeud < MERKLE_NOEUDS;
+}
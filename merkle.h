@@ -0,0 +1,74 @@
+#ifndef __MERKLE_H__
+#define __MERKLE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Profondeur de l'arbre : l'espace des codes de hachage des cles est
+   decoupe en 2^MERKLE_PROFONDEUR feuilles selon leurs bits de poids fort */
+#define MERKLE_PROFONDEUR 12
+#define MERKLE_FEUILLES (1U<<MERKLE_PROFONDEUR)
+
+/* Nombre de noeuds de l'arbre (tas : les fils du noeud i sont 2i+1 et 2i+2,
+   les feuilles sont les MERKLE_FEUILLES derniers noeuds) */
+#define MERKLE_NOEUDS (2*MERKLE_FEUILLES-1)
+
+/* Feuille couvrant le code de hachage d'une cle */
+#define FEUILLE_MERKLE(code) ((uint32_t)((code)>>(64-MERKLE_PROFONDEUR)))
+
+/* Noeud de l'arbre correspondant a une feuille */
+#define NOEUD_FEUILLE(f) ((f)+MERKLE_FEUILLES-1)
+
+/* Nombre de mots d'un ensemble de feuilles ou de noeuds (un bit chacun) */
+#define MERKLE_MOTS(n) (((n)+63)/64)
+
+/*
+ Feuilles d'une partition : chaque feuille est la somme (modulo 2^64) des
+ empreintes des couples hash/adresse dont la cle y tombe. Ajouter ou retirer
+ un couple ne touche que sa feuille. Les feuilles modifiees depuis leur
+ derniere publication dans l'arbre sont marquees.
+*/
+typedef struct feuilles_merkle{
+    uint64_t sommes[MERKLE_FEUILLES];   // Somme des empreintes de chaque
+                                        // feuille
+    uint64_t publiees[MERKLE_FEUILLES]; // Sommes deja reportees dans l'arbre
+    uint64_t modifiees[MERKLE_MOTS(MERKLE_FEUILLES)]; // Feuilles a publier
+} feuilles_merkle;
+
+/*
+ Arbre de Merkle de l'ensemble des partitions : une feuille est la somme des
+ feuilles correspondantes des partitions, un noeud interne est le melange des
+ condenses de ses deux fils. Seuls les noeuds au-dessus de feuilles modifiees
+ sont recalcules.
+*/
+typedef struct arbre_merkle{
+    uint64_t noeuds[MERKLE_NOEUDS];     // Condense de chaque noeud
+    uint64_t a_calculer[MERKLE_MOTS(MERKLE_NOEUDS)]; // Noeuds modifies
+                                                     // depuis le calcul
+    unsigned long recalcules;   // Noeuds internes recalcules
+} arbre_merkle;
+
+/* Initialise l'arbre de partitions vides */
+void init_merkle(arbre_merkle *a);
+
+/* Melange un entier de 64 bits (empreintes et condenses) */
+uint64_t melanger_merkle(uint64_t x);
+
+/* Ajoute l'empreinte d'un couple a la feuille de sa cle */
+void ajouter_merkle(feuilles_merkle *f, uint64_t code_cle, uint64_t empreinte);
+
+/* Retire l'empreinte d'un couple de la feuille de sa cle */
+void retirer_merkle(feuilles_merkle *f, uint64_t code_cle, uint64_t empreinte);
+
+/* Reporte dans l'arbre les feuilles modifiees d'une partition */
+void publier_merkle(arbre_merkle *a, feuilles_merkle *f);
+
+/* Recalcule les noeuds internes au-dessus des feuilles modifiees */
+void calculer_merkle(arbre_merkle *a);
+
+/* Indique si un noeud est une feuille */
+int est_feuille_merkle(uint32_t noeud);
+
+#endif
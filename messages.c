@@ -1,5 +1,7 @@
 #include "messages.h"
 
+reserve_tampons reserve_messages = {NULL, 0, 0, 0};
+
 /**
  * @brief Creer un nouveau message.
  *
@@ -41,6 +43,7 @@ int create_message(message **m, donnees type, unsigned int lg)
     m2->type = type;
     m2->lg_allouee = lg;
     m2->lg_message = SIZEOF_ENTETE;
+    m2->tampon = NULL;
 
     *m = m2;
 
@@ -69,11 +72,17 @@ int create_message_with_header(message **m, donnees *header)
 /**
  * @brief Libere l'espace alloue par un message.
  *
+ * Un message reçu dans un tampon de reserve rend ce tampon a sa reserve.
+ *
  * @param m un pointeur sur un message dont l'uitilisation est terminee.
 */
 void delete_message(message *m)
 {
-    if(m!=NULL)
+    if(m!=NULL && m->tampon!=NULL)
+    {
+        rendre_tampon(m->tampon);
+    }
+    else if(m!=NULL)
     {
         if(m->contenu!=NULL)
             free(m->contenu);
@@ -106,7 +115,7 @@ int add_data(message *m, donnees type, taille lg, void* data)
         {
             fprintf(stderr,"La taille du message est "\
                            "trop grande ( > %d)\n",MAX_MESS_SIZE);
-            return 52;
+            return CODE_MESSAGE_PLEIN;
         }
         
         tmp_realloc=realloc(m->contenu, m->lg_allouee);
@@ -143,11 +152,109 @@ void prepare_message(message *m)
     memcpy(m->contenu+1, &(m->lg_message), 2);
 }
 
+/**
+ * @brief Emprunte un tampon de reception a une reserve.
+ *
+ * Un tampon disponible est reutilise, un nouveau tampon n'est alloue que si
+ * la reserve est vide.
+ *
+ * @param reserve la reserve.
+ * @return le tampon, NULL si la memoire manque.
+*/
+tampon_message *emprunter_tampon(reserve_tampons *reserve)
+{
+    tampon_message *t = reserve->libres;
+    
+    if(t!=NULL)
+    {
+        reserve->libres = t->suivant;
+        reserve->nb_libres--;
+    }
+    else
+    {
+        t = malloc(sizeof(tampon_message));
+        if(t==NULL)
+        {
+            perror("Error malloc");
+            return NULL;
+        }
+        t->reserve = reserve;
+        reserve->nb_tampons++;
+    }
+    
+    reserve->emprunts++;
+    
+    return t;
+}
+
+/**
+ * @brief Rend un tampon de reception a sa reserve.
+ *
+ * @param t le tampon, qui ne doit plus etre utilise.
+*/
+void rendre_tampon(tampon_message *t)
+{
+    t->suivant = t->reserve->libres;
+    t->reserve->libres = t;
+    t->reserve->nb_libres++;
+}
+
+/**
+ * @brief Initialise le message decrivant le datagramme reçu dans un tampon.
+ *
+ * Le message pointe sur les octets du tampon, sans copie. Comme un message
+ * alloue, sa taille est limitee a celle annoncee par son entete.
+ *
+ * @param t le tampon.
+ * @param lg le nombre d'octets reçus.
+ * @return 0 en cas de reussite, -1 si le datagramme est trop court pour
+ *         etre un message.
+*/
+int vue_message(tampon_message *t, unsigned int lg)
+{
+    taille annoncee;
+    
+    if(lg < SIZEOF_ENTETE)
+        return -1;
+    
+    memcpy(&annoncee, t->octets+SIZEOF_TYPE, sizeof(taille));
+    if(annoncee >= SIZEOF_ENTETE && annoncee < lg)
+        lg = annoncee;
+    
+    t->m.contenu = t->octets;
+    t->m.lg_allouee = MAX_MESS_SIZE;
+    t->m.lg_message = lg;
+    t->m.type = t->octets[0];
+    t->m.tampon = t;
+    
+    return 0;
+}
+
+/**
+ * @brief Libere les tampons disponibles d'une reserve.
+ *
+ * @param reserve la reserve.
+*/
+void vider_reserve(reserve_tampons *reserve)
+{
+    tampon_message *t;
+    
+    while((t=reserve->libres)!=NULL)
+    {
+        reserve->libres = t->suivant;
+        free(t);
+        reserve->nb_libres--;
+        reserve->nb_tampons--;
+    }
+}
+
 /**
  * @brief Receptionne un message.
  *
- * Lit l'entete d'un message en attente d'etre lu, cree une structure pouvant
- * acceuillir le message, puis lit la totalitee du message.
+ * Le datagramme est lu en un seul appel systeme dans un tampon emprunte a
+ * la reserve des tampons de reception ; le message renvoye est une vue sur
+ * ce tampon, rendu a la reserve par delete_message. Les datagrammes trop
+ * courts pour etre des messages sont ignores.
  *
  * @param retour un pointeur vers un pointeur sur un message
  *        (valeur de retour par effet de bord).
@@ -161,43 +268,33 @@ void prepare_message(message *m)
 int recevoir_message(message **retour, int sfd, 
                       struct sockaddr *client, socklen_t *addrlen)
 {
-    int taille_lue, err;
-    donnees entete[SIZEOF_ENTETE];
-    message *m;
+    ssize_t taille_lue;
+    tampon_message *t;
     
-    /* Lit l'entete du message tout en le gardant dans la file des messages
-       a lire */
-    if(recvfrom(sfd, entete, SIZEOF_ENTETE, MSG_PEEK, client, addrlen) == -1)
-    {
-        /* Interruption system (suppose SIGINT ou SIGALRM) */
-        if(errno==EINTR)
-            return CODE_INTERRUP_SYSTEM;
-        /* Interruption programmee */
-        if(errno==EAGAIN || errno==EWOULDBLOCK)
-            return CODE_CANCEL_WAIT;
-        perror("Error recvfrom");
-        return 54; 
-    }
-    
-    /* Cree un nouveau message a partir de l'entete lue */
-    err=create_message_with_header(&m, entete);
-    if(err!=0)
-    {
-        return err;
-    }
+    t = emprunter_tampon(&reserve_messages);
+    if(t==NULL)
+        return 50;
     
-    /* Lit l'ensemble du message */
-    if((taille_lue=recvfrom(sfd, m->contenu, m->lg_allouee,
-                                 0, client, addrlen)) == -1)
+    do
     {
-        perror("recvfrom");
-        delete_message(m);
-        return 55;
+        taille_lue = recvfrom(sfd, t->octets, MAX_MESS_SIZE, 0, client,
+                              addrlen);
+        if(taille_lue == -1)
+        {
+            rendre_tampon(t);
+            /* Interruption system (suppose SIGINT ou SIGALRM) */
+            if(errno==EINTR)
+                return CODE_INTERRUP_SYSTEM;
+            /* Interruption programmee */
+            if(errno==EAGAIN || errno==EWOULDBLOCK)
+                return CODE_CANCEL_WAIT;
+            perror("Error recvfrom");
+            return 54;
+        }
     }
+    while(vue_message(t, taille_lue)==-1);
     
-    m->lg_message=taille_lue;
-    
-    *retour = m;
+    *retour = &t->m;
 
     return 0;
 }
@@ -221,8 +318,8 @@ int recevoir_message(message **retour, int sfd,
 int message_get_h(message *m, donnees** emplacement, taille *taille_lue)
 {
     taille taille_element;
-    static donnees *current = NULL;
-    static donnees *fin_message = NULL;
+    static __thread donnees *current = NULL;
+    static __thread donnees *fin_message = NULL;
     
     if(m!=NULL)
     {
@@ -236,10 +333,14 @@ int message_get_h(message *m, donnees** emplacement, taille *taille_lue)
     }
     
     /* Tant qu'il reste au moins l'entete d'un bloc a lire */
-    while(current+SIZEOF_ENTETE_BLOC < fin_message)
+    while(current+SIZEOF_ENTETE_BLOC <= fin_message)
     {
         taille_element=*(taille *)(current+SIZEOF_TYPE_BLOC);
         
+        /* Bloc tronque : le message est mal forme */
+        if(current+SIZEOF_ENTETE_BLOC+taille_element > fin_message)
+            break;
+        
         if(current[0]=='h')
         {
             *emplacement = current+SIZEOF_ENTETE_BLOC;
@@ -273,8 +374,8 @@ int message_get_h(message *m, donnees** emplacement, taille *taille_lue)
 int message_get_a(message *m, donnees** emplacement, taille *taille_lue)
 {
     taille taille_element;
-    static donnees *current = NULL;
-    static donnees *fin_message = NULL;
+    static __thread donnees *current = NULL;
+    static __thread donnees *fin_message = NULL;
     
     if(m!=NULL)
     {
@@ -288,9 +389,13 @@ int message_get_a(message *m, donnees** emplacement, taille *taille_lue)
     }
     
     /* Tant qu'il reste au moins l'entete d'un bloc a lire */
-    while(current+SIZEOF_ENTETE_BLOC < fin_message)
+    while(current+SIZEOF_ENTETE_BLOC <= fin_message)
     {
         taille_element=*(taille *)(current+SIZEOF_TYPE_BLOC);
+        
+        /* Bloc tronque : le message est mal forme */
+        if(current+SIZEOF_ENTETE_BLOC+taille_element > fin_message)
+            break;
 
         if(current[0]=='a')
         {
@@ -325,8 +430,8 @@ int message_get_a(message *m, donnees** emplacement, taille *taille_lue)
 int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue)
 {
     taille taille_element;
-    static donnees *current = NULL;
-    static donnees *fin_message = NULL;
+    static __thread donnees *current = NULL;
+    static __thread donnees *fin_message = NULL;
     
     if(m!=NULL)
     {
@@ -340,9 +445,13 @@ int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue)
     }
     
     /* Tant qu'il reste au moins l'entete d'un bloc a lire */
-    while(current+SIZEOF_ENTETE_BLOC < fin_message)
+    while(current+SIZEOF_ENTETE_BLOC <= fin_message)
     {
         taille_element=*(taille *)(current+SIZEOF_TYPE_BLOC);
+        
+        /* Bloc tronque : le message est mal forme */
+        if(current+SIZEOF_ENTETE_BLOC+taille_element > fin_message)
+            break;
 
         if(current[0]=='s')
         {
@@ -358,6 +467,233 @@ int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue)
     return -1;
 }
 
+/**
+ * @brief Lit un message et renvoie le bloc suivant dont le type est parmi
+ *        ceux demandes.
+ *
+ * Si l'adresse d'un message est specifiee, alors les variables static sont
+ * initialisees et la recherche commence au debut de ce message. Si aucun
+ * message n'est specifie alors la recherche continue la ou la lecture
+ * precedente s'etait terminee.
+ *
+ * @param m un pointeur sur le message a lire ou 
+          NULL pour continuer la lecture d'un message.
+ * @param types la liste des types de bloc acceptes (ex : "hb").
+ * @param type le type du bloc trouve (valeur de retour par effet de bord).
+ * @param emplacement un pointeur sur les donnees du bloc
+ *        (valeur de retour par effet de bord).
+ * @param taille_lue taille de la donnee trouvee 
+ *        (valeur de retour par effet de bord).
+ * @return 0 si une donnee a ete trouvee, -1 sinon.
+*/
+int message_get_bloc(message *m, const char *types, donnees *type,
+                        donnees** emplacement, taille *taille_lue)
+{
+    taille taille_element;
+    static __thread donnees *current = NULL;
+    static __thread donnees *fin_message = NULL;
+    
+    if(m!=NULL)
+    {
+        current = m->contenu+SIZEOF_ENTETE;
+        fin_message = m->contenu+m->lg_message;
+    }
+    
+    if(current==NULL || fin_message==NULL)
+    {
+        return -1;
+    }
+    
+    /* Tant qu'il reste au moins l'entete d'un bloc a lire */
+    while(current+SIZEOF_ENTETE_BLOC <= fin_message)
+    {
+        taille_element=*(taille *)(current+SIZEOF_TYPE_BLOC);
+        
+        /* Bloc tronque : le message est mal forme */
+        if(current+SIZEOF_ENTETE_BLOC+taille_element > fin_message)
+            break;
+
+        if(current[0]!='\0' && strchr(types, current[0])!=NULL)
+        {
+            *type = current[0];
+            *emplacement = current+SIZEOF_ENTETE_BLOC;
+            *taille_lue = taille_element;
+            current+=taille_element+SIZEOF_ENTETE_BLOC;
+            return 0;
+        }
+        
+        current+=taille_element+SIZEOF_ENTETE_BLOC;
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Convertit un hash hexadecimal (SHA-1 ou SHA-256) en cle binaire.
+ *
+ * La chaine doit contenir exactement 40 ou 64 chiffres hexadecimaux,
+ * eventuellement suivis du caractere de fin de chaine.
+ *
+ * @param hex la chaine hexadecimale.
+ * @param lg la longueur de la chaine hex.
+ * @param cle un tableau d'au moins TAILLE_CLE_SHA256 octets recevant la cle
+ *        (valeur de retour par effet de bord).
+ * @param taille_cle la taille de la cle (valeur de retour par effet de bord).
+ * @return 0 si la conversion a reussi, -1 si la chaine n'est pas un hash
+ *         hexadecimal de la bonne taille.
+*/
+int hex_vers_binaire(const char *hex, taille lg, donnees *cle,
+                        taille *taille_cle)
+{
+    taille i;
+    int chiffre, octet = 0;
+    
+    if(lg>0 && hex[lg-1]=='\0')
+        lg--;
+    
+    if(lg!=2*TAILLE_CLE_SHA1 && lg!=2*TAILLE_CLE_SHA256)
+        return -1;
+    
+    for(i=0; i<lg; i++)
+    {
+        if(hex[i]>='0' && hex[i]<='9')
+            chiffre = hex[i]-'0';
+        else if(hex[i]>='a' && hex[i]<='f')
+            chiffre = hex[i]-'a'+10;
+        else if(hex[i]>='A' && hex[i]<='F')
+            chiffre = hex[i]-'A'+10;
+        else
+            return -1;
+        
+        octet = (octet<<4) | chiffre;
+        if(i%2==1)
+        {
+            cle[i/2] = (donnees)octet;
+            octet = 0;
+        }
+    }
+    
+    *taille_cle = lg/2;
+    
+    return 0;
+}
+
+/**
+ * @brief Convertit une adresse textuelle en extremite binaire (bloc 'e').
+ *
+ * Les formes acceptees sont "ipv4", "ipv4:port", "ipv6" et "[ipv6]:port",
+ * eventuellement suivies du caractere de fin de chaine. L'extremite produite
+ * contient l'adresse (4 ou 16 octets) suivie du port sur 2 octets en ordre
+ * reseau, la famille se deduisant de la taille (6 ou 18 octets). Un port nul
+ * signifie que l'adresse n'en precisait pas.
+ *
+ * @param texte la chaine representant l'adresse.
+ * @param lg la longueur de la chaine texte.
+ * @param ext un tableau d'au moins TAILLE_EXTREMITE_IPV6 octets recevant
+ *        l'extremite (valeur de retour par effet de bord).
+ * @param taille_ext la taille de l'extremite
+ *        (valeur de retour par effet de bord).
+ * @return 0 si la conversion a reussi, -1 si la chaine n'est pas une adresse
+ *         IP reconnue.
+*/
+int texte_vers_extremite(const char *texte, taille lg, donnees *ext,
+                            taille *taille_ext)
+{
+    char tampon[INET6_ADDRSTRLEN+8], *ip = tampon, *port = NULL, *fin;
+    unsigned long num_port = 0;
+    
+    if(lg>0 && texte[lg-1]=='\0')
+        lg--;
+    
+    if(lg==0 || lg>=sizeof(tampon) || memchr(texte, '\0', lg)!=NULL)
+        return -1;
+    
+    memcpy(tampon, texte, lg);
+    tampon[lg] = '\0';
+    
+    /* Separation de l'adresse et du port */
+    if(tampon[0]=='[')
+    {
+        ip = tampon+1;
+        fin = strchr(ip, ']');
+        if(fin==NULL || (fin[1]!='\0' && fin[1]!=':'))
+            return -1;
+        if(fin[1]==':')
+            port = fin+2;
+        *fin = '\0';
+    }
+    else if((fin=strchr(tampon, ':'))!=NULL && strchr(fin+1, ':')==NULL)
+    {
+        *fin = '\0';
+        port = fin+1;
+    }
+    
+    if(port!=NULL)
+    {
+        if(*port<'0' || *port>'9')
+            return -1;
+        num_port = strtoul(port, &fin, 10);
+        if(*fin!='\0' || num_port>65535)
+            return -1;
+    }
+    
+    if(inet_pton(AF_INET, ip, ext)==1)
+        *taille_ext = TAILLE_EXTREMITE_IPV4;
+    else if(inet_pton(AF_INET6, ip, ext)==1)
+        *taille_ext = TAILLE_EXTREMITE_IPV6;
+    else
+        return -1;
+    
+    ext[*taille_ext-2] = (donnees)(num_port>>8);
+    ext[*taille_ext-1] = (donnees)num_port;
+    
+    return 0;
+}
+
+/**
+ * @brief Convertit une extremite binaire (bloc 'e') en adresse textuelle.
+ *
+ * L'adresse est ecrite sous la forme "ip" si le port est nul, "ipv4:port" ou
+ * "[ipv6]:port" sinon, de sorte qu'une adresse recue sous forme textuelle
+ * puis compactee est restituee a l'identique.
+ *
+ * @param ext l'extremite binaire.
+ * @param lg la taille de l'extremite (6 ou 18 octets).
+ * @param texte le tampon recevant la chaine (valeur de retour par effet de
+ *        bord), TAILLE_TEXTE_EXTREMITE octets suffisent toujours.
+ * @param max la taille du tampon texte.
+ * @return la longueur de la chaine ecrite (caractere de fin compris),
+ *         -1 si l'extremite est mal formee.
+*/
+int extremite_vers_texte(const donnees *ext, taille lg, char *texte,
+                            size_t max)
+{
+    char ip[INET6_ADDRSTRLEN];
+    unsigned int port;
+    int ecrits;
+    
+    if(lg==TAILLE_EXTREMITE_IPV4)
+        inet_ntop(AF_INET, ext, ip, sizeof(ip));
+    else if(lg==TAILLE_EXTREMITE_IPV6)
+        inet_ntop(AF_INET6, ext, ip, sizeof(ip));
+    else
+        return -1;
+    
+    port = ((unsigned int)ext[lg-2]<<8) | ext[lg-1];
+    
+    if(port==0)
+        ecrits = snprintf(texte, max, "%s", ip);
+    else if(lg==TAILLE_EXTREMITE_IPV4)
+        ecrits = snprintf(texte, max, "%s:%u", ip, port);
+    else
+        ecrits = snprintf(texte, max, "[%s]:%u", ip, port);
+    
+    if(ecrits<0 || (size_t)ecrits>=max)
+        return -1;
+    
+    return ecrits+1;
+}
+
 /**
  * @brief Recherche parmis toute les adresses possibles une adresse valide.
  *
@@ -366,7 +702,10 @@ int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue)
  * qui demande, ou juste connaitre l'adresse du serveur si c'est le client qui
  * demande.
  *
- * @param role un entier representant le SERVEUR ou le CLIENT.
+ * @param role un entier representant le SERVEUR ou le CLIENT, ou
+ *        SERVEUR_REUSEPORT pour un serveur dont plusieurs sockets partagent
+ *        l'adresse (SO_REUSEPORT), ou FLUX_SERVEUR / FLUX_CLIENT pour une
+ *        socket de flux (TCP) en ecoute / connectee.
  * @param adresse la chaine de caractere designant l'adresse de destination dans
  *        le cas d'un client, ou l'adresse d'ecoute dans le cas d'un serveur.
  * @param port le numero du port a utiliser.
@@ -380,7 +719,7 @@ int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue)
 int get_addr(int role, char *adresse, char *port, int *sockfd, 
                     struct addrinfo **debut, struct addrinfo **valide)
 {
-    int err;
+    int err, un = 1;
     struct addrinfo hints;
     struct addrinfo *result, *rp;
 
@@ -390,6 +729,11 @@ int get_addr(int role, char *adresse, char *port, int *sockfd,
 	hints.ai_family = AF_UNSPEC;        /* AF_UNSPEC pour ipv4 et ipv6 */
 	hints.ai_socktype = SOCK_DGRAM;     /* Datagrames */
 	hints.ai_protocol = IPPROTO_UDP;    /* Protocole UDP */
+	if(role==FLUX_SERVEUR || role==FLUX_CLIENT)
+	{
+	    hints.ai_socktype = SOCK_STREAM;    /* Flux */
+	    hints.ai_protocol = IPPROTO_TCP;    /* Protocole TCP */
+	}
 	hints.ai_addr = NULL;
 	hints.ai_canonname = NULL;
 	hints.ai_next = NULL;
@@ -410,8 +754,39 @@ int get_addr(int role, char *adresse, char *port, int *sockfd,
 	    if(role==CLIENT)
 	        break;
 	    
+	    if(role==FLUX_CLIENT)
+	    {
+	        if(connect(*sockfd, rp->ai_addr, rp->ai_addrlen)!=-1)
+	            break;
+	        close(*sockfd);
+	        continue;
+	    }
+	    
+	    /* L'ecoute du flux peut reprendre aussitot apres un redemarrage */
+	    if(role==FLUX_SERVEUR &&
+	       setsockopt(*sockfd, SOL_SOCKET, SO_REUSEADDR, &un,
+	                  sizeof(un))==-1)
+	    {
+	        perror("Error setsockopt");
+	        close(*sockfd);
+	        freeaddrinfo(result);
+	        return 61;
+	    }
+	    
+	    /* Plusieurs sockets du serveur partagent l'adresse, le noyau
+	       repartit les datagrammes entre elles */
+	    if(role==SERVEUR_REUSEPORT &&
+	       setsockopt(*sockfd, SOL_SOCKET, SO_REUSEPORT, &un,
+	                  sizeof(un))==-1)
+	    {
+	        perror("Error setsockopt");
+	        close(*sockfd);
+	        freeaddrinfo(result);
+	        return 61;
+	    }
+	    
 	    /* Si c'est une demande du serveur et que bind fonctionne */
-	    if(role==SERVEUR && 
+	    if(role!=CLIENT && 
 	       bind(*sockfd, (struct sockaddr *) rp->ai_addr, rp->ai_addrlen)!=-1)
 		{
 			break;
@@ -421,6 +796,12 @@ int get_addr(int role, char *adresse, char *port, int *sockfd,
 	}
     
     /* Si aucune adresse n'est valide. */
+	if (rp == NULL && role==FLUX_CLIENT)
+	{
+		fprintf(stderr, "Connexion au flux impossible\n");
+		freeaddrinfo(result);
+		return 62;
+	}
 	if (rp == NULL)
 	{
 		fprintf(stderr, "No DNS results\n");
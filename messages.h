@@ -20,10 +20,17 @@
 
 #define SERVEUR 1
 #define CLIENT 2
+#define SERVEUR_REUSEPORT 3
+#define FLUX_SERVEUR 4
+#define FLUX_CLIENT 5
+
+/* Nombre maximal de threads de reception du serveur */
+#define SERVEUR_THREADS_MAX 64
 
 /* Codes de retour particuliers */
 #define CODE_CANCEL_WAIT 98
 #define CODE_INTERRUP_SYSTEM 99
+#define CODE_MESSAGE_PLEIN 52
 
 /* Temps d'attente avant que le client arrete d'attendre une reponse */
 #define CLIENT_TIMEOUT_SEC 2
@@ -33,9 +40,6 @@
 #define SERVEUR_CHK_A_SEC 5
 #define SERVEUR_CHK_A_MICROSEC 0
 
-/* Duree avant qu'une donnee soit obsolete */
-#define TEMPS_OBSOLESCENCE 30
-
 /* Donnees relatives a l'entete d'un message */
 #define SIZEOF_TYPE 1
 #define SIZEOF_TAILLE 2
@@ -49,13 +53,26 @@
 /* 2^sizeof(taille)-1 */
 #define MAX_MESS_SIZE 65535
 
+/* Charge utile maximale d'un datagramme UDP sur IPv4 */
+#define MAX_DATAGRAMME 65507
+
+/* Tailles des cles binaires (bloc 'b') : SHA-1 et SHA-256 */
+#define TAILLE_CLE_SHA1 20
+#define TAILLE_CLE_SHA256 32
+
+/* Tailles des extremites binaires (bloc 'e') : adresse IP puis port */
+#define TAILLE_EXTREMITE_IPV4 6
+#define TAILLE_EXTREMITE_IPV6 18
+/* Longueur maximale de la forme textuelle d'une extremite : "[ipv6]:port" */
+#define TAILLE_TEXTE_EXTREMITE (INET6_ADDRSTRLEN+8)
+
 typedef unsigned short taille;
 typedef unsigned char donnees;
 
 typedef struct sockaddr_in6 sockaddr_in;
 typedef struct sockaddr sockaddr;
 
-typedef struct{
+typedef struct message{
             unsigned int lg_allouee;    // Nombre d'octets alloues a contenu
             unsigned int lg_message;    // Nombre d'octets utilises
             donnees *contenu;           // Suite d'octets a envoyer
@@ -69,11 +86,37 @@ typedef struct{
                                         // - a pour alive
                                         // - d pour deconnexion
                                         // - t pour transfert
+            struct tampon_message *tampon; // Tampon de reserve contenant le
+                                        // message (NULL si le message a ete
+                                        // alloue par create_message)
 } message;
+
+/*
+ Tampon de reception reutilisable : un message reçu est une vue sur les
+ octets de son tampon, rendu a sa reserve par delete_message.
+*/
+typedef struct tampon_message{
+    message m;                  // Message decrivant le contenu du tampon
+    struct reserve_tampons *reserve; // Reserve a laquelle rendre le tampon
+    struct tampon_message *suivant;  // Tampon libre suivant de la reserve
+    donnees octets[MAX_MESS_SIZE];   // Datagramme reçu
+} tampon_message;
+
+typedef struct reserve_tampons{
+    tampon_message *libres;     // Tampons disponibles
+    unsigned long nb_libres;    // Nombre de tampons disponibles
+    unsigned long nb_tampons;   // Nombre de tampons alloues
+    unsigned long emprunts;     // Nombre total d'emprunts
+} reserve_tampons;
+
+/* Reserve des tampons de reception de recevoir_message */
+extern reserve_tampons reserve_messages;
 /* 
  Type des bloc de donnees dans le message : 
  - a pour adresse
  - h pour hash
+ - b pour hash binaire (20 ou 32 octets bruts)
+ - e pour extremite binaire (IPv4 ou IPv6 puis port, 6 ou 18 octets)
  - s pour serveur
 */
 
@@ -92,6 +135,18 @@ int add_data(message *m, donnees type, taille lg, void* data);
 /* Ecrit la taille totale du message dans l'entete du message */
 void prepare_message(message *m);
 
+/* Emprunte un tampon de reception a une reserve */
+tampon_message *emprunter_tampon(reserve_tampons *reserve);
+
+/* Rend un tampon de reception a sa reserve */
+void rendre_tampon(tampon_message *t);
+
+/* Initialise le message decrivant le datagramme reçu dans un tampon */
+int vue_message(tampon_message *t, unsigned int lg);
+
+/* Libere les tampons disponibles d'une reserve */
+void vider_reserve(reserve_tampons *reserve);
+
 /* Receptionne un message */
 int recevoir_message(message **m, int sfd, struct sockaddr *client, socklen_t *addrlen);
 
@@ -104,6 +159,22 @@ int message_get_a(message *m, donnees** emplacement, taille *taille_lue);
 /* Lit un message et renvoie le serveur suivant trouve */
 int message_get_s(message *m, struct sockaddr **serveur, taille *taille_lue);
 
+/* Lit un message et renvoie le bloc suivant dont le type est parmi types */
+int message_get_bloc(message *m, const char *types, donnees *type,
+                        donnees** emplacement, taille *taille_lue);
+
+/* Convertit un hash hexadecimal (SHA-1 ou SHA-256) en cle binaire */
+int hex_vers_binaire(const char *hex, taille lg, donnees *cle,
+                        taille *taille_cle);
+
+/* Convertit une adresse textuelle en extremite binaire */
+int texte_vers_extremite(const char *texte, taille lg, donnees *ext,
+                            taille *taille_ext);
+
+/* Convertit une extremite binaire en adresse textuelle */
+int extremite_vers_texte(const donnees *ext, taille lg, char *texte,
+                            size_t max);
+
 /* Recherche parmis toute les adresses possibles une adresse valide */
 int get_addr(int role, char *adresse, char* port, int *sockfd, 
                     struct addrinfo **debut, struct addrinfo **valide);
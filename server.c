@@ -1,622 +1,4256 @@
 #include "messages.h"
 #include "stockage_serveur.h"
+#include "instantane.h"
+#include "journal.h"
+#include "lots.h"
+#include "transferts.h"
+#include "synchro.h"
+#include "historique.h"
+#include "anneau.h"
+#ifdef AVEC_URING
+#include "uring.h"
+#endif
+
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sched.h>
+#include <endian.h>
+#include <limits.h>
+
+/* Intervalle (en secondes) entre deux passages de la roue d'obsolescence */
+#define PERIODE_OBSOLESCENCE 1
+
+/* Sources des evenements attendus par un thread (champ data.u32 des
+   evenements epoll, combinees en masque par attendre_evenements) */
+#define SOURCE_SOCKET 1         // Datagrammes sur la socket du thread
+#define SOURCE_REVEIL 2         // Reveil par un autre thread (eventfd)
+#define SOURCE_OBSOLESCENCE 4   // Passage de la roue d'obsolescence
+#define SOURCE_KEEP_ALIVE 8     // Verification des keep-alive
+#define SOURCE_SIGNAUX 16       // Signal reçu (signalfd)
+#define SOURCE_FLUX 32          // Connexion d'un nouveau serveur (flux)
+#define SOURCE_REPLICATION 64   // Echeance de l'envoi des couples a repliquer
+#define SOURCE_DEMANDE 128      // Demande d'etat d'un nouveau serveur (flux)
+
+/* Taille par defaut d'un datagramme de transfert entre serveurs (option
+   -d) : tient dans une trame Ethernet sans fragmentation */
+#define TRANSFERT_DEFAUT 1400
+
+/* Delai par defaut (en millisecondes) avant l'envoi des couples a repliquer
+   (option -e) */
+#define REPLICATION_DELAI_DEFAUT 2
+
+/* Propagation par commerage (option -f) : nombre maximal de serveurs tires
+   au hasard par envoi, et nombre de tours par defaut et maximal (option -n)
+   au-dela duquel une mise a jour n'est plus propagee */
+#define GOSSIP_FANOUT_MAX 16
+#define GOSSIP_TOURS_DEFAUT 8
+#define GOSSIP_TOURS_MAX 32
+
+/* Taille d'un bloc 'i' : tour (1 octet) et date d'origine en millisecondes
+   (8 octets) des couples ou serveurs qui le suivent */
+#define TAILLE_BLOC_TOUR 9
+
+/* Nombre maximal de vues de l'anneau envoyees par seconde par un thread aux
+   clients mal adresses (mode anneau) */
+#define VUES_PAR_SECONDE 64
+
+/* Couples d'un thread a envoyer a un membre de l'anneau (mode anneau) */
+typedef struct envoi_membre{
+    message *m;                 // Message de transfert (NULL si aucun)
+    struct sockaddr_storage adresse; // Adresse du membre
+    socklen_t addrlen;          // Longueur de l'adresse
+} envoi_membre;
+
+/* Periode par defaut (en secondes) des comparaisons d'arbres de Merkle */
+#define MERKLE_PERIODE_DEFAUT 10
+
+/* Nombre maximal d'evenements lus par un appel a epoll_wait */
+#define EVENEMENTS_MAX 8
+
+/* Thread de reception : sa socket, ses lots et ses compteurs */
+typedef struct travailleur{
+    unsigned int indice;        // Indice du thread (et de sa partition en
+                                // mode partitionne)
+    int sockfd;                 // Socket du thread (SO_REUSEPORT si
+                                // plusieurs threads)
+    lot_reception lot;          // Datagrammes reçus
+    lot_envoi envois;           // Reponses et envois en attente
+    serveurs_connus *st;        // Serveurs connus partages
+    pthread_t thread;           // Thread (sauf pour le thread principal)
+    int epoll;                  // Evenements attendus par le thread
+    int reveil;                 // Signale des messages dans les files
+                                // entrantes ou l'arret du serveur (eventfd)
+    int minuteur;               // Passages de la roue d'obsolescence
+                                // (timerfd, -1 si le thread n'en gere pas)
+    file_transferts *entrantes; // File de chaque thread vers celui-ci
+                                // (mode partitionne)
+    donnees *a_reveiller;       // Threads auxquels des messages ont ete
+                                // transmis pendant le lot
+    unsigned long puts;         // Nombre de put traites
+    unsigned long gets;         // Nombre de get traites
+    unsigned long transmis;     // Messages transmis a une autre partition
+    unsigned long recus;        // Messages reçus d'une autre partition
+    message *replication;       // Couples hash/adresse des put a envoyer
+                                // aux autres serveurs (NULL si aucun)
+    int echeance;               // Echeance de l'envoi de ces couples
+                                // (timerfd, -1 s'ils partent a la fin de
+                                // chaque lot)
+    int echeance_atteinte;      // L'echeance est passee depuis le dernier lot
+    uint64_t *vus;              // Empreintes des couples du message de
+                                // replication (ensemble a adressage ouvert,
+                                // 0 pour une case vide)
+    unsigned int capacite_vus;  // Nombre de cases (puissance de 2)
+    unsigned int nb_vus;        // Nombre d'empreintes
+    unsigned long couples_repliques;    // Couples envoyes aux autres serveurs
+    unsigned long messages_replication; // Messages les ayant regroupes
+    unsigned long envois_echeance;      // Messages partis a l'echeance
+    unsigned long doublons_ecartes;     // Couples deja presents dans le
+                                        // message de replication
+    unsigned long datagrammes_replication; // Envois de ces messages (un par
+                                           // destinataire)
+    unsigned int tour_replication;      // Tour et date d'origine des derniers
+    uint64_t origine_replication;       // couples du message (commerage)
+    unsigned int graine;        // Etat du tirage des destinataires
+    unsigned long nouveaux_tour[GOSSIP_TOURS_MAX]; // Couples reçus par
+                                        // commerage qui etaient nouveaux, par
+                                        // tour
+    unsigned long redondants;   // Couples reçus par commerage deja connus
+    uint64_t delai_total;       // Somme et maximum des delais (ms) entre la
+    uint64_t delai_max;         // date d'origine et la reception des couples
+                                // nouveaux
+    envoi_membre *vers_membres; // Couples a envoyer a chaque membre de
+                                // l'anneau (mode anneau)
+    unsigned int capacite_membres;      // Nombre d'envois alloues
+    unsigned long generation_membres;   // Anneau auquel ils correspondent
+    unsigned int membres_en_attente;    // Envois non vides
+    unsigned long puts_transmis;        // Put et get d'un hash dont le
+    unsigned long gets_transmis;        // serveur n'est pas proprietaire
+    unsigned long vues_envoyees;        // Vues de l'anneau envoyees aux
+                                        // clients mal adresses
+    unsigned long vues_limitees;        // Vues non envoyees (limite)
+    long int seconde_vues;              // Seconde des vues_seconde vues
+    unsigned int vues_seconde;          // envoyees
+#ifdef AVEC_URING
+    uring es;                   // Backend io_uring de la socket (option -u)
+#endif
+} travailleur;
 
 // Permet d'arreter le serveur proprement.
 int serveur_actif = TRUE;
 
-// Permet de verifier si les reponses des keep-alive ont ete reçues.
-int check_K_A = FALSE;
+// Mode cle binaire : les hash hexadecimaux SHA-1/SHA-256 sont stockes sous
+// forme binaire (option -b).
+int mode_binaire = FALSE;
+
+// Plafond memoire de la table de hash en octets, 0 si illimite (option -m).
+size_t memoire_max = 0;
+
+// Fichier d'instantane de la table, NULL si desactive (option -s).
+char *fichier_instantane = NULL;
+
+// Processus fils en train d'ecrire l'instantane, 0 s'il n'y en a pas.
+pid_t pid_instantane = 0;
+
+// Nombre maximal de datagrammes reçus et traites par lot (option -l).
+unsigned int taille_lot = LOT_DEFAUT;
+
+// Journal des put, NULL si desactive (option -j).
+char *fichier_journal = NULL;
+
+// Intervalle entre deux validations du journal en millisecondes (option -g).
+long intervalle_journal = JOURNAL_INTERVALLE_DEFAUT;
+
+// Journal des put, ouvert une fois l'etat precedent restaure.
+journal journal_puts;
+int journal_actif = FALSE;
+
+// Taille maximale d'un datagramme de transfert regroupant des couples
+// hash/adresse, a la replication des put et a la connexion d'un serveur
+// (option -d).
+unsigned int taille_transfert = TRANSFERT_DEFAUT;
+
+// Delai en millisecondes entre le premier couple a repliquer d'un message et
+// son envoi, s'il n'est pas plein avant ; 0 pour envoyer les couples a la
+// fin de chaque lot (option -e).
+long delai_replication = REPLICATION_DELAI_DEFAUT;
+
+// Propagation par commerage : chaque message de replication part vers
+// fanout_gossip serveurs tires au hasard, qui propagent a leur tour les
+// couples qui etaient nouveaux pour eux, jusqu'au tour tours_gossip ; 0 pour
+// envoyer a tous les serveurs connus (options -f et -n).
+unsigned int fanout_gossip = 0;
+unsigned int tours_gossip = GOSSIP_TOURS_DEFAUT;
+
+// Periode en secondes des comparaisons de l'arbre de Merkle avec un serveur
+// connu tire au hasard, 0 si l'anti-entropie est desactivee (option -a).
+long periode_merkle = MERKLE_PERIODE_DEFAUT;
+
+// Arbre de Merkle de l'ensemble des partitions, mis a jour avant chaque
+// comparaison, et compteurs de l'anti-entropie. Son verrou est pris avant
+// ceux des partitions.
+arbre_merkle arbre;
+pthread_mutex_t verrou_merkle = PTHREAD_MUTEX_INITIALIZER;
+unsigned long tours_merkle = 0;         // Comparaisons lancees
+unsigned long noeuds_compares = 0;      // Noeuds reçus et compares
+unsigned long feuilles_differentes = 0; // Feuilles trouvees differentes
+unsigned long couples_pousses = 0;      // Couples envoyes pour les reparer
+
+// Historique des modifications de la table : un serveur qui revient ne
+// reçoit que les modifications posterieures a sa position (option -r, taille
+// en megaoctets, 0 pour le desactiver).
+size_t taille_historique = HISTORIQUE_TAILLE_DEFAUT;
+historique modifications;
+
+// Positions de ce serveur dans l'historique des autres, rechargees avec
+// l'instantane et presentees au serveur contacte a la connexion.
+position positions[POSITIONS_MAX];
+unsigned int nb_positions = 0;
+
+// Mode anneau : un hash n'est stocke que par ses copies_anneau serveurs
+// proprietaires, ses successeurs sur un anneau de hachage coherent ou chaque
+// serveur place virtuels_anneau noeuds virtuels ; 0 pour que chaque serveur
+// stocke toute la table (options -c et -v).
+unsigned int copies_anneau = 0;
+unsigned int virtuels_anneau = ANNEAU_VIRTUELS_DEFAUT;
+
+// Anneau forme de ce serveur (membre_local, rang_local dans l'anneau) et des
+// serveurs connus, reconstruit par le thread principal quand ceux-ci
+// changent : version_anneau est la version des serveurs connus a sa
+// construction, generation_anneau le nombre de constructions. Son verrou est
+// pris avant ceux des partitions.
+anneau vue_anneau;
+membre_anneau membre_local;
+int rang_local = -1;
+unsigned long version_anneau = ULONG_MAX;
+unsigned long generation_anneau = 0;
+pthread_rwlock_t verrou_anneau;
+unsigned long hash_deplaces = 0;    // Hash envoyes a de nouveaux proprietaires
+unsigned long hash_retires = 0;     // Hash dont le serveur n'est plus
+                                    // proprietaire
+int cession_en_attente = FALSE;     // Hash cedes a de nouveaux proprietaires,
+                                    // renvoyes puis retires au passage
+                                    // suivant de la roue (mode anneau)
+
+// Nombre de threads de reception, chacun avec sa socket (option -t).
+unsigned int nb_threads = 1;
+
+// Threads de reception (le thread principal est le premier).
+travailleur *travailleurs = NULL;
+
+// Mode partitionne : chaque thread possede la partition de la table
+// correspondant a son indice (option -p).
+int mode_partitions = FALSE;
+
+// Backend io_uring pour la reception et l'envoi des datagrammes, si le
+// serveur est compile avec (option -u).
+int mode_uring = FALSE;
+
+// Partitions de la table de hash : un hash appartient a la partition donnee
+// par partition_cle. Hors mode partitionne, il n'y a qu'une partition.
+unsigned int nb_partitions = 1;
+table_hash *tables = NULL;
+
+// Une partition est consultee (get) par plusieurs threads a la fois, et
+// modifiee (put, obsolescence) par un seul ; en mode partitionne, seul son
+// thread la prend, sauf le temps d'un instantane, d'une connexion de serveur
+// ou de l'affichage des statistiques. Les serveurs connus ont leur propre
+// verrou. Ordre de prise : partitions par indice croissant, puis serveurs.
+pthread_rwlock_t *verrous = NULL;
+pthread_mutex_t verrou_serveurs = PTHREAD_MUTEX_INITIALIZER;
+
+// Demandes d'etat des nouveaux serveurs, lues sans bloquer par le thread
+// principal (fd a -1 pour un emplacement libre).
+demande_synchro demandes_synchro[SYNCHRO_DEMANDES_MAX];
+
+/**
+ * @brief Bloque les signaux traites par la boucle du serveur et ouvre le
+ *        descripteur qui les reçoit.
+ *
+ * SIGINT (arret du serveur) et SIGUSR1 (statistiques) ne sont plus delivres
+ * de maniere asynchrone : ils sont lus par la boucle principale sur un
+ * signalfd. Le masque doit etre pose avant la creation des threads, qui en
+ * heritent.
+ *
+ * @param signaux l'identifiant du signalfd (valeur de retour par effet de
+ *        bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int gestion_signaux(int *signaux)
+{
+    sigset_t masque;
+    
+    if(sigemptyset(&masque)==-1)
+    {
+        perror("Error sigemptyset");
+        return 1;
+    }
+    sigaddset(&masque, SIGINT);
+    sigaddset(&masque, SIGUSR1);
+    
+    if(sigprocmask(SIG_BLOCK, &masque, NULL)==-1)
+    {
+        perror("Error sigprocmask");
+        return 2;
+    }
+    
+    *signaux = signalfd(-1, &masque, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(*signaux==-1)
+    {
+        perror("Error signalfd");
+        return 3;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Cree un minuteur periodique.
+ *
+ * Le minuteur est lu comme un descripteur (timerfd) : il s'integre a la
+ * boucle d'evenements et ne depend d'aucun signal.
+ *
+ * @param minuteur l'identifiant du minuteur (valeur de retour par effet de
+ *        bord).
+ * @param secondes la periode, en secondes.
+ * @param microsecondes le complement de la periode, en microsecondes.
+ *        Une periode nulle donne un minuteur desarme.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int creer_minuteur(int *minuteur, time_t secondes, long microsecondes)
+{
+    struct itimerspec periode;
+    
+    periode.it_interval.tv_sec = secondes;
+    periode.it_interval.tv_nsec = microsecondes*1000;
+    periode.it_value = periode.it_interval;
+    
+    *minuteur = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(*minuteur==-1)
+    {
+        perror("Error timerfd_create");
+        return 4;
+    }
+    
+    if(timerfd_settime(*minuteur, 0, &periode, NULL)==-1)
+    {
+        perror("Error timerfd_settime");
+        close(*minuteur);
+        *minuteur = -1;
+        return 24;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute un descripteur aux evenements attendus par un thread.
+ *
+ * @param epfd l'identifiant de l'epoll du thread.
+ * @param fd le descripteur a surveiller en lecture.
+ * @param source la source (SOURCE_*) signalee par ses evenements.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int surveiller(int epfd, int fd, unsigned int source)
+{
+    struct epoll_event evenement;
+    
+    evenement.events = EPOLLIN;
+    evenement.data.u32 = source;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evenement)==-1)
+    {
+        perror("Error epoll_ctl");
+        return 25;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Lit les options de la ligne de commande.
+ *
+ * - -b : mode cle binaire.
+ * - -m MO : plafond memoire de la table de hash, en megaoctets.
+ * - -s FICHIER : instantane de la table, charge au demarrage et reecrit
+ *   periodiquement.
+ * - -j FICHIER : journal des put, rejoue au demarrage.
+ * - -g MS : intervalle entre deux validations (fdatasync) du journal.
+ * - -l N : nombre maximal de datagrammes reçus (recvmmsg) et traites par lot.
+ * - -t N : nombre de threads de reception, chacun avec sa socket.
+ * - -p : partitionne la table entre les threads de reception.
+ * - -u : reçoit et envoie les datagrammes par io_uring (make URING=1).
+ * - -d OCTETS : taille maximale d'un datagramme de transfert entre
+ *   serveurs.
+ * - -a SECONDES : periode de l'anti-entropie (0 pour la desactiver).
+ * - -r MO : taille de l'historique des modifications (0 pour le
+ *   desactiver).
+ * - -e MS : delai d'envoi des couples repliques.
+ * - -f N : propagation par commerage vers N serveurs tires au hasard (0
+ *   pour repliquer vers tous les serveurs connus).
+ * - -n TOURS : nombre maximal de tours de propagation par commerage.
+ * - -c R : mode anneau, chaque hash n'est stocke que par R serveurs (0 pour
+ *   stocker toute la table sur chaque serveur).
+ * - -v N : nombre de noeuds virtuels par serveur dans l'anneau.
+ *
+ * @param argc le nombre d'arguments.
+ * @param argv les arguments.
+ * @return l'indice du premier argument qui n'est pas une option, -1 si une
+ *         option est invalide.
+*/
+int lire_options(int argc, char **argv)
+{
+    int opt;
+    unsigned long mo;
+    long ms;
+    char *fin;
+    
+    while((opt=getopt(argc, argv, "bm:s:j:g:l:t:pud:a:r:e:f:n:c:v:"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'b':
+                mode_binaire = TRUE;
+                break;
+            case 'm':
+                mo = strtoul(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || mo==0)
+                    return -1;
+                memoire_max = mo*1024*1024;
+                break;
+            case 's':
+                fichier_instantane = optarg;
+                break;
+            case 'j':
+                fichier_journal = optarg;
+                break;
+            case 'g':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms==0)
+                    return -1;
+                intervalle_journal = ms;
+                break;
+            case 'l':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms==0 ||
+                   ms > LOT_MAX)
+                    return -1;
+                taille_lot = ms;
+                break;
+            case 't':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms==0 ||
+                   ms > SERVEUR_THREADS_MAX)
+                    return -1;
+                nb_threads = ms;
+                break;
+            case 'p':
+                mode_partitions = TRUE;
+                break;
+            case 'd':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' ||
+                   ms < SIZEOF_ENTETE || ms > MAX_DATAGRAMME)
+                    return -1;
+                taille_transfert = ms;
+                break;
+            case 'a':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0')
+                    return -1;
+                periode_merkle = ms;
+                break;
+            case 'r':
+                mo = strtoul(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0')
+                    return -1;
+                taille_historique = mo;
+                break;
+            case 'e':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms > 1000)
+                    return -1;
+                delai_replication = ms;
+                break;
+            case 'f':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' ||
+                   ms > GOSSIP_FANOUT_MAX)
+                    return -1;
+                fanout_gossip = ms;
+                break;
+            case 'n':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms==0 ||
+                   ms > GOSSIP_TOURS_MAX)
+                    return -1;
+                tours_gossip = ms;
+                break;
+            case 'c':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' ||
+                   ms > ANNEAU_COPIES_MAX)
+                    return -1;
+                copies_anneau = ms;
+                break;
+            case 'v':
+                ms = strtol(optarg, &fin, 10);
+                if(*optarg<'0' || *optarg>'9' || *fin!='\0' || ms==0 ||
+                   ms > ANNEAU_VIRTUELS_MAX)
+                    return -1;
+                virtuels_anneau = ms;
+                break;
+            case 'u':
+#ifdef AVEC_URING
+                mode_uring = TRUE;
+                break;
+#else
+                fprintf(stderr, "Option -u : serveur compile sans io_uring "\
+                        "(make URING=1)\n");
+                return -1;
+#endif
+            default:
+                return -1;
+        }
+    }
+    
+    return optind;
+}
+
+/**
+ * @brief Met un hash sous sa forme de stockage.
+ *
+ * Le hash peut etre une chaine (bloc 'h') ou une cle binaire (bloc 'b'). En
+ * mode cle binaire, une chaine representant un SHA-1 ou un SHA-256 en
+ * hexadecimal est convertie, pour etre stockee comme la cle binaire
+ * equivalente.
+ *
+ * @param type_cle le type du hash (modifie par effet de bord).
+ * @param hash un pointeur sur le hash (modifie par effet de bord).
+ * @param taille_hash la taille du hash (modifiee par effet de bord).
+ * @param cle un tableau d'au moins TAILLE_CLE_SHA256 octets pouvant recevoir
+ *        la cle convertie.
+*/
+void normaliser_cle(donnees *type_cle, donnees **hash, taille *taille_hash,
+                        donnees *cle)
+{
+    if(mode_binaire && *type_cle=='h' &&
+       hex_vers_binaire((char *)*hash, *taille_hash, cle, taille_hash)==0)
+    {
+        *type_cle = 'b';
+        *hash = cle;
+    }
+}
+
+/**
+ * @brief Recupere le hash d'un message sous sa forme de stockage.
+ *
+ * @param m un pointeur sur le message a lire.
+ * @param type_cle le type du hash (valeur de retour par effet de bord).
+ * @param hash un pointeur sur le hash (valeur de retour par effet de bord).
+ * @param taille_hash la taille du hash (valeur de retour par effet de bord).
+ * @param cle un tableau d'au moins TAILLE_CLE_SHA256 octets pouvant recevoir
+ *        la cle convertie (voir normaliser_cle).
+ * @return 0 si un hash a ete trouve, -1 sinon.
+*/
+int message_get_cle(message *m, donnees *type_cle, donnees **hash,
+                        taille *taille_hash, donnees *cle)
+{
+    if(message_get_bloc(m, "hb", type_cle, hash, taille_hash)==-1)
+        return -1;
+    
+    normaliser_cle(type_cle, hash, taille_hash, cle);
+    
+    return 0;
+}
+
+/**
+ * @brief Met une adresse sous sa forme de stockage.
+ *
+ * L'adresse peut etre une extremite binaire (bloc 'e') ou une chaine (bloc
+ * 'a'). Une chaine representant une adresse IP (avec ou sans port) est
+ * compactee en extremite binaire, seules les adresses non reconnues sont
+ * conservees sous forme textuelle.
+ *
+ * @param type_adresse la forme de l'adresse ('e' ou 'a')
+ *        (modifiee par effet de bord).
+ * @param adresse un pointeur sur l'adresse (modifie par effet de bord).
+ * @param taille_adresse la taille de l'adresse (modifiee par effet de bord).
+ * @param ext un tableau d'au moins TAILLE_EXTREMITE_IPV6 octets pouvant
+ *        recevoir l'extremite convertie.
+ * @return 0 en cas de reussite, -1 si l'extremite est mal formee.
+*/
+int normaliser_adresse(donnees *type_adresse, donnees **adresse,
+                        taille *taille_adresse, donnees *ext)
+{
+    if(*type_adresse=='e')
+    {
+        return *taille_adresse==TAILLE_EXTREMITE_IPV4 ||
+               *taille_adresse==TAILLE_EXTREMITE_IPV6 ? 0 : -1;
+    }
+    
+    if(texte_vers_extremite((char *)*adresse, *taille_adresse, ext,
+                            taille_adresse)==0)
+    {
+        *type_adresse = 'e';
+        *adresse = ext;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Recupere l'adresse d'un message sous sa forme de stockage.
+ *
+ * Les extremites mal formees sont ignorees (voir normaliser_adresse).
+ *
+ * @param m un pointeur sur le message a lire.
+ * @param type_adresse la forme de l'adresse ('e' ou 'a')
+ *        (valeur de retour par effet de bord).
+ * @param adresse un pointeur sur l'adresse (valeur de retour par effet de
+ *        bord).
+ * @param taille_adresse la taille de l'adresse (valeur de retour par effet
+ *        de bord).
+ * @param ext un tableau d'au moins TAILLE_EXTREMITE_IPV6 octets pouvant
+ *        recevoir l'extremite convertie.
+ * @return 0 si une adresse a ete trouvee, -1 sinon.
+*/
+int message_get_adresse(message *m, donnees *type_adresse, donnees **adresse,
+                            taille *taille_adresse, donnees *ext)
+{
+    int err;
+    
+    for(err=message_get_bloc(m, "ae", type_adresse, adresse, taille_adresse);
+        err==0;
+        err=message_get_bloc(NULL, "ae", type_adresse, adresse, taille_adresse))
+    {
+        if(normaliser_adresse(type_adresse, adresse, taille_adresse, ext)==0)
+            return 0;
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Ajoute un couple hash/adresse a un message de transfert.
+ *
+ * Le message ne depasse pas taille_transfert octets, sauf s'il ne contient
+ * que ce couple.
+ *
+ * @param m un pointeur sur le message.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @param age l'age de l'adresse en secondes, envoye dans un bloc 'o' avant
+ *        elle, ou -1 pour une adresse qui vient d'etre annoncee.
+ * @return 0 en cas de reussite, CODE_MESSAGE_PLEIN si le couple ne tient
+ *         plus dans le message, un autre code d'erreur sinon.
+*/
+int ajouter_couple(message *m, donnees type_cle, donnees *hash,
+                    taille taille_hash, donnees type_adresse,
+                    donnees *adresse, taille taille_adresse, long int age)
+{
+    int err;
+    uint16_t age_reseau;
+    size_t taille_age = age>=0 ? SIZEOF_ENTETE_BLOC+sizeof(uint16_t) : 0;
+    
+    if(m->lg_message > SIZEOF_ENTETE &&
+       m->lg_message+2*(SIZEOF_ENTETE_BLOC)+taille_hash+taille_adresse+
+                                            taille_age > taille_transfert)
+        return CODE_MESSAGE_PLEIN;
+    
+    err=add_data(m, type_cle, taille_hash, hash);
+    if(err==0 && age>=0)
+    {
+        age_reseau = htons(age > UINT16_MAX ? UINT16_MAX : age);
+        err=add_data(m, 'o', sizeof(age_reseau), &age_reseau);
+    }
+    if(err==0)
+        err=add_data(m, type_adresse, taille_adresse, adresse);
+    
+    return err;
+}
+
+/**
+ * @brief Ajoute une adresse stockee a un message.
+ *
+ * Les extremites binaires sont envoyees telles quelles (bloc 'e') si le
+ * destinataire les comprend, sinon elles sont remises sous forme textuelle
+ * (bloc 'a') pour les anciens clients.
+ *
+ * @param m un pointeur sur le message a remplir.
+ * @param adresse l'adresse a ajouter.
+ * @param binaire TRUE si le destinataire accepte les blocs 'e'.
+ * @return 0 en cas de reussite, CODE_MESSAGE_PLEIN si l'adresse ne tient plus
+ *         dans un datagramme, un autre code d'erreur sinon.
+*/
+int ajouter_adresse(message *m, adresse_interne *adresse, int binaire)
+{
+    char texte[TAILLE_TEXTE_EXTREMITE];
+    int lg;
+    
+    if(adresse->type_adresse=='a' || binaire)
+    {
+        if(m->lg_message+SIZEOF_ENTETE_BLOC+adresse->taille_adresse
+                                                            > MAX_DATAGRAMME)
+            return CODE_MESSAGE_PLEIN;
+        return add_data(m, adresse->type_adresse, adresse->taille_adresse,
+                        adresse->octets);
+    }
+    
+    lg=extremite_vers_texte(adresse->octets, adresse->taille_adresse,
+                            texte, sizeof(texte));
+    if(lg==-1)
+        return 0;
+    
+    if(m->lg_message+SIZEOF_ENTETE_BLOC+lg > MAX_DATAGRAMME)
+        return CODE_MESSAGE_PLEIN;
+    
+    return add_data(m, 'a', lg, texte);
+}
+
+/**
+ * @brief Ajoute au DHT un hash et son adresse associee.
+ *
+ * Le hash est ajoute a sa partition ; l'ajout, sa journalisation et son
+ * numero de sequence dans l'historique sont faits sous le verrou de
+ * celle-ci, pour que le journal et l'historique suivent l'ordre des ajouts.
+ *
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @param date la date de la derniere annonce de l'adresse.
+ * @param change TRUE si l'adresse etait nouvelle pour ce hash ou si sa date a
+ *        avance (valeur de retour par effet de bord, ignoree si NULL).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int stocker_couple(donnees type_cle, donnees *hash, taille taille_hash,
+                    donnees type_adresse, donnees *adresse,
+                    taille taille_adresse, long int date, int *change)
+{
+    int err;
+    unsigned int p;
+    unsigned long changements;
+    
+    p = partition_cle(type_cle, hash, taille_hash, nb_partitions);
+    pthread_rwlock_wrlock(&verrous[p]);
+    changements = tables[p].changements;
+    err=add_hash(&tables[p], type_cle, hash, taille_hash, type_adresse, adresse,
+                 taille_adresse, date);
+    if(change!=NULL)
+        *change = tables[p].changements!=changements;
+    if(err==0 && journal_actif)
+        journaliser_put(&journal_puts, date, type_cle, hash, taille_hash,
+                        type_adresse, adresse, taille_adresse);
+    if(err==0)
+        historiser(&modifications, date, type_cle, hash, taille_hash,
+                   type_adresse, adresse, taille_adresse);
+    pthread_rwlock_unlock(&verrous[p]);
+    
+    return err;
+}
+
+/**
+ * @brief Arme l'echeance de l'envoi des couples a repliquer d'un thread.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int armer_echeance(travailleur *w)
+{
+    struct itimerspec delai = {0};
+    
+    if(w->echeance==-1)
+        return 0;
+    
+    delai.it_value.tv_sec = delai_replication/1000;
+    delai.it_value.tv_nsec = (delai_replication%1000)*1000000;
+    if(timerfd_settime(w->echeance, 0, &delai, NULL)==-1)
+    {
+        perror("Error timerfd_settime");
+        return 30;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Cherche l'empreinte d'un couple parmi celles du message de
+ *        replication d'un thread, et l'y ajoute si elle n'y est pas.
+ *
+ * Au-dela d'une demi-occupation, les empreintes ne sont plus retenues : les
+ * couples suivants sont envoyes meme s'ils sont repetes.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param empreinte l'empreinte du couple (voir empreinte_octets).
+ * @return TRUE (1) si le couple est deja dans le message, 0 sinon.
+*/
+int deja_vu(travailleur *w, uint64_t empreinte)
+{
+    unsigned int i, masque = w->capacite_vus-1;
+    
+    if(empreinte==0)
+        empreinte = 1;
+    
+    for(i=empreinte&masque; w->vus[i]!=0; i=(i+1)&masque)
+    {
+        if(w->vus[i]==empreinte)
+            return TRUE;
+    }
+    
+    if(2*(w->nb_vus+1) <= w->capacite_vus)
+    {
+        w->vus[i] = empreinte;
+        w->nb_vus++;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Renvoie la date courante en millisecondes.
+ *
+ * @return le nombre de millisecondes depuis le 1er janvier 1970.
+*/
+uint64_t maintenant_ms()
+{
+    struct timespec t;
+    
+    clock_gettime(CLOCK_REALTIME, &t);
+    
+    return (uint64_t)t.tv_sec*1000+t.tv_nsec/1000000;
+}
+
+/**
+ * @brief Tire au hasard les serveurs connus auxquels propager un message.
+ *
+ * Tirage sans remise de fanout_gossip serveurs (echantillonnage par
+ * reservoir), ou de tous s'il y en a moins. Les serveurs connus doivent etre
+ * verrouilles tant que les serveurs tires sont utilises.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param graine l'etat du generateur pseudo-aleatoire de l'appelant.
+ * @param voisins un tableau d'au moins GOSSIP_FANOUT_MAX serveurs (valeur de
+ *        retour par effet de bord).
+ * @return le nombre de serveurs tires.
+*/
+unsigned int tirer_voisins(serveurs_connus *st, unsigned int *graine,
+                            l_serveur **voisins)
+{
+    unsigned int n = 0, vus = 0, j;
+    l_serveur *emp;
+    
+    for(emp=st->premier; emp!=NULL; emp=emp->next, vus++)
+    {
+        if(n < fanout_gossip)
+        {
+            voisins[n++] = emp;
+            continue;
+        }
+        j = rand_r(graine)%(vus+1);
+        if(j < n)
+            voisins[j] = emp;
+    }
+    
+    return n;
+}
+
+/**
+ * @brief Envoie les couples d'un thread destines a un membre de l'anneau.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param e l'envoi du membre (vide au retour).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_membre(travailleur *w, envoi_membre *e)
+{
+    int err;
+    message *m = e->m;
+    
+    if(m==NULL)
+        return 0;
+    e->m = NULL;
+    w->membres_en_attente--;
+    w->messages_replication++;
+    w->datagrammes_replication++;
+    prepare_message(m);
+    
+    err=ajouter_envoi(&w->envois, w->sockfd, m,
+                      (struct sockaddr *) &e->adresse, e->addrlen);
+    if(err==0)
+        err=confier_message(&w->envois, w->sockfd, m);
+    else
+        delete_message(m);
+    
+    return err;
+}
+
+/**
+ * @brief Envoie tous les couples d'un thread destines aux membres de
+ *        l'anneau (mode anneau).
+ *
+ * Comme pour la replication a tous les serveurs, les empreintes des couples
+ * envoyes sont oubliees.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_membres(travailleur *w)
+{
+    int err = 0;
+    unsigned int i;
+    
+    for(i=0; i<w->capacite_membres && err==0; i++)
+        err=envoyer_membre(w, &w->vers_membres[i]);
+    
+    if(w->nb_vus>0)
+    {
+        memset(w->vus, 0, w->capacite_vus*sizeof(uint64_t));
+        w->nb_vus = 0;
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Envoie aux serveurs connus les couples a repliquer d'un thread.
+ *
+ * Le message de transfert est place dans le lot d'envoi du thread, une fois
+ * par serveur connu, ou par serveur tire au hasard en mode commerage. Les
+ * empreintes de ses couples sont oubliees : un couple repete apres l'envoi
+ * repart dans le message suivant. En mode anneau, ce sont les couples
+ * destines a chaque proprietaire qui partent (voir envoyer_membres).
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_replication(travailleur *w)
+{
+    int err = 0;
+    unsigned int i, n;
+    message *m = w->replication;
+    l_serveur *emp, *voisins[GOSSIP_FANOUT_MAX];
+    
+    if(copies_anneau>0)
+        return envoyer_membres(w);
+    if(m==NULL)
+        return 0;
+    w->replication = NULL;
+    w->messages_replication++;
+    if(w->nb_vus>0)
+    {
+        memset(w->vus, 0, w->capacite_vus*sizeof(uint64_t));
+        w->nb_vus = 0;
+    }
+    prepare_message(m);
+    
+    /* Parcours de la liste de serveurs, ou des serveurs tires au hasard */
+    pthread_mutex_lock(&verrou_serveurs);
+    if(fanout_gossip>0)
+    {
+        n = tirer_voisins(w->st, &w->graine, voisins);
+        for(i=0; i<n && err==0; i++)
+            err=ajouter_envoi(&w->envois, w->sockfd, m, voisins[i]->serveur,
+                              voisins[i]->addrlen);
+        w->datagrammes_replication += n;
+    }
+    else
+    {
+        for(emp=w->st->premier; emp!=NULL && err==0; emp=emp->next)
+        {
+            err=ajouter_envoi(&w->envois, w->sockfd, m, emp->serveur,
+                              emp->addrlen);
+            w->datagrammes_replication++;
+        }
+    }
+    pthread_mutex_unlock(&verrou_serveurs);
+    
+    if(err==0)
+        err=confier_message(&w->envois, w->sockfd, m);
+    else
+        delete_message(m);
+    
+    return err;
+}
+
+/**
+ * @brief Ajoute un bloc 'i' (tour et date d'origine des couples suivants) au
+ *        message de replication d'un thread.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param tour le tour des couples suivants.
+ * @param origine la date (ms) de leur put d'origine.
+ * @return 0 en cas de reussite, CODE_MESSAGE_PLEIN si le bloc ne tient plus
+ *         dans le message, un autre code d'erreur sinon.
+*/
+int ajouter_tour(travailleur *w, unsigned int tour, uint64_t origine)
+{
+    int err;
+    donnees bloc[TAILLE_BLOC_TOUR];
+    uint64_t origine_reseau = htobe64(origine);
+    message *m = w->replication;
+    
+    if(m->lg_message > SIZEOF_ENTETE &&
+       m->lg_message+SIZEOF_ENTETE_BLOC+TAILLE_BLOC_TOUR > taille_transfert)
+        return CODE_MESSAGE_PLEIN;
+    
+    bloc[0] = tour;
+    memcpy(bloc+1, &origine_reseau, sizeof(origine_reseau));
+    err=add_data(m, 'i', TAILLE_BLOC_TOUR, bloc);
+    if(err==0)
+    {
+        w->tour_replication = tour;
+        w->origine_replication = origine;
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Ajoute un couple hash/adresse aux couples a repliquer d'un thread.
+ *
+ * Les couples des put sont regroupes dans des messages de transfert d'au
+ * plus taille_transfert octets. Un message plein part aussitot ; sinon, il
+ * part delai_replication millisecondes apres son premier couple, ou a la fin
+ * du lot si ce delai est nul (voir traiter_lot). Un couple deja present dans
+ * le message (put repete par un client) n'y est pas ajoute une seconde fois.
+ * En mode commerage, les couples sont precedes de leur tour et de la date de
+ * leur put d'origine (bloc 'i'), repetes seulement quand ils changent.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param tour le tour du couple (0 pour un put reçu d'un client).
+ * @param origine la date (ms) du put d'origine du couple.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int repliquer_couple(travailleur *w, unsigned int tour, uint64_t origine,
+                        donnees type_cle, donnees *hash, taille taille_hash,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse)
+{
+    int err = CODE_MESSAGE_PLEIN;
+    uint64_t empreinte = empreinte_octets(type_cle, hash, taille_hash,
+                                          type_adresse, adresse,
+                                          taille_adresse);
+    
+    if(w->replication!=NULL)
+    {
+        if(deja_vu(w, empreinte))
+        {
+            w->doublons_ecartes++;
+            return 0;
+        }
+        err = 0;
+        if(fanout_gossip>0 && (tour!=w->tour_replication ||
+                               origine!=w->origine_replication))
+            err=ajouter_tour(w, tour, origine);
+        if(err==0)
+            err=ajouter_couple(w->replication, type_cle, hash, taille_hash,
+                               type_adresse, adresse, taille_adresse, -1);
+    }
+    
+    if(err==CODE_MESSAGE_PLEIN)
+    {
+        if((err=envoyer_replication(w))!=0 ||
+           (err=create_message(&w->replication, 't', taille_transfert))!=0 ||
+           (err=armer_echeance(w))!=0)
+            return err;
+        deja_vu(w, empreinte);
+        if(fanout_gossip>0)
+            err=ajouter_tour(w, tour, origine);
+        if(err==0)
+            err=ajouter_couple(w->replication, type_cle, hash, taille_hash,
+                               type_adresse, adresse, taille_adresse, -1);
+    }
+    
+    if(err==0)
+        w->couples_repliques++;
+    
+    return err;
+}
+
+/**
+ * @brief Prepare les envois d'un thread aux membres de l'anneau courant.
+ *
+ * Les envois sont indices par membre : apres une reconstruction de
+ * l'anneau, ceux de l'ancien anneau partent d'abord. L'appelant tient
+ * verrou_anneau.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int preparer_envois_membres(travailleur *w)
+{
+    int err;
+    unsigned int i;
+    envoi_membre *envois;
+    
+    if(w->generation_membres==generation_anneau)
+        return 0;
+    if((err=envoyer_membres(w))!=0)
+        return err;
+    
+    if(vue_anneau.nb_membres > w->capacite_membres)
+    {
+        envois = realloc(w->vers_membres,
+                         vue_anneau.nb_membres*sizeof(envoi_membre));
+        if(envois==NULL)
+        {
+            perror("Error realloc");
+            return 20;
+        }
+        for(i=w->capacite_membres; i<vue_anneau.nb_membres; i++)
+            envois[i].m = NULL;
+        w->vers_membres = envois;
+        w->capacite_membres = vue_anneau.nb_membres;
+    }
+    w->generation_membres = generation_anneau;
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute un couple hash/adresse aux couples d'un thread destines a un
+ *        membre de l'anneau.
+ *
+ * Comme a la replication vers tous les serveurs, les couples sont regroupes
+ * dans des messages de transfert, un par membre, qui partent pleins ou a
+ * l'echeance armee par le premier couple en attente. L'appelant tient
+ * verrou_anneau et a prepare les envois (voir preparer_envois_membres).
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param membre l'indice du membre dans l'anneau.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int repliquer_membre(travailleur *w, unsigned int membre, donnees type_cle,
+                        donnees *hash, taille taille_hash,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse)
+{
+    int err = CODE_MESSAGE_PLEIN;
+    envoi_membre *e = &w->vers_membres[membre];
+    
+    if(e->m!=NULL)
+        err=ajouter_couple(e->m, type_cle, hash, taille_hash, type_adresse,
+                           adresse, taille_adresse, -1);
+    
+    if(err==CODE_MESSAGE_PLEIN)
+    {
+        if((err=envoyer_membre(w, e))!=0 ||
+           (err=create_message(&e->m, 't', taille_transfert))!=0)
+            return err;
+        memcpy(&e->adresse, &vue_anneau.membres[membre].adresse,
+               vue_anneau.membres[membre].addrlen);
+        e->addrlen = vue_anneau.membres[membre].addrlen;
+        if(w->membres_en_attente++==0 && (err=armer_echeance(w))!=0)
+            return err;
+        err=ajouter_couple(e->m, type_cle, hash, taille_hash, type_adresse,
+                           adresse, taille_adresse, -1);
+    }
+    
+    if(err==0)
+        w->couples_repliques++;
+    
+    return err;
+}
+
+/**
+ * @brief Stocke un couple hash/adresse reçu d'un client chez les
+ *        proprietaires de son hash (mode anneau).
+ *
+ * Le couple n'est stocke localement que si le serveur est l'un des
+ * proprietaires ; il est envoye aux autres proprietaires, ou a tous si le
+ * serveur n'en est pas un (put transmis). Un couple deja en attente d'envoi
+ * n'est pas envoye une seconde fois.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int placer_couple(travailleur *w, donnees type_cle, donnees *hash,
+                    taille taille_hash, donnees type_adresse,
+                    donnees *adresse, taille taille_adresse)
+{
+    int err = 0, proprietaire = FALSE;
+    unsigned int membres[ANNEAU_COPIES_MAX], n, i;
+    
+    pthread_rwlock_rdlock(&verrou_anneau);
+    n = proprietaires(&vue_anneau, position_cle(type_cle, hash, taille_hash),
+                      membres);
+    for(i=0; i<n; i++)
+        proprietaire |= (int)membres[i]==rang_local;
+    
+    if(proprietaire)
+        err=stocker_couple(type_cle, hash, taille_hash, type_adresse,
+                           adresse, taille_adresse, time(NULL), NULL);
+    else
+        w->puts_transmis++;
+    
+    if(err==0)
+        err=preparer_envois_membres(w);
+    if(err==0 && deja_vu(w, empreinte_octets(type_cle, hash, taille_hash,
+                                             type_adresse, adresse,
+                                             taille_adresse)))
+    {
+        w->doublons_ecartes++;
+        n = 0;
+    }
+    for(i=0; i<n && err==0; i++)
+    {
+        if((int)membres[i]!=rang_local)
+            err=repliquer_membre(w, membres[i], type_cle, hash, taille_hash,
+                                 type_adresse, adresse, taille_adresse);
+    }
+    pthread_rwlock_unlock(&verrou_anneau);
+    
+    return err;
+}
+
+/**
+ * @brief Lis le message et ajoute au DHT un hash et son adresse associee.
+ *
+ * Lecture du message pour recuperer le hash et l'adresse, puis ajout d'un
+ * element a la liste des hash (voir stocker_couple), et replication du
+ * couple vers les autres serveurs par le thread qui a reçu le put (vers les
+ * proprietaires du hash en mode anneau, voir placer_couple).
+ *
+ * @param m un pointeur sur le message reçu.
+ * @param w un pointeur sur le thread de reception.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int serveur_put(message *m, travailleur *w)
+{
+    int err;
+    donnees *hash, *adresse, type_cle, cle[TAILLE_CLE_SHA256];
+    donnees type_adresse, ext[TAILLE_EXTREMITE_IPV6];
+    taille taille_hash, taille_adresse;
+
+    /* Recuperation du hash dans le message */
+    if(message_get_cle(m, &type_cle, &hash, &taille_hash, cle)==-1)
+    {
+        fprintf(stderr, "Erreur : Le message ne contenait pas de hash\n");
+        return 5;
+    }
+    
+    /* Recuperation de l'adresse dans le message */
+    if(message_get_adresse(m, &type_adresse, &adresse, &taille_adresse,
+                           ext)==-1)
+    {
+        fprintf(stderr, "Erreur : Le message ne contenait pas d'adresse\n");
+        return 6;
+    }
+    
+    /* En mode anneau, le couple va aux proprietaires du hash */
+    if(copies_anneau>0)
+        return placer_couple(w, type_cle, hash, taille_hash, type_adresse,
+                             adresse, taille_adresse);
+    
+    /* Ajout du hash et son adresse associee dans la table de hashage */
+    err=stocker_couple(type_cle, hash, taille_hash, type_adresse, adresse,
+                       taille_adresse, time(NULL), NULL);
+    if(err!=0)
+        return err;
+
+    return repliquer_couple(w, 0, maintenant_ms(), type_cle, hash,
+                            taille_hash, type_adresse, adresse,
+                            taille_adresse);
+}
+
+/**
+ * @brief Recupere toute les adresses ip associees a un hash.
+ *
+ * Lit le message reçu, en extrait le hash en question, le recherche dans la
+ * table de hash, puis ajoute a un nouveau message toutes les adresses ip
+ * associees. Si la requete contient un bloc 'e', le client accepte les
+ * extremites binaires, sinon elles lui sont envoyees sous forme textuelle.
+ * Les adresses qui ne tiennent plus dans un datagramme sont omises. La
+ * partition du hash n'est prise qu'en lecture.
+ *
+ * @param retour un pointeur vers un pointeur sur le message qui sera la reponse
+ *        du serveur (valeur de retour par effet de bord).
+ * @param m un pointeur sur le message recu par le serveur.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int serveur_get(message **retour, message *m)
+{
+    int err = 0, binaire;
+    unsigned int p;
+    table_hash *dht;
+    message *m2;
+    donnees *hash, *marqueur, type_cle, type, cle[TAILLE_CLE_SHA256];
+    l_hash *table;
+    l_emplacement *emp;
+    adresse_interne *adresse;
+    taille taille_hash, taille_marqueur;
+    
+    /* Recupere le hash dans le message */
+    if(message_get_cle(m, &type_cle, &hash, &taille_hash, cle)==-1)
+    {
+        fprintf(stderr, "Erreur : Le message ne contenait pas de hash.\n");
+        return 8;
+    }
+    
+    /* Le client accepte-t-il les extremites binaires ? */
+    binaire = message_get_bloc(m, "e", &type, &marqueur,
+                               &taille_marqueur)==0;
+    
+    /* Creer un message de type reponse */
+    err=create_message(&m2, 'r', SIZEOF_ENTETE);
+    if(err!=0)
+        return err;
+    
+    /* Si on a trouve le hash dans la table */
+    p = partition_cle(type_cle, hash, taille_hash, nb_partitions);
+    dht = &tables[p];
+    pthread_rwlock_rdlock(&verrous[p]);
+    table=consulter_hash(dht, type_cle, hash, taille_hash);
+    if(table!=NULL)
+    {
+        /* Pour chaque element de la liste d'adresse ip */
+        for(emp=table->dispo; emp!=NULL; emp=emp->next)
+        {
+            /* On ajoute l'adresse ip au message */
+            adresse = ADRESSE(dht, emp);
+            err=ajouter_adresse(m2, adresse, binaire);
+            if(err!=0)
+                break;
+        }
+    }
+    pthread_rwlock_unlock(&verrous[p]);
+    
+    if(err!=0 && err!=CODE_MESSAGE_PLEIN)
+    {
+        delete_message(m2);
+        return err;
+    }
+
+    /* Passage du message par effet de bord */
+    *retour = m2;
+    
+    return 0;
+}
+
+/**
+ * @brief Transmet un get a son proprietaire principal si le serveur n'est
+ *        pas proprietaire du hash (mode anneau).
+ *
+ * Le get transmis porte l'extremite du client (bloc 'x') : le proprietaire
+ * lui repond directement. Un get deja transmis par un autre serveur est
+ * toujours traite localement, meme si les anneaux des deux serveurs
+ * different un instant.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param m un pointeur sur le get reçu.
+ * @param client l'adresse du client.
+ * @param addrlen la longueur de l'adresse du client.
+ * @param transmis TRUE si le get a ete transmis (valeur de retour par effet
+ *        de bord), FALSE s'il doit etre traite localement.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int transmettre_get(travailleur *w, message *m, struct sockaddr *client,
+                    socklen_t addrlen, int *transmis)
+{
+    int err, proprietaire = FALSE;
+    unsigned int membres[ANNEAU_COPIES_MAX], n, i;
+    donnees *hash, *bloc, type_cle, type, cle[TAILLE_CLE_SHA256];
+    taille taille_hash, lg;
+    membre_anneau demandeur, destinataire;
+    message *m2 = NULL;
+    
+    *transmis = FALSE;
+    if(copies_anneau==0 || message_get_bloc(m, "x", &type, &bloc, &lg)==0 ||
+       message_get_cle(m, &type_cle, &hash, &taille_hash, cle)==-1 ||
+       membre_depuis_adresse(&demandeur, client, addrlen)==-1)
+        return 0;
+    
+    pthread_rwlock_rdlock(&verrou_anneau);
+    n = proprietaires(&vue_anneau, position_cle(type_cle, hash, taille_hash),
+                      membres);
+    for(i=0; i<n; i++)
+        proprietaire |= (int)membres[i]==rang_local;
+    if(n>0 && !proprietaire)
+        destinataire = vue_anneau.membres[membres[0]];
+    pthread_rwlock_unlock(&verrou_anneau);
+    if(n==0 || proprietaire)
+        return 0;
+    
+    /* Meme requete, avec l'extremite du client */
+    err=create_message(&m2, 'g', SIZEOF_ENTETE);
+    if(err==0)
+        err=add_data(m2, type_cle, taille_hash, hash);
+    if(err==0 && message_get_bloc(m, "e", &type, &bloc, &lg)==0)
+        err=add_data(m2, 'e', lg, bloc);
+    if(err==0)
+        err=add_data(m2, 'x', demandeur.taille_cle, demandeur.cle);
+    if(err!=0)
+    {
+        if(m2!=NULL)
+            delete_message(m2);
+        return err;
+    }
+    prepare_message(m2);
+    
+    err=ajouter_envoi(&w->envois, w->sockfd, m2,
+                      (struct sockaddr *) &destinataire.adresse,
+                      destinataire.addrlen);
+    if(err==0)
+        err=confier_message(&w->envois, w->sockfd, m2);
+    else
+        delete_message(m2);
+    
+    w->gets_transmis++;
+    *transmis = TRUE;
+    
+    return err;
+}
+
+/**
+ * @brief Indique a un client qui connait l'anneau qu'il ne s'est pas
+ *        adresse a un proprietaire du hash (mode anneau).
+ *
+ * Un client qui route lui-meme ses gets y joint l'empreinte de sa vue de
+ * l'anneau (bloc 'v', 8 octets, nulle s'il n'en a pas). Si le serveur n'est
+ * pas proprietaire du hash, ou si sa vue a une autre empreinte, il envoie la
+ * sienne au client (message 'w') ; le get est traite normalement ensuite.
+ * Seuls les gets, dont le client attend la reponse, reçoivent une vue, et au
+ * plus VUES_PAR_SECONDE vues par seconde sont envoyees par un thread : une
+ * adresse usurpee ne fait pas du serveur un amplificateur. Une vue non
+ * envoyee n'est pas une erreur.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param m un pointeur sur le get.
+ * @param client l'adresse du client.
+ * @param addrlen la longueur de l'adresse du client.
+*/
+void signaler_proprietaire(travailleur *w, message *m,
+                            struct sockaddr *client, socklen_t addrlen)
+{
+    int err = 0, proprietaire = FALSE;
+    unsigned int membres[ANNEAU_COPIES_MAX], n, i;
+    uint64_t empreinte;
+    long int maintenant;
+    donnees *hash, *bloc, type_cle, type, cle[TAILLE_CLE_SHA256];
+    taille taille_hash, lg;
+    message *m2 = NULL;
+    
+    if(copies_anneau==0 || message_get_bloc(m, "v", &type, &bloc, &lg)!=0 ||
+       lg!=sizeof(empreinte) ||
+       message_get_cle(m, &type_cle, &hash, &taille_hash, cle)==-1)
+        return;
+    memcpy(&empreinte, bloc, sizeof(empreinte));
+    
+    pthread_rwlock_rdlock(&verrou_anneau);
+    n = proprietaires(&vue_anneau, position_cle(type_cle, hash, taille_hash),
+                      membres);
+    for(i=0; i<n; i++)
+        proprietaire |= (int)membres[i]==rang_local;
+    if(proprietaire && be64toh(empreinte)==vue_anneau.empreinte)
+    {
+        pthread_rwlock_unlock(&verrou_anneau);
+        return;
+    }
+    
+    /* Limite des vues envoyees par seconde */
+    maintenant = time(NULL);
+    if(maintenant!=w->seconde_vues)
+    {
+        w->seconde_vues = maintenant;
+        w->vues_seconde = 0;
+    }
+    if(w->vues_seconde >= VUES_PAR_SECONDE)
+    {
+        pthread_rwlock_unlock(&verrou_anneau);
+        w->vues_limitees++;
+        return;
+    }
+    w->vues_seconde++;
+    
+    err=create_message(&m2, 'w', SIZEOF_ENTETE);
+    if(err==0)
+        err=ecrire_vue(m2, &vue_anneau);
+    pthread_rwlock_unlock(&verrou_anneau);
+    
+    /* Une vue trop grande pour un datagramme n'est pas envoyee */
+    if(err!=0)
+    {
+        if(m2!=NULL)
+            delete_message(m2);
+        return;
+    }
+    prepare_message(m2);
+    
+    if(ajouter_envoi(&w->envois, w->sockfd, m2, client, addrlen)!=0)
+    {
+        delete_message(m2);
+        return;
+    }
+    if(confier_message(&w->envois, w->sockfd, m2)==0)
+        w->vues_envoyees++;
+}
+
+/**
+ * @brief Renvoie le client d'un get transmis par un autre serveur.
+ *
+ * Seul un serveur connu peut faire repondre a un autre client que
+ * lui-meme.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param m un pointeur sur le get reçu.
+ * @param serveur l'adresse de l'emetteur du get.
+ * @param demandeur le client (valeur de retour par effet de bord).
+ * @return TRUE (1) si le get porte l'extremite d'un client (bloc 'x') et
+ *         vient d'un serveur connu, 0 sinon.
+*/
+int demandeur_get(travailleur *w, message *m, struct sockaddr *serveur,
+                    membre_anneau *demandeur)
+{
+    int connu;
+    donnees type, *bloc;
+    taille lg;
+    
+    if(message_get_bloc(m, "x", &type, &bloc, &lg)!=0 ||
+       membre_depuis_extremite(demandeur, bloc, lg)==-1)
+        return 0;
+    
+    pthread_mutex_lock(&verrou_serveurs);
+    connu = chercher_serveur(w->st, serveur)!=NULL;
+    pthread_mutex_unlock(&verrou_serveurs);
+    
+    return connu;
+}
+
+/**
+ * @brief Envoie un message de transfert puis le vide.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param m le message de transfert.
+ * @param destinataire l'adresse du destinataire.
+ * @param addrlen la longueur de l'adresse.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+int envoyer_transfert(int sockfd, message *m, struct sockaddr *destinataire,
+                        socklen_t addrlen)
+{
+    prepare_message(m);
+    
+    if(sendto(sockfd, m->contenu, m->lg_message, 0, destinataire,
+              addrlen) == -1)
+    {
+        perror("Error sendto");
+        return -1;
+    }
+    
+    /* Reutilisation du meme message en reecrivant sur les donnees
+       precedentes */
+    m->lg_message = SIZEOF_ENTETE;
+    
+    return 0;
+}
+
+/**
+ * @brief Envoie sa table de hash a un nouveau serveur.
+ *
+ * Envoie toute la table de hashage a un nouveau serveur se connectant au
+ * serveur courant, en regroupant les couples (hash,adresse) puis les
+ * serveurs connus dans des messages de transfert d'au plus
+ * taille_transfert octets. En mode anneau, seuls les serveurs sont envoyes :
+ * le nouveau serveur reçoit ses hash des autres serveurs quand ils l'ajoutent
+ * a leur anneau.
+ * Les partitions doivent etre verrouillees (en lecture) par l'appelant.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param nouveau_serv un pointeur vers la structure contenant les informations
+ *        necessaires pour parler au nouveau serveur.
+ * @param addrlen la longueur de nouveau_serv.
+ * @param st un pointeur vers le debut de la liste de serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int serveur_send_all(int sockfd, struct sockaddr *nouveau_serv, 
+                            socklen_t addrlen, l_serveur* st)
+{
+    int err = 0;
+    unsigned int p;
+    unsigned long couples = 0, messages = 0;
+    table_hash *dht;
+    message *m2;
+    l_hash *table;
+    l_emplacement * emp;
+    adresse_interne *adresse;
+    size_t curseur;
+
+    /* Cree un nouveau message de type transfert */
+    err=create_message(&m2, 't', taille_transfert);
+    if(err!=0)
+        return err;
+
+    /* Pour chaque partition de la table de hash */
+    for(p=0; p<nb_partitions && copies_anneau==0 && err==0; p++)
+    {
+        dht = &tables[p];
+        curseur = 0;
+        
+        /* Pour chaque element de la partition */
+        while(err==0 && (table=parcours_table(dht, &curseur))!=NULL)
+        {        
+            /* Pour chaque element de la liste d'adresse ip */
+            for(emp = table->dispo; emp!=NULL && err==0; emp=emp->next)
+            {
+                /* Ajout du couple hash/adresse au message, envoye au
+                   nouveau serveur lorsqu'il est plein */
+                adresse = ADRESSE(dht, emp);
+                err=ajouter_couple(m2, table->type_cle, table->hash,
+                                   table->taille_hash, adresse->type_adresse,
+                                   adresse->octets, adresse->taille_adresse,
+                                   -1);
+                if(err==CODE_MESSAGE_PLEIN)
+                {
+                    if(envoyer_transfert(sockfd, m2, nouveau_serv,
+                                         addrlen)==-1)
+                        err = 9;
+                    else
+                    {
+                        messages++;
+                        err=ajouter_couple(m2, table->type_cle, table->hash,
+                                           table->taille_hash,
+                                           adresse->type_adresse,
+                                           adresse->octets,
+                                           adresse->taille_adresse, -1);
+                    }
+                }
+                couples++;
+            }
+        }
+    }
+    
+    if(err==0 && m2->lg_message > SIZEOF_ENTETE)
+    {
+        if(envoyer_transfert(sockfd, m2, nouveau_serv, addrlen)==-1)
+            err = 9;
+        else
+            messages++;
+    }
+    
+    /* Les serveurs connus sont regroupes de la meme facon */
+    for(; st!=NULL && err==0; st=st->next)
+    {
+        if(m2->lg_message > SIZEOF_ENTETE &&
+           m2->lg_message+SIZEOF_ENTETE_BLOC+st->addrlen > taille_transfert &&
+           envoyer_transfert(sockfd, m2, nouveau_serv, addrlen)==-1)
+            err = 18;
+        
+        /* Ajout du serveur dans le message */
+        if(err==0)
+            err=add_data(m2, 's', st->addrlen, st->serveur);
+    }
+    
+    if(err==0 && m2->lg_message > SIZEOF_ENTETE &&
+       envoyer_transfert(sockfd, m2, nouveau_serv, addrlen)==-1)
+        err = 18;
+    
+    delete_message(m2);
+    if(err!=0)
+        return err;
+    
+    printf("Transfert : %lu couples en %lu messages\n", couples, messages);
+    
+    /* Cree un nouveau message de type fin */
+    err=create_message(&m2, 'f', SIZEOF_ENTETE);
+    if(err!=0)
+        return err;
+
+    prepare_message(m2);
+    
+    /* Envoie un message signifiant la fin du transfert du DHT */
+    if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
+                nouveau_serv, addrlen) == -1)
+    {
+        perror("Error sendto");
+        delete_message(m2);
+        return 10;
+    }
+    
+    delete_message(m2); 
+
+    return 0;
+}
+
+/**
+ * @brief Informe tout les serveurs connus de l'arret du serveur courant.
+ *
+ * Envoie un message de type 'd' (deconnexion) a tout les serveurs de la liste 
+ * de serveurs pour les informer que le programme va s'arreter.
+ *
+ * @param st un pointeur sur le debut de la liste de serveurs.
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int informer_arret_serveur(l_serveur *st, int sockfd)
+{
+    int err;
+    message *m;
+    l_serveur *serv;
+
+    /* Cree un nouveau message de type deconnexion */
+    err=create_message(&m, 'd', SIZEOF_ENTETE);
+    if(err!=0)
+        return err;
+    
+    prepare_message(m);
+
+    for(serv=st; serv!=NULL; serv=serv->next)
+    {
+        /* Envoie le message de deconnexion a un serveur */
+        if(sendto(sockfd, m->contenu, m->lg_message, 0,
+                  serv->serveur, serv->addrlen) == -1)
+        {
+            perror("Error sendto");
+            delete_message(m);
+            return 11;
+        }
+    }
+
+    delete_message(m);
+
+    return 0;
+}
+
+/**
+ * @brief Supprime les serveurs qui ne repondent pas et questionne les autres.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus (les serveurs
+ *        n'ayant pas repondu en sont retires).
+ * @param sockfd l'identifiant d'un socket.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int check_send_KA(serveurs_connus *st, int sockfd)
+{
+    int err;
+    message *m;
+    l_serveur *actu, *suivant;
+    
+    if(st->premier == NULL)
+        return 0;
+    
+    /* Creer un nouveau message de type keep-alive */
+    err=create_message(&m, 'k', SIZEOF_ENTETE);
+    if(err!=0)
+        return err;
+    
+    prepare_message(m);
+    
+    /* Parcours de la liste de serveurs */
+    for(actu=st->premier; actu!=NULL; actu=suivant)
+    {
+        suivant = actu->next;
+        
+        /* Suppression d'un serveur n'ayant pas repondu */
+        if(actu->present==0)
+        {
+            retirer_serveur(st, actu);
+            printf("Serveur déconnecté: pas de réponse au keep-alive\n");
+        }
+        else /* Renvoie d'un message keep-alive a un serveur ayant repondu */
+        {
+            if(sendto(sockfd, m->contenu, m->lg_message, 0,
+                      actu->serveur, actu->addrlen) == -1)
+            {
+                perror("Error sendto");
+                delete_message(m);
+                return 12;
+            }
+            
+            actu->present=0;
+        }
+    }
+    
+    delete_message(m);
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute a un message la position courante de l'historique du
+ *        serveur (bloc 'q'), si l'historique est active.
+ *
+ * @param m un pointeur sur le message.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ajouter_position(message *m)
+{
+    position courante = position_historique(&modifications);
+    uint64_t valeurs[2] = {htobe64(courante.epoque),
+                           htobe64(courante.sequence)};
+    
+    if(modifications.anneau==NULL)
+        return 0;
+    
+    return add_data(m, 'q', sizeof(valeurs), valeurs);
+}
+
+/**
+ * @brief Enregistre le fait qu'un serveur soit toujours actif.
+ *
+ * Le serveur est retrouve par l'index des serveurs connus. Sa reponse porte
+ * la position de son historique (bloc 'q' : epoque puis sequence, 8 octets
+ * chacune dans l'ordre du reseau), conservee comme position du serveur
+ * courant dans cet historique.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param serv un pointeur sur la structure contenant les informations du
+ *        serveur ayant repondu.
+ * @param m un pointeur sur la reponse au keep-alive.
+*/
+void isAlive(serveurs_connus *st, struct sockaddr *serv, message *m)
+{
+    l_serveur *emp = chercher_serveur(st, serv);
+    uint64_t valeurs[2];
+    donnees type, *bloc;
+    taille lg;
+    
+    if(emp==NULL)
+        return;
+    
+    emp->present=1;
+    if(message_get_bloc(m, "q", &type, &bloc, &lg)==0 &&
+       lg==sizeof(valeurs))
+    {
+        memcpy(valeurs, bloc, sizeof(valeurs));
+        emp->epoque = be64toh(valeurs[0]);
+        emp->sequence = be64toh(valeurs[1]);
+    }
+}
+
+/**
+ * @brief Releve les positions du serveur dans l'historique des serveurs
+ *        connus.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param releve les positions (au plus POSITIONS_MAX, valeur de retour par
+ *        effet de bord).
+ * @return le nombre de positions.
+*/
+unsigned int relever_positions(serveurs_connus *st, position *releve)
+{
+    unsigned int nb = 0;
+    l_serveur *emp;
+    
+    pthread_mutex_lock(&verrou_serveurs);
+    for(emp=st->premier; emp!=NULL && nb<POSITIONS_MAX; emp=emp->next)
+    {
+        if(emp->epoque==0)
+            continue;
+        releve[nb].epoque = emp->epoque;
+        releve[nb].sequence = emp->sequence;
+        nb++;
+    }
+    pthread_mutex_unlock(&verrou_serveurs);
+    
+    return nb;
+}
+
+/**
+ * @brief Gere l'obsolescence des adresses associees aux hashs
+ *
+ * Supprime les donnees devenues obsoletes depuis le dernier appel. Seules les
+ * adresses arrivant a echeance sont examinees (roue d'obsolescence).
+ *
+ * @param dht un pointeur sur la table de hashs.
+ * @return le temps avant la prochaine verification.
+*/
+int gestion_obsolescence(table_hash *dht)
+{
+    expire_emplacements(dht, time(NULL));
+    
+    return 1;
+}
+
+/**
+ * @brief Gere l'obsolescence de la partition d'un thread, a chaque passage
+ *        de son minuteur.
+ *
+ * @param w un pointeur sur le thread de reception (son indice designe la
+ *        partition).
+*/
+void verifier_obsolescence(travailleur *w)
+{
+    pthread_rwlock_wrlock(&verrous[w->indice]);
+    gestion_obsolescence(&tables[w->indice]);
+    pthread_rwlock_unlock(&verrous[w->indice]);
+}
+
+/**
+ * @brief Verrouille toutes les partitions, par indice croissant.
+ *
+ * @param ecriture TRUE pour les verrouiller en ecriture, FALSE en lecture.
+*/
+void verrouiller_partitions(int ecriture)
+{
+    unsigned int p;
+    
+    for(p=0; p<nb_partitions; p++)
+    {
+        if(ecriture)
+            pthread_rwlock_wrlock(&verrous[p]);
+        else
+            pthread_rwlock_rdlock(&verrous[p]);
+    }
+}
+
+/**
+ * @brief Deverrouille toutes les partitions.
+*/
+void deverrouiller_partitions()
+{
+    unsigned int p;
+    
+    for(p=0; p<nb_partitions; p++)
+        pthread_rwlock_unlock(&verrous[p]);
+}
+
+/**
+ * @brief Affiche les statistiques de commerage d'un thread.
+ *
+ * Les couples nouveaux sont comptes par tour de reception : le tour le plus
+ * eleve atteint donne la profondeur de la propagation, et le delai maximal
+ * depuis le put d'origine le temps de convergence vu par ce serveur.
+ *
+ * @param w un pointeur sur le thread de reception.
+*/
+void afficher_stats_commerage(travailleur *w)
+{
+    unsigned int t;
+    unsigned long nouveaux = 0;
+    
+    for(t=0; t<GOSSIP_TOURS_MAX; t++)
+        nouveaux += w->nouveaux_tour[t];
+    
+    printf("Commerage : %lu couples nouveaux, %lu redondants", nouveaux,
+           w->redondants);
+    if(nouveaux>0)
+        printf(", delai moyen %.1f ms, maximum %lu ms",
+               (double)w->delai_total/nouveaux,
+               (unsigned long)w->delai_max);
+    printf("\n    tours :");
+    for(t=0; t<GOSSIP_TOURS_MAX; t++)
+    {
+        if(w->nouveaux_tour[t]>0)
+            printf(" %u %lu,", t, w->nouveaux_tour[t]);
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Affiche les statistiques du serveur sur la sortie standard.
+ *
+ * Les compteurs des autres threads sont lus sans les interrompre : ils
+ * peuvent etre en retard de quelques datagrammes. En mode partitionne, les
+ * put et get d'un thread sont ceux de sa partition, qu'ils aient ete reçus
+ * par sa socket ou transmis par un autre thread : leur desequilibre est
+ * celui des partitions.
+*/
+void afficher_statistiques()
+{
+    unsigned int i, d;
+    unsigned long perdus;
+    
+    printf("--- Statistiques ---\n");
+    for(i=0; i<nb_partitions; i++)
+    {
+        if(nb_partitions>1)
+            printf("Partition %u :\n", i);
+        pthread_rwlock_rdlock(&verrous[i]);
+        afficher_stats_table(&tables[i], stdout);
+        pthread_rwlock_unlock(&verrous[i]);
+    }
+    for(i=0; i<nb_threads; i++)
+    {
+        printf("Thread %u : %lu put, %lu get\n", i, travailleurs[i].puts,
+               travailleurs[i].gets);
+        if(mode_partitions)
+        {
+            for(d=0, perdus=0; d<nb_threads; d++)
+            {
+                if(d!=i)
+                    perdus += travailleurs[d].entrantes[i].perdus;
+            }
+            printf("Transferts : %lu transmis a d'autres partitions, "\
+                   "%lu reçus, %lu perdus (file pleine)\n",
+                   travailleurs[i].transmis, travailleurs[i].recus, perdus);
+        }
+        if(travailleurs[i].messages_replication>0)
+            printf("Replication : %lu couples en %lu messages (%.1f par "\
+                   "message, %lu partis a l'echeance) et %lu datagrammes, "\
+                   "%lu doublons ecartes\n",
+                   travailleurs[i].couples_repliques,
+                   travailleurs[i].messages_replication,
+                   (double)travailleurs[i].couples_repliques/
+                   travailleurs[i].messages_replication,
+                   travailleurs[i].envois_echeance,
+                   travailleurs[i].datagrammes_replication,
+                   travailleurs[i].doublons_ecartes);
+        if(fanout_gossip>0)
+            afficher_stats_commerage(&travailleurs[i]);
+        if(copies_anneau>0)
+            printf("Anneau : %lu put et %lu get transmis aux "\
+                   "proprietaires, %lu vues envoyees aux clients (%lu "\
+                   "limitees)\n",
+                   travailleurs[i].puts_transmis,
+                   travailleurs[i].gets_transmis,
+                   travailleurs[i].vues_envoyees,
+                   travailleurs[i].vues_limitees);
+        afficher_stats_lots(&travailleurs[i].lot, &travailleurs[i].envois,
+                            stdout);
+#ifdef AVEC_URING
+        if(travailleurs[i].lot.uring!=NULL)
+            afficher_stats_uring(&travailleurs[i].es, stdout);
+#endif
+    }
+    if(copies_anneau>0)
+    {
+        pthread_rwlock_rdlock(&verrou_anneau);
+        printf("Anneau : %u serveurs, %u copies, %u noeuds virtuels par "\
+               "serveur, %lu reconstructions, %lu hash deplaces, %lu "\
+               "retires\n", vue_anneau.nb_membres, copies_anneau,
+               virtuels_anneau, generation_anneau, hash_deplaces,
+               hash_retires);
+        pthread_rwlock_unlock(&verrou_anneau);
+    }
+    if(modifications.anneau!=NULL)
+        afficher_stats_historique(&modifications, stdout);
+    if(periode_merkle>0)
+        printf("Anti-entropie : %lu comparaisons lancees, %lu noeuds "\
+               "compares, %lu feuilles differentes, %lu couples envoyes\n",
+               tours_merkle, noeuds_compares, feuilles_differentes,
+               couples_pousses);
+    if(journal_actif)
+        afficher_stats_journal(&journal_puts, stdout);
+    fflush(stdout);
+}
+
+/**
+ * @brief Traite les signaux en attente sur le signalfd.
+ *
+ * - SIGINT : arret du serveur.
+ * - SIGUSR1 : affichage des statistiques.
+ *
+ * @param signaux l'identifiant du signalfd.
+*/
+void lire_signaux(int signaux)
+{
+    struct signalfd_siginfo info;
+    
+    while(read(signaux, &info, sizeof(info))==sizeof(info))
+    {
+        if(info.ssi_signo==SIGINT)
+            serveur_actif = FALSE;
+        else if(info.ssi_signo==SIGUSR1)
+            afficher_statistiques();
+    }
+}
+
+/**
+ * @brief Lance l'ecriture de l'instantane de la table dans un processus fils.
+ *
+ * Le fils travaille sur une copie de la memoire du serveur (fork), le
+ * serveur continue donc de repondre pendant l'ecriture. Une seule ecriture
+ * est en cours a la fois. Le journal commence un nouveau segment au meme
+ * instant : le precedent sera supprime une fois l'instantane ecrit. Les
+ * positions du serveur dans l'historique des autres, relevees avant la
+ * copie, sont ecrites apres l'instantane.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int lancer_instantane(serveurs_connus *st)
+{
+    int err;
+    pid_t pid;
+    position releve[POSITIONS_MAX];
+    unsigned int nb;
+    
+    if(pid_instantane!=0)
+        return 0;
+    
+    nb = relever_positions(st, releve);
+    
+    /* Aucun put ne doit etre en cours pendant le fork : le fils recoit une
+       table coherente, et le journal change de segment au meme instant */
+    verrouiller_partitions(TRUE);
+    if(journal_actif)
+        pivoter_journal(&journal_puts);
+    
+    pid = fork();
+    deverrouiller_partitions();
+    if(pid==-1)
+    {
+        perror("Error fork");
+        return 17;
+    }
+    
+    if(pid==0)
+    {
+        err=ecrire_instantane_partitions(tables, nb_partitions,
+                                         fichier_instantane);
+        if(err==0)
+            err=ecrire_positions(fichier_instantane, releve, nb);
+        _exit(err);
+    }
+    
+    pid_instantane = pid;
+    
+    return 0;
+}
+
+/**
+ * @brief Recupere le processus fils ecrivant l'instantane s'il a termine.
+ *
+ * @param attendre TRUE pour attendre la fin de l'ecriture en cours.
+*/
+void terminer_instantane(int attendre)
+{
+    int statut;
+    pid_t pid;
+    
+    if(pid_instantane==0)
+        return;
+    
+    do
+        pid = waitpid(pid_instantane, &statut, attendre ? 0 : WNOHANG);
+    while(pid==-1 && errno==EINTR);
+    
+    if(pid==0)
+        return;
+    
+    if(pid==-1 || !WIFEXITED(statut) || WEXITSTATUS(statut)!=0)
+        fprintf(stderr, "Erreur : l'ecriture de l'instantane a echoue\n");
+    else if(journal_actif)
+        oublier_ancien_journal(&journal_puts);
+    
+    pid_instantane = 0;
+}
+
+/**
+ * @brief Journalise l'eviction d'un hash par le plafond memoire.
+ *
+ * @param contexte un pointeur sur le journal.
+ * @param table le hash evince.
+*/
+void journaliser_eviction(void *contexte, l_hash *table)
+{
+    journaliser_retrait(contexte, time(NULL), table->type_cle, table->hash,
+                        table->taille_hash);
+}
+
+/**
+ * @brief Restaure l'etat precedent de la table puis ouvre le journal.
+ *
+ * L'instantane est charge, puis le journal est rejoue par-dessus. Le journal
+ * est ensuite compacte : avec un instantane, un nouvel instantane est ecrit
+ * et le journal repart vide ; sinon, le journal est reecrit avec un seul put
+ * par adresse encore presente. Les evictions ne sont pas encore journalisees
+ * (voir restaurer_partitions).
+ *
+ * @param dht un pointeur sur la table de hashs.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int restaurer_table(table_hash *dht)
+{
+    int err = 0;
+    unsigned long chargees, ignorees;
+    struct timespec debut, fin;
+    
+    /* Rechargement du dernier instantane (les adresses obsoletes sont
+       ignorees) */
+    if(fichier_instantane!=NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &debut);
+        err=charger_instantane(dht, fichier_instantane, &chargees, &ignorees);
+        clock_gettime(CLOCK_MONOTONIC, &fin);
+        if(err!=0)
+            fprintf(stderr, "Erreur : instantane ignore (%d)\n", err);
+        
+        /* Positions dans l'historique des autres serveurs a la date de
+           l'instantane : seules les modifications posterieures seront
+           demandees */
+        else if(charger_positions(fichier_instantane, positions,
+                                  &nb_positions)!=0)
+            nb_positions = 0;
+        printf("Instantane : %lu adresses chargees, %lu obsoletes ignorees "\
+               "en %ld ms\n", chargees, ignorees,
+               (fin.tv_sec-debut.tv_sec)*1000
+               + (fin.tv_nsec-debut.tv_nsec)/1000000);
+    }
+    
+    if(fichier_journal==NULL)
+        return 0;
+    
+    /* Rejeu des put posterieurs a l'instantane */
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+    err=rejouer_journal(dht, fichier_journal, &chargees, &ignorees);
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    if(err!=0)
+    {
+        fprintf(stderr, "Erreur : journal illisible (%d)\n", err);
+        return err;
+    }
+    printf("Journal : %lu enregistrements rejoues, %lu obsoletes ignores "\
+           "en %ld ms\n", chargees, ignorees,
+           (fin.tv_sec-debut.tv_sec)*1000
+           + (fin.tv_nsec-debut.tv_nsec)/1000000);
+    
+    /* Compaction */
+    if(fichier_instantane!=NULL)
+    {
+        err=ecrire_instantane(dht, fichier_instantane);
+        if(err==0)
+            supprimer_journal(fichier_journal);
+    }
+    else
+    {
+        err=compacter_journal(dht, fichier_journal);
+    }
+    if(err!=0)
+        return err;
+    
+    err=ouvrir_journal(&journal_puts, fichier_journal, intervalle_journal);
+    if(err!=0)
+        return err;
+    
+    journal_actif = TRUE;
+    
+    return 0;
+}
+
+/**
+ * @brief Restaure l'etat precedent dans les partitions de la table.
+ *
+ * Avec plusieurs partitions, l'etat est restaure (et le journal compacte)
+ * dans une table temporaire, dont les hash sont ensuite repartis. Les
+ * evictions de chaque partition sont ensuite journalisees.
+ *
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int restaurer_partitions()
+{
+    int err;
+    unsigned int p;
+    table_hash chargee;
+    
+    if(nb_partitions==1)
+    {
+        err=restaurer_table(&tables[0]);
+    }
+    else
+    {
+        if((err=init_table_hash(&chargee))!=0)
+            return err;
+        chargee.budget.max = memoire_max;
+        err=restaurer_table(&chargee);
+        if(err==0)
+            err=repartir_table(&chargee, tables, nb_partitions);
+        delete_table_hash(&chargee);
+    }
+    if(err!=0)
+        return err;
+    
+    for(p=0; journal_actif && p<nb_partitions; p++)
+    {
+        tables[p].retrait = journaliser_eviction;
+        tables[p].contexte_retrait = &journal_puts;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Informe tout les serveurs connus de la creation d'un nouveau serveur.
+ *
+ * En mode commerage, seuls des serveurs tires au hasard sont informes, avec
+ * le tour de l'annonce (bloc 'i') : ceux pour qui le serveur est nouveau la
+ * propagent a leur tour. Les serveurs connus doivent etre verrouilles.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param nouveau_serv les informations du nouveau serveur.
+ * @param addrlen la longueur des infos du nouveau serveur.
+ * @param tour le tour de l'annonce (0 pour le serveur contacte).
+ * @param graine l'etat du generateur pseudo-aleatoire de l'appelant.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int informer_connexion_serveur(int sockfd, serveurs_connus *st,
+                        struct sockaddr * nouveau_serv, taille addrlen,
+                        unsigned int tour, unsigned int *graine)
+{
+    int err;
+    unsigned int i, n = 0;
+    uint64_t origine = htobe64(maintenant_ms());
+    donnees bloc[TAILLE_BLOC_TOUR];
+    message *m;
+    l_serveur *emp, *voisins[GOSSIP_FANOUT_MAX];
+
+    /* Creer un nouveau message de type transfert */
+    err=create_message(&m, 't', SIZEOF_ENTETE);
+    if(err!=0)
+        return err;
+    
+    /* Tour de l'annonce en mode commerage */
+    if(fanout_gossip>0)
+    {
+        bloc[0] = tour;
+        memcpy(bloc+1, &origine, sizeof(origine));
+        n = tirer_voisins(st, graine, voisins);
+        err=add_data(m, 'i', TAILLE_BLOC_TOUR, bloc);
+        if(err!=0)
+        {
+            delete_message(m);
+            return err;
+        }
+    }
+    
+    /* Ajout des donnees d'un serveur au message */
+    err=add_data(m, 's', addrlen, nouveau_serv);
+    if(err!=0)
+    {
+        delete_message(m);
+        return err;
+    }
+
+    prepare_message(m);
+    
+    /* Envoie du message a tt les serveurs connus */
+    for(emp=st->premier; fanout_gossip==0 && emp!=NULL; emp=emp->next)
+    {
+        if(sendto(sockfd, m->contenu, m->lg_message, 0,
+                  emp->serveur, emp->addrlen) == -1)
+        {
+            perror("Error sendto");
+            delete_message(m);
+            return 17;
+        }
+    }
+    
+    /* Ou seulement a ceux tires en mode commerage */
+    for(i=0; i<n; i++)
+    {
+        if(sendto(sockfd, m->contenu, m->lg_message, 0,
+                  voisins[i]->serveur, voisins[i]->addrlen) == -1)
+        {
+            perror("Error sendto");
+            delete_message(m);
+            return 17;
+        }
+    }
+    
+    delete_message(m);
+    
+    return 0;
+}
+
+/**
+ * @brief Compte un couple reçu par commerage et le propage s'il etait
+ *        nouveau.
+ *
+ * Un couple deja connu (meme date) n'est pas propage : la propagation
+ * s'arrete d'elle-meme quand les serveurs tires connaissent deja les
+ * couples, et au plus tard au tour tours_gossip.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param tour le tour auquel le couple a ete reçu.
+ * @param origine la date (ms) du put d'origine du couple.
+ * @param change TRUE si le couple a modifie la table.
+ * @param type_cle le type du hash.
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int propager_couple(travailleur *w, unsigned int tour, uint64_t origine,
+                        int change, donnees type_cle, donnees *hash,
+                        taille taille_hash, donnees type_adresse,
+                        donnees *adresse, taille taille_adresse)
+{
+    uint64_t maintenant = maintenant_ms(), delai;
+    
+    if(!change)
+    {
+        w->redondants++;
+        return 0;
+    }
+    
+    w->nouveaux_tour[tour]++;
+    delai = maintenant > origine ? maintenant-origine : 0;
+    w->delai_total += delai;
+    if(delai > w->delai_max)
+        w->delai_max = delai;
+    
+    if(tour+1 >= tours_gossip)
+        return 0;
+    
+    return repliquer_couple(w, tour+1, origine, type_cle, hash, taille_hash,
+                            type_adresse, adresse, taille_adresse);
+}
+
+/**
+ * @brief Verifie qu'un bloc 's' contient bien une adresse de serveur.
+ *
+ * @param bloc le contenu du bloc.
+ * @param lg la taille du bloc.
+ * @return TRUE si le bloc est une sockaddr_in ou une sockaddr_in6 complete,
+ *         FALSE sinon.
+*/
+int adresse_serveur_valide(const donnees *bloc, taille lg)
+{
+    sa_family_t famille;
+    
+    if(lg<sizeof(famille))
+        return FALSE;
+    memcpy(&famille, bloc, sizeof(famille));
+    
+    return (lg==sizeof(struct sockaddr_in) && famille==AF_INET) ||
+           (lg==sizeof(struct sockaddr_in6) && famille==AF_INET6);
+}
+
+/**
+ * @brief Applique un message de transfert reçu d'un autre serveur.
+ *
+ * Le message contient des serveurs (blocs 's') ou une suite de couples
+ * hash/adresse : chaque adresse est associee au dernier hash qui la precede.
+ * Un bloc 'o' (anti-entropie) donne l'age de l'adresse qui le suit : elle
+ * garde sa date d'annonce, et est ignoree si elle est deja obsolete. Chaque
+ * couple est ajoute sous le verrou de sa partition. Seuls les couples et
+ * serveurs precedes d'un bloc 'i' (commerage) sont propages, par le thread
+ * qui les reçoit. Un bloc 's' qui n'est pas une adresse IPv4 ou IPv6
+ * complete est ignore.
+ *
+ * @param m un pointeur sur le message reçu.
+ * @param w un pointeur sur le thread de reception (NULL pour ne rien
+ *        propager).
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int reception_transfert(message *m, travailleur *w, serveurs_connus *st)
+{
+    int err = 0, lu, change, commerage = FALSE;
+    unsigned int tour = 0;
+    long int maintenant = time(NULL), age = 0;
+    uint16_t age_reseau;
+    uint64_t origine = 0;
+    donnees type, *bloc, type_cle = 0, *hash = NULL;
+    donnees cle[TAILLE_CLE_SHA256], ext[TAILLE_EXTREMITE_IPV6];
+    taille lg, taille_hash = 0;
+    
+    for(lu=message_get_bloc(m, "hbaesoi", &type, &bloc, &lg);
+        lu==0 && err==0;
+        lu=message_get_bloc(NULL, "hbaesoi", &type, &bloc, &lg))
+    {
+        /* Age de l'adresse suivante */
+        if(type=='o')
+        {
+            if(lg==sizeof(age_reseau))
+            {
+                memcpy(&age_reseau, bloc, sizeof(age_reseau));
+                age = ntohs(age_reseau);
+            }
+        }
+        /* Tour et date d'origine des couples et serveurs suivants */
+        else if(type=='i')
+        {
+            if(lg==TAILLE_BLOC_TOUR && bloc[0] < GOSSIP_TOURS_MAX)
+            {
+                commerage = w!=NULL;
+                tour = bloc[0];
+                memcpy(&origine, bloc+1, sizeof(origine));
+                origine = be64toh(origine);
+            }
+        }
+        /* Reception d'un serveur, annonce aux serveurs tires au hasard
+           avant d'etre ajoute s'il etait inconnu */
+        else if(type=='s')
+        {
+            /* Un bloc tronque n'est ni cherche, ni propage, ni ajoute */
+            if(!adresse_serveur_valide(bloc, lg))
+                continue;
+            pthread_mutex_lock(&verrou_serveurs);
+            if(commerage && fanout_gossip>0 && tour+1 < tours_gossip &&
+               chercher_serveur(st, (struct sockaddr *) bloc)==NULL)
+                err=informer_connexion_serveur(w->sockfd, st,
+                                               (struct sockaddr *) bloc, lg,
+                                               tour+1, &w->graine);
+            if(err==0)
+                err=add_a_serveurs(st, (struct sockaddr *) bloc,
+                                   (socklen_t) lg);
+            pthread_mutex_unlock(&verrou_serveurs);
+        }
+        /* Hash des adresses suivantes */
+        else if(type=='h' || type=='b')
+        {
+            type_cle = type;
+            hash = bloc;
+            taille_hash = lg;
+            normaliser_cle(&type_cle, &hash, &taille_hash, cle);
+        }
+        /* Reception d'un couple hash/adresse */
+        else
+        {
+            if(hash!=NULL && age < TEMPS_OBSOLESCENCE &&
+               normaliser_adresse(&type, &bloc, &lg, ext)==0)
+            {
+                err=stocker_couple(type_cle, hash, taille_hash, type, bloc,
+                                   lg, maintenant-age, &change);
+                if(err==0 && commerage)
+                    err=propager_couple(w, tour, origine, change, type_cle,
+                                        hash, taille_hash, type, bloc, lg);
+            }
+            age = 0;
+        }
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Ajoute les adresses d'un hash aux couples destines a un membre
+ *        d'un anneau, avec leur age.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param vers les messages de transfert de chaque membre (crees au besoin).
+ * @param a l'anneau.
+ * @param membre l'indice du membre destinataire.
+ * @param dht la partition du hash.
+ * @param table le hash.
+ * @param maintenant la date courante.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_hash(int sockfd, message **vers, const anneau *a,
+                    unsigned int membre, table_hash *dht, l_hash *table,
+                    long int maintenant)
+{
+    int err = 0;
+    long int age;
+    l_emplacement *emp;
+    adresse_interne *adresse;
+    membre_anneau *dest = &a->membres[membre];
+    
+    if(vers[membre]==NULL &&
+       (err=create_message(&vers[membre], 't', taille_transfert))!=0)
+        return err;
+    
+    for(emp=table->dispo; emp!=NULL && err==0; emp=emp->next)
+    {
+        adresse = ADRESSE(dht, emp);
+        age = maintenant-emp->obsolescence;
+        if(age < 0)
+            age = 0;
+        err=ajouter_couple(vers[membre], table->type_cle, table->hash,
+                           table->taille_hash, adresse->type_adresse,
+                           adresse->octets, adresse->taille_adresse, age);
+        if(err==CODE_MESSAGE_PLEIN)
+        {
+            if(envoyer_transfert(sockfd, vers[membre],
+                                 (struct sockaddr *) &dest->adresse,
+                                 dest->addrlen)==-1)
+                err = 9;
+            else
+                err=ajouter_couple(vers[membre], table->type_cle,
+                                   table->hash, table->taille_hash,
+                                   adresse->type_adresse, adresse->octets,
+                                   adresse->taille_adresse, age);
+        }
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Indique si un membre figure parmi des proprietaires.
+ *
+ * @param membres les indices des proprietaires.
+ * @param n le nombre de proprietaires.
+ * @param membre l'indice cherche (-1 si le membre n'est pas dans l'anneau).
+ * @return TRUE (1) si le membre est l'un des proprietaires, 0 sinon.
+*/
+int est_proprietaire(const unsigned int *membres, unsigned int n, int membre)
+{
+    unsigned int i;
+    
+    for(i=0; i<n; i++)
+    {
+        if((int)membres[i]==membre)
+            return TRUE;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Deplace les hash du serveur vers leurs proprietaires dans un
+ *        nouvel anneau.
+ *
+ * Pour chaque hash, seul le premier de ses anciens proprietaires encore
+ * present dans le nouvel anneau (le serveur lui-meme si aucun ne l'est)
+ * l'envoie, et seulement aux nouveaux proprietaires : un ajout ou un
+ * retrait de serveur ne deplace que les hash des intervalles qu'il gagne ou
+ * perd. Un hash que le serveur detient sans en etre proprietaire (couples
+ * restaures ou reçus pendant un changement d'anneau) est envoye a tous ses
+ * proprietaires. Les hash dont le serveur n'est plus proprietaire ne sont
+ * retires, si retirer le demande, qu'une fois tous les datagrammes envoyes :
+ * un envoi qui echoue n'en retire aucun. L'appelant tient verrou_anneau et
+ * les partitions en ecriture.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param ancien l'anneau precedent (vide au demarrage).
+ * @param nouveau le nouvel anneau (l'anneau courant lui-meme pour renvoyer
+ *        les hash cedes, voir ceder_hash).
+ * @param retirer TRUE pour retirer ensuite les hash dont le serveur n'est
+ *        plus proprietaire.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int deplacer_hash(int sockfd, anneau *ancien, anneau *nouveau, int retirer)
+{
+    int err = 0, local_ancien, local_nouveau, envoyeur, dans_nouveau, k;
+    unsigned int anciens[ANNEAU_COPIES_MAX], nouveaux[ANNEAU_COPIES_MAX];
+    unsigned int p, i, na, nn, envoyes;
+    unsigned long etrangers = 0;
+    long int maintenant = time(NULL);
+    uint64_t position;
+    table_hash *dht;
+    l_hash *table;
+    message **vers;
+    membre_anneau *cible;
+    size_t curseur;
+    
+    vers = calloc(nouveau->nb_membres>0 ? nouveau->nb_membres : 1,
+                  sizeof(message *));
+    if(vers==NULL)
+    {
+        perror("Error malloc");
+        return 20;
+    }
+    
+    local_ancien = chercher_membre(ancien, membre_local.cle,
+                                   membre_local.taille_cle);
+    local_nouveau = chercher_membre(nouveau, membre_local.cle,
+                                    membre_local.taille_cle);
+    
+    for(p=0; p<nb_partitions && err==0; p++)
+    {
+        dht = &tables[p];
+        curseur = 0;
+        while(err==0 && (table=parcours_table(dht, &curseur))!=NULL)
+        {
+            position = position_cle(table->type_cle, table->hash,
+                                    table->taille_hash);
+            na = proprietaires(ancien, position, anciens);
+            nn = proprietaires(nouveau, position, nouveaux);
+            dans_nouveau = est_proprietaire(nouveaux, nn, local_nouveau);
+            
+            /* Envoyeur : premier ancien proprietaire encore present */
+            envoyeur = local_ancien;
+            for(i=0; i<na; i++)
+            {
+                if(chercher_membre(nouveau, ancien->membres[anciens[i]].cle,
+                                   ancien->membres[anciens[i]].taille_cle)!=-1)
+                {
+                    envoyeur = anciens[i];
+                    break;
+                }
+            }
+            
+            envoyes = 0;
+            if(est_proprietaire(anciens, na, local_ancien))
+            {
+                for(i=0; envoyeur==local_ancien && i<nn && err==0; i++)
+                {
+                    cible = &nouveau->membres[nouveaux[i]];
+                    k = chercher_membre(ancien, cible->cle, cible->taille_cle);
+                    if((int)nouveaux[i]==local_nouveau ||
+                       est_proprietaire(anciens, na, k))
+                        continue;
+                    err=envoyer_hash(sockfd, vers, nouveau, nouveaux[i], dht,
+                                     table, maintenant);
+                    envoyes++;
+                }
+            }
+            else if(!dans_nouveau)
+            {
+                for(i=0; i<nn && err==0; i++, envoyes++)
+                    err=envoyer_hash(sockfd, vers, nouveau, nouveaux[i], dht,
+                                     table, maintenant);
+            }
+            if(envoyes>0 && ancien!=nouveau)
+                hash_deplaces++;
+            if(!dans_nouveau)
+                etrangers++;
+        }
+    }
+    
+    for(i=0; i<nouveau->nb_membres; i++)
+    {
+        if(vers[i]==NULL)
+            continue;
+        if(err==0 && vers[i]->lg_message > SIZEOF_ENTETE &&
+           envoyer_transfert(sockfd, vers[i],
+                             (struct sockaddr *) &nouveau->membres[i].adresse,
+                             nouveau->membres[i].addrlen)==-1)
+            err = 9;
+        delete_message(vers[i]);
+    }
+    free(vers);
+    
+    /* Tous les couples sont partis : les hash cedes peuvent etre retires */
+    for(p=0; p<nb_partitions && err==0 && retirer && etrangers>0; p++)
+    {
+        dht = &tables[p];
+        curseur = 0;
+        while((table=parcours_table(dht, &curseur))!=NULL)
+        {
+            position = position_cle(table->type_cle, table->hash,
+                                    table->taille_hash);
+            nn = proprietaires(nouveau, position, nouveaux);
+            if(est_proprietaire(nouveaux, nn, local_nouveau))
+                continue;
+            if(dht->retrait!=NULL)
+                dht->retrait(dht->contexte_retrait, table);
+            remove_hash(dht, table);
+            hash_retires++;
+        }
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Reconstruit l'anneau quand les serveurs connus ont change, et
+ *        deplace les hash en consequence (mode anneau).
+ *
+ * Appelee par le thread principal a chaque tour de sa boucle : l'anneau
+ * suit les serveurs connus avec au plus une periode d'obsolescence de
+ * retard. Les put et get des autres threads attendent la fin du
+ * deplacement. Les hash cedes restent sur le serveur jusqu'au passage
+ * suivant de la roue (voir ceder_hash).
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param quitter TRUE pour deplacer les hash vers l'anneau des autres
+ *        serveurs, a l'arret du serveur.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int mettre_a_jour_anneau(int sockfd, serveurs_connus *st, int quitter)
+{
+    int err;
+    unsigned int n = 0;
+    unsigned long version;
+    anneau nouveau;
+    membre_anneau *membres;
+    l_serveur *emp;
+    
+    pthread_mutex_lock(&verrou_serveurs);
+    if(!quitter && st->version==version_anneau)
+    {
+        pthread_mutex_unlock(&verrou_serveurs);
+        return 0;
+    }
+    
+    membres = malloc((st->nb+1)*sizeof(membre_anneau));
+    if(membres==NULL)
+    {
+        pthread_mutex_unlock(&verrou_serveurs);
+        perror("Error malloc");
+        return 20;
+    }
+    if(!quitter)
+        membres[n++] = membre_local;
+    for(emp=st->premier; emp!=NULL; emp=emp->next)
+    {
+        if(membre_depuis_adresse(&membres[n], emp->serveur, emp->addrlen)==0)
+            n++;
+    }
+    version = st->version;
+    pthread_mutex_unlock(&verrou_serveurs);
+    
+    init_anneau(&nouveau, virtuels_anneau, copies_anneau);
+    err=construire_anneau(&nouveau, membres, n);
+    free(membres);
+    if(err!=0)
+        return err;
+    
+    pthread_rwlock_wrlock(&verrou_anneau);
+    verrouiller_partitions(TRUE);
+    err=deplacer_hash(sockfd, &vue_anneau, &nouveau, FALSE);
+    deverrouiller_partitions();
+    if(err==0 && !quitter)
+        cession_en_attente = TRUE;
+    delete_anneau(&vue_anneau);
+    vue_anneau = nouveau;
+    rang_local = chercher_membre(&vue_anneau, membre_local.cle,
+                                 membre_local.taille_cle);
+    version_anneau = version;
+    generation_anneau++;
+    pthread_rwlock_unlock(&verrou_anneau);
+    
+    printf("Anneau : %u serveurs, %lu hash deplaces, %lu retires\n",
+           vue_anneau.nb_membres, hash_deplaces, hash_retires);
+    
+    return err;
+}
+
+/**
+ * @brief Renvoie les hash cedes a leurs proprietaires, puis les retire
+ *        (mode anneau).
+ *
+ * Appelee au passage de la roue d'obsolescence qui suit un changement
+ * d'anneau : les hash que le serveur detient sans en etre proprietaire sont
+ * envoyes une seconde fois, ce qui couvre un datagramme perdu, et ne sont
+ * retires que si tous les envois ont reussi. Sinon ils sont gardes.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int ceder_hash(int sockfd)
+{
+    int err;
+    
+    if(!cession_en_attente)
+        return 0;
+    
+    pthread_rwlock_rdlock(&verrou_anneau);
+    verrouiller_partitions(TRUE);
+    err=deplacer_hash(sockfd, &vue_anneau, &vue_anneau, TRUE);
+    deverrouiller_partitions();
+    pthread_rwlock_unlock(&verrou_anneau);
+    if(err==0)
+        cession_en_attente = FALSE;
+    
+    return err;
+}
+
+/**
+ * @brief Place le serveur dans l'anneau et construit le premier anneau
+ *        (mode anneau).
+ *
+ * Le serveur figure dans l'anneau sous l'adresse de sa socket, qui doit
+ * etre celle sous laquelle les autres serveurs le connaissent : une adresse
+ * d'ecoute quelconque (0.0.0.0 ou ::) est refusee.
+ *
+ * @param sockfd la socket de datagrammes du serveur.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int rejoindre_anneau(int sockfd, serveurs_connus *st)
+{
+    struct sockaddr_storage local;
+    socklen_t addrlen = sizeof(local);
+    donnees nulle[TAILLE_EXTREMITE_IPV6] = {0};
+    
+    if(getsockname(sockfd, (struct sockaddr *) &local, &addrlen)==-1)
+    {
+        perror("Error getsockname");
+        return 29;
+    }
+    
+    if(membre_depuis_adresse(&membre_local, (struct sockaddr *) &local,
+                             addrlen)==-1 ||
+       memcmp(membre_local.cle, nulle, membre_local.taille_cle-2)==0)
+    {
+        fprintf(stderr, "Erreur : en mode anneau, le serveur doit ecouter "\
+                "sur une adresse precise\n");
+        return 31;
+    }
+    
+    return mettre_a_jour_anneau(sockfd, st, FALSE);
+}
+
+/**
+ * @brief Libere l'emplacement d'une demande de synchronisation.
+ *
+ * Le flux est retire de l'epoll avant d'etre ferme : un envoyeur qui en
+ * aurait herite une copie ne doit pas continuer a reveiller le serveur.
+ *
+ * @param d un pointeur sur la demande.
+*/
+void fermer_demande(demande_synchro *d)
+{
+    epoll_ctl(travailleurs[0].epoll, EPOLL_CTL_DEL, d->fd, NULL);
+    close(d->fd);
+    d->fd = -1;
+}
+
+/**
+ * @brief Accepte la connexion d'un nouveau serveur qui demande l'etat.
+ *
+ * Le flux est non bloquant et surveille par l'epoll du thread principal :
+ * sa demande est lue au fil de son arrivee (voir servir_synchro). Quand
+ * toutes les demandes sont occupees, la plus ancienne est abandonnee.
+ *
+ * @param ecoute la socket d'ecoute des flux.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int accepter_synchro(int ecoute)
+{
+    int fd;
+    unsigned int i, libre = 0;
+    struct sockaddr_storage nouveau;
+    socklen_t addrlen = sizeof(nouveau);
+    
+    fd = accept4(ecoute, (struct sockaddr *) &nouveau, &addrlen,
+                 SOCK_CLOEXEC|SOCK_NONBLOCK);
+    if(fd==-1)
+    {
+        if(errno!=EAGAIN && errno!=EINTR && errno!=ECONNABORTED)
+            perror("Error accept");
+        return 0;
+    }
+    
+    for(i=0; i<SYNCHRO_DEMANDES_MAX; i++)
+    {
+        if(demandes_synchro[i].fd==-1)
+        {
+            libre = i;
+            break;
+        }
+        if(demandes_synchro[i].debut < demandes_synchro[libre].debut)
+            libre = i;
+    }
+    if(demandes_synchro[libre].fd!=-1)
+        fermer_demande(&demandes_synchro[libre]);
+    
+    demandes_synchro[libre].fd = fd;
+    demandes_synchro[libre].adresse = nouveau;
+    demandes_synchro[libre].addrlen = addrlen;
+    demandes_synchro[libre].debut = time(NULL);
+    demandes_synchro[libre].lu = 0;
+    
+    if(surveiller(travailleurs[0].epoll, fd, SOURCE_DEMANDE)!=0)
+    {
+        close(fd);
+        demandes_synchro[libre].fd = -1;
+        return 25;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Envoie l'etat du serveur a un nouveau serveur connecte par un flux.
+ *
+ * Le flux est servi par un petit-fils du serveur, cree pendant que les
+ * partitions et les serveurs connus sont verrouilles : il envoie une copie
+ * coherente de l'etat sans bloquer le traitement des datagrammes. Le nouveau
+ * serveur est ensuite annonce aux serveurs connus et ajoute a la liste. Un
+ * echec ne concerne que ce nouveau serveur et n'arrete pas le serveur. En
+ * mode anneau, les hash ne sont pas envoyes (voir serveur_send_all).
+ *
+ * @param d un pointeur sur la demande complete du nouveau serveur.
+ * @param depuis la position du nouveau serveur dans l'historique.
+ * @param sockfd la socket de datagrammes du serveur.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_etat(demande_synchro *d, position depuis, int sockfd,
+                    serveurs_connus *st)
+{
+    int err, statut, drapeaux;
+    pid_t pid;
+    struct timeval delai = {SYNCHRO_DELAI, 0};
+    stats_synchro stats;
+    
+    /* L'envoyeur ecrit sur un flux bloquant, borne par un delai */
+    drapeaux = fcntl(d->fd, F_GETFL);
+    if(drapeaux==-1 || fcntl(d->fd, F_SETFL, drapeaux&~O_NONBLOCK)==-1)
+    {
+        perror("Error fcntl");
+        return 28;
+    }
+    setsockopt(d->fd, SOL_SOCKET, SO_SNDTIMEO, &delai, sizeof(delai));
+    printf("Nouvelle connexion (flux)\n");
+    
+    verrouiller_partitions(TRUE);
+    pthread_mutex_lock(&verrou_serveurs);
+    
+    /* L'envoyeur ne doit pas reecrire les sorties en attente du serveur */
+    fflush(stdout);
+    pid = fork();
+    if(pid==0)
+    {
+        /* Le fils cree l'envoyeur et se termine aussitot : le serveur n'a
+           pas a recuperer l'envoyeur */
+        if(fork()==0)
+        {
+            err=envoyer_synchro(d->fd, tables,
+                                copies_anneau>0 ? 0 : nb_partitions,
+                                st->premier,
+                                &modifications, depuis, &stats);
+            afficher_stats_synchro(&stats, "envoyees", stdout);
+            fflush(stdout);
+            _exit(err);
+        }
+        _exit(0);
+    }
+    
+    err = 0;
+    if(pid==-1)
+    {
+        perror("Error fork");
+        err = 28;
+    }
+    else
+    {
+        while(waitpid(pid, &statut, 0)==-1 && errno==EINTR);
+        
+        /* Envoie le nouveau serveur a tt les serveurs connus, puis l'ajoute
+           dans la liste de serveurs */
+        err=informer_connexion_serveur(sockfd, st,
+                                       (struct sockaddr *) &d->adresse,
+                                       (taille) d->addrlen, 0,
+                                       &travailleurs[0].graine);
+        if(err==0)
+            err=add_a_serveurs(st, (struct sockaddr *) &d->adresse,
+                               d->addrlen);
+    }
+    
+    pthread_mutex_unlock(&verrou_serveurs);
+    deverrouiller_partitions();
+    
+    return err;
+}
+
+/**
+ * @brief Lit les demandes de synchronisation en cours et sert celles qui
+ *        sont completes.
+ *
+ * Les octets deja arrives sont lus sans attendre : un nouveau serveur muet
+ * ou lent ne bloque pas le thread principal, et sa demande est abandonnee
+ * apres SYNCHRO_DELAI secondes. Les verrous ne sont pris, et l'envoyeur
+ * cree, qu'une fois la demande entiere reçue.
+ *
+ * @param sockfd la socket de datagrammes du serveur.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, le code d'erreur du dernier envoi d'etat
+ *         echoue sinon.
+*/
+int servir_synchro(int sockfd, serveurs_connus *st)
+{
+    int err, res = 0;
+    unsigned int i;
+    position depuis;
+    demande_synchro *d;
+    
+    for(i=0; i<SYNCHRO_DEMANDES_MAX; i++)
+    {
+        d = &demandes_synchro[i];
+        if(d->fd==-1)
+            continue;
+        
+        err=lire_demande_synchro(d, modifications.epoque, &depuis);
+        if(err==-1 && time(NULL)-d->debut < SYNCHRO_DELAI)
+            continue;
+        if(err==0)
+            err=envoyer_etat(d, depuis, sockfd, st);
+        if(err>0)
+            res = err;
+        fermer_demande(d);
+    }
+    
+    return res;
+}
+
+/**
+ * @brief Reporte dans l'arbre de Merkle les couples ajoutes ou retires
+ *        depuis sa derniere mise a jour.
+ *
+ * Seules les feuilles modifiees de chaque partition, puis les noeuds
+ * au-dessus d'elles, sont recalcules. L'appelant tient verrou_merkle.
+*/
+void mettre_a_jour_merkle()
+{
+    unsigned int p;
+    
+    for(p=0; p<nb_partitions; p++)
+    {
+        pthread_rwlock_wrlock(&verrous[p]);
+        publier_merkle(&arbre, tables[p].merkle);
+        pthread_rwlock_unlock(&verrous[p]);
+    }
+    calculer_merkle(&arbre);
+}
+
+/**
+ * @brief Ajoute un noeud de l'arbre de Merkle a un message d'anti-entropie.
+ *
+ * Un bloc 'c' porte l'indice du noeud puis son condense local (4 et 8
+ * octets), un bloc 'l' l'indice d'une feuille seul. L'appelant tient
+ * verrou_merkle.
+ *
+ * @param m un pointeur sur le message.
+ * @param type le type du bloc ('c' ou 'l').
+ * @param noeud l'indice du noeud.
+ * @return 0 en cas de reussite, CODE_MESSAGE_PLEIN si le bloc ne tient plus
+ *         dans le message, un autre code d'erreur sinon.
+*/
+int ajouter_noeud_merkle(message *m, donnees type, uint32_t noeud)
+{
+    donnees bloc[sizeof(uint32_t)+sizeof(uint64_t)];
+    uint32_t indice = htonl(noeud);
+    uint64_t condense = htobe64(arbre.noeuds[noeud]);
+    taille lg = type=='c' ? sizeof(bloc) : sizeof(indice);
+    
+    if(m->lg_message > SIZEOF_ENTETE &&
+       m->lg_message+SIZEOF_ENTETE_BLOC+lg > taille_transfert)
+        return CODE_MESSAGE_PLEIN;
+    
+    memcpy(bloc, &indice, sizeof(indice));
+    memcpy(bloc+sizeof(indice), &condense, sizeof(condense));
+    
+    return add_data(m, type, lg, bloc);
+}
+
+/**
+ * @brief Ajoute un noeud a un message d'anti-entropie, envoye d'abord s'il
+ *        est plein.
+ *
+ * Un envoi perdu n'est pas une erreur : la comparaison reprendra au tour
+ * suivant.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param m un pointeur sur le message.
+ * @param type le type du bloc ('c' ou 'l').
+ * @param noeud l'indice du noeud.
+ * @param destinataire l'adresse du serveur compare.
+ * @param addrlen la longueur de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_noeud_merkle(int sockfd, message *m, donnees type, uint32_t noeud,
+                            struct sockaddr *destinataire, socklen_t addrlen)
+{
+    int err=ajouter_noeud_merkle(m, type, noeud);
+    
+    if(err==CODE_MESSAGE_PLEIN)
+    {
+        envoyer_transfert(sockfd, m, destinataire, addrlen);
+        err=ajouter_noeud_merkle(m, type, noeud);
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Compare l'arbre de Merkle du serveur a celui d'un serveur connu
+ *        tire au hasard.
+ *
+ * Seule la racine est envoyee : la comparaison descend ensuite, message par
+ * message, dans les seuls sous-arbres qui different (voir traiter_merkle).
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int lancer_anti_entropie(int sockfd, serveurs_connus *st)
+{
+    int err;
+    long choisi;
+    l_serveur *emp = NULL;
+    message *m;
+    struct sockaddr_storage pair;
+    socklen_t addrlen = 0;
+    
+    pthread_mutex_lock(&verrou_serveurs);
+    if(st->nb>0)
+    {
+        choisi = random()%st->nb;
+        for(emp=st->premier; emp!=NULL && choisi>0; emp=emp->next)
+            choisi--;
+    }
+    if(emp!=NULL && emp->addrlen<=sizeof(pair))
+    {
+        memcpy(&pair, emp->serveur, emp->addrlen);
+        addrlen = emp->addrlen;
+    }
+    pthread_mutex_unlock(&verrou_serveurs);
+    if(addrlen==0)
+        return 0;
+    
+    err=create_message(&m, 'm', taille_transfert);
+    if(err!=0)
+        return err;
+    
+    pthread_mutex_lock(&verrou_merkle);
+    mettre_a_jour_merkle();
+    err=ajouter_noeud_merkle(m, 'c', 0);
+    tours_merkle++;
+    pthread_mutex_unlock(&verrou_merkle);
+    
+    if(err==0)
+        envoyer_transfert(sockfd, m, (struct sockaddr *) &pair, addrlen);
+    delete_message(m);
+    
+    return err;
+}
+
+/**
+ * @brief Envoie a un serveur les couples des feuilles de Merkle qui
+ *        different.
+ *
+ * Les couples sont regroupes dans des messages de transfert d'au plus
+ * taille_transfert octets, chaque adresse precedee de son age (bloc 'o').
+ * Chaque partition est parcourue sous son verrou en lecture : le trafic est
+ * proportionnel a la divergence, pas le parcours.
+ *
+ * @param sockfd l'identifiant du socket a utiliser.
+ * @param feuilles l'ensemble des feuilles a envoyer.
+ * @param destinataire l'adresse du serveur compare.
+ * @param addrlen la longueur de l'adresse.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int pousser_feuilles(int sockfd, uint64_t *feuilles,
+                        struct sockaddr *destinataire, socklen_t addrlen)
+{
+    int err;
+    unsigned int p;
+    uint32_t f;
+    unsigned long couples = 0;
+    long int maintenant = time(NULL), age;
+    table_hash *dht;
+    message *m2;
+    l_hash *table;
+    l_emplacement *emp;
+    adresse_interne *adresse;
+    size_t curseur;
+    
+    err=create_message(&m2, 't', taille_transfert);
+    if(err!=0)
+        return err;
+    
+    for(p=0; p<nb_partitions && err==0; p++)
+    {
+        dht = &tables[p];
+        curseur = 0;
+        pthread_rwlock_rdlock(&verrous[p]);
+        while(err==0 && (table=parcours_table(dht, &curseur))!=NULL)
+        {
+            f = FEUILLE_MERKLE(table->code);
+            if(!((feuilles[f/64]>>(f%64))&1))
+                continue;
+            
+            for(emp=table->dispo; emp!=NULL && err==0; emp=emp->next)
+            {
+                adresse = ADRESSE(dht, emp);
+                age = maintenant-emp->obsolescence;
+                if(age < 0)
+                    age = 0;
+                err=ajouter_couple(m2, table->type_cle, table->hash,
+                                   table->taille_hash, adresse->type_adresse,
+                                   adresse->octets, adresse->taille_adresse,
+                                   age);
+                if(err==CODE_MESSAGE_PLEIN)
+                {
+                    envoyer_transfert(sockfd, m2, destinataire, addrlen);
+                    err=ajouter_couple(m2, table->type_cle, table->hash,
+                                       table->taille_hash,
+                                       adresse->type_adresse,
+                                       adresse->octets,
+                                       adresse->taille_adresse, age);
+                }
+                couples++;
+            }
+        }
+        pthread_rwlock_unlock(&verrous[p]);
+    }
+    
+    if(err==0 && m2->lg_message > SIZEOF_ENTETE)
+        envoyer_transfert(sockfd, m2, destinataire, addrlen);
+    delete_message(m2);
+    __atomic_fetch_add(&couples_pousses, couples, __ATOMIC_RELAXED);
+    
+    return err;
+}
+
+/**
+ * @brief Traite un message d'anti-entropie d'un autre serveur.
+ *
+ * Pour chaque noeud reçu (bloc 'c'), le condense est compare a celui de
+ * l'arbre local. S'ils different, les condenses locaux des deux fils sont
+ * renvoyes, pour que l'autre serveur les compare a son tour ; pour une
+ * feuille, ses couples sont envoyes a l'autre serveur et un bloc 'l' lui
+ * demande les siens. Une feuille demandee (bloc 'l') est envoyee de meme.
+ * Les couples reçus sont ajoutes comme un transfert : chaque serveur finit
+ * avec l'union des deux tables. Un message qui ne vient pas d'un serveur
+ * connu est ignore : il ferait envoyer la table a une adresse quelconque.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param m un pointeur sur le message reçu.
+ * @param client l'adresse de l'emetteur du message.
+ * @param addrlen la longueur de l'adresse de l'emetteur.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int traiter_merkle(travailleur *w, message *m, struct sockaddr *client,
+                    socklen_t addrlen)
+{
+    int err, lu, a_pousser = FALSE, connu;
+    uint32_t noeud, f;
+    uint64_t condense, feuilles[MERKLE_MOTS(MERKLE_FEUILLES)];
+    donnees type, *bloc;
+    taille lg;
+    message *m2;
+    
+    pthread_mutex_lock(&verrou_serveurs);
+    connu = chercher_serveur(w->st, client)!=NULL;
+    pthread_mutex_unlock(&verrou_serveurs);
+    if(!connu)
+        return 0;
+    
+    err=create_message(&m2, 'm', taille_transfert);
+    if(err!=0)
+        return err;
+    memset(feuilles, 0, sizeof(feuilles));
+    
+    pthread_mutex_lock(&verrou_merkle);
+    mettre_a_jour_merkle();
+    for(lu=message_get_bloc(m, "cl", &type, &bloc, &lg);
+        lu==0 && err==0;
+        lu=message_get_bloc(NULL, "cl", &type, &bloc, &lg))
+    {
+        if(lg < sizeof(noeud))
+            continue;
+        memcpy(&noeud, bloc, sizeof(noeud));
+        noeud = ntohl(noeud);
+        if(noeud >= MERKLE_NOEUDS)
+            continue;
+        
+        /* Comparaison d'un noeud : s'il est identique, le sous-arbre
+           l'est aussi */
+        if(type=='c')
+        {
+            if(lg!=sizeof(noeud)+sizeof(condense))
+                continue;
+            memcpy(&condense, bloc+sizeof(noeud), sizeof(condense));
+            noeuds_compares++;
+            if(be64toh(condense)==arbre.noeuds[noeud])
+                continue;
+            
+            /* Noeud interne different : descente dans ses fils */
+            if(!est_feuille_merkle(noeud))
+            {
+                err=envoyer_noeud_merkle(w->sockfd, m2, 'c', 2*noeud+1,
+                                         client, addrlen);
+                if(err==0)
+                    err=envoyer_noeud_merkle(w->sockfd, m2, 'c', 2*noeud+2,
+                                             client, addrlen);
+                continue;
+            }
+            
+            /* Feuille differente : echange de ses couples */
+            feuilles_differentes++;
+            err=envoyer_noeud_merkle(w->sockfd, m2, 'l', noeud, client,
+                                     addrlen);
+        }
+        
+        if(est_feuille_merkle(noeud))
+        {
+            f = noeud-(MERKLE_FEUILLES-1);
+            feuilles[f/64] |= 1ULL<<(f%64);
+            a_pousser = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&verrou_merkle);
+    
+    if(err==0 && m2->lg_message > SIZEOF_ENTETE)
+        envoyer_transfert(w->sockfd, m2, client, addrlen);
+    delete_message(m2);
+    
+    if(err==0 && a_pousser)
+        err=pousser_feuilles(w->sockfd, feuilles, client, addrlen);
+    
+    return err;
+}
+
+/**
+ * @brief Traite un message reçu par un thread.
+ *
+ * Les reponses et les envois aux autres serveurs sont places dans le lot
+ * d'envoi du thread. Les get ne prennent leur partition qu'en lecture et
+ * sont donc servis en parallele par les threads ; les autres messages
+ * prennent les verrous dont ils ont besoin. En cas d'erreur, le serveur est
+ * arrete.
+ *
+ * @param w un pointeur sur le thread de reception.
+ * @param m un pointeur sur le message.
+ * @param client l'adresse de l'emetteur du message.
+ * @param addrlen la longueur de l'adresse de l'emetteur.
+*/
+void traiter_message(travailleur *w, message *m, struct sockaddr *client,
+                        socklen_t addrlen)
+{
+    int err, transmis;
+    message *m2;
+    membre_anneau demandeur;
+    
+    /* Effectue un action en fonction du type du message */
+    switch(m->type)
+    {
+        /* Lit le message et stocke les donnees recues (put d'un
+           hash) */
+        case 'p':
+            err=serveur_put(m, w);
+            printf("Arrivee Hash\n");
+            w->puts++;
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+    
+        /* Lit le message et recherche dans le DHT toutes les donnees
+           voulues (get d'un hash) */
+        case 'g':
+            w->gets++;
+            
+            /* En mode anneau, un get d'un hash dont le serveur n'est pas
+               proprietaire va au proprietaire principal, et un client qui
+               route lui-meme ses requetes recoit d'abord la vue du
+               serveur */
+            signaler_proprietaire(w, m, client, addrlen);
+            err=transmettre_get(w, m, client, addrlen, &transmis);
+            if(err==0 && transmis)
+                break;
+            if(err==0)
+                err=serveur_get(&m2, m);
+            if(err!=0)
+            {
+                serveur_actif = FALSE;
+                break;
+            }
+        
+            prepare_message(m2);
+            
+            /* Un get transmis par un autre serveur est repondu au client */
+            if(demandeur_get(w, m, client, &demandeur))
+            {
+                client = (struct sockaddr *) &demandeur.adresse;
+                addrlen = demandeur.addrlen;
+            }
+        
+            /* Envoie la reponse au client (avec le reste du lot) */
+            err=ajouter_envoi(&w->envois, w->sockfd, m2, client, addrlen);
+            if(err==0)
+                err=confier_message(&w->envois, w->sockfd, m2);
+            else
+                delete_message(m2);
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+        
+        /* Un nouveau serveur souhaite se connecter */
+        case 'n':
+            printf("Nouvelle connexion\n");
+            verrouiller_partitions(FALSE);
+            pthread_mutex_lock(&verrou_serveurs);
+            
+            /* Envoie la table de hashage et la liste de serveurs au
+               serveur se connectant */
+            err=serveur_send_all(w->sockfd, client, addrlen,
+                                 w->st->premier);
+        
+            /* Envoie le nouveau serveur a tt les serveurs connus */
+            if(err==0)
+                err=informer_connexion_serveur(w->sockfd, w->st, client,
+                                               (taille)addrlen, 0, &w->graine);
+        
+            /* Ajoute le serveur dans la liste de serveurs */
+            if(err==0)
+                err=add_a_serveurs(w->st, client, addrlen);
+            
+            pthread_mutex_unlock(&verrou_serveurs);
+            deverrouiller_partitions();
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+
+        /* Un serveur informe qu'il s'arrete */
+        case 'd':
+            printf("Deconnexion d'un serveur\n");
+            pthread_mutex_lock(&verrou_serveurs);
+            delete_server(w->st, client);
+            pthread_mutex_unlock(&verrou_serveurs);
+            break;
+
+        /* Reception d'un message demandant si le serveur est
+           toujours actif (keep-alive) */
+        case 'k':
+            /* Creer un nouveau message de type alive, avec la position de
+               l'historique */
+            err=create_message(&m2, 'a', SIZEOF_ENTETE);
+            if(err==0 && (err=ajouter_position(m2))!=0)
+                delete_message(m2);
+            if(err!=0)
+            {
+                serveur_actif = FALSE;
+                break;
+            }
+        
+            prepare_message(m2);
+        
+            /* Envoie la reponse au serveur (avec le reste du lot) */
+            err=ajouter_envoi(&w->envois, w->sockfd, m2, client, addrlen);
+            if(err==0)
+                err=confier_message(&w->envois, w->sockfd, m2);
+            else
+                delete_message(m2);
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+
+            /*Reception de la reponse d'un serveur a un keep-alive */
+        case 'a':
+            pthread_mutex_lock(&verrou_serveurs);
+            isAlive(w->st, client, m);
+            pthread_mutex_unlock(&verrou_serveurs);
+            break;
+        case 't':
+            /* Reception d'une donnée d'un autre serveur */
+            err=reception_transfert(m, w, w->st);
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+        case 'm':
+            /* Comparaison des arbres de Merkle (anti-entropie) */
+            if(periode_merkle>0)
+                err=traiter_merkle(w, m, client, addrlen);
+            else
+                err=0;
+            if(err!=0)
+                serveur_actif = FALSE;
+            break;
+        /* Cas de message inconnu. Le message n'est pas pris en
+           compte. */
+        default:
+            fprintf(stderr, "Type de message inconnu (%c)\n",
+                    m->type);
+    }
+}
 
 /**
- * @brief Fonction appelee lorsque le programme reçoit le signal SIGINT.
+ * @brief Renvoie la partition concernee par un message.
  *
- * Informe le serveur qu'il doit s'arreter.
+ * Seuls les put, les get et les transferts de hash concernent un hash ; les
+ * autres messages sont traites par le thread qui les reçoit. Un transfert
+ * regroupant plusieurs couples va a la partition de son premier hash, chaque
+ * couple etant ajoute sous le verrou de sa propre partition.
  *
- * @param val la valeur du signal reçu (ignoree).
+ * @param m un pointeur sur le message.
+ * @param defaut la partition a renvoyer si le message ne concerne pas un
+ *        hash.
+ * @return l'indice de la partition du hash du message, defaut sinon.
 */
-void arret_serveur(__attribute__((unused)) int val)
+unsigned int partition_message(message *m, unsigned int defaut)
 {
-    serveur_actif = FALSE;
+    donnees *hash, type_cle, cle[TAILLE_CLE_SHA256];
+    taille taille_hash;
+    
+    if(m->type!='p' && m->type!='g' && m->type!='t')
+        return defaut;
+    
+    if(message_get_cle(m, &type_cle, &hash, &taille_hash, cle)==-1)
+        return defaut;
+    
+    return partition_cle(type_cle, hash, taille_hash, nb_partitions);
 }
 
 /**
- * @brief Fonction appelee lorsque le programme reçoit le signal SIGALRM.
+ * @brief Traite les messages transmis a un thread par les autres threads.
  *
- * Informe le serveur qu'il doit vérifier que les reponses aux
- * keep-alive ont ete reçues.
+ * Chaque message est copie dans un tampon de la reserve du thread, puis
+ * traite comme s'il avait ete reçu par sa socket.
  *
- * @param val la valeur du signal reçu (ignoree).
+ * @param w un pointeur sur le thread de reception.
 */
-void check_keep_alive(__attribute__((unused)) int val)
+void recevoir_transferts(travailleur *w)
 {
-    check_K_A = TRUE;
+    unsigned int s;
+    tampon_message *t = NULL;
+    socklen_t addrlen;
+    sockaddr_in client;
+    
+    for(s=0; s<nb_threads && serveur_actif; s++)
+    {
+        if(s==w->indice)
+            continue;
+        
+        while(serveur_actif)
+        {
+            if(t==NULL && (t=emprunter_tampon(&w->lot.reserve))==NULL)
+            {
+                serveur_actif = FALSE;
+                break;
+            }
+            
+            if(retirer_transfert(&w->entrantes[s], t,
+                                 (struct sockaddr *) &client, &addrlen)==-1)
+                break;
+            
+            w->recus++;
+            traiter_message(w, &t->m, (struct sockaddr *) &client, addrlen);
+            if(confier_message(&w->envois, w->sockfd, &t->m)!=0)
+                serveur_actif = FALSE;
+            t = NULL;
+        }
+    }
+    
+    if(t!=NULL)
+        rendre_tampon(t);
 }
 
 /**
- * @brief Gere les actions a effectuer en fonction des signaux reçus.
+ * @brief Traite les messages d'un lot reçu par un thread.
  *
- * - Change l'action par default lors de la reception du signal SIGINT
- *   (appel de la fonction arret_serveur).
- * - Change l'action par default lors de la reception du signal SIGALRM
- *   (appel de la fonction check_keep_alive).
+ * En mode partitionne, un message concernant le hash d'une autre partition
+ * est transmis au thread de celle-ci par sa file, puis les messages transmis
+ * par les autres threads sont traites. Les reponses et les envois aux autres
+ * serveurs partent ensemble (sendmmsg) a la fin du lot ; les threads ayant
+ * reçu des messages sont ensuite reveilles.
  *
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * @param w un pointeur sur le thread de reception.
 */
-int gestion_signaux()
+void traiter_lot(travailleur *w)
 {
-    struct sigaction sig;
-
-    /* Changement de l'action par default pour SIGINT */
+    int err;
+    unsigned int i, p;
+    uint64_t un = 1;
+    message *m;
+    socklen_t addrlen = sizeof(sockaddr_in);
+    sockaddr_in client = {0};
     
-    if(sigemptyset(&sig.sa_mask)==-1)
+    for(i=0; i<w->lot.nb && serveur_actif; i++)
     {
-        perror("Error sigemptyset");
-        return 1;
+        err=message_du_lot(&m, &w->lot, i, (struct sockaddr *) &client,
+                           &addrlen);
+        if(err==-1)
+            continue;
+        
+        if(mode_partitions &&
+           (p=partition_message(m, w->indice))!=w->indice)
+        {
+            /* Une file pleine perd le message, comme un datagramme */
+            if(deposer_transfert(&travailleurs[p].entrantes[w->indice], m,
+                                 (struct sockaddr *) &client, addrlen)==0)
+            {
+                w->transmis++;
+                w->a_reveiller[p] = TRUE;
+            }
+            delete_message(m);
+            continue;
+        }
+        
+        traiter_message(w, m, (struct sockaddr *) &client, addrlen);
+        
+        /* Le message peut etre reference par des envois en attente */
+        if(confier_message(&w->envois, w->sockfd, m)!=0)
+            serveur_actif = FALSE;
     }
     
-    /* Masquage de SIGALRM pendant l'execution de la fonction pour SIGINT */
-    sigaddset(&sig.sa_mask, SIGALRM);
-    sig.sa_handler = arret_serveur;
-    sig.sa_flags = 0;
+    if(mode_partitions)
+        recevoir_transferts(w);
     
-    if(sigaction(SIGINT, &sig, NULL)==-1)
+    /* Les couples des put partent ensemble vers les autres serveurs, a la
+       fin du lot ou a leur echeance */
+    if(w->echeance==-1 || w->echeance_atteinte)
     {
-        perror("Error sigaction");
-        return 2;
+        if(w->echeance_atteinte && w->replication!=NULL)
+            w->envois_echeance++;
+        w->echeance_atteinte = FALSE;
+        if(envoyer_replication(w)!=0)
+            serveur_actif = FALSE;
     }
     
-    /* Changement de l'action par default pour SIGALRM */
+    if(vider_envois(&w->envois, w->sockfd)!=0)
+        serveur_actif = FALSE;
     
-    if(sigemptyset(&sig.sa_mask)==-1)
+    for(p=0; mode_partitions && p<nb_threads; p++)
     {
-        perror("Error sigemptyset");
-        return 3;
+        if(!w->a_reveiller[p])
+            continue;
+        if(write(travailleurs[p].reveil, &un, sizeof(un))==-1)
+            perror("Error write");
+        w->a_reveiller[p] = FALSE;
     }
+}
+
+/**
+ * @brief Attend les evenements d'un thread.
+ *
+ * Les datagrammes deja arrives sur la socket sont lus en un lot, les
+ * reveils, les passages du minuteur d'obsolescence et l'echeance de la
+ * replication sont consommes ; les autres sources (keep-alive, signaux) sont
+ * laissees a l'appelant.
+ *
+ * @param w un pointeur sur le thread de reception (w->lot reçoit le lot,
+ *        eventuellement vide).
+ * @param sources le masque des sources (SOURCE_*) pretes (valeur de retour
+ *        par effet de bord).
+ * @return 0 en cas de reussite, CODE_INTERRUP_SYSTEM si l'attente a ete
+ *         interrompue par un signal, un code d'erreur sinon.
+*/
+int attendre_evenements(travailleur *w, unsigned int *sources)
+{
+    struct epoll_event evenements[EVENEMENTS_MAX];
+    uint64_t nb;
+    int i, prets;
     
-    /* Masquage de SIGINT pendant l'execution de la fonction pour SIGALRM */
-    sigaddset (&sig.sa_mask, SIGINT);
-    sig.sa_handler = check_keep_alive;
-    sig.sa_flags = 0;
+    w->lot.nb = 0;
+    *sources = 0;
     
-    if(sigaction(SIGALRM, &sig, NULL)==-1)
+    prets = epoll_wait(w->epoll, evenements, EVENEMENTS_MAX, -1);
+    if(prets==-1)
     {
-        perror("Error sigaction");
-        return 4;
+        if(errno==EINTR)
+            return CODE_INTERRUP_SYSTEM;
+        perror("Error epoll_wait");
+        return 21;
     }
     
+    for(i=0; i<prets; i++)
+        *sources |= evenements[i].data.u32;
+    
+    if((*sources & SOURCE_REVEIL) && read(w->reveil, &nb, sizeof(nb))==-1)
+        perror("Error read");
+    if((*sources & SOURCE_OBSOLESCENCE) &&
+       read(w->minuteur, &nb, sizeof(nb))==-1 && errno!=EAGAIN)
+        perror("Error read");
+    if(*sources & SOURCE_REPLICATION)
+    {
+        if(read(w->echeance, &nb, sizeof(nb))==-1 && errno!=EAGAIN)
+            perror("Error read");
+        w->echeance_atteinte = TRUE;
+    }
+    
+    if(*sources & SOURCE_SOCKET)
+        return recevoir_lot(&w->lot, w->sockfd, FALSE);
+    
     return 0;
 }
 
 /**
- * @brief Lis le message et ajoute au DHT un hash et son adresse associee.
+ * @brief Demarre la reception d'un thread, depuis ce thread.
  *
- * Lecture du message pour recuperer le hash et l'adresse, puis ajout d'un
- * element a la liste des hash, et envoie du hash aux autres serveurs si c'est
- * demande (si st est non NULL).
+ * Seul le backend io_uring (option -u) a besoin d'etre demarre : sa
+ * reception est soumise par le thread qui en traitera les completions.
  *
- * @param m un pointeur sur le message reçu.
- * @param dht un pointeur vers le pointeur sur le debut de la liste de hash.
- * @param st un pointeur vers le pointeur sur le debut de la liste de serveur.
- * @param sockfd l'identifiant d'un socket.
+ * @param w un pointeur sur le thread de reception.
  * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int serveur_put(message *m, l_hash **dht, l_serveur **st, int *sockfd)
+int demarrer_reception(__attribute__((unused)) travailleur *w)
 {
-    int err;
-    donnees *hash, *adresse;
-    taille taille_hash, taille_adresse;
-    l_serveur *emp;
-
-    /* Recuperation du hash dans le message */
-    if(message_get_h(m, &hash, &taille_hash)==-1)
-    {
-        fprintf(stderr, "Erreur : Le message ne contenait pas de hash\n");
-        return 5;
-    }
-    
-    /* Recuperation de l'adresse dans le message */
-    if(message_get_a(m, &adresse, &taille_adresse)==-1)
-    {
-        fprintf(stderr, "Erreur : Le message ne contenait pas d'adresse\n");
-        return 6;
-    }
+#ifdef AVEC_URING
+    if(w->lot.uring!=NULL)
+        return demarrer_uring(&w->es);
+#endif
     
-    /* Ajout du hash et son adresse associee dans la table de hashage */
-    err=add_hash(dht, hash, taille_hash, adresse, taille_adresse);
-    if(err!=0)
-        return err;
-
-    /* Si la liste de serveurs n'est pas donnee ( = NULL) alors il n'y a rien
-       d'autre a faire */
-    if(st==NULL || sockfd==NULL)
-        return 0;
-    else
-        emp = *st;
+    return 0;
+}
 
-    /* Changement du type du message pour qu'il soit correctement interprete */
-    m->contenu[0]='t';
+/**
+ * @brief Envoie les couples a repliquer d'un thread qui s'arrete.
+ *
+ * @param w un pointeur sur le thread de reception.
+*/
+void terminer_replication(travailleur *w)
+{
+    if(envoyer_replication(w)==0)
+        vider_envois(&w->envois, w->sockfd);
+}
 
-    /* Parcours de la liste de serveurs */
-    for(;emp!=NULL;emp=emp->next)
+/**
+ * @brief Boucle d'un thread de reception supplementaire.
+ *
+ * Le thread reçoit et traite les lots de sa socket jusqu'a l'arret du
+ * serveur. En mode partitionne, il gere aussi l'obsolescence de sa
+ * partition ; les autres taches periodiques (keep-alive, instantane,
+ * statistiques) restent au thread principal.
+ *
+ * @param arg un pointeur sur le thread de reception.
+ * @return NULL.
+*/
+void *travailler(void *arg)
+{
+    travailleur *w = arg;
+    unsigned int sources;
+    int err;
+    
+    if(demarrer_reception(w)!=0)
+        serveur_actif = FALSE;
+    
+    while(serveur_actif)
     {
-        /* Envoie le message a un serveur */
-        if(sendto(*sockfd, m->contenu, m->lg_message, 0,
-                  emp->serveur, emp->addrlen) == -1)
+        /* Attend l'arrivee d'un lot de messages, d'un message transmis par
+           un autre thread ou de l'arret du serveur (reveil) */
+        err=attendre_evenements(w, &sources);
+        if(err==CODE_INTERRUP_SYSTEM)
+            continue;
+        if(err!=0)
         {
-            perror("Error sendto");
-            return 7;
+            serveur_actif = FALSE;
+            break;
         }
+        
+        if(sources & SOURCE_OBSOLESCENCE)
+            verifier_obsolescence(w);
+        
+        traiter_lot(w);
     }
-
-    return 0;
+    
+    terminer_replication(w);
+    
+    return NULL;
 }
 
 /**
- * @brief Recupere toute les adresses ip associees a un hash.
+ * @brief Epingle un thread sur un processeur.
  *
- * Lit le message reçu, en extrait le hash en question, parcours la liste
- * des hash jusqu'a le trouver, puis ajoute a un nouveau message toutes les
- * adresses ip associees.
+ * Les threads sont repartis dans l'ordre sur les processeurs autorises au
+ * processus. Un echec n'est pas fatal : le thread reste non epingle.
  *
- * @param retour un pointeur vers un pointeur sur le message qui sera la reponse
- *        du serveur (valeur de retour par effet de bord).
- * @param m un pointeur sur le message recu par le serveur.
- * @param dht un pointeur vers le premier element de la liste de hash.
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * @param thread le thread.
+ * @param i l'indice du thread.
+ * @param autorises les processeurs autorises.
 */
-int serveur_get(message **retour, message *m, l_hash *dht)
+void epingler_thread(pthread_t thread, unsigned int i, cpu_set_t *autorises)
 {
-    int err;
-    message *m2;
-    donnees *hash;
-    l_emplacement *emp;
-    taille taille_hash;  
+    int err, cpu, rang;
+    cpu_set_t choix;
     
-    /* Recupere le hash dans le message */
-    if(message_get_h(m, &hash, &taille_hash)==-1)
+    rang = i % CPU_COUNT(autorises);
+    for(cpu=0; cpu<CPU_SETSIZE; cpu++)
     {
-        fprintf(stderr, "Erreur : Le message ne contenait pas de hash.\n");
-        return 8;
+        if(CPU_ISSET(cpu, autorises) && rang-- == 0)
+            break;
     }
     
-    /* Creer un message de type reponse */
-    err=create_message(&m2, 'r', SIZEOF_ENTETE);
+    CPU_ZERO(&choix);
+    CPU_SET(cpu, &choix);
+    err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &choix);
     if(err!=0)
-        return err;
-    
-    /* Pour chaque element de la liste de hash */
-    for(; dht!=NULL; dht=dht->next)
     {
-        /* Si on a trouve le hash dans la liste */
-        if(taille_hash == dht->taille_hash &&
-            strncmp((char*)hash, (char*)dht->hash, taille_hash)==0)
-        {
-            /* Pour chaque element de la liste d'adresse ip */
-            for(emp=dht->dispo; emp!=NULL; emp=emp->next)
-            {
-                /* On ajoute l'adresse ip au message */
-                err=add_data(m2, 'a', emp->taille_adresse, emp->adresse);
-                if(err!=0)
-                {
-                    delete_message(m2);
-                    return err;
-                }
-            }
-            break;
-        }
+        errno = err;
+        perror("Error pthread_setaffinity_np");
     }
-
-    /* Passage du message par effet de bord */
-    *retour = m2;
-    
-    return 0;
 }
 
 /**
- * @brief Envoie sa table de hash a un nouveau serveur.
+ * @brief Prepare les structures d'un thread de reception.
  *
- * Envoie par couple (hash,adresse), toute la table de hashage a un nouveau
- * serveur se connectant au serveur courant.
+ * Le thread attend ses evenements sur un epoll, ou figurent l'eventfd qui le
+ * reveille, l'echeance de sa replication et, s'il gere l'obsolescence d'une
+ * partition (thread principal, ou tout thread en mode partitionne), son
+ * minuteur. En mode partitionne, le thread reçoit aussi une file par autre
+ * thread.
  *
- * @param sockfd l'identifiant du socket a utiliser.
- * @param nouveau_serv un pointeur vers la structure contenant les informations
- *        necessaires pour parler au nouveau serveur.
- * @param addrlen la longueur de nouveau_serv.
- * @param dht un pointeur vers le debut de la table de hashage.
- * @param st un pointeur vers le debut de la liste de serveurs connus.
+ * @param w un pointeur sur le thread de reception.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
  * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int serveur_send_all(int sockfd, struct sockaddr *nouveau_serv, 
-                            socklen_t addrlen, l_hash *dht, l_serveur* st)
+int preparer_travailleur(travailleur *w, serveurs_connus *st)
 {
     int err;
-    message *m2;
-    l_emplacement * emp;
-
-    /* Cree un nouveau message de type transfert */
-    err=create_message(&m2, 't', SIZEOF_ENTETE);
-    if(err!=0)
+    unsigned int s;
+    
+    w->st = st;
+    
+    if((err=init_lot_reception(&w->lot, taille_lot))!=0 ||
+       (err=init_lot_envoi(&w->envois, taille_lot))!=0)
         return err;
-
-    /* Pour chaque element de la liste de hash */
-    for(; dht!=NULL; dht=dht->next)
-    {        
-        /* Pour chaque element de la liste d'adresse ip */
-        for(emp = dht->dispo; emp!=NULL; emp=emp->next)
-        {
-            /* Reutilisation du meme message a chaque envoie en reecrivant
-               sur les donnees precedentes */
-            m2->lg_message = SIZEOF_ENTETE;            
-            
-            /* Ajout du hash dans le message */
-            err=add_data(m2, 'h', dht->taille_hash, dht->hash);
-            if(err!=0)
-            {
-                delete_message(m2);
-                return err;
-            }
-            
-            /* Ajout de l'adresse associee au hash dans le message */
-            err=add_data(m2, 'a', emp->taille_adresse, emp->adresse);
-            if(err!=0)
-            {
-                delete_message(m2);
-                return err;
-            }
-            
-            prepare_message(m2);
-            
-            /* Envoie un couple hash/adresse au nouveau serveur */
-            if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
-                        nouveau_serv, addrlen) == -1)
-            {
-                perror("Error sendto");
-                delete_message(m2);
-                return 9;
-            }
-        }
-    }
     
-    delete_message(m2);
+    w->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(w->epoll==-1)
+    {
+        perror("Error epoll_create1");
+        return 26;
+    }
     
-    /* Cree un nouveau message de type transfert */
-    err=create_message(&m2, 't', SIZEOF_ENTETE);
-    if(err!=0)
+    w->reveil = eventfd(0, EFD_NONBLOCK);
+    if(w->reveil==-1)
+    {
+        perror("Error eventfd");
+        return 22;
+    }
+    if((err=surveiller(w->epoll, w->reveil, SOURCE_REVEIL))!=0)
         return err;
     
-    for(; st!=NULL; st=st->next)
+    /* Les empreintes d'un message de replication plein tiennent dans la
+       moitie de l'ensemble (un couple occupe au moins 2 blocs de 1 octet) */
+    w->capacite_vus = 1;
+    while(w->capacite_vus < taille_transfert/(2*(SIZEOF_ENTETE_BLOC+1)))
+        w->capacite_vus *= 2;
+    w->capacite_vus *= 2;
+    w->vus = calloc(w->capacite_vus, sizeof(uint64_t));
+    if(w->vus==NULL)
     {
-        /* Reutilisation du meme message a chaque envoie en reecrivant
-           sur les donnees precedentes */
-        m2->lg_message = SIZEOF_ENTETE;            
-        
-        /* Ajout du serveur dans le message */
-        err=add_data(m2, 's', st->addrlen, st->serveur);
-        if(err!=0)
-        {
-            delete_message(m2);
+        perror("Error malloc");
+        return 20;
+    }
+    
+    /* Minuteur desarme, arme au premier couple de chaque message */
+    if(delai_replication>0)
+    {
+        err=creer_minuteur(&w->echeance, 0, 0);
+        if(err!=0 ||
+           (err=surveiller(w->epoll, w->echeance, SOURCE_REPLICATION))!=0)
             return err;
-        }
-        
-        prepare_message(m2);
-        
-        /* Envoie des donnees au serveur */
-        if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
-                    nouveau_serv, addrlen) == -1)
-        {
-            perror("Error sendto");
-            delete_message(m2);
-            return 18;
-        }
     }
     
-    delete_message(m2);
+    if(w->indice==0 || mode_partitions)
+    {
+        err=creer_minuteur(&w->minuteur, PERIODE_OBSOLESCENCE, 0);
+        if(err!=0 ||
+           (err=surveiller(w->epoll, w->minuteur, SOURCE_OBSOLESCENCE))!=0)
+            return err;
+    }
     
-    /* Cree un nouveau message de type fin */
-    err=create_message(&m2, 'f', SIZEOF_ENTETE);
-    if(err!=0)
-        return err;
-
-    prepare_message(m2);
+    if(!mode_partitions)
+        return 0;
     
-    /* Envoie un message signifiant la fin du transfert du DHT */
-    if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
-                nouveau_serv, addrlen) == -1)
+    w->entrantes = calloc(nb_threads, sizeof(file_transferts));
+    w->a_reveiller = calloc(nb_threads, sizeof(donnees));
+    if(w->entrantes==NULL || w->a_reveiller==NULL)
     {
-        perror("Error sendto");
-        delete_message(m2);
-        return 10;
+        perror("Error malloc");
+        return 20;
+    }
+    
+    for(s=0; s<nb_threads; s++)
+    {
+        if(s!=w->indice && (err=init_file_transferts(&w->entrantes[s]))!=0)
+            return err;
     }
     
-    delete_message(m2); 
-
     return 0;
 }
 
 /**
- * @brief Informe tout les serveurs connus de l'arret du serveur courant.
+ * @brief Ajoute la socket d'un thread a ses evenements.
  *
- * Envoie un message de type 'd' (deconnexion) a tout les serveurs de la liste 
- * de serveurs pour les informer que le programme va s'arreter.
+ * Avec l'option -u, les datagrammes sont reçus et envoyes par io_uring, et
+ * c'est l'instance de reception qui est surveillee. Si io_uring n'est pas
+ * disponible (noyau trop ancien), le thread garde recvmmsg et sendmmsg.
  *
- * @param st un pointeur sur le debut de la liste de serveurs.
- * @param sockfd l'identifiant du socket a utiliser.
+ * @param w un pointeur sur le thread de reception (sa socket est ouverte).
  * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int informer_arret_serveur(l_serveur *st, int sockfd)
-{
-    int err;
-    message *m;
-    l_serveur *serv;
-
-    /* Cree un nouveau message de type deconnexion */
-    err=create_message(&m, 'd', SIZEOF_ENTETE);
-    if(err!=0)
-        return err;
-    
-    prepare_message(m);
-
-    for(serv=st; serv!=NULL; serv=serv->next)
-    {
-        /* Envoie le message de deconnexion a un serveur */
-        if(sendto(sockfd, m->contenu, m->lg_message, 0,
-                  serv->serveur, serv->addrlen) == -1)
+int surveiller_socket(travailleur *w)
+{
+#ifdef AVEC_URING
+    if(mode_uring)
+    {
+        if(init_uring(&w->es, w->sockfd, taille_lot)==0)
         {
-            perror("Error sendto");
-            delete_message(m);
-            return 11;
+            w->lot.uring = &w->es;
+            w->envois.uring = &w->es;
+            return surveiller(w->epoll, w->es.reception.fd, SOURCE_SOCKET);
         }
+        delete_uring(&w->es);
+        fprintf(stderr, "Thread %u : io_uring indisponible, recvmmsg et "\
+                "sendmmsg utilises\n", w->indice);
     }
-
-    delete_message(m);
-
-    return 0;
+#endif
+    
+    return surveiller(w->epoll, w->sockfd, SOURCE_SOCKET);
 }
 
 /**
- * @brief Supprime les serveurs qui ne repondent pas et questionne les autres.
+ * @brief Prepare les threads de reception et demarre les supplementaires.
  *
- * @param st un pointeur vers le pointeur sur le debut de liste de serveurs
- *        (sa valeur est modifiee si le/les serveurs en tete de liste sont
- *         supprimes).
- * @param sockfd l'identifiant d'un socket.
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * Le thread 0 est le thread principal, dont la socket est deja ouverte. Les
+ * autres threads ouvrent chacun une socket sur la meme adresse
+ * (SO_REUSEPORT) : le noyau repartit les datagrammes entre elles selon
+ * l'emetteur. Ils ne reçoivent aucun signal. En mode partitionne, chaque
+ * thread (y compris le principal) est epingle sur un processeur.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param sockfd la socket du thread principal.
+ * @param adresse l'adresse d'ecoute du serveur.
+ * @param port le port d'ecoute du serveur.
+ * @return 0 en cas de reussite, un code d'erreur sinon (les threads deja
+ *         demarres le restent, arreter_travailleurs doit etre appele).
 */
-int check_send_KA(l_serveur **st, int sockfd)
+int demarrer_travailleurs(serveurs_connus *st, int sockfd, char *adresse,
+                            char *port)
 {
     int err;
-    message *m;
-    l_serveur *actu, *suivant, *prec;
-    
-    if(*st == NULL)
-        return 0;
+    unsigned int i;
+    sigset_t signaux, anciens;
+    cpu_set_t autorises;
     
-    actu = *st;
-    suivant = NULL;
-    prec = NULL;
+    for(i=0; i<nb_threads; i++)
+    {
+        travailleurs[i].indice = i;
+        travailleurs[i].sockfd = -1;
+        travailleurs[i].epoll = -1;
+        travailleurs[i].reveil = -1;
+        travailleurs[i].minuteur = -1;
+        travailleurs[i].echeance = -1;
+        travailleurs[i].graine = time(NULL)^getpid()^(i<<16);
+    }
+    travailleurs[0].sockfd = sockfd;
     
-    /* Creer un nouveau message de type keep-alive */
-    err=create_message(&m, 'k', SIZEOF_ENTETE);
-    if(err!=0)
+    /* Les files doivent toutes exister avant le demarrage des threads */
+    for(i=0; i<nb_threads; i++)
+    {
+        if((err=preparer_travailleur(&travailleurs[i], st))!=0)
+            return err;
+    }
+    if((err=surveiller_socket(&travailleurs[0]))!=0)
         return err;
     
-    prepare_message(m);
+    if(mode_partitions && sched_getaffinity(0, sizeof(autorises),
+                                            &autorises)==-1)
+    {
+        perror("Error sched_getaffinity");
+        return 23;
+    }
     
-    /* Parcours de la liste de serveurs */
-    while(actu!=NULL)
+    for(i=1; i<nb_threads; i++)
     {
-        /* Suppression d'un serveur n'ayant pas repondu */
-        if(actu->present==0)
+        err=get_addr(SERVEUR_REUSEPORT, adresse, port,
+                     &travailleurs[i].sockfd, NULL, NULL);
+        if(err!=0)
         {
-            suivant = actu->next;
-            free(actu->serveur);
-            free(actu);
-            actu = suivant;
-            printf("Serveur déconnecté: pas de réponse au keep-alive\n");
-            /* Si il y as un element avant, on indique sont suivant, sinon
-               on change la valeur du pointeur sur la tete de liste */
-            if(prec != NULL)
-            {
-                prec->next = actu;
-            }
-            else
-            {
-                *st = actu;
-            }
+            travailleurs[i].sockfd = -1;
+            return err;
         }
-        else /* Renvoie d'un message keep-alive a un serveur ayant repondu */
+        if((err=surveiller_socket(&travailleurs[i]))!=0)
         {
-            if(sendto(sockfd, m->contenu, m->lg_message, 0,
-                      actu->serveur, actu->addrlen) == -1)
-            {
-                perror("Error sendto");
-                delete_message(m);
-                return 12;
-            }
-            
-            actu->present=0;
-            prec = actu;
-            actu = actu->next;
+            close(travailleurs[i].sockfd);
+            travailleurs[i].sockfd = -1;
+            return err;
+        }
+        
+        sigfillset(&signaux);
+        pthread_sigmask(SIG_BLOCK, &signaux, &anciens);
+        err = pthread_create(&travailleurs[i].thread, NULL, travailler,
+                             &travailleurs[i]);
+        pthread_sigmask(SIG_SETMASK, &anciens, NULL);
+        if(err!=0)
+        {
+            errno = err;
+            perror("Error pthread_create");
+            close(travailleurs[i].sockfd);
+            travailleurs[i].sockfd = -1;
+            return 19;
         }
+        
+        if(mode_partitions)
+            epingler_thread(travailleurs[i].thread, i, &autorises);
     }
     
-    delete_message(m);
+    if(mode_partitions)
+        epingler_thread(pthread_self(), 0, &autorises);
     
     return 0;
 }
 
 /**
- * @brief Enregistre le fait qu'un serveur soit toujours actif.
+ * @brief Arrete les threads de reception supplementaires et libere les
+ *        ressources de tous les threads.
  *
- * @param st un pointeur sur le debut de la liste de serveurs.
- * @param serv un pointeur sur la structure contenant les informations du
- *        serveur ayant repondu.
+ * Chaque thread est reveille par son eventfd ; il constate alors l'arret du
+ * serveur.
 */
-void isAlive(l_serveur *st, struct sockaddr *serv)
+void arreter_travailleurs()
 {
-    l_serveur *emp;
+    unsigned int i, s;
+    uint64_t un = 1;
+    
+    serveur_actif = FALSE;
+    
+    for(i=1; i<nb_threads; i++)
+    {
+        if(travailleurs[i].sockfd==-1)
+            continue;
+        if(write(travailleurs[i].reveil, &un, sizeof(un))==-1)
+            perror("Error write");
+        pthread_join(travailleurs[i].thread, NULL);
+    }
     
-    /* Parcours de la liste de serveur a la recherche de serv */
-    for(emp=st; emp!=NULL; emp=emp->next)
+    for(i=0; i<nb_threads; i++)
     {
-        if(sockaddrcmp(serv,emp->serveur)==0)
+#ifdef AVEC_URING
+        if(travailleurs[i].lot.uring!=NULL)
+            delete_uring(&travailleurs[i].es);
+#endif
+        if(i>0 && travailleurs[i].sockfd!=-1)
+            close(travailleurs[i].sockfd);
+        if(travailleurs[i].reveil!=-1)
+            close(travailleurs[i].reveil);
+        if(travailleurs[i].minuteur!=-1)
+            close(travailleurs[i].minuteur);
+        if(travailleurs[i].echeance!=-1)
+            close(travailleurs[i].echeance);
+        free(travailleurs[i].vus);
+        if(travailleurs[i].epoll!=-1)
+            close(travailleurs[i].epoll);
+        for(s=0; travailleurs[i].entrantes!=NULL && s<nb_threads; s++)
+            delete_file_transferts(&travailleurs[i].entrantes[s]);
+        free(travailleurs[i].entrantes);
+        free(travailleurs[i].a_reveiller);
+        if(travailleurs[i].replication!=NULL)
+            delete_message(travailleurs[i].replication);
+        for(s=0; s<travailleurs[i].capacite_membres; s++)
         {
-            emp->present=1;
-            break;
-        }        
-    }    
+            if(travailleurs[i].vers_membres[s].m!=NULL)
+                delete_message(travailleurs[i].vers_membres[s].m);
+        }
+        free(travailleurs[i].vers_membres);
+        delete_lot_envoi(&travailleurs[i].envois);
+        delete_lot_reception(&travailleurs[i].lot);
+    }
 }
 
 /**
- * @brief Gere l'obsolescence des adresses associees aux hashs
+ * @brief Alloue les partitions de la table de hash et leurs verrous.
  *
- * Parcours l'ensemble de la table en supprimant l'ensemble des donnees
- * etant devenue obsoletes.
+ * Il y a une partition par thread en mode partitionne, une seule sinon. Le
+ * plafond memoire est partage egalement entre les partitions. L'anneau, vide
+ * jusqu'a sa premiere construction, et son verrou sont prepares ici aussi.
  *
- * @param dht un pointeur vers le pointeur sur le debut de la liste de hashs
- *        (dht peut etre modifie si le hash de debut de liste est supprime).
- * @return le temps minimal avant qu'un autre hash ne soit obsolete.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int gestion_obsolescence(l_hash **dht)
+int init_partitions()
 {
-    l_hash *table_actu, *table_prec, *table_next;
-    l_emplacement *emp_actu, *emp_next, *emp_prec;
-    long int temps_actuel;
-    int next_time;
+    int err;
+    unsigned int p, nb = mode_partitions ? nb_threads : 1;
+    pthread_rwlockattr_t attributs;
     
-    next_time = TEMPS_OBSOLESCENCE;
-    temps_actuel = time(NULL);
+    tables = calloc(nb, sizeof(table_hash));
+    verrous = calloc(nb, sizeof(pthread_rwlock_t));
+    if(tables==NULL || verrous==NULL)
+    {
+        perror("Error malloc");
+        free(tables);
+        free(verrous);
+        return 20;
+    }
     
-    table_prec=NULL;
-    /* Parcours de la liste de hash */
-    for(table_actu=*dht; table_actu!=NULL;)
+    /* Les put ne doivent pas attendre indefiniment derriere un flot de get :
+       un thread en attente d'ecriture passe avant les nouveaux lecteurs */
+    pthread_rwlockattr_init(&attributs);
+    pthread_rwlockattr_setkind_np(&attributs,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    
+    for(nb_partitions=0; nb_partitions<nb; nb_partitions++)
     {
-        emp_prec=NULL;
-        /* Parcours de la liste des adresses ip associees au hash */
-        for(emp_actu=table_actu->dispo; emp_actu!=NULL;)
-        {
-            /* Si l'adresse ip est obsolete, on la supprime */
-            if(temps_actuel-emp_actu->obsolescence > TEMPS_OBSOLESCENCE)
-            {
-                if(emp_prec==NULL)
-                    table_actu->dispo = emp_actu->next;
-                else
-                    emp_prec->next = emp_actu->next;
-                emp_next = emp_actu->next;
-                free(emp_actu->adresse);
-                free(emp_actu);
-                emp_actu=emp_next;
-            }
-            else
-            {
-                /* Sinon, on regarde le temps qui lui reste avant
-                   d'etre obsolete */
-                if(TEMPS_OBSOLESCENCE+emp_actu->obsolescence-temps_actuel 
-                                                                    < next_time)
-                {
-                    next_time = TEMPS_OBSOLESCENCE-temps_actuel
-                                +emp_actu->obsolescence;
-                }
-                
-                emp_prec=emp_actu;
-                emp_actu=emp_actu->next;
-            }
-        }
-        
-        /* Si le hash ne contient plus d'adresse associee, on le supprime */
-        if(table_actu->dispo==NULL)
+        p = nb_partitions;
+        if((err=init_table_hash(&tables[p]))!=0)
         {
-            if(table_prec==NULL)
-                *dht = table_actu->next;
-            else
-                table_prec->next = table_actu->next;
-                
-            table_next=table_actu->next;
-            free(table_actu->hash);
-            free(table_actu);
-            table_actu=table_next;            
+            pthread_rwlockattr_destroy(&attributs);
+            return err;
         }
-        else
+        tables[p].budget.max = memoire_max/nb;
+        pthread_rwlock_init(&verrous[p], &attributs);
+        if(periode_merkle>0 && (err=activer_merkle(&tables[p]))!=0)
         {
-            table_prec = table_actu;
-            table_actu=table_actu->next;
+            nb_partitions++;
+            pthread_rwlockattr_destroy(&attributs);
+            return err;
         }
     }
     
-    return next_time+1;
+    /* De meme, une reconstruction de l'anneau passe avant les put et get */
+    pthread_rwlock_init(&verrou_anneau, &attributs);
+    init_anneau(&vue_anneau, virtuels_anneau, copies_anneau);
+    
+    pthread_rwlockattr_destroy(&attributs);
+    if(periode_merkle>0)
+        init_merkle(&arbre);
+    
+    return 0;
 }
 
 /**
- *
- *
- *
- *
+ * @brief Libere les partitions de la table de hash et leurs verrous.
 */
-int reception_transfert(message *m, l_hash **dht, l_serveur **st)
+void delete_partitions()
 {
-    int err=0;
-    struct sockaddr *serveur;
-    taille taille_addrlent;
+    unsigned int p;
     
-    /* Si le message contient un serveur */
-    if(message_get_s(m, &serveur, &taille_addrlent)==0)
+    for(p=0; p<nb_partitions; p++)
     {
-        err=add_a_serveurs(st, serveur, (socklen_t) taille_addrlent);
-    }
-    else
-    {
-        /* Reception d'un couple hash/adresse */
-        err=serveur_put(m, dht, NULL, NULL);
+        delete_table_hash(&tables[p]);
+        pthread_rwlock_destroy(&verrous[p]);
     }
     
-    return err;
+    free(tables);
+    free(verrous);
+    tables = NULL;
+    verrous = NULL;
+    delete_anneau(&vue_anneau);
 }
 
 /**
- * @brief Informe tout les serveurs connus de la creation d'un nouveau serveur.
+ * @brief Recupere l'etat d'un serveur par un flux de synchronisation.
  *
- * @param sockfd l'identifiant du socket a utiliser.
- * @param st un pointeur vers le debut de la liste de serveur.
- * @param nouveau_serv les informations du nouveau serveur.
- * @param addrlen la longueur des infos du nouveau serveur.
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * La demande porte les positions rechargees avec l'instantane : si le
+ * serveur contacte y retrouve la sienne, il n'envoie que les modifications
+ * posterieures.
+ *
+ * @param sockfd la socket de datagrammes du nouveau serveur (son adresse
+ *        est annoncee au serveur contacte).
+ * @param ip l'ip du serveur a contacter.
+ * @param port le port du serveur a contacter.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, 62 si le serveur contacte n'accepte pas de
+ *         flux, un autre code d'erreur sinon.
 */
-int informer_connexion_serveur(int sockfd, l_serveur *st, 
-                        struct sockaddr * nouveau_serv, taille addrlen)
+int synchro_flux(int sockfd, char *ip, char *port, serveurs_connus *st)
 {
-    int err;
-    message *m;
-
-    /* Creer un nouveau message de type transfert */
-    err=create_message(&m, 't', SIZEOF_ENTETE);
-    if(err!=0)
-        return err;
+    int fd, err;
+    stats_synchro stats;
+    sockaddr_in local;
+    socklen_t addrlen = sizeof(local);
+    struct timeval delai = {SYNCHRO_DELAI, 0};
     
-    /* Ajout des donnees d'un serveur au message */
-    err=add_data(m, 's', addrlen, nouveau_serv);
-    if(err!=0)
+    if(getsockname(sockfd, (struct sockaddr *) &local, &addrlen)==-1)
     {
-        delete_message(m);
-        return err;
+        perror("Error getsockname");
+        return 29;
     }
-
-    prepare_message(m);
     
-    /* Envoie du message a tt les serveurs connus */
-    for(; st!=NULL; st=st->next)
-    {
-        if(sendto(sockfd, m->contenu, m->lg_message, 0,
-                  st->serveur, st->addrlen) == -1)
-        {
-            perror("Error sendto");
-            delete_message(m);
-            return 17;
-        }
-    }
+    if((err=get_addr(FLUX_CLIENT, ip, port, &fd, NULL, NULL))!=0)
+        return err;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &delai, sizeof(delai));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &delai, sizeof(delai));
     
-    delete_message(m);
+    err=demander_synchro(fd, (struct sockaddr *) &local, positions,
+                         nb_positions);
+    if(err==0)
+        err=recevoir_synchro(fd, tables, nb_partitions, st,
+                             journal_actif ? &journal_puts : NULL, &stats);
+    if(err==0)
+        afficher_stats_synchro(&stats, "reçues", stdout);
+    close(fd);
     
-    return 0;
+    return err;
 }
 
 /**
@@ -629,27 +4263,73 @@ int informer_connexion_serveur(int sockfd, l_serveur *st,
  * @param argv[2] PORT port sur lequel ecouter.
  * @param argv[3] IP (facultatif) l'ip d'un serveur auquel se connecter.
  * @param argv[4] PORT (si argv[3] specifie) le port du serveur a contacter.
+ * Les options (voir lire_options) precedent ces arguments.
 */
 int main(int argc, char **argv)
 {
-    int sockfd, sockfd2, err, last = 0;
-    long int derniere_verification, temps_ecoule, next_time;
+    int sockfd, sockfd2, err, last = 0, nb_args, role, signaux, minuteur_ka;
+    int ecoute = -1;
+    unsigned int sources, i;
+    uint64_t nb;
+    char **args;
+    long int derniere_sauvegarde, dernier_merkle;
     struct addrinfo *head, *valide;
+    struct timeval delai = {SYNCHRO_DELAI, 0};
     message *m, *m2;
-    l_hash *dht = NULL;
-    l_serveur *st = NULL;
-    socklen_t addrlen = sizeof(sockaddr_in);
-    sockaddr_in client = {0};
-    struct itimerval timer = {{SERVEUR_CHK_A_SEC,SERVEUR_CHK_A_MICROSEC},
-                              {SERVEUR_CHK_A_SEC,SERVEUR_CHK_A_MICROSEC}};
+    serveurs_connus st;
 
-    if((err=gestion_signaux())!=0)
+    if((err=gestion_signaux(&signaux))!=0)
+    {
+        return err;
+    }
+    
+    if((err=init_serveurs(&st))!=0)
+    {
+        return err;
+    }
+    
+    /* Lecture des options, les arguments restants sont les adresses
+       (args[1] est le premier d'entre eux, comme argv[1] sans option) */
+    args = argv;
+    nb_args = lire_options(argc, argv);
+    if(nb_args!=-1)
     {
+        args = argv+nb_args-1;
+        nb_args = argc-nb_args+1;
+    }
+    
+    /* En mode anneau, les tables des serveurs different par construction :
+       ni anti-entropie, ni envoi des modifications depuis l'historique, et
+       pas de commerage (les couples vont directement aux proprietaires) */
+    if(copies_anneau>0)
+    {
+        if(fanout_gossip>0)
+            nb_args = -1;
+        periode_merkle = 0;
+        taille_historique = 0;
+    }
+    
+    if((err=init_partitions())!=0 ||
+       (err=init_historique(&modifications,
+                            taille_historique*1024*1024))!=0)
+    {
+        delete_partitions();
+        delete_serveurs(&st);
+        return err;
+    }
+    
+    /* Avec plusieurs threads, chacun a sa socket sur l'adresse d'ecoute */
+    role = nb_threads>1 ? SERVEUR_REUSEPORT : SERVEUR;
+    
+    if(nb_args!=-1 && (err=restaurer_partitions())!=0)
+    {
+        delete_serveurs(&st);
+        delete_partitions();
         return err;
     }
     
     /* Teste la validite de la ligne de commande */
-    if(argc == 5) /* Cas d'une connexion a un autre serveur */
+    if(nb_args == 5) /* Cas d'une connexion a un autre serveur */
     {
         /* Creer un nouveau message de type new server */
         err=create_message(&m, 'n', SIZEOF_ENTETE);
@@ -661,16 +4341,32 @@ int main(int argc, char **argv)
         prepare_message(m);
         
         /*Initialisation de l'ecoute du serveur */
-        err=get_addr(SERVEUR, argv[1], argv[2], &sockfd, NULL, NULL);
+        err=get_addr(role, args[1], args[2], &sockfd, NULL, NULL);
         if(err!=0)
         {
             delete_message(m);
             last=1;
         }
 
+        /* Recuperation de l'etat par un flux, ou par datagrammes si le
+           serveur contacte n'accepte pas de flux */
+        if(last==0)
+        {
+            err=synchro_flux(sockfd, args[3], args[4], &st);
+            if(err==0)
+                last=1;
+            else if(err!=62)
+            {
+                delete_message(m);
+                close(sockfd);
+                delete_partitions();
+                exit(err);
+            }
+        }
+        
         /* Recuperation d'une adresse valide pour contacter le serveur
            auquel se connecter */
-        err=get_addr(CLIENT, argv[3], argv[4], &sockfd2, &head, &valide);
+        err=get_addr(CLIENT, args[3], args[4], &sockfd2, &head, &valide);
         if(err!=0)
         {
             delete_message(m);
@@ -680,7 +4376,7 @@ int main(int argc, char **argv)
         close(sockfd2);
         
         /* Envoie l'information de connexion a l'autre serveur */
-        if(sendto(sockfd, m->contenu, m->lg_message, 0,
+        if(last==0 && sendto(sockfd, m->contenu, m->lg_message, 0,
                   valide->ai_addr, valide->ai_addrlen) == -1)
         {
             perror("Error sendto");
@@ -692,10 +4388,19 @@ int main(int argc, char **argv)
         
         delete_message(m);
         
-        /* Reception du message */
+        /* Reception du message. Un transfert par datagrammes n'est pas
+           fiable : sans message pendant SYNCHRO_DELAI secondes (fin perdue
+           ou serveur arrete), le serveur demarre avec ce qu'il a reçu */
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &delai, sizeof(delai));
         while(last==0)
         {
             err = recevoir_message(&m2, sockfd, NULL, NULL);
+            if(err==CODE_CANCEL_WAIT)
+            {
+                fprintf(stderr, "Erreur : transfert par datagrammes "\
+                        "incomplet\n");
+                break;
+            }
             if(err!=0)
             {
                 close(sockfd);
@@ -706,13 +4411,13 @@ int main(int argc, char **argv)
             /* Reception d'un element (hash/adresse ou serveur) */
             if(m2->type=='t')
             {
-                err=reception_transfert(m2, &dht, &st);
+                err=reception_transfert(m2, NULL, &st);
                 if(err!=0)
                 {
                     delete_message(m2);
                     freeaddrinfo(head);
                     close(sockfd);
-                    delete_l_hash(dht);
+                    delete_partitions();
                     exit(err);
                 }
             }
@@ -722,13 +4427,15 @@ int main(int argc, char **argv)
             }
             delete_message(m2);
         }
+        delai.tv_sec = 0;
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &delai, sizeof(delai));
         err=add_a_serveurs(&st, valide->ai_addr, valide->ai_addrlen);
         freeaddrinfo(head);
     }
-    else if(argc == 3)  /*Cas de la creation d'un serveur solitaire */
+    else if(nb_args == 3)  /*Cas de la creation d'un serveur solitaire */
     {
         /*Initialisation de l'ecoute du serveur */
-        err=get_addr(SERVEUR, argv[1], argv[2], &sockfd, NULL, NULL);
+        err=get_addr(role, args[1], args[2], &sockfd, NULL, NULL);
         if(err!=0)
         {
             return err;
@@ -736,180 +4443,188 @@ int main(int argc, char **argv)
     }
     else /* Cas de commande invalide */
     {
-        printf("Usage : %s IP PORT\n", argv[0]);
-        printf("Usage : %s IP PORT IP_AUTRE_SERVEUR PORT_AUTRE_SERVEUR\n", 
-                                                                       argv[0]);
+        printf("Usage : %s [-b] [-m MO] [-s FICHIER] [-j FICHIER] [-g MS] "\
+               "[-l N] [-t N] [-p] [-u] [-d OCTETS] [-a SECONDES] [-r MO] "\
+               "[-e MS] [-f N] [-n TOURS] [-c R] [-v N] IP PORT\n",
+               argv[0]);
+        printf("Usage : %s [-b] [-m MO] [-s FICHIER] [-j FICHIER] [-g MS] "\
+               "[-l N] [-t N] [-p] [-u] [-d OCTETS] [-a SECONDES] [-r MO] "\
+               "[-e MS] [-f N] [-n TOURS] [-c R] [-v N] IP PORT "\
+               "IP_AUTRE_SERVEUR PORT_AUTRE_SERVEUR\n", argv[0]);
         exit(13);
     }
+    
+    /* Premier anneau : les hash restaures ou reçus dont le serveur n'est
+       pas proprietaire partent vers leurs proprietaires */
+    if(copies_anneau>0 && (err=rejoindre_anneau(sockfd, &st))!=0)
+    {
+        close(sockfd);
+        delete_partitions();
+        delete_serveurs(&st);
+        return err;
+    }
+    
+    /* Threads de reception, avec les tampons des lots de datagrammes
+       reçus et envoyes de chacun */
+    travailleurs = calloc(nb_threads, sizeof(travailleur));
+    if(travailleurs==NULL)
+    {
+        perror("Error malloc");
+        return 20;
+    }
+    err=demarrer_travailleurs(&st, sockfd, args[1], args[2]);
+    if(err!=0)
+    {
+        arreter_travailleurs();
+        return err;
+    }
 
-    /* Timer pour indiquer qu'il faut verifier si les serveurs sont toujours
-       en vie */
-    setitimer(ITIMER_REAL, &timer, NULL);
+    /* Le thread principal attend aussi le minuteur des keep-alive, les
+       signaux et les flux des nouveaux serveurs */
+    err=creer_minuteur(&minuteur_ka, SERVEUR_CHK_A_SEC,
+                       SERVEUR_CHK_A_MICROSEC);
+    if(err==0)
+        err=get_addr(FLUX_SERVEUR, args[1], args[2], &ecoute, NULL, NULL);
+    /* Socket d'ecoute non bloquante : une connexion abandonnee avant
+       accept ne bloque pas la boucle */
+    if(err==0 && (fcntl(ecoute, F_SETFL, O_NONBLOCK)==-1 ||
+                  listen(ecoute, SOMAXCONN)==-1))
+    {
+        perror("Error listen");
+        err = 27;
+    }
+    for(i=0; i<SYNCHRO_DEMANDES_MAX; i++)
+        demandes_synchro[i].fd = -1;
+    if(err==0)
+        err=surveiller(travailleurs[0].epoll, ecoute, SOURCE_FLUX);
+    if(err==0)
+        err=surveiller(travailleurs[0].epoll, minuteur_ka, SOURCE_KEEP_ALIVE);
+    if(err==0)
+        err=surveiller(travailleurs[0].epoll, signaux, SOURCE_SIGNAUX);
+    if(err==0)
+        err=demarrer_reception(&travailleurs[0]);
+    if(err!=0)
+    {
+        arreter_travailleurs();
+        return err;
+    }
     
-    /* Variables permettant de verifier quand il faut, si les donnees sont
-       obsoletes ou non */
-    temps_ecoule = 0;
-    derniere_verification = time(NULL);
-    next_time = TEMPS_OBSOLESCENCE;
+    derniere_sauvegarde = time(NULL);
+    dernier_merkle = time(NULL);
+    srandom(time(NULL)^getpid());
     
     while(serveur_actif)
     {
+        /* Attend un lot de messages, un minuteur ou un signal */
+        err=attendre_evenements(&travailleurs[0], &sources);
+        if(err==CODE_INTERRUP_SYSTEM)
+            continue;
+        if(err!=0)
+            break;
+        
+        /* Signaux reçus (SIGINT ou SIGUSR1) */
+        if(sources & SOURCE_SIGNAUX)
+            lire_signaux(signaux);
+        
+        /* Un nouveau serveur demande l'etat par un flux : sa demande est
+           lue au fil de son arrivee, et abandonnee si elle tarde */
+        if(sources & SOURCE_FLUX)
+            accepter_synchro(ecoute);
+        if(sources & (SOURCE_FLUX|SOURCE_DEMANDE|SOURCE_OBSOLESCENCE))
+            servir_synchro(sockfd, &st);
+        
         /* Si le delais d'attente des reponse des keep-alive est ecoule */
-        if(check_K_A)
+        if(sources & SOURCE_KEEP_ALIVE)
         {
+            if(read(minuteur_ka, &nb, sizeof(nb))==-1 && errno!=EAGAIN)
+                perror("Error read");
+            pthread_mutex_lock(&verrou_serveurs);
             err=check_send_KA(&st,sockfd);
+            pthread_mutex_unlock(&verrou_serveurs);
             if(err!=0)
                 break;
-            
-            check_K_A=FALSE;
         }
         
-        /* Attend l'arrivee d'un message */
-        err=recevoir_message(&m, sockfd, (struct sockaddr *) &client, &addrlen);
-        if(err!=0)
+        /* Passage de la roue d'obsolescence (de toute la table, ou de la
+           premiere partition en mode partitionne), meme sans message reçu,
+           puis ecriture periodique de l'instantane, comparaison
+           periodique de l'arbre de Merkle avec un autre serveur et, en mode
+           anneau, retrait des hash cedes au dernier changement d'anneau */
+        if(sources & SOURCE_OBSOLESCENCE)
         {
-            if(err==CODE_INTERRUP_SYSTEM)
+            verifier_obsolescence(&travailleurs[0]);
+            if(fichier_instantane!=NULL)
             {
-                /* Si l'interruption a eu lieu a cause de SIGALRM */
-                if(check_K_A)
-                    continue;
-                /* Si l'interruption a eu lieu a cause de SIGINT */
-                if(!serveur_actif)
-                    break;
-            }
-            else
-            {
-                break;
-            }
-        }
-        
-        /* Avant de traiter le message, l'obsolescence des
-           donnees peut etreverifiee selon le temps qui est 
-           passe depuis la derniere verification */
-        temps_ecoule = time(NULL)-derniere_verification;
-        if(temps_ecoule>=next_time)
-        {
-            next_time = gestion_obsolescence(&dht);
-            derniere_verification = time(NULL);
-        }
-
-        /* Effectue un action en fonction du type du message */
-        switch(m->type)
-        {
-            /* Lit le message et stocke les donnees recues (put d'un hash) */
-            case 'p':
-                err=serveur_put(m, &dht, &st, &sockfd);
-                printf("Arrivee Hash\n");
-                if(err!=0)
-                    serveur_actif = FALSE;
-                break;
-            
-            /* Lit le message et recherche dans le DHT toutes les donnees
-               voulues (get d'un hash) */
-            case 'g':
-                err=serveur_get(&m2, m, dht);
-                if(err!=0)
-                {
-                    serveur_actif = FALSE;
-                    break;
-                }
-                
-                prepare_message(m2);
-                
-                /* Envoie la reponse au client */
-                if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
-                            (struct sockaddr *) &client, addrlen) == -1)
-                {
-                    perror("Error sendto");
-                    serveur_actif = FALSE;
-                    err = 14;
-                }
-                delete_message(m2);
-                break;
-                
-            /* Un nouveau serveur souhaite se connecter */
-            case 'n':
-                printf("Nouvelle connexion\n");
-                /* Envoie la table de hashage et la liste de serveurs au serveur
-                   se connectant */
-                err=serveur_send_all(sockfd, (struct sockaddr *) &client,
-                                     addrlen, dht, st);
-                if(err!=0)
-                {
-                    serveur_actif = FALSE;
-                    break;
-                }
-                
-                /* Envoie le nouveau serveur a tt les serveurs connus */
-                err=informer_connexion_serveur(sockfd, st,
-                                (struct sockaddr *) &client, (taille)addrlen);
-                if(err!=0)
+                terminer_instantane(FALSE);
+                if(time(NULL)-derniere_sauvegarde >= INSTANTANE_PERIODE)
                 {
-                    serveur_actif = FALSE;
-                    break;
+                    lancer_instantane(&st);
+                    derniere_sauvegarde = time(NULL);
                 }
-                
-                /* Ajoute le serveur dans la liste de serveurs */
-                err=add_a_serveurs(&st,(struct sockaddr *) &client, addrlen);
-                if(err!=0)
-                    serveur_actif = FALSE;
-                
-                break;
-
-            /* Un serveur informe qu'il s'arrete */
-            case 'd':
-                printf("Deconnexion d'un serveur\n");
-                delete_server(&st,(struct sockaddr *) &client);
-                break;
-
-            /* Reception d'un message demandant si le serveur est
-               toujours actif (keep-alive) */
-            case 'k':
-                /* Creer un nouveau message de type alive */
-                err=create_message(&m2, 'a', SIZEOF_ENTETE);
+            }
+            if(periode_merkle>0 &&
+               time(NULL)-dernier_merkle >= periode_merkle)
+            {
+                err=lancer_anti_entropie(sockfd, &st);
                 if(err!=0)
-                {
-                    serveur_actif = FALSE;
                     break;
-                }
-                
-                prepare_message(m2);
-                
-                /* Envoie la reponse au serveur */
-                if(sendto(sockfd, m2->contenu, m2->lg_message, 0,
-                            (struct sockaddr *) &client, addrlen) == -1)
-                {
-                    perror("Error sendto");
-                    serveur_actif = FALSE;
-                    err = 15;
-                }
-                
-                delete_message(m2);
-                break;
-
-                /*Reception de la reponse d'un serveur a un keep-alive */
-            case 'a':
-                isAlive(st, (struct sockaddr*) &client);
-                break;
-            case 't':
-                /* Reception d'une donnée d'un autre serveur */
-                err=reception_transfert(m, &dht, &st);
-                if(err!=0)
-                    serveur_actif = FALSE;
+                dernier_merkle = time(NULL);
+            }
+            if(copies_anneau>0 && (err=ceder_hash(sockfd))!=0)
                 break;
-            /* Cas de message inconnu. Le message n'est pas pris en compte. */
-            default:
-                fprintf(stderr, "Type de message inconnu (%c)\n", m->type);
         }
-        delete_message(m);
+        
+        /* Traitement des messages du lot */
+        traiter_lot(&travailleurs[0]);
+        
+        /* Reconstruction de l'anneau si les serveurs connus ont change */
+        if(copies_anneau>0 &&
+           (err=mettre_a_jour_anneau(sockfd, &st, FALSE))!=0)
+            break;
+    }
+    terminer_replication(&travailleurs[0]);
+    for(i=0; i<SYNCHRO_DEMANDES_MAX; i++)
+    {
+        if(demandes_synchro[i].fd!=-1)
+            fermer_demande(&demandes_synchro[i]);
     }
     
+    /* Arret des autres threads de reception */
+    arreter_travailleurs();
+    free(travailleurs);
+    
+    /* En mode anneau, les hash dont le serveur etait le dernier
+       proprietaire present partent vers leurs nouveaux proprietaires */
+    if(copies_anneau>0)
+        mettre_a_jour_anneau(sockfd, &st, TRUE);
+    
     /* Informe les serveurs connus de l'arret de celui-ci */
-    err=informer_arret_serveur(st,sockfd);
+    err=informer_arret_serveur(st.premier,sockfd);
     printf("Fermeture du serveur\n");
+    
+    /* Dernier instantane, apres la fin d'une eventuelle ecriture en cours.
+       Le journal, valide jusqu'au bout, devient inutile s'il est ecrit */
+    if(fichier_instantane!=NULL)
+        terminer_instantane(TRUE);
+    if(journal_actif)
+        fermer_journal(&journal_puts);
+    if(fichier_instantane!=NULL &&
+       ecrire_instantane_partitions(tables, nb_partitions,
+                                    fichier_instantane)==0)
+    {
+        nb_positions = relever_positions(&st, positions);
+        ecrire_positions(fichier_instantane, positions, nb_positions);
+        if(journal_actif)
+            supprimer_journal(fichier_journal);
+    }
     close(sockfd);
-    delete_l_hash(dht);
-    delete_l_serveurs(st);
+    close(minuteur_ka);
+    close(ecoute);
+    close(signaux);
+    vider_reserve(&reserve_messages);
+    delete_historique(&modifications);
+    delete_partitions();
+    delete_serveurs(&st);
 
     return err;
 }
@@ -1,248 +1,1433 @@
 #include "stockage_serveur.h"
 
+/**
+ * @brief Calcule le code de hachage d'une chaine (FNV-1a sur 64 bits).
+ *
+ * @param hash la chaine a hacher.
+ * @param taille_hash la longueur de la chaine hash.
+ * @return le code de hachage de la chaine.
+*/
+static uint64_t calcul_code(donnees *hash, taille taille_hash)
+{
+    uint64_t code = 14695981039346656037ULL;
+    taille i;
+
+    for(i=0; i<taille_hash; i++)
+    {
+        code ^= hash[i];
+        code *= 1099511628211ULL;
+    }
+
+    return code;
+}
+
+/**
+ * @brief Calcule le code de hachage d'une cle.
+ *
+ * Une cle binaire est deja le resultat d'une fonction de hachage
+ * cryptographique : ses 8 premiers octets sont utilises tels quels.
+ *
+ * @param type_cle le type de la cle ('h' chaine, 'b' cle binaire).
+ * @param hash la cle.
+ * @param taille_hash la longueur de la cle.
+ * @return le code de hachage de la cle.
+*/
+static uint64_t code_cle(donnees type_cle, donnees *hash, taille taille_hash)
+{
+    uint64_t code;
+    
+    if(type_cle=='b' && taille_hash>=sizeof(uint64_t))
+    {
+        memcpy(&code, hash, sizeof(uint64_t));
+        return code;
+    }
+    
+    return calcul_code(hash, taille_hash);
+}
+
+/**
+ * @brief Calcule l'empreinte d'un couple hash/adresse pour l'arbre de Merkle.
+ *
+ * L'empreinte ne depend que des octets du hash et de l'adresse (et de leurs
+ * types), pas de leur date : deux serveurs stockant le meme couple calculent
+ * la meme.
+ *
+ * @param table le hash.
+ * @param adresse l'adresse.
+ * @return l'empreinte du couple.
+*/
+static uint64_t empreinte_couple(l_hash *table, adresse_interne *adresse)
+{
+    uint64_t types = ((uint64_t)table->type_cle<<8)|adresse->type_adresse;
+    
+    return melanger_merkle(table->code^melanger_merkle(adresse->code+types));
+}
+
+/**
+ * @brief Initialise un dictionnaire d'adresses vide.
+ *
+ * @param dico un pointeur sur le dictionnaire a initialiser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_dico(dico_adresses *dico)
+{
+    memset(dico, 0, sizeof(dico_adresses));
+    
+    dico->index = malloc(DICO_CAPACITE_INITIALE*sizeof(alveole_dico));
+    if(dico->index == NULL)
+    {
+        perror("Error malloc");
+        return 109;
+    }
+    /* Toutes les alveoles sont vides (identifiant DICO_VIDE) */
+    memset(dico->index, 0xff, DICO_CAPACITE_INITIALE*sizeof(alveole_dico));
+    dico->capacite_index = DICO_CAPACITE_INITIALE;
+    
+    return 0;
+}
+
+/**
+ * @brief Libere la memoire attribuee a un dictionnaire d'adresses.
+ *
+ * @param dico un pointeur sur le dictionnaire a liberer.
+ * @param alloc l'allocateur ayant servi a allouer les adresses.
+*/
+void delete_dico(dico_adresses *dico, allocateur *alloc)
+{
+    uint32_t id;
+    adresse_interne *a;
+    
+    for(id=0; id<dico->nb_ids; id++)
+    {
+        a = dico->adresses[id];
+        if(a!=NULL)
+            liberer(alloc, a, TAILLE_ADRESSE_INTERNE(a->taille_adresse));
+    }
+    
+    free(dico->adresses);
+    free(dico->libres);
+    free(dico->index);
+    memset(dico, 0, sizeof(dico_adresses));
+}
+
+/**
+ * @brief Recherche une adresse dans l'index du dictionnaire.
+ *
+ * @param dico un pointeur sur le dictionnaire.
+ * @param code le code de hachage de l'adresse.
+ * @param type_adresse la forme de l'adresse ('e' ou 'a').
+ * @param adresse l'adresse sous cette forme.
+ * @param taille_adresse la taille de l'adresse.
+ * @return l'indice de l'alveole contenant l'adresse, sinon l'indice de
+ *         l'alveole vide terminant la sequence de sonde.
+*/
+static size_t sonde_dico(dico_adresses *dico, uint64_t code,
+                            donnees type_adresse, donnees *adresse,
+                            taille taille_adresse)
+{
+    size_t i, masque = dico->capacite_index-1;
+    uint32_t empreinte = (uint32_t)(code>>32);
+    adresse_interne *a;
+    
+    for(i=code&masque; dico->index[i].id!=DICO_VIDE; i=(i+1)&masque)
+    {
+        if(dico->index[i].id==DICO_SUPPRIMEE ||
+           dico->index[i].empreinte!=empreinte)
+            continue;
+        
+        a = dico->adresses[dico->index[i].id];
+        if(a->taille_adresse==taille_adresse &&
+           a->type_adresse==type_adresse &&
+           memcmp(a->octets, adresse, taille_adresse)==0)
+            break;
+    }
+    
+    return i;
+}
+
+/**
+ * @brief Reconstruit l'index du dictionnaire avec une nouvelle capacite.
+ *
+ * Le dictionnaire ne contient que les adresses distinctes (quelques milliers
+ * en pratique), l'index est donc reconstruit d'un seul coup.
+ *
+ * @param dico un pointeur sur le dictionnaire.
+ * @param capacite la nouvelle capacite (puissance de 2).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int reindexer_dico(dico_adresses *dico, size_t capacite)
+{
+    alveole_dico *index;
+    size_t i, masque = capacite-1;
+    uint32_t id;
+    adresse_interne *a;
+    
+    index = malloc(capacite*sizeof(alveole_dico));
+    if(index == NULL)
+    {
+        perror("Error malloc");
+        return 110;
+    }
+    memset(index, 0xff, capacite*sizeof(alveole_dico));
+    
+    for(id=0; id<dico->nb_ids; id++)
+    {
+        a = dico->adresses[id];
+        if(a==NULL)
+            continue;
+        
+        for(i=a->code&masque; index[i].id!=DICO_VIDE; i=(i+1)&masque);
+        index[i].id = id;
+        index[i].empreinte = (uint32_t)(a->code>>32);
+    }
+    
+    free(dico->index);
+    dico->index = index;
+    dico->capacite_index = capacite;
+    dico->supprimees = 0;
+    
+    return 0;
+}
+
+/**
+ * @brief Renvoie l'identifiant d'une adresse en l'ajoutant au dictionnaire
+ *        si necessaire.
+ *
+ * Le compteur de references de l'adresse est incremente : chaque appel doit
+ * etre equilibre par un appel a relacher_adresse.
+ *
+ * @param dico un pointeur sur le dictionnaire.
+ * @param alloc l'allocateur a utiliser pour stocker l'adresse.
+ * @param type_adresse la forme de l'adresse ('e' extremite binaire,
+ *        'a' chaine de caracteres).
+ * @param adresse l'adresse sous cette forme.
+ * @param taille_adresse la taille de l'adresse.
+ * @param id l'identifiant de l'adresse (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int interner_adresse(dico_adresses *dico, allocateur *alloc,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse, uint32_t *id)
+{
+    int err;
+    size_t i;
+    uint64_t code = calcul_code(adresse, taille_adresse);
+    adresse_interne *a, **tmp_realloc;
+    
+    i = sonde_dico(dico, code, type_adresse, adresse, taille_adresse);
+    if(dico->index[i].id!=DICO_VIDE)
+    {
+        *id = dico->index[i].id;
+        dico->adresses[*id]->references++;
+        dico->references++;
+        return 0;
+    }
+    
+    /* Nouvelle adresse : reconstruit l'index s'il est trop rempli, en le
+       doublant seulement si les adresses presentes le justifient (sinon il
+       s'agit juste de se debarrasser des alveoles supprimees) */
+    if((dico->nb_adresses+dico->supprimees+1)*8 >
+                                dico->capacite_index*TABLE_REMPLISSAGE_MAX)
+    {
+        err=reindexer_dico(dico, (dico->nb_adresses+1)*2 > dico->capacite_index
+                                 ? 2*dico->capacite_index
+                                 : dico->capacite_index);
+        if(err!=0)
+            return err;
+        i = sonde_dico(dico, code, type_adresse, adresse, taille_adresse);
+    }
+    
+    /* Agrandit le tableau des adresses si aucun identifiant n'est libre */
+    if(dico->nb_libres==0 && dico->nb_ids==dico->capacite_ids)
+    {
+        tmp_realloc = realloc(dico->adresses, (2*dico->capacite_ids+16)
+                                              *sizeof(adresse_interne *));
+        if(tmp_realloc==NULL)
+        {
+            perror("Error realloc");
+            return 111;
+        }
+        dico->adresses = tmp_realloc;
+        dico->capacite_ids = 2*dico->capacite_ids+16;
+    }
+    
+    a = allouer(alloc, TAILLE_ADRESSE_INTERNE(taille_adresse));
+    if(a==NULL)
+        return 102;
+    
+    memcpy(a->octets, adresse, taille_adresse);
+    a->taille_adresse = taille_adresse;
+    a->type_adresse = type_adresse;
+    a->code = code;
+    a->references = 1;
+    
+    if(dico->nb_libres>0)
+        *id = dico->libres[--dico->nb_libres];
+    else
+        *id = dico->nb_ids++;
+    
+    dico->adresses[*id] = a;
+    dico->index[i].id = *id;
+    dico->index[i].empreinte = (uint32_t)(code>>32);
+    dico->nb_adresses++;
+    dico->references++;
+    
+    return 0;
+}
+
+/**
+ * @brief Relache une reference sur une adresse du dictionnaire.
+ *
+ * L'adresse est retiree du dictionnaire lorsque plus aucun emplacement ne
+ * l'utilise, et son identifiant peut alors etre reutilise.
+ *
+ * @param dico un pointeur sur le dictionnaire.
+ * @param alloc l'allocateur ayant servi a stocker l'adresse.
+ * @param id l'identifiant de l'adresse.
+*/
+void relacher_adresse(dico_adresses *dico, allocateur *alloc, uint32_t id)
+{
+    size_t i;
+    uint32_t *tmp_realloc;
+    adresse_interne *a = dico->adresses[id];
+    
+    dico->references--;
+    if(--a->references > 0)
+        return;
+    
+    i = sonde_dico(dico, a->code, a->type_adresse, a->octets,
+                   a->taille_adresse);
+    dico->index[i].id = DICO_SUPPRIMEE;
+    dico->supprimees++;
+    dico->nb_adresses--;
+    
+    dico->adresses[id] = NULL;
+    liberer(alloc, a, TAILLE_ADRESSE_INTERNE(a->taille_adresse));
+    
+    /* Memorise l'identifiant libere (si la memoire manque, il est perdu) */
+    if(dico->nb_libres==dico->capacite_libres)
+    {
+        tmp_realloc = realloc(dico->libres, (2*dico->capacite_libres+16)
+                                            *sizeof(uint32_t));
+        if(tmp_realloc==NULL)
+            return;
+        dico->libres = tmp_realloc;
+        dico->capacite_libres = 2*dico->capacite_libres+16;
+    }
+    dico->libres[dico->nb_libres++] = id;
+}
+
 /**
  * @brief Libere recursivement la memoire attribuee a une liste d'emplacement.
  *
- * Libere dans l'ordre : l'emplacement suivant, la chaine de caractere
- * representant une adresse, puis enfin l'emplacement actuel.
+ * Libere dans l'ordre : l'emplacement suivant, la reference sur l'adresse
+ * dans le dictionnaire, puis l'emplacement actuel.
+ *
+ * @param dht la table a laquelle appartiennent les emplacements.
+ * @param emp le pointeur sur la liste chainee d'emplacement a liberer.
+*/
+void delete_l_emplacement(table_hash *dht, l_emplacement *emp)
+{
+    if(emp==NULL)
+        return;
+    
+    delete_l_emplacement(dht, emp->next);
+    relacher_adresse(&dht->adresses, &dht->alloc, emp->id_adresse);
+    liberer(&dht->alloc, emp, sizeof(l_emplacement));
+}
+
+/**
+ * @brief Creer une nouvelle structure l_emplacement et l'initialise.
+ *
+ * Alloue la place pour une strucuture l_emplacement, puis initialise
+ * l'identifiant de l'adresse (deja presente dans le dictionnaire).
+ *
+ * @param alloc l'allocateur a utiliser.
+ * @param retour un pointeur vers le pointeur dans lequel stocker l'adresse de
+ *        la structure allouee (valeur de retour par effet de bord).
+ * @param id_adresse l'identifiant de l'adresse IP dans le dictionnaire.
+ * @return 0 en cas de reussite, un code d'erreur sinon
+*/
+int new_emplacement(allocateur *alloc, l_emplacement **retour,
+                        uint32_t id_adresse)
+{
+    l_emplacement *emp = allouer(alloc, sizeof(l_emplacement));
+    if(emp == NULL)
+    {
+        return 101;
+    }
+    
+    emp->id_adresse = id_adresse;
+    emp->obsolescence = time(NULL);
+    emp->proprietaire = NULL;
+    emp->next = NULL;
+    emp->prec = NULL;
+    emp->roue_next = NULL;
+    emp->roue_prec = NULL;
+    
+    *retour = emp;
+    
+    return 0;    
+}
+
+/**
+ * @brief Inscrit un emplacement dans la case de la roue correspondant a la
+ *        seconde ou il deviendra obsolete.
+ *
+ * Un emplacement dont l'echeance est deja passee est place dans la case de la
+ * prochaine seconde a traiter.
+ *
+ * @param roue la roue d'obsolescence.
+ * @param emp l'emplacement a inscrire (il ne doit pas deja etre inscrit).
+*/
+static void planifier(roue_obsolescence *roue, l_emplacement *emp)
+{
+    long int echeance = emp->obsolescence+TEMPS_OBSOLESCENCE+1;
+    l_emplacement **case_roue;
+    
+    if(echeance <= roue->derniere)
+        echeance = roue->derniere+1;
+    
+    case_roue = &roue->cases[echeance&(TAILLE_ROUE-1)];
+    
+    emp->roue_prec = NULL;
+    emp->roue_next = *case_roue;
+    if(*case_roue!=NULL)
+        (*case_roue)->roue_prec = emp;
+    *case_roue = emp;
+}
+
+/**
+ * @brief Retire un emplacement de la case de la roue ou il est inscrit.
+ *
+ * @param roue la roue d'obsolescence.
+ * @param emp l'emplacement a retirer.
+*/
+static void deplanifier(roue_obsolescence *roue, l_emplacement *emp)
+{
+    long int echeance = emp->obsolescence+TEMPS_OBSOLESCENCE+1;
+    
+    if(emp->roue_prec!=NULL)
+    {
+        emp->roue_prec->roue_next = emp->roue_next;
+    }
+    else
+    {
+        /* L'emplacement est en tete de sa case, qui peut etre celle de son
+           echeance ou, si elle etait passee a l'inscription, une autre */
+        if(roue->cases[echeance&(TAILLE_ROUE-1)]==emp)
+        {
+            roue->cases[echeance&(TAILLE_ROUE-1)] = emp->roue_next;
+        }
+        else
+        {
+            for(echeance=0; echeance<TAILLE_ROUE; echeance++)
+                if(roue->cases[echeance]==emp)
+                    roue->cases[echeance] = emp->roue_next;
+        }
+    }
+    
+    if(emp->roue_next!=NULL)
+        emp->roue_next->roue_prec = emp->roue_prec;
+    
+    emp->roue_next = NULL;
+    emp->roue_prec = NULL;
+}
+
+/**
+ * @brief Ajoute un emplacement (une adresse IP) a la liste d'un hash.
+ *
+ * L'adresse est d'abord remplacee par son identifiant dans le dictionnaire,
+ * puis on regarde si elle n'est pas deja sockee dans la liste : si elle y
+ * est, sa date est rafraichie et elle est deplacee dans la roue
+ * d'obsolescence, sinon on l'ajoute a la fin de la liste.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param table le hash auquel associer l'adresse.
+ * @param type_adresse la forme de l'adresse ('e' ou 'a').
+ * @param adresse l'adresse IP associee au hash.
+ * @param taille_adresse la longueur de la chaine adresse.
+ * @param date la date de l'annonce de l'adresse (time(NULL) pour une annonce
+ *        recue maintenant). Une date plus ancienne que celle deja connue ne
+ *        la fait pas reculer.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int add_emplacement(table_hash *dht, l_hash *table, donnees type_adresse,
+                        donnees* adresse, taille taille_adresse, long int date)
+{
+    int err;
+    uint32_t id;
+    l_emplacement *last, *emp;
+    
+    err=interner_adresse(&dht->adresses, &dht->alloc, type_adresse, adresse,
+                         taille_adresse, &id);
+    if(err!=0)
+        return err;
+    
+    last = NULL;
+    
+    /* Parcours de la liste */
+    for(emp=table->dispo; emp!=NULL; emp=emp->next)
+    {
+        last = emp;
+        
+        /* Si l'adresse est deja associee a ce meme hash */
+        if(emp->id_adresse==id)
+        {
+            relacher_adresse(&dht->adresses, &dht->alloc, id);
+            if(date > emp->obsolescence)
+            {
+                deplanifier(&dht->roue, emp);
+                emp->obsolescence = date;
+                planifier(&dht->roue, emp);
+                dht->changements++;
+            }
+            return 0;
+        }
+    }
+    
+    err=new_emplacement(&dht->alloc, &emp, id);
+    if(err!=0)
+    {
+        relacher_adresse(&dht->adresses, &dht->alloc, id);
+        return err;
+    }
+    
+    emp->proprietaire = table;
+    emp->obsolescence = date;
+    if(dht->merkle!=NULL)
+        ajouter_merkle(dht->merkle, table->code,
+                       empreinte_couple(table, dht->adresses.adresses[id]));
+    
+    /* Cas d'une liste vide ou d'ajout en fin de liste */
+    if(last==NULL)
+    {
+        table->dispo = emp;
+    }
+    else
+    {
+        last->next = emp;
+        emp->prec = last;
+    }
+    
+    planifier(&dht->roue, emp);
+    dht->changements++;
+    
+    return 0;
+}
+
+/**
+ * @brief Retire un emplacement de son hash et libere sa memoire.
+ *
+ * Si le hash n'a plus d'adresse associee, il est retire de la table.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param emp l'emplacement a retirer.
+*/
+void remove_emplacement(table_hash *dht, l_emplacement *emp)
+{
+    l_hash *table = emp->proprietaire;
+    
+    deplanifier(&dht->roue, emp);
+    
+    if(emp->prec!=NULL)
+        emp->prec->next = emp->next;
+    else
+        table->dispo = emp->next;
+    
+    if(emp->next!=NULL)
+        emp->next->prec = emp->prec;
+    
+    if(dht->merkle!=NULL)
+        retirer_merkle(dht->merkle, table->code,
+                       empreinte_couple(table, ADRESSE(dht, emp)));
+    relacher_adresse(&dht->adresses, &dht->alloc, emp->id_adresse);
+    liberer(&dht->alloc, emp, sizeof(l_emplacement));
+    
+    if(table->dispo==NULL)
+        remove_hash(dht, table);
+}
+
+/**
+ * @brief Supprime les emplacements devenus obsoletes.
+ *
+ * Seules les cases de la roue correspondant aux secondes ecoulees depuis le
+ * dernier passage sont parcourues : le travail est proportionnel au nombre
+ * d'adresses qui expirent, et non a la taille de la table.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param temps_actuel la date courante.
+ * @return le nombre d'emplacements supprimes.
+*/
+unsigned long expire_emplacements(table_hash *dht, long int temps_actuel)
+{
+    roue_obsolescence *roue = &dht->roue;
+    l_emplacement *emp, *emp_next;
+    unsigned long expirees = 0;
+    long int seconde, fin;
+    
+    /* Au dela d'un tour de roue, toutes les cases sont a parcourir une fois */
+    seconde = roue->derniere+1;
+    fin = temps_actuel;
+    if(fin-seconde >= TAILLE_ROUE)
+        seconde = fin-TAILLE_ROUE+1;
+    
+    for(; seconde<=fin; seconde++)
+    {
+        for(emp=roue->cases[seconde&(TAILLE_ROUE-1)]; emp!=NULL; emp=emp_next)
+        {
+            emp_next = emp->roue_next;
+            
+            if(temps_actuel-emp->obsolescence > TEMPS_OBSOLESCENCE)
+            {
+                remove_emplacement(dht, emp);
+                expirees++;
+            }
+        }
+    }
+    
+    if(temps_actuel > roue->derniere)
+        roue->derniere = temps_actuel;
+    
+    roue->ticks++;
+    roue->expirees_tick = expirees;
+    roue->expirees_total += expirees;
+    if(expirees > roue->expirees_max)
+        roue->expirees_max = expirees;
+    
+    return expirees;
+}
+
+/**
+ * @brief Affiche les statistiques de la table.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_table(table_hash *dht, FILE *f)
+{
+    fprintf(f, "Hash stockes : %lu (capacite %lu)\n",
+            (unsigned long)dht->nb_hash, (unsigned long)dht->capacite);
+    fprintf(f, "Obsolescence : %lu passages, %lu expirees au dernier, "\
+               "%lu au maximum, %lu au total\n",
+            dht->roue.ticks, dht->roue.expirees_tick,
+            dht->roue.expirees_max, dht->roue.expirees_total);
+    fprintf(f, "Adresses : %lu distinctes pour %lu references\n",
+            dht->adresses.nb_adresses, dht->adresses.references);
+    fprintf(f, "Memoire : %lu Ko utilises, plafond ",
+            (unsigned long)memoire_table(dht)/1024);
+    if(dht->budget.max==0)
+        fprintf(f, "aucun\n");
+    else
+        fprintf(f, "%lu Ko\n", (unsigned long)dht->budget.max/1024);
+    fprintf(f, "Evictions : %lu depassements, %lu hash et %lu adresses "\
+               "evinces, %lu secondes chances\n",
+            dht->budget.depassements, dht->budget.hash_evinces,
+            dht->budget.emplacements_evinces, dht->budget.secondes_chances);
+    afficher_stats_allocateur(&dht->alloc, f);
+}
+
+/**
+ * @brief Renvoie la memoire occupee par la table.
+ *
+ * Sont comptes les objets alloues (hash, emplacements, adresses) et les
+ * tableaux de la table et du dictionnaire. La place libre dans les slabs
+ * n'est pas comptee, elle est reutilisee par les insertions suivantes.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @return le nombre d'octets occupes.
+*/
+size_t memoire_table(table_hash *dht)
+{
+    dico_adresses *dico = &dht->adresses;
+    
+    return objets_allocateur(&dht->alloc)
+           + (dht->capacite+dht->capacite_anciennes)*sizeof(alveole)
+           + dico->capacite_ids*sizeof(adresse_interne *)
+           + dico->capacite_libres*sizeof(uint32_t)
+           + dico->capacite_index*sizeof(alveole_dico);
+}
+
+/* Marque une alveole dont le hash a ete supprime (pierre tombale) */
+static l_hash alveole_supprimee;
+#define SUPPRIMEE (&alveole_supprimee)
+
+/**
+ * @brief Libere la memoire attribuee a un hash.
+ *
+ * Libere dans l'ordre : la liste d'emplacement associee au hash, puis la
+ * structure representant le hash (qui contient la chaine du hash).
+ *
+ * @param dht la table a laquelle appartient le hash.
+ * @param table le pointeur sur le hash a liberer.
+*/
+void delete_l_hash(table_hash *dht, l_hash* table)
+{
+    if(table==NULL)
+        return;
+    
+    delete_l_emplacement(dht, table->dispo);
+    liberer(&dht->alloc, table, TAILLE_L_HASH(table->taille_hash));
+}
+
+/**
+ * @brief Creer une nouvelle structure l_hash et l'initialise.
+ *
+ * Alloue en une seule fois l'espace pour la strucuture suivie de la chaine
+ * contenant le hash, puis initialise les valeurs de la structure (sans
+ * adresse associee).
+ * 
+ * @param alloc l'allocateur a utiliser.
+ * @param retour un pointeur vers le pointeur dans lequel stocker l'adresse de
+ *        la structure allouee (valeur de retour par effet de bord).
+ * @param type_cle le type du hash ('h' chaine, 'b' cle binaire).
+ * @param hash la chaine representant le hash a stocker.
+ * @param taille_hash la longueur de la chaine hash.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int new_hash(allocateur *alloc, l_hash **retour, donnees type_cle,
+                donnees* hash, taille taille_hash)
+{
+    l_hash *table = allouer(alloc, TAILLE_L_HASH(taille_hash));
+    if(table == NULL)
+    {
+        return 103;
+    }
+    
+    memcpy(table->hash, hash, taille_hash);
+    table->taille_hash = taille_hash;
+    table->type_cle = type_cle;
+    table->code = code_cle(type_cle, hash, taille_hash);
+    table->dispo = NULL;
+    table->reference = 0;
+    
+    *retour = table;
+    
+    return 0;
+}
+
+/**
+ * @brief Initialise une table de hash vide.
+ *
+ * @param dht un pointeur sur la table a initialiser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_table_hash(table_hash *dht)
+{
+    dht->alveoles = calloc(TABLE_CAPACITE_INITIALE, sizeof(alveole));
+    if(dht->alveoles == NULL)
+    {
+        perror("Error calloc");
+        return 107;
+    }
+    
+    dht->capacite = TABLE_CAPACITE_INITIALE;
+    dht->occupees = 0;
+    dht->supprimees = 0;
+    dht->anciennes = NULL;
+    dht->capacite_anciennes = 0;
+    dht->migration = 0;
+    dht->nb_hash = 0;
+    
+    memset(&dht->roue, 0, sizeof(roue_obsolescence));
+    memset(&dht->budget, 0, sizeof(budget_memoire));
+    dht->retrait = NULL;
+    dht->contexte_retrait = NULL;
+    dht->merkle = NULL;
+    init_allocateur(&dht->alloc);
+    
+    if(init_dico(&dht->adresses)!=0)
+    {
+        free(dht->alveoles);
+        return 109;
+    }
+    dht->roue.derniere = time(NULL);
+    
+    return 0;
+}
+
+/**
+ * @brief Libere la memoire attribuee a la table et a tous ses hash.
+ *
+ * @param dht un pointeur sur la table a liberer.
+*/
+void delete_table_hash(table_hash *dht)
+{
+    size_t curseur = 0;
+    l_hash *table;
+    
+    while((table=parcours_table(dht, &curseur))!=NULL)
+        delete_l_hash(dht, table);
+    
+    delete_dico(&dht->adresses, &dht->alloc);
+    delete_allocateur(&dht->alloc);
+    free(dht->alveoles);
+    free(dht->anciennes);
+    free(dht->merkle);
+    dht->merkle = NULL;
+    dht->alveoles = NULL;
+    dht->anciennes = NULL;
+    dht->capacite = 0;
+    dht->capacite_anciennes = 0;
+    dht->nb_hash = 0;
+    memset(dht->roue.cases, 0, sizeof(dht->roue.cases));
+}
+
+/**
+ * @brief Tient a jour les feuilles de Merkle d'une table.
+ *
+ * La table doit etre vide : chaque couple ajoute ensuite est compte dans la
+ * feuille de sa cle, chaque couple retire (expiration, eviction) en est
+ * decompte.
+ *
+ * @param dht un pointeur sur la table.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int activer_merkle(table_hash *dht)
+{
+    dht->merkle = calloc(1, sizeof(feuilles_merkle));
+    if(dht->merkle==NULL)
+    {
+        perror("Error calloc");
+        return 113;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Compare la cle d'un hash stocke a une cle recherchee.
+ *
+ * Les cles binaires de 20 (SHA-1) et 32 octets (SHA-256) sont comparees mot
+ * par mot, sans appel a memcmp.
+ *
+ * @param table le hash stocke.
+ * @param type_cle le type de la cle recherchee.
+ * @param hash la cle recherchee.
+ * @param taille_hash la longueur de la cle recherchee.
+ * @return 1 si les cles sont identiques, 0 sinon.
+*/
+static int cle_egale(l_hash *table, donnees type_cle, donnees *hash,
+                        taille taille_hash)
+{
+    uint64_t a[4], b[4];
+    
+    if(table->taille_hash!=taille_hash || table->type_cle!=type_cle)
+        return 0;
+    
+    if(type_cle=='b' && taille_hash==TAILLE_CLE_SHA1)
+    {
+        memcpy(a, table->hash, TAILLE_CLE_SHA1);
+        memcpy(b, hash, TAILLE_CLE_SHA1);
+        return ((a[0]^b[0]) | (a[1]^b[1]) |
+                ((uint32_t)a[2]^(uint32_t)b[2])) == 0;
+    }
+    
+    if(type_cle=='b' && taille_hash==TAILLE_CLE_SHA256)
+    {
+        memcpy(a, table->hash, TAILLE_CLE_SHA256);
+        memcpy(b, hash, TAILLE_CLE_SHA256);
+        return ((a[0]^b[0]) | (a[1]^b[1]) | (a[2]^b[2]) | (a[3]^b[3])) == 0;
+    }
+    
+    return memcmp(table->hash, hash, taille_hash)==0;
+}
+
+/**
+ * @brief Recherche un hash dans un tableau d'alveoles.
+ *
+ * Sondage lineaire a partir de l'alveole designee par le code : seules les
+ * alveoles dont l'empreinte correspond donnent lieu a une comparaison des
+ * chaines.
+ *
+ * @param alveoles le tableau dans lequel chercher.
+ * @param capacite le nombre d'alveoles du tableau (puissance de 2).
+ * @param code le code de hachage du hash recherche.
+ * @param type_cle le type du hash recherche.
+ * @param hash la chaine representant le hash recherche.
+ * @param taille_hash la longueur de la chaine hash.
+ * @return l'indice de l'alveole contenant le hash, -1 s'il est absent.
+*/
+static long sonde(alveole *alveoles, size_t capacite, uint64_t code,
+                    donnees type_cle, donnees *hash, taille taille_hash)
+{
+    size_t i, masque = capacite-1;
+    uint32_t empreinte = (uint32_t)(code>>32);
+    l_hash *table;
+    
+    for(i=code&masque; alveoles[i].entree!=NULL; i=(i+1)&masque)
+    {
+        table = alveoles[i].entree;
+        if(alveoles[i].empreinte==empreinte && table!=SUPPRIMEE &&
+           cle_egale(table, type_cle, hash, taille_hash))
+        {
+            return (long)i;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Place un hash dans la premiere alveole libre de sa sequence de sonde.
+ *
+ * Le hash ne doit pas deja etre present dans le tableau.
+ *
+ * @param dht la table dont le tableau principal recoit le hash.
+ * @param table le hash a placer.
+*/
+static void placer(table_hash *dht, l_hash *table)
+{
+    size_t i, masque = dht->capacite-1;
+    
+    for(i=table->code&masque; dht->alveoles[i].entree!=NULL &&
+                              dht->alveoles[i].entree!=SUPPRIMEE;
+        i=(i+1)&masque);
+    
+    if(dht->alveoles[i].entree==SUPPRIMEE)
+        dht->supprimees--;
+    
+    dht->alveoles[i].entree = table;
+    dht->alveoles[i].empreinte = (uint32_t)(table->code>>32);
+    dht->occupees++;
+}
+
+/**
+ * @brief Migre quelques alveoles de l'ancien tableau vers le nouveau.
+ *
+ * Le redimensionnement est ainsi etale sur les insertions suivantes plutot
+ * que de bloquer le serveur pendant la recopie de toute la table.
  *
- * @param emp le pointeur sur la liste chainee d'emplacement a liberer.
+ * @param dht la table en cours de redimensionnement.
+ * @param nb le nombre maximal d'alveoles a migrer.
 */
-void delete_l_emplacement(l_emplacement *emp)
+static void migrer(table_hash *dht, size_t nb)
 {
-    if(emp==NULL)
+    l_hash *table;
+    
+    if(dht->anciennes==NULL)
         return;
     
-    delete_l_emplacement(emp->next);
-    free(emp->adresse);
-    free(emp);
+    for(; nb>0 && dht->migration<dht->capacite_anciennes; nb--)
+    {
+        table = dht->anciennes[dht->migration].entree;
+        if(table!=NULL && table!=SUPPRIMEE)
+        {
+            placer(dht, table);
+            dht->anciennes[dht->migration].entree = SUPPRIMEE;
+        }
+        dht->migration++;
+    }
+    
+    if(dht->migration==dht->capacite_anciennes)
+    {
+        free(dht->anciennes);
+        dht->anciennes = NULL;
+        dht->capacite_anciennes = 0;
+        dht->migration = 0;
+    }
 }
 
 /**
- * @brief Creer une nouvelle structure l_emplacement et l'initialise.
+ * @brief Commence le redimensionnement de la table si elle est trop remplie.
  *
- * Alloue de la place pour une strucuture l_emplacement puis pour une chaine de
- * caractere, puis initialise la valeur de l'adresse et la taille de l'adresse.
+ * Le nouveau tableau est deux fois plus grand si les hash presents le
+ * justifient, sinon de meme taille (pour se debarrasser des alveoles
+ * supprimees). L'ancien tableau est migre progressivement.
  *
- * @param retour un pointeur vers le pointeur dans lequel stocker l'adresse de
- *        la structure allouee (valeur de retour par effet de bord).
- * @param adresse une chaine de caractere representant une adresse IP.
- * @param taille_adresse la taille de la chaine de caractere adresse.
- * @return 0 en cas de reussite, un code d'erreur sinon
+ * @param dht la table a redimensionner.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int new_emplacement(l_emplacement **retour, donnees *adresse, 
-                        taille taille_adresse)
+static int agrandir(table_hash *dht)
 {
-    l_emplacement *emp = malloc(sizeof(l_emplacement));
-    if(emp == NULL)
+    alveole *nouvelles;
+    size_t capacite;
+    
+    if((dht->occupees+dht->supprimees+1)*8 <= dht->capacite*TABLE_REMPLISSAGE_MAX)
+        return 0;
+    
+    /* Une migration precedente doit etre terminee avant d'en lancer une autre */
+    migrer(dht, dht->capacite_anciennes);
+    
+    capacite = dht->capacite;
+    if((dht->nb_hash+1)*2 > capacite)
+        capacite *= 2;
+    
+    nouvelles = calloc(capacite, sizeof(alveole));
+    if(nouvelles == NULL)
     {
-        perror("Error malloc");
-        return 101;
+        perror("Error calloc");
+        return 108;
     }
     
-    emp->adresse = malloc(taille_adresse);
-    if(emp->adresse == NULL)
+    dht->anciennes = dht->alveoles;
+    dht->capacite_anciennes = dht->capacite;
+    dht->migration = 0;
+    dht->alveoles = nouvelles;
+    dht->capacite = capacite;
+    dht->occupees = 0;
+    dht->supprimees = 0;
+    
+    return 0;
+}
+
+/**
+ * @brief Recherche un hash dans la table.
+ *
+ * Le hash est cherche dans le tableau principal puis, si un redimensionnement
+ * est en cours, dans l'ancien tableau. La table n'est pas modifiee.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param type_cle le type du hash recherche ('h' ou 'b').
+ * @param hash la chaine representant le hash recherche.
+ * @param taille_hash la longueur de la chaine hash.
+ * @return un pointeur sur le hash trouve, NULL s'il est absent.
+*/
+l_hash *get_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                    taille taille_hash)
+{
+    long i;
+    uint64_t code = code_cle(type_cle, hash, taille_hash);
+    
+    i=sonde(dht->alveoles, dht->capacite, code,
+            type_cle, hash, taille_hash);
+    if(i!=-1)
+        return dht->alveoles[i].entree;
+    
+    if(dht->anciennes!=NULL)
     {
-        perror("Error malloc");
-        free(emp);
-        return 102;
+        i=sonde(dht->anciennes, dht->capacite_anciennes, code,
+                type_cle, hash, taille_hash);
+        if(i!=-1)
+            return dht->anciennes[i].entree;
     }
     
-    memcpy(emp->adresse, adresse, taille_adresse);
-    emp->taille_adresse = taille_adresse;
-    emp->obsolescence = time(NULL);
-    emp->next = NULL;
+    return NULL;
+}
+
+/**
+ * @brief Renvoie la partition a laquelle appartient un hash.
+ *
+ * La partition est tiree des bits de poids fort du code du hash : les bits
+ * de poids faible choisissent l'alveole dans la table de la partition et
+ * doivent y rester uniformement repartis.
+ *
+ * @param type_cle le type du hash ('h' ou 'b').
+ * @param hash la chaine representant le hash.
+ * @param taille_hash la longueur de la chaine hash.
+ * @param nb_partitions le nombre de partitions.
+ * @return l'indice de la partition, entre 0 et nb_partitions-1.
+*/
+unsigned int partition_cle(donnees type_cle, donnees *hash,
+                            taille taille_hash, unsigned int nb_partitions)
+{
+    uint64_t code = code_cle(type_cle, hash, taille_hash);
     
-    *retour = emp;
+    return (unsigned int)(((code>>32)*nb_partitions)>>32);
+}
+
+/**
+ * @brief Calcule l'empreinte d'un couple hash/adresse donne par ses octets.
+ *
+ * L'empreinte est celle du couple une fois stocke (voir empreinte_couple).
+ *
+ * @param type_cle le type du hash ('h' ou 'b').
+ * @param hash le hash.
+ * @param taille_hash la taille du hash.
+ * @param type_adresse la forme de l'adresse.
+ * @param adresse l'adresse.
+ * @param taille_adresse la taille de l'adresse.
+ * @return l'empreinte du couple.
+*/
+uint64_t empreinte_octets(donnees type_cle, donnees *hash, taille taille_hash,
+                            donnees type_adresse, donnees *adresse,
+                            taille taille_adresse)
+{
+    uint64_t types = ((uint64_t)type_cle<<8)|type_adresse;
     
-    return 0;    
+    return melanger_merkle(code_cle(type_cle, hash, taille_hash)^
+                           melanger_merkle(calcul_code(adresse,
+                                                       taille_adresse)+types));
 }
 
 /**
- * @brief Ajoute un emplacement (une adresse IP) a une liste d'emplacement.
+ * @brief Repartit les hash d'une table entre des partitions.
  *
- * Si la liste passee en parametre est NULL, alors un premier element est cree,
- * sinon on regarde si l'adresse n'est pas deja sockee dans la liste, et si elle
- * n'y est pas alors on l'ajoute a la fin.
+ * Chaque adresse est ajoutee, avec sa date, a la partition de son hash
+ * (partition_cle). La table source n'est pas modifiee.
  *
- * @param debut un pointeur vers le pointeur de debut de la liste des
- *        emplacements (*debut est modifie si *debut==NULL).
- * @param adresse la chaine representant l'adresse IP associee au hash.
- * @param taille_adresse la longueur de la chaine adresse.
+ * @param source un pointeur sur la table a repartir.
+ * @param tables le tableau des partitions.
+ * @param nb_tables le nombre de partitions.
  * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int add_emplacement(l_emplacement **debut, donnees* adresse, 
-                        taille taille_adresse)
+int repartir_table(table_hash *source, table_hash *tables,
+                    unsigned int nb_tables)
 {
     int err;
-    l_emplacement *last, *emp;
+    unsigned int p;
+    size_t curseur = 0;
+    l_hash *table;
+    l_emplacement *emp;
+    adresse_interne *a;
     
-    last = emp = *debut;
-
-    /* Cas d'une liste vide */
-    if(emp==NULL)
+    while((table=parcours_table(source, &curseur))!=NULL)
     {
-        err=new_emplacement(debut, adresse, taille_adresse);
-        return err;
+        p = partition_cle(table->type_cle, table->hash, table->taille_hash,
+                          nb_tables);
+        for(emp=table->dispo; emp!=NULL; emp=emp->next)
+        {
+            a = ADRESSE(source, emp);
+            err=add_hash(&tables[p], table->type_cle, table->hash,
+                         table->taille_hash, a->type_adresse, a->octets,
+                         a->taille_adresse, emp->obsolescence);
+            if(err!=0)
+                return err;
+        }
     }
     
-    /* Parcours de la liste */
-    for(;emp!=NULL;emp=emp->next)
+    return 0;
+}
+
+/**
+ * @brief Recherche un hash demande par un client.
+ *
+ * Comme get_hash, mais le hash trouve est marque comme utilise : l'eviction
+ * lui laissera une seconde chance. Plusieurs threads pouvant consulter la
+ * table en meme temps, la marque est posee par une ecriture atomique.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param type_cle le type du hash recherche ('h' ou 'b').
+ * @param hash la chaine representant le hash recherche.
+ * @param taille_hash la longueur de la chaine hash.
+ * @return un pointeur sur le hash trouve, NULL s'il est absent.
+*/
+l_hash *consulter_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                        taille taille_hash)
+{
+    l_hash *table = get_hash(dht, type_cle, hash, taille_hash);
+    
+    if(table!=NULL)
+        __atomic_store_n(&table->reference, 1, __ATOMIC_RELAXED);
+    
+    return table;
+}
+
+/**
+ * @brief Choisit le prochain hash a evincer (algorithme CLOCK).
+ *
+ * L'aiguille parcourt les alveoles en boucle : un hash lu depuis le dernier
+ * passage perd son bit de reference et est epargne, le premier hash non lu
+ * est choisi. Un redimensionnement en cours est d'abord termine pour que
+ * tous les hash soient dans le tableau parcouru.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param protege un hash a ne pas choisir (peut etre NULL).
+ * @return le hash a evincer, NULL s'il n'y en a aucun.
+*/
+static l_hash *choisir_victime(table_hash *dht, l_hash *protege)
+{
+    size_t pas, masque;
+    l_hash *table;
+    
+    migrer(dht, dht->capacite_anciennes);
+    masque = dht->capacite-1;
+    
+    /* Deux tours suffisent : le premier efface tous les bits de reference */
+    for(pas=0; pas<2*dht->capacite; pas++)
     {
-        if(emp->next!=NULL)
-            last = emp->next;
+        table = dht->alveoles[dht->budget.aiguille&masque].entree;
+        dht->budget.aiguille = (dht->budget.aiguille+1)&masque;
         
-        /* Si l'adresse est deja associee a ce meme hash */
-        if(taille_adresse==emp->taille_adresse &&
-           strncmp((char*)adresse, (char*)emp->adresse, taille_adresse)==0)
+        if(table==NULL || table==SUPPRIMEE || table==protege)
+            continue;
+        
+        if(table->reference)
         {
-            emp->obsolescence = time(NULL);
-            return 0;
+            table->reference = 0;
+            dht->budget.secondes_chances++;
+            continue;
         }
+        
+        return table;
     }
     
-    /* Cas d'ajout en fin de liste */
-    err=new_emplacement(&last->next, adresse, taille_adresse);
-    return err;
+    return NULL;
 }
 
 /**
- * @brief Libere recursivement la memoire attribuee la liste de hash.
+ * @brief Evince des hash froids tant que la table depasse son plafond.
  *
- * Libere dans l'ordre : Le hash suivant dans la liste, la liste d'emplacement
- * associee au hash actuel, la chaine de caractere representant le hash, et pour
- * finir la structure representant le hash actuel.
+ * Les hash sont choisis par choisir_victime et retires avec toutes leurs
+ * adresses. Rien n'est fait si aucun plafond n'est fixe.
  *
- * @param table le pointeur sur la liste de hash a liberer.
+ * @param dht un pointeur sur la table de hash.
+ * @param protege un hash a ne pas evincer, typiquement celui qui vient
+ *        d'etre insere (peut etre NULL).
+ * @return le nombre de hash evinces.
 */
-void delete_l_hash(l_hash* table)
+unsigned long appliquer_budget(table_hash *dht, l_hash *protege)
 {
-    if(table==NULL)
-        return;
+    unsigned long evinces = 0;
+    l_emplacement *emp;
+    l_hash *table;
+    
+    if(dht->budget.max==0 || memoire_table(dht)<=dht->budget.max)
+        return 0;
+    
+    dht->budget.depassements++;
+    
+    while(memoire_table(dht) > dht->budget.max)
+    {
+        table = choisir_victime(dht, protege);
+        if(table==NULL)
+            break;
+        
+        for(emp=table->dispo; emp!=NULL; emp=emp->next)
+            dht->budget.emplacements_evinces++;
+        
+        if(dht->retrait!=NULL)
+            dht->retrait(dht->contexte_retrait, table);
+        remove_hash(dht, table);
+        evinces++;
+    }
+    
+    dht->budget.hash_evinces += evinces;
     
-    delete_l_hash(table->next);
-    delete_l_emplacement(table->dispo);
-    free(table->hash);
-    free(table);
+    return evinces;
 }
 
 /**
- * @brief Creer une nouvelle structure l_hash et l'initialise.
+ * @brief Ajoute un hash a la table des hash repertories par le serveur.
  *
- * Alloue de l'espace pour la strucuture puis pour la chaine contenant le hash,
- * puis initialise les valeurs de la structure.
- * 
- * @param retour un pointeur vers le pointeur dans lequel stocker l'adresse de
- *        la structure allouee (valeur de retour par effet de bord).
- * @param hash la chaine representant le hash a stocker.
+ * Si le hash est deja present, on ajoute la nouvelle adresse ip associee a sa
+ * liste d'adresse ip, sinon il est cree et place dans la table. Si la table
+ * depasse alors son plafond memoire, des hash froids sont evinces.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param type_cle le type du hash ('h' chaine, 'b' cle binaire).
+ * @param hash une chaine representant la valeur du hash a stocker.
  * @param taille_hash la longueur de la chaine hash.
- * @param adresse la chaine representant une adresse IP associee au hash.
+ * @param type_adresse la forme de l'adresse ('e' extremite binaire,
+ *        'a' chaine de caracteres).
+ * @param adresse une adresse associee au hash.
  * @param taille_adresse la longueur de la chaine adresse.
+ * @param date la date de l'annonce (time(NULL) pour une annonce recue
+ *        maintenant, date d'origine pour une entree restauree).
  * @return 0 en cas de reussite, un code d'erreur sinon.
 */
-int new_hash(l_hash **retour, donnees* hash, taille taille_hash, 
-                donnees* adresse, taille taille_adresse)
+int add_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                taille taille_hash, donnees type_adresse, donnees* adresse,
+                taille taille_adresse, long int date)
 {
     int err;
+    l_hash *table;
     
-    l_hash *table = malloc(sizeof(l_hash));
-    if(table == NULL)
+    /* Si le hash est deja present dans la table */
+    table=get_hash(dht, type_cle, hash, taille_hash);
+    if(table!=NULL)
     {
-        perror("Error malloc");
-        return 103;
+        err=add_emplacement(dht, table, type_adresse, adresse,
+                            taille_adresse, date);
+        if(err!=0)
+            return err;
+        
+        appliquer_budget(dht, table);
+        return 0;
     }
     
-    table->hash = malloc(taille_hash);
-    if(table->hash == NULL)
-    {
-        perror("Error malloc");
-        free(table);
-        return 104;
-    }
+    err=agrandir(dht);
+    if(err!=0)
+        return err;
     
-    memcpy(table->hash, hash, taille_hash);
-    table->taille_hash = taille_hash;
-    table->next = NULL;
-    table->dispo = NULL;
-    err=add_emplacement(&table->dispo, adresse, taille_adresse);
+    err=new_hash(&dht->alloc, &table, type_cle, hash, taille_hash);
+    if(err!=0)
+        return err;
+    
+    err=add_emplacement(dht, table, type_adresse, adresse,
+                            taille_adresse, date);
     if(err!=0)
     {
-        free(table->hash);
-        free(table);
+        delete_l_hash(dht, table);
         return err;
     }
     
-    *retour = table;
+    placer(dht, table);
+    dht->nb_hash++;
+    
+    migrer(dht, TABLE_PAS_MIGRATION);
+    appliquer_budget(dht, table);
     
     return 0;
 }
 
 /**
- * @brief Ajoute un hash a la liste des hash repertories par le serveur.
+ * @brief Retire un hash de la table et libere sa memoire.
  *
- * Si la liste est vide, un premier element est cree (et la variable debut est
- * modifiee), sinon si le hash est deja present, on ajoute la nouvelle adresse
- * ip associee a sa liste d'adresse ip, et si il n'existe pas encore dans la
- * liste alors il est ajoute a la fin.
+ * L'alveole est marquee supprimee pour ne pas interrompre les sequences de
+ * sonde qui la traversent. Aucun hash n'est deplace, un parcours de la table
+ * peut donc retirer le hash courant. Les adresses encore associees au hash
+ * sont retirees de la roue d'obsolescence.
  *
- * @param debut un pointeur vers le pointeur sur le debut de la liste de hash.
- * @param hash une chaine representant la valeur du hash a stocker.
- * @param taille_hash la longueur de la chaine hash.
- * @param adresse une chaine representant une adresse associee au hash.
- * @param taille_adresse la longueur de la chaine adresse.
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * @param dht un pointeur sur la table de hash.
+ * @param table le hash a retirer.
 */
-int add_hash(l_hash **debut, donnees* hash, taille taille_hash, 
-                donnees* adresse, taille taille_adresse)
+void remove_hash(table_hash *dht, l_hash *table)
 {
-    int err;
-    l_hash *last, *table;
+    long i;
+    l_emplacement *emp;
     
-    last = table = *debut;
+    i=sonde(dht->alveoles, dht->capacite, table->code,
+            table->type_cle, table->hash, table->taille_hash);
+    if(i!=-1)
+    {
+        dht->alveoles[i].entree = SUPPRIMEE;
+        dht->occupees--;
+        dht->supprimees++;
+    }
+    else if(dht->anciennes!=NULL)
+    {
+        i=sonde(dht->anciennes, dht->capacite_anciennes, table->code,
+                table->type_cle, table->hash, table->taille_hash);
+        if(i==-1)
+            return;
+        dht->anciennes[i].entree = SUPPRIMEE;
+    }
+    else
+    {
+        return;
+    }
     
-    /* Cas d'une liste vide */
-    if(table==NULL)
+    dht->nb_hash--;
+    for(emp=table->dispo; emp!=NULL; emp=emp->next)
     {
-        err=new_hash(debut, hash, taille_hash, adresse, taille_adresse);
-        return err;
+        deplanifier(&dht->roue, emp);
+        if(dht->merkle!=NULL)
+            retirer_merkle(dht->merkle, table->code,
+                           empreinte_couple(table, ADRESSE(dht, emp)));
     }
+    delete_l_hash(dht, table);
+}
+
+/**
+ * @brief Parcourt la table et renvoie le hash suivant.
+ *
+ * Le curseur doit etre initialise a 0 avant le premier appel. Les alveoles
+ * de l'ancien tableau (redimensionnement en cours) sont parcourues en premier.
+ * Aucune insertion ne doit avoir lieu pendant un parcours.
+ *
+ * @param dht un pointeur sur la table de hash.
+ * @param curseur la position du parcours (modifiee par effet de bord).
+ * @return le hash suivant, NULL lorsque le parcours est termine.
+*/
+l_hash *parcours_table(table_hash *dht, size_t *curseur)
+{
+    l_hash *table;
     
-    /* Parcours de la liste */
-    for(;table!=NULL;table=table->next)
+    for(; *curseur < dht->capacite_anciennes+dht->capacite; (*curseur)++)
     {
-        if(table->next!=NULL)
-            last = table->next;
-            
-        /* Si le hash est deja present dans la liste */
-        if(taille_hash==table->taille_hash &&
-           strncmp((char*)hash, (char*)table->hash, taille_hash)==0)
+        if(*curseur < dht->capacite_anciennes)
+            table = dht->anciennes[*curseur].entree;
+        else
+            table = dht->alveoles[*curseur-dht->capacite_anciennes].entree;
+        
+        if(table!=NULL && table!=SUPPRIMEE)
         {
-            err=add_emplacement(&table->dispo, adresse, taille_adresse);
-            return err;
+            (*curseur)++;
+            return table;
         }
     }
     
-    /* Cas d'ajout en fin de liste */
-    err=new_hash(&last->next, hash, taille_hash, adresse, taille_adresse);
-    return err;
+    return NULL;
+}
+
+/**
+ * @brief Calcule la cle binaire d'une adresse de serveur.
+ *
+ * La cle est formee de l'adresse IP puis du port, dans l'ordre du reseau
+ * (la meme forme qu'une extremite binaire) : deux adresses designent le meme
+ * serveur si et seulement si leurs cles sont egales.
+ *
+ * @param serveur l'adresse du serveur.
+ * @param cle un tableau d'au moins TAILLE_CLE_SERVEUR octets recevant la cle.
+ * @return la taille de la cle, 0 si la famille d'adresse est inconnue.
+*/
+donnees cle_serveur(const struct sockaddr *serveur, donnees *cle)
+{
+    const struct sockaddr_in *in;
+    const struct sockaddr_in6 *in6;
+    
+    switch(serveur->sa_family)
+    {
+        case AF_INET:
+            in = (const struct sockaddr_in *)serveur;
+            memcpy(cle, &in->sin_addr, 4);
+            memcpy(cle+4, &in->sin_port, 2);
+            return 6;
+        case AF_INET6:
+            in6 = (const struct sockaddr_in6 *)serveur;
+            memcpy(cle, &in6->sin6_addr, 16);
+            memcpy(cle+16, &in6->sin6_port, 2);
+            return 18;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Initialise un ensemble de serveurs connus vide.
+ *
+ * @param st un pointeur sur l'ensemble a initialiser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_serveurs(serveurs_connus *st)
+{
+    st->index = calloc(SERVEURS_CAPACITE_INITIALE, sizeof(l_serveur *));
+    if(st->index == NULL)
+    {
+        perror("Error calloc");
+        return 112;
+    }
+    
+    st->capacite = SERVEURS_CAPACITE_INITIALE;
+    st->premier = NULL;
+    st->dernier = NULL;
+    st->nb = 0;
+    st->version = 0;
+    
+    return 0;
 }
 
 /**
- * @brief Libere recursivement la memoire attribuee la liste de serveurs.
+ * @brief Libere la memoire attribuee aux serveurs connus.
  *
- * Libere la memoire du serveur suivant, puis la memoire de l'adresse du
- * serveur courant et pour finir la structure du serveur courant.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+*/
+void delete_serveurs(serveurs_connus *st)
+{
+    delete_l_serveurs(st->premier);
+    free(st->index);
+    st->premier = NULL;
+    st->dernier = NULL;
+    st->index = NULL;
+    st->nb = 0;
+}
+
+/**
+ * @brief Libere la memoire attribuee la liste de serveurs.
  *
  * @param serveurs un pointeur sur le premier element de la liste de serveurs.
 */
 void delete_l_serveurs(l_serveur *serveurs)
 {
-    if(serveurs==NULL)
-        return;
+    l_serveur *suivant;
     
-    delete_l_serveurs(serveurs->next);
-    free(serveurs->serveur);
-    free(serveurs);
+    for(; serveurs!=NULL; serveurs=suivant)
+    {
+        suivant = serveurs->next;
+        free(serveurs->serveur);
+        free(serveurs);
+    }
 }
 
 /**
@@ -250,7 +1435,7 @@ void delete_l_serveurs(l_serveur *serveurs)
  *
  * Alloue de la place pour une strucuture l_serveur puis pour une structure
  * pouvant contenir les information pour contacter un serveur, et initialise
- * les donnees.
+ * les donnees (dont la cle binaire du serveur).
  *
  * @param retour un pointeur vers le pointeur dans lequel stocker l'adresse de
  *        la structure allouee (valeur de retour par effet de bord).
@@ -279,7 +1464,13 @@ int new_a_serveurs(l_serveur **retour,
     memcpy(emp->serveur, serveur, addrlen);
     emp->addrlen = addrlen;
     emp->present = 1;
+    emp->epoque = 0;
+    emp->sequence = 0;
+    emp->taille_cle = cle_serveur(serveur, emp->cle);
+    emp->code = calcul_code(emp->cle, emp->taille_cle);
     emp->next = NULL;
+    emp->prec = NULL;
+    emp->suivant_index = NULL;
 
     *retour = emp;
     
@@ -287,79 +1478,165 @@ int new_a_serveurs(l_serveur **retour,
 }
 
 /**
- * @brief Ajoute un serveur (une structure sockaddr) a une liste de serveurs.
+ * @brief Double la capacite de l'index des serveurs connus.
  *
- * @param debut un pointeur vers le pointeur de debut de la liste des
- *        serveurs (*debut est modifie si *debut==NULL).
- * @param serveur un pointeur sur une structure contenant les donnees du serveur
- * @param addrlen la taille de la structure serveur.
- * @return 0 en cas de reussite, un code d'erreur sinon.
+ * En cas d'echec de l'allocation, l'index garde sa capacite (les listes
+ * des alveoles s'allongent seulement).
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
 */
-int add_a_serveurs(l_serveur **debut,struct sockaddr* serveur,socklen_t addrlen)
+static void agrandir_serveurs(serveurs_connus *st)
 {
-    int err;
-    l_serveur *last, *emp;
+    l_serveur **index, *emp;
+    size_t capacite = st->capacite*2, i;
     
-    last = emp = *debut;
-
-    /* Cas d'une liste vide */
-    if(emp==NULL)
-    {
-        err=new_a_serveurs(debut, serveur, addrlen);
-        return err;
-    }
+    index = calloc(capacite, sizeof(l_serveur *));
+    if(index == NULL)
+        return;
     
-    /* Parcours de la liste */
-    for(;emp!=NULL;emp=emp->next)
+    for(emp=st->premier; emp!=NULL; emp=emp->next)
     {
-        if(emp->next!=NULL)
-            last = emp->next;
+        i = emp->code&(capacite-1);
+        emp->suivant_index = index[i];
+        index[i] = emp;
     }
     
-    /*Ajout en fin de liste */
-    err=new_a_serveurs(&last->next, serveur, addrlen);
-    return err;
+    free(st->index);
+    st->index = index;
+    st->capacite = capacite;
 }
 
 /**
- * @brief Supprime un serveur de la liste des serveurs.
+ * @brief Renvoie le serveur connu correspondant a une adresse.
  *
- * @param debut un pointeur vers un pointeur sur le debut de la liste de serveur
- * @param serveur les donnees caracterisant un serveur.
+ * La recherche se fait dans l'index, sur la cle binaire de l'adresse.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param serveur l'adresse (IP et port) du serveur.
+ * @return un pointeur sur le serveur, NULL s'il n'est pas connu.
 */
-void delete_server(l_serveur **debut, struct sockaddr* serveur)
+l_serveur *chercher_serveur(serveurs_connus *st, struct sockaddr *serveur)
 {
-    l_serveur *last, *emp;
-
-    last = emp = *debut;
-
-    if(emp==NULL)
+    donnees cle[TAILLE_CLE_SERVEUR], taille_cle;
+    uint64_t code;
+    l_serveur *emp;
+    
+    taille_cle = cle_serveur(serveur, cle);
+    if(taille_cle==0)
+        return NULL;
+    
+    code = calcul_code(cle, taille_cle);
+    for(emp=st->index[code&(st->capacite-1)]; emp!=NULL;
+        emp=emp->suivant_index)
     {
-        return;
+        if(emp->code==code && emp->taille_cle==taille_cle &&
+           memcmp(emp->cle, cle, taille_cle)==0)
+            return emp;
     }
+    
+    return NULL;
+}
 
-    /* Si le serveur a supprimer est le premier element de la liste */
-    if(sockaddrcmp(serveur,emp->serveur)==0)  
+/**
+ * @brief Ajoute un serveur (une structure sockaddr) aux serveurs connus.
+ *
+ * Le serveur est ajoute en fin de liste et dans l'index. Un serveur deja
+ * connu n'est pas ajoute une seconde fois, il est seulement marque present.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param serveur un pointeur sur une structure contenant les donnees du serveur
+ * @param addrlen la taille de la structure serveur.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int add_a_serveurs(serveurs_connus *st, struct sockaddr* serveur,
+                    socklen_t addrlen)
+{
+    int err;
+    size_t i;
+    l_serveur *emp;
+    
+    emp = chercher_serveur(st, serveur);
+    if(emp!=NULL)
     {
-        *debut=emp->next;
-        free(emp->serveur);
-        free(emp);
-        return;
+        emp->present = 1;
+        return 0;
     }
     
-    emp=emp->next;
-    /* Parcours de la liste a la recherche du serveur a supprimer */
-    for(;emp!=NULL;emp=emp->next)
-    {      
-        if(sockaddrcmp(serveur,emp->serveur)==0)  
+    err=new_a_serveurs(&emp, serveur, addrlen);
+    if(err!=0)
+        return err;
+    
+    /* Ajout en fin de liste */
+    emp->prec = st->dernier;
+    if(st->dernier!=NULL)
+        st->dernier->next = emp;
+    else
+        st->premier = emp;
+    st->dernier = emp;
+    
+    /* Ajout dans l'index */
+    i = emp->code&(st->capacite-1);
+    emp->suivant_index = st->index[i];
+    st->index[i] = emp;
+    
+    st->nb++;
+    st->version++;
+    if(st->nb > st->capacite)
+        agrandir_serveurs(st);
+    
+    return 0;
+}
+
+/**
+ * @brief Retire un serveur des serveurs connus et libere sa memoire.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param emp le serveur a retirer.
+*/
+void retirer_serveur(serveurs_connus *st, l_serveur *emp)
+{
+    l_serveur **lien;
+    
+    /* Retrait de l'index */
+    for(lien=&st->index[emp->code&(st->capacite-1)]; *lien!=NULL;
+        lien=&(*lien)->suivant_index)
+    {
+        if(*lien==emp)
         {
-            last->next=emp->next;
-            free(emp->serveur);
-            free(emp);
+            *lien = emp->suivant_index;
             break;
         }
-        last=emp;
     }
+    
+    /* Retrait de la liste */
+    if(emp->prec!=NULL)
+        emp->prec->next = emp->next;
+    else
+        st->premier = emp->next;
+    
+    if(emp->next!=NULL)
+        emp->next->prec = emp->prec;
+    else
+        st->dernier = emp->prec;
+    
+    st->nb--;
+    st->version++;
+    free(emp->serveur);
+    free(emp);
+}
+
+/**
+ * @brief Supprime un serveur des serveurs connus.
+ *
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param serveur les donnees caracterisant un serveur.
+*/
+void delete_server(serveurs_connus *st, struct sockaddr* serveur)
+{
+    l_serveur *emp = chercher_serveur(st, serveur);
+    
+    if(emp!=NULL)
+        retirer_serveur(st, emp);
 }
 
 /**
@@ -426,15 +1703,12 @@ void get_ip_str(const struct sockaddr *sa, char *s, size_t maxlen)
 */
 int sockaddrcmp(struct sockaddr *x, struct sockaddr *y)
 {
-    size_t adlen=128;
-    if(sockaddr_cmp(x,y)==0)  
-    {
-        char ad1[128];
-        char ad2[128];
-        get_ip_str(x, ad1, adlen);
-        get_ip_str(y, ad2, adlen);
-        if(strlen(ad1)==strlen(ad2) && strncmp(ad1, ad2, strlen(ad1))==0)
-            return 0;
-    }
+    donnees cle_x[TAILLE_CLE_SERVEUR], cle_y[TAILLE_CLE_SERVEUR], taille_cle;
+    
+    taille_cle = cle_serveur(x, cle_x);
+    if(taille_cle!=0 && cle_serveur(y, cle_y)==taille_cle &&
+       memcmp(cle_x, cle_y, taille_cle)==0)
+        return 0;
+    
     return 1;
 }
@@ -8,56 +8,291 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "allocateur.h"
+#include "merkle.h"
+
+/* Duree avant qu'une donnee soit obsolete */
+#define TEMPS_OBSOLESCENCE 30
+
+/* Nombre de cases de la roue d'obsolescence (une case par seconde, puissance
+   de 2 strictement superieure a TEMPS_OBSOLESCENCE+1) */
+#define TAILLE_ROUE 64
+
+/* Capacite initiale de l'index du dictionnaire d'adresses (puissance de 2) */
+#define DICO_CAPACITE_INITIALE 64
+
+/* Identifiants particuliers des alveoles de l'index du dictionnaire */
+#define DICO_VIDE UINT32_MAX
+#define DICO_SUPPRIMEE (UINT32_MAX-1)
+
+/* Tailles des cles binaires (SHA-1 et SHA-256), aussi definies par
+   messages.h */
+#ifndef TAILLE_CLE_SHA1
+#define TAILLE_CLE_SHA1 20
+#define TAILLE_CLE_SHA256 32
+#endif
+
+/* Capacite initiale de l'index des serveurs connus (puissance de 2) */
+#define SERVEURS_CAPACITE_INITIALE 16
+
+/* Taille maximale de la cle d'un serveur : adresse IPv6 et port */
+#define TAILLE_CLE_SERVEUR 18
+
+/* Capacite initiale de la table de hash (puissance de 2) */
+#define TABLE_CAPACITE_INITIALE 64
+
+/* Taux de remplissage maximal (alveoles occupees ou supprimees) en 1/8 */
+#define TABLE_REMPLISSAGE_MAX 6
+
+/* Nombre d'alveoles migrees de l'ancien tableau a chaque insertion pendant
+   un redimensionnement */
+#define TABLE_PAS_MIGRATION 32
 
 typedef unsigned short taille;
 typedef unsigned char donnees;
 
+typedef struct adresse_interne{
+    uint64_t code;              // Code de hachage de la chaine adresse
+    uint32_t references;        // Nombre d'emplacements utilisant l'adresse
+    taille taille_adresse;      // Taille de l'adresse en octets
+    donnees type_adresse;       // Forme de l'adresse : 'e' extremite binaire
+                                // (6 ou 18 octets), 'a' chaine de caracteres
+    donnees octets[];           // Adresse IP (et port) sous cette forme
+} adresse_interne;
+
+/* Taille occupee par une adresse interne dont l'adresse fait t octets */
+#define TAILLE_ADRESSE_INTERNE(t) (offsetof(adresse_interne, octets)+(t))
+
+typedef struct alveole_dico{
+    uint32_t empreinte;         // Bits de poids fort du code de l'adresse
+    uint32_t id;                // Identifiant de l'adresse, DICO_VIDE ou
+                                // DICO_SUPPRIMEE
+} alveole_dico;
+
+typedef struct dico{
+    adresse_interne **adresses; // Adresses indexees par leur identifiant
+    uint32_t nb_ids;            // Nombre d'identifiants deja distribues
+    uint32_t capacite_ids;      // Taille du tableau adresses
+    uint32_t *libres;           // Identifiants liberes, a reutiliser
+    uint32_t nb_libres;         // Nombre d'identifiants libres
+    uint32_t capacite_libres;   // Taille du tableau libres
+    alveole_dico *index;        // Index adresse -> identifiant (adressage
+                                // ouvert)
+    size_t capacite_index;      // Nombre d'alveoles de l'index
+    size_t supprimees;          // Alveoles de l'index marquees supprimees
+    unsigned long nb_adresses;  // Nombre d'adresses distinctes
+    unsigned long references;   // Nombre total de references
+} dico_adresses;
+
 typedef struct emplacement{
-    donnees *adresse;           // Adresse IP associee a un hash
-    taille taille_adresse;      // Taille de la chaine adresse
+    uint32_t id_adresse;        // Identifiant de l'adresse IP associee au
+                                // hash dans le dictionnaire d'adresses
     long int obsolescence;      // Timer de la derniere mise a jour de la donnee
+    struct stockage *proprietaire; // Hash auquel l'adresse est associee
     struct emplacement *next;   // Pointeur sur la prochaine adresse IP associee
+    struct emplacement *prec;   // Pointeur sur l'adresse IP associee precedente
+    struct emplacement *roue_next; // Emplacement suivant dans la meme case
+                                   // de la roue d'obsolescence
+    struct emplacement *roue_prec; // Emplacement precedent dans cette case
 } l_emplacement;
 
+typedef struct roue{
+    l_emplacement *cases[TAILLE_ROUE]; // Emplacements classes par seconde
+                                       // d'expiration (modulo TAILLE_ROUE)
+    long int derniere;          // Derniere seconde traitee
+    unsigned long ticks;        // Nombre de passages effectues
+    unsigned long expirees_tick;   // Emplacements expires au dernier passage
+    unsigned long expirees_max;    // Maximum d'emplacements expires en un
+                                   // passage
+    unsigned long expirees_total;  // Total des emplacements expires
+} roue_obsolescence;
+
 typedef struct stockage{
-    donnees *hash;              // Chaine representant un hash
-    taille taille_hash;         // Taille de la chaine hash
+    uint64_t code;              // Code de hachage de la chaine hash
     struct emplacement *dispo;  // Pointeur sur la liste des adresses IP
                                 // associees au hash
-    struct stockage *next;      // Pointeur sur le hash suivant
+    taille taille_hash;         // Taille de la chaine hash
+    donnees type_cle;           // Type du hash : 'h' pour une chaine, 'b'
+                                // pour une cle binaire (SHA-1 ou SHA-256)
+    donnees reference;          // Bit de seconde chance de l'eviction CLOCK,
+                                // mis a 1 par chaque get du hash
+    donnees hash[];             // Chaine representant un hash (allouee avec
+                                // la structure)
 } l_hash;
 
+/* Taille allouee pour un hash dont la chaine fait t octets */
+#define TAILLE_L_HASH(t) (offsetof(l_hash, hash)+(t))
+
+typedef struct alveole{
+    uint32_t empreinte;         // Bits de poids fort du code du hash, pour
+                                // eviter de comparer les chaines
+    l_hash *entree;             // Hash stocke, NULL si l'alveole est vide
+} alveole;
+
+typedef struct budget{
+    size_t max;                 // Plafond memoire en octets (0 : illimite)
+    size_t aiguille;            // Prochaine alveole examinee par l'eviction
+    unsigned long depassements; // Nombre d'insertions ayant depasse le plafond
+    unsigned long hash_evinces;    // Hash retires pour respecter le plafond
+    unsigned long emplacements_evinces; // Adresses retirees avec ces hash
+    unsigned long secondes_chances;     // Hash epargnes car lus recemment
+} budget_memoire;
+
+typedef struct table{
+    alveole *alveoles;          // Tableau d'alveoles (adressage ouvert)
+    size_t capacite;            // Nombre d'alveoles (puissance de 2)
+    size_t occupees;            // Nombre d'alveoles contenant un hash
+    size_t supprimees;          // Nombre d'alveoles marquees supprimees
+    alveole *anciennes;         // Tableau en cours de migration (ou NULL)
+    size_t capacite_anciennes;  // Nombre d'alveoles de l'ancien tableau
+    size_t migration;           // Prochaine alveole a migrer
+    size_t nb_hash;             // Nombre total de hash stockes
+    roue_obsolescence roue;     // Echeancier d'expiration des adresses
+    allocateur alloc;           // Allocateur des hash, des emplacements et
+                                // des adresses
+    dico_adresses adresses;     // Adresses distinctes, partagees par tous
+                                // les hash
+    budget_memoire budget;      // Plafond memoire et eviction des hash froids
+    void (*retrait)(void *contexte, l_hash *table);
+                                // Appelee avant l'eviction d'un hash (ou NULL)
+    void *contexte_retrait;     // Premier argument de retrait
+    feuilles_merkle *merkle;    // Feuilles de l'arbre de Merkle de la
+                                // partition (NULL si l'anti-entropie est
+                                // desactivee)
+    unsigned long changements;  // Adresses ajoutees ou dont la date a avance
+} table_hash;
+
 typedef struct a_serveurs
 {
     struct sockaddr * serveur;  // Structure contenant les informations
                                 // necessaire pour contacter ce serveur
     socklen_t addrlen;          // Longueur de la structure serveur
     int present;                // Indique si le serveur est suppose present
+    uint64_t epoque;            // Position du serveur courant dans
+    uint64_t sequence;          // l'historique de ce serveur (reponse au
+                                // dernier keep-alive, epoque nulle si
+                                // inconnue)
+    uint64_t code;              // Code de hachage de la cle
+    donnees cle[TAILLE_CLE_SERVEUR]; // Adresse puis port, sous forme binaire
+                                     // (6 octets en IPv4, 18 en IPv6)
+    donnees taille_cle;         // Taille de la cle, 0 si la famille
+                                // d'adresse est inconnue
     struct a_serveurs *next;    // Pointeur sur le a_serveur suivant
+    struct a_serveurs *prec;    // Pointeur sur le a_serveur precedent
+    struct a_serveurs *suivant_index; // Serveur suivant dans la meme alveole
+                                      // de l'index
 } l_serveur;
 
+typedef struct serveurs{
+    l_serveur *premier;         // Liste des serveurs, dans l'ordre d'ajout
+    l_serveur *dernier;         // Dernier serveur de la liste
+    l_serveur **index;          // Index cle -> serveur (une liste chainee
+                                // par alveole)
+    size_t capacite;            // Nombre d'alveoles de l'index
+    size_t nb;                  // Nombre de serveurs connus
+    unsigned long version;      // Incrementee a chaque ajout ou retrait
+} serveurs_connus;
+
+
+/* Initialise un dictionnaire d'adresses vide */
+int init_dico(dico_adresses *dico);
+
+/* Libere la memoire attribuee a un dictionnaire d'adresses */
+void delete_dico(dico_adresses *dico, allocateur *alloc);
+
+/* Renvoie l'identifiant d'une adresse (l'ajoute au dictionnaire si besoin) */
+int interner_adresse(dico_adresses *dico, allocateur *alloc,
+                        donnees type_adresse, donnees *adresse,
+                        taille taille_adresse, uint32_t *id);
+
+/* Relache une reference sur une adresse du dictionnaire */
+void relacher_adresse(dico_adresses *dico, allocateur *alloc, uint32_t id);
+
+/* Renvoie l'adresse associee a un emplacement */
+#define ADRESSE(dht, emp) ((dht)->adresses.adresses[(emp)->id_adresse])
 
 /* Libere recursivement la memoire attribuee a une liste d'emplacement */
-void delete_l_emplacement(l_emplacement *emp);
+void delete_l_emplacement(table_hash *dht, l_emplacement *emp);
 
 /* Creer une nouvelle structure l_emplacement et l'initialise */
-int new_emplacement(l_emplacement **retour, donnees* adresse, 
-                        taille taille_adresse);
+int new_emplacement(allocateur *alloc, l_emplacement **retour,
+                        uint32_t id_adresse);
+
+/* Ajoute un emplacement (une adresse IP) a la liste d'emplacement d'un hash */
+int add_emplacement(table_hash *dht, l_hash *table, donnees type_adresse,
+                        donnees* adresse, taille taille_adresse, long int date);
+
+/* Retire un emplacement de son hash (et le hash s'il n'a plus d'adresse) */
+void remove_emplacement(table_hash *dht, l_emplacement *emp);
 
-/* Ajoute un emplacement (une adresse IP) a une liste d'emplacement */
-int add_emplacement(l_emplacement **retour, donnees* adresse, 
-                        taille taille_adresse);
+/* Supprime les emplacements devenus obsoletes */
+unsigned long expire_emplacements(table_hash *dht, long int temps_actuel);
 
-/* Libere recursivement la memoire attribuee la liste de hash */
-void delete_l_hash(l_hash* table);
+/* Affiche les statistiques de la table */
+void afficher_stats_table(table_hash *dht, FILE *f);
+
+/* Renvoie la memoire occupee par la table (hash, adresses et tableaux) */
+size_t memoire_table(table_hash *dht);
+
+/* Evince des hash froids tant que la table depasse son plafond memoire */
+unsigned long appliquer_budget(table_hash *dht, l_hash *protege);
+
+/* Libere la memoire attribuee a un hash et a ses emplacements */
+void delete_l_hash(table_hash *dht, l_hash* table);
 
 /* Creer une nouvelle structure l_hash et l'initialise */
-int new_hash(l_hash **retour, donnees* hash, taille taille_hash, 
-                donnees* adresse, taille taille_adresse);
+int new_hash(allocateur *alloc, l_hash **retour, donnees type_cle,
+                donnees* hash, taille taille_hash);
+
+/* Initialise une table de hash vide */
+int init_table_hash(table_hash *dht);
+
+/* Libere la memoire attribuee a la table et a tous les hash qu'elle contient */
+void delete_table_hash(table_hash *dht);
+
+/* Tient a jour les feuilles de Merkle d'une table (encore vide) */
+int activer_merkle(table_hash *dht);
 
-/* Ajoute un hash a la liste des hash repertories par le serveur */
-int add_hash(l_hash **retour, donnees* hash, taille taille_hash, 
-                donnees* adresse, taille taille_adresse);
+/* Recherche un hash dans la table */
+l_hash *get_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                    taille taille_hash);
+
+/* Recherche un hash demande par un client (le marque comme utilise) */
+l_hash *consulter_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                        taille taille_hash);
+
+/* Ajoute un hash a la table des hash repertories par le serveur */
+int add_hash(table_hash *dht, donnees type_cle, donnees* hash,
+                taille taille_hash, donnees type_adresse, donnees* adresse,
+                taille taille_adresse, long int date);
+
+/* Retire un hash de la table et libere sa memoire */
+void remove_hash(table_hash *dht, l_hash *table);
+
+/* Parcourt la table et renvoie le hash suivant */
+l_hash *parcours_table(table_hash *dht, size_t *curseur);
+
+/* Renvoie la partition a laquelle appartient un hash */
+unsigned int partition_cle(donnees type_cle, donnees *hash,
+                            taille taille_hash, unsigned int nb_partitions);
+
+/* Calcule l'empreinte d'un couple hash/adresse donne par ses octets */
+uint64_t empreinte_octets(donnees type_cle, donnees *hash, taille taille_hash,
+                            donnees type_adresse, donnees *adresse,
+                            taille taille_adresse);
+
+/* Repartit les hash d'une table entre des partitions */
+int repartir_table(table_hash *source, table_hash *tables,
+                    unsigned int nb_tables);
+
+/* Initialise un ensemble de serveurs connus vide */
+int init_serveurs(serveurs_connus *st);
+
+/* Libere la memoire attribuee aux serveurs connus */
+void delete_serveurs(serveurs_connus *st);
 
 /* Libere recursivement la memoire attribuee la liste de serveurs */
 void delete_l_serveurs(l_serveur *serveurs);
@@ -66,12 +301,21 @@ void delete_l_serveurs(l_serveur *serveurs);
 int new_a_serveurs(l_serveur **retour,
                     struct sockaddr* serveur, socklen_t addrlen);
 
-/* Ajoute un serveur a une liste de serveurs */
-int add_a_serveurs(l_serveur **debut, 
+/* Ajoute un serveur aux serveurs connus */
+int add_a_serveurs(serveurs_connus *st,
                     struct sockaddr* serveur, socklen_t addrlen);
 
+/* Renvoie le serveur connu correspondant a une adresse */
+l_serveur *chercher_serveur(serveurs_connus *st, struct sockaddr *serveur);
+
+/* Retire un serveur des serveurs connus et libere sa memoire */
+void retirer_serveur(serveurs_connus *st, l_serveur *emp);
+
 /* Supprime un serveur à partir de son adresse Ip et son port */
-void delete_server(l_serveur **debut, struct sockaddr* serveur);
+void delete_server(serveurs_connus *st, struct sockaddr* serveur);
+
+/* Calcule la cle binaire d'une adresse de serveur */
+donnees cle_serveur(const struct sockaddr *serveur, donnees *cle);
 
 /* Compare les ports de deux structures sockaddr */
 int sockaddr_cmp(struct sockaddr *x, struct sockaddr *y);
@@ -0,0 +1,790 @@
+#include "synchro.h"
+
+/* Trame en cours de construction */
+typedef struct trame{
+    int fd;                     // Flux sur lequel envoyer la trame
+    donnees *octets;            // Entete puis contenu de la trame
+    size_t lg;                  // Nombre d'octets utilises (entete compris)
+    stats_synchro *stats;       // Statistiques du transfert
+} trame;
+
+/**
+ * @brief Ecrit des octets sur un flux, en plusieurs fois si besoin.
+ *
+ * @param fd le flux.
+ * @param data les octets a ecrire.
+ * @param lg le nombre d'octets.
+ * @return 0 en cas de reussite, -1 sinon.
+*/
+static int ecrire_tout(int fd, const void *data, size_t lg)
+{
+    ssize_t nb;
+    
+    while(lg > 0)
+    {
+        nb = send(fd, data, lg, MSG_NOSIGNAL);
+        if(nb==-1 && errno==EINTR)
+            continue;
+        if(nb<=0)
+            return -1;
+        data = (const donnees *)data+nb;
+        lg -= nb;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Lit un nombre exact d'octets sur un flux.
+ *
+ * @param fd le flux.
+ * @param data la destination des octets.
+ * @param lg le nombre d'octets.
+ * @return 0 en cas de reussite, -1 en cas d'erreur ou de fin du flux.
+*/
+static int lire_tout(int fd, void *data, size_t lg)
+{
+    ssize_t nb;
+    
+    while(lg > 0)
+    {
+        nb = read(fd, data, lg);
+        if(nb==-1 && errno==EINTR)
+            continue;
+        if(nb<=0)
+            return -1;
+        data = (donnees *)data+nb;
+        lg -= nb;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Commence une trame vide.
+ *
+ * @param t un pointeur sur la trame.
+ * @param type le type de la trame.
+*/
+static void ouvrir_trame(trame *t, donnees type)
+{
+    t->octets[4] = type;
+    t->lg = SYNCHRO_ENTETE;
+}
+
+/**
+ * @brief Indique si des octets tiennent encore dans une trame.
+ *
+ * @param t un pointeur sur la trame.
+ * @param lg le nombre d'octets a ajouter.
+ * @return TRUE s'ils tiennent, FALSE sinon.
+*/
+static int place_trame(trame *t, size_t lg)
+{
+    return t->lg+lg <= SYNCHRO_ENTETE+SYNCHRO_TRAME;
+}
+
+/**
+ * @brief Envoie une trame et la vide (son type est conserve).
+ *
+ * @param t un pointeur sur la trame.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int envoyer_trame(trame *t)
+{
+    uint32_t lg = htonl(t->lg-4);
+    
+    memcpy(t->octets, &lg, sizeof(lg));
+    if(ecrire_tout(t->fd, t->octets, t->lg)==-1)
+    {
+        perror("Error write");
+        return 161;
+    }
+    t->stats->trames++;
+    t->stats->octets += t->lg;
+    t->lg = SYNCHRO_ENTETE;
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute des octets a une trame (la place doit avoir ete verifiee).
+ *
+ * @param t un pointeur sur la trame.
+ * @param data les octets.
+ * @param lg le nombre d'octets.
+*/
+static void ajouter_octets(trame *t, const void *data, size_t lg)
+{
+    memcpy(t->octets+t->lg, data, lg);
+    t->lg += lg;
+}
+
+/**
+ * @brief Ecrit un entier de 2 octets (ordre du reseau) a une position.
+ *
+ * @param octets le tampon.
+ * @param valeur l'entier.
+*/
+static void ecrire_16(donnees *octets, uint16_t valeur)
+{
+    valeur = htons(valeur);
+    memcpy(octets, &valeur, sizeof(valeur));
+}
+
+/**
+ * @brief Ajoute un entier de 2 octets (ordre du reseau) a une trame.
+ *
+ * @param t un pointeur sur la trame.
+ * @param valeur l'entier.
+*/
+static void ajouter_16(trame *t, uint16_t valeur)
+{
+    ecrire_16(t->octets+t->lg, valeur);
+    t->lg += 2;
+}
+
+/**
+ * @brief Ajoute un entier de 8 octets (ordre du reseau) a une trame.
+ *
+ * @param t un pointeur sur la trame.
+ * @param valeur l'entier.
+*/
+static void ajouter_64(trame *t, uint64_t valeur)
+{
+    int i;
+    
+    for(i=7; i>=0; i--)
+        t->octets[t->lg++] = (donnees)(valeur>>(8*i));
+}
+
+/**
+ * @brief Lit un entier de 8 octets (ordre du reseau).
+ *
+ * @param octets les octets de l'entier.
+ * @return l'entier.
+*/
+static uint64_t lire_64(const donnees *octets)
+{
+    int i;
+    uint64_t valeur = 0;
+    
+    for(i=0; i<8; i++)
+        valeur = (valeur<<8)|octets[i];
+    
+    return valeur;
+}
+
+/**
+ * @brief Commence le releve des statistiques d'un transfert.
+ *
+ * @param stats les statistiques.
+*/
+static void commencer_stats(stats_synchro *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &stats->debut);
+}
+
+/**
+ * @brief Termine le releve des statistiques d'un transfert : duree, et
+ *        compteurs de TCP pour le flux.
+ *
+ * @param stats les statistiques.
+ * @param fd le flux.
+*/
+static void terminer_stats(stats_synchro *stats, int fd)
+{
+    struct timespec fin;
+    struct tcp_info info;
+    socklen_t lg = sizeof(info);
+    
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    stats->secondes = (fin.tv_sec-stats->debut.tv_sec)+
+                      (fin.tv_nsec-stats->debut.tv_nsec)/1e9;
+    
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &lg)==0)
+    {
+        stats->retransmissions = info.tcpi_total_retrans;
+        stats->rtt = info.tcpi_rtt;
+    }
+}
+
+/**
+ * @brief Affiche les statistiques d'un transfert d'etat.
+ *
+ * @param stats les statistiques.
+ * @param sens "envoyees" ou "reçues".
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_synchro(stats_synchro *stats, const char *sens, FILE *f)
+{
+    double mo = stats->octets/(1024.0*1024.0);
+    
+    fprintf(f, "Synchronisation : %lu adresses %s en %lu trames (%.1f Mo) "\
+            "en %.3f s", stats->adresses, sens, stats->trames, mo,
+            stats->secondes);
+    if(stats->secondes > 0)
+        fprintf(f, " (%.1f Mo/s, %.0f adresses/s)", mo/stats->secondes,
+                stats->adresses/stats->secondes);
+    if(stats->delta)
+        fprintf(f, ", modifications jusqu'a la sequence %llu",
+                (unsigned long long) stats->position.sequence);
+    fprintf(f, ", %u retransmissions, rtt %u us\n", stats->retransmissions,
+            stats->rtt);
+}
+
+/**
+ * @brief Lit un entier de 2 octets (ordre du reseau) dans une trame reçue.
+ *
+ * @param pos la position de lecture (avancee par effet de bord).
+ * @param fin la fin du contenu de la trame.
+ * @param valeur l'entier lu (valeur de retour par effet de bord).
+ * @return 0 en cas de reussite, -1 si la trame est trop courte.
+*/
+static int lire_16(donnees **pos, donnees *fin, uint16_t *valeur)
+{
+    if(fin-*pos < 2)
+        return -1;
+    memcpy(valeur, *pos, sizeof(uint16_t));
+    *valeur = ntohs(*valeur);
+    *pos += 2;
+    
+    return 0;
+}
+
+/**
+ * @brief Lit une suite d'octets dans une trame reçue.
+ *
+ * @param pos la position de lecture (avancee par effet de bord).
+ * @param fin la fin du contenu de la trame.
+ * @param lg le nombre d'octets.
+ * @return un pointeur sur les octets, NULL si la trame est trop courte.
+*/
+static donnees *lire_octets(donnees **pos, donnees *fin, size_t lg)
+{
+    donnees *octets = *pos;
+    
+    if((size_t)(fin-*pos) < lg)
+        return NULL;
+    *pos += lg;
+    
+    return octets;
+}
+
+/**
+ * @brief Envoie la demande de synchronisation d'un nouveau serveur.
+ *
+ * @param fd le flux ouvert vers le serveur contacte.
+ * @param adresse l'adresse de la socket de datagrammes du nouveau serveur.
+ * @param positions les positions du nouveau serveur dans l'historique des
+ *        serveurs qu'il connaissait (rechargees avec son instantane).
+ * @param nb_positions le nombre de positions (au plus POSITIONS_MAX).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int demander_synchro(int fd, const struct sockaddr *adresse,
+                        position *positions, unsigned int nb_positions)
+{
+    donnees demande[SYNCHRO_DEMANDE_MAX];
+    donnees lg_ext = cle_serveur(adresse, demande+SYNCHRO_ENTETE);
+    uint32_t lg;
+    unsigned int i;
+    trame t;
+    
+    t.octets = demande;
+    t.lg = SYNCHRO_ENTETE+lg_ext;
+    for(i=0; i<nb_positions && i<POSITIONS_MAX; i++)
+    {
+        ajouter_64(&t, positions[i].epoque);
+        ajouter_64(&t, positions[i].sequence);
+    }
+    
+    lg = htonl(t.lg-4);
+    memcpy(demande, &lg, sizeof(lg));
+    demande[4] = SYNCHRO_DEMANDE;
+    
+    if(ecrire_tout(fd, demande, t.lg)==-1)
+    {
+        perror("Error write");
+        return 164;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Lit la suite de la demande de synchronisation d'un nouveau serveur.
+ *
+ * Le flux est non bloquant : les octets deja arrives sont ajoutes a la
+ * demande, qui n'est analysee qu'une fois complete. Un nouveau serveur muet
+ * ou lent ne bloque donc pas l'appelant.
+ *
+ * @param d un pointeur sur la demande en cours de reception. Son adresse,
+ *        celle de l'autre extremite du flux, est remplacee par celle de la
+ *        socket de datagrammes du nouveau serveur (seul le port est
+ *        remplace si celle-ci ecoute sur toutes les adresses).
+ * @param epoque l'epoque de l'historique du serveur contacte.
+ * @param depuis la position du nouveau serveur dans cet historique (valeur
+ *        de retour par effet de bord, epoque nulle s'il n'en a pas).
+ * @return 0 si la demande est complete, -1 s'il manque des octets, un code
+ *         d'erreur sinon.
+*/
+int lire_demande_synchro(demande_synchro *d, uint64_t epoque,
+                            position *depuis)
+{
+    ssize_t nb;
+    size_t attendu = SYNCHRO_ENTETE;
+    donnees nulle[16] = {0}, *ext, *pos;
+    uint32_t lg = 0, lg_positions;
+    struct sockaddr_in *in = (struct sockaddr_in *) &d->adresse;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &d->adresse;
+    
+    /* L'entete donne la longueur de la demande */
+    for(;;)
+    {
+        if(d->lu >= SYNCHRO_ENTETE)
+        {
+            memcpy(&lg, d->octets, sizeof(lg));
+            lg = ntohl(lg)-1;
+            if(d->octets[4]!=SYNCHRO_DEMANDE ||
+               lg > sizeof(d->octets)-SYNCHRO_ENTETE)
+                return 163;
+            attendu = SYNCHRO_ENTETE+lg;
+        }
+        if(d->lu==attendu)
+            break;
+        
+        nb = read(d->fd, d->octets+d->lu, attendu-d->lu);
+        if(nb==-1 && errno==EINTR)
+            continue;
+        if(nb==-1 && (errno==EAGAIN || errno==EWOULDBLOCK))
+            return -1;
+        if(nb<=0)
+            return 162;
+        d->lu += nb;
+    }
+    
+    /* Les positions (16 octets chacune) suivent une extremite de 6 ou 18
+       octets : la longueur de la demande designe la famille */
+    if(lg >= TAILLE_EXTREMITE_IPV4 && (lg-TAILLE_EXTREMITE_IPV4)%16==0)
+        lg_positions = lg-TAILLE_EXTREMITE_IPV4;
+    else if(lg >= TAILLE_EXTREMITE_IPV6 && (lg-TAILLE_EXTREMITE_IPV6)%16==0)
+        lg_positions = lg-TAILLE_EXTREMITE_IPV6;
+    else
+        return 163;
+    ext = d->octets+SYNCHRO_ENTETE;
+    lg -= lg_positions;
+    
+    depuis->epoque = 0;
+    depuis->sequence = 0;
+    for(pos=ext+lg; pos<ext+lg+lg_positions; pos+=16)
+    {
+        if(lire_64(pos)==epoque)
+        {
+            depuis->epoque = epoque;
+            depuis->sequence = lire_64(pos+8);
+        }
+    }
+    
+    if(memcmp(ext, nulle, lg-2)!=0)
+    {
+        memset(&d->adresse, 0, sizeof(d->adresse));
+        if(lg==TAILLE_EXTREMITE_IPV4)
+        {
+            in->sin_family = AF_INET;
+            memcpy(&in->sin_addr, ext, 4);
+            d->addrlen = sizeof(*in);
+        }
+        else
+        {
+            in6->sin6_family = AF_INET6;
+            memcpy(&in6->sin6_addr, ext, 16);
+            d->addrlen = sizeof(*in6);
+        }
+    }
+    
+    /* Le port est au meme endroit en IPv4 et en IPv6 */
+    memcpy(&in->sin_port, ext+lg-2, 2);
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute les hash d'une partition aux trames du flux.
+ *
+ * Une trame pleine est envoyee ; les adresses restantes du hash en cours
+ * sont reprises dans la suivante, derriere une copie de l'entete du hash.
+ *
+ * @param t un pointeur sur la trame en cours (de type SYNCHRO_HASH).
+ * @param dht un pointeur sur la partition.
+ * @param maintenant la date de l'envoi.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int envoyer_hashs(trame *t, table_hash *dht, long int maintenant)
+{
+    int err;
+    size_t curseur = 0, position_nb = 0, lg_entete, lg;
+    uint16_t nb;
+    long int age;
+    l_hash *table;
+    l_emplacement *emp;
+    adresse_interne *adresse;
+    
+    while((table=parcours_table(dht, &curseur))!=NULL)
+    {
+        lg_entete = 1+2+table->taille_hash+2;
+        nb = 0;
+    
+        for(emp=table->dispo; emp!=NULL; emp=emp->next)
+        {
+            adresse = ADRESSE(dht, emp);
+            lg = 1+2+adresse->taille_adresse+2;
+    
+            /* Entete du hash au debut de la trame ou apres UINT16_MAX
+               adresses */
+            if(nb==UINT16_MAX)
+            {
+                ecrire_16(t->octets+position_nb, nb);
+                nb = 0;
+            }
+            if(!place_trame(t, lg+(nb==0 ? lg_entete : 0)))
+            {
+                if(nb > 0)
+                    ecrire_16(t->octets+position_nb, nb);
+                if((err=envoyer_trame(t))!=0)
+                    return err;
+                nb = 0;
+            }
+            if(nb==0)
+            {
+                ajouter_octets(t, &table->type_cle, 1);
+                ajouter_16(t, table->taille_hash);
+                ajouter_octets(t, table->hash, table->taille_hash);
+                position_nb = t->lg;
+                ajouter_16(t, 0);
+            }
+    
+            age = maintenant-emp->obsolescence;
+            if(age < 0)
+                age = 0;
+            if(age > UINT16_MAX)
+                age = UINT16_MAX;
+            ajouter_octets(t, &adresse->type_adresse, 1);
+            ajouter_16(t, adresse->taille_adresse);
+            ajouter_octets(t, adresse->octets, adresse->taille_adresse);
+            ajouter_16(t, age);
+            t->stats->adresses++;
+            nb++;
+        }
+    
+        if(nb > 0)
+            ecrire_16(t->octets+position_nb, nb);
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute aux trames du flux les modifications de l'historique
+ *        posterieures a une position.
+ *
+ * Chaque modification devient un hash suivi d'une adresse ; celles dont
+ * l'adresse est deja obsolete sont omises.
+ *
+ * @param t un pointeur sur la trame en cours (de type SYNCHRO_HASH).
+ * @param h un pointeur sur l'historique.
+ * @param curseur la position de la premiere modification a envoyer.
+ * @param maintenant la date de l'envoi.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int envoyer_modifications(trame *t, historique *h, uint64_t curseur,
+                                    long int maintenant)
+{
+    int err;
+    long int age;
+    modification m;
+    
+    while(lire_historique(h, &curseur, &m)==0)
+    {
+        age = maintenant-m.date;
+        if(age >= TEMPS_OBSOLESCENCE)
+            continue;
+        if(age < 0)
+            age = 0;
+    
+        if(!place_trame(t, 1+2+m.taille_hash+2+1+2+m.taille_adresse+2) &&
+           (err=envoyer_trame(t))!=0)
+            return err;
+        ajouter_octets(t, &m.type_cle, 1);
+        ajouter_16(t, m.taille_hash);
+        ajouter_octets(t, m.hash, m.taille_hash);
+        ajouter_16(t, 1);
+        ajouter_octets(t, &m.type_adresse, 1);
+        ajouter_16(t, m.taille_adresse);
+        ajouter_octets(t, m.adresse, m.taille_adresse);
+        ajouter_16(t, age);
+        t->stats->adresses++;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Envoie l'etat du serveur sur le flux d'un nouveau serveur.
+ *
+ * La position de l'etat dans l'historique est envoyee d'abord. Si le
+ * nouveau serveur revient avec une position que l'historique couvre encore,
+ * seules les modifications posterieures suivent ; sinon, les hash de toutes
+ * les partitions sont envoyes avec l'age de chaque adresse. Puis viennent
+ * les serveurs connus et la trame de fin. Appelee dans un processus fils
+ * (copie de la memoire du serveur), sans verrou.
+ *
+ * @param fd le flux ouvert par le nouveau serveur.
+ * @param tables les partitions de la table.
+ * @param nb_tables le nombre de partitions.
+ * @param serveurs la liste des serveurs connus.
+ * @param h l'historique des modifications du serveur.
+ * @param depuis la position du nouveau serveur dans l'historique (epoque
+ *        nulle s'il n'en a pas).
+ * @param stats les statistiques du transfert (valeur de retour par effet de
+ *        bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_synchro(int fd, table_hash *tables, unsigned int nb_tables,
+                    l_serveur *serveurs, historique *h, position depuis,
+                    stats_synchro *stats)
+{
+    int err = 0;
+    unsigned int p;
+    uint64_t curseur;
+    long int maintenant = time(NULL);
+    trame t;
+    
+    commencer_stats(stats);
+    t.fd = fd;
+    t.stats = stats;
+    t.octets = malloc(SYNCHRO_ENTETE+SYNCHRO_TRAME);
+    if(t.octets==NULL)
+    {
+        perror("Error malloc");
+        return 160;
+    }
+    
+    stats->position.epoque = h->epoque;
+    stats->position.sequence = h->sequence;
+    stats->delta = chercher_historique(h, depuis, &curseur)==0;
+    ouvrir_trame(&t, SYNCHRO_POSITION);
+    ajouter_64(&t, stats->position.epoque);
+    ajouter_64(&t, stats->position.sequence);
+    t.octets[t.lg++] = stats->delta;
+    err=envoyer_trame(&t);
+    
+    ouvrir_trame(&t, SYNCHRO_HASH);
+    if(stats->delta && err==0)
+        err=envoyer_modifications(&t, h, curseur, maintenant);
+    for(p=0; !stats->delta && p<nb_tables && err==0; p++)
+        err=envoyer_hashs(&t, &tables[p], maintenant);
+    if(err==0 && t.lg > SYNCHRO_ENTETE)
+        err=envoyer_trame(&t);
+    
+    ouvrir_trame(&t, SYNCHRO_SERVEURS);
+    for(; serveurs!=NULL && err==0; serveurs=serveurs->next)
+    {
+        if(!place_trame(&t, 2+serveurs->addrlen))
+            err=envoyer_trame(&t);
+        ajouter_16(&t, serveurs->addrlen);
+        ajouter_octets(&t, serveurs->serveur, serveurs->addrlen);
+    }
+    if(err==0 && t.lg > SYNCHRO_ENTETE)
+        err=envoyer_trame(&t);
+    
+    ouvrir_trame(&t, SYNCHRO_FIN);
+    ajouter_64(&t, stats->adresses);
+    if(err==0)
+        err=envoyer_trame(&t);
+    terminer_stats(stats, fd);
+    
+    free(t.octets);
+    
+    return err;
+}
+
+/**
+ * @brief Ajoute aux partitions les hash d'une trame reçue.
+ *
+ * La date de chaque adresse est reconstituee a partir de son age : une
+ * adresse expire chez le nouveau serveur en meme temps que chez l'ancien.
+ *
+ * @param pos le contenu de la trame.
+ * @param fin la fin du contenu.
+ * @param tables les partitions de la table.
+ * @param nb_tables le nombre de partitions.
+ * @param j le journal des put (NULL s'il est desactive).
+ * @param stats les statistiques du transfert (adresses reçues
+ *        incrementees).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int lire_trame_hash(donnees *pos, donnees *fin, table_hash *tables,
+                            unsigned int nb_tables, journal *j,
+                            stats_synchro *stats)
+{
+    int err;
+    unsigned int p;
+    uint16_t taille_hash, nb, taille_adresse, age;
+    donnees type_cle, type_adresse, *hash, *adresse;
+    long int maintenant = time(NULL);
+    
+    while(pos < fin)
+    {
+        type_cle = *pos++;
+        if(lire_16(&pos, fin, &taille_hash)==-1 ||
+           (hash=lire_octets(&pos, fin, taille_hash))==NULL ||
+           lire_16(&pos, fin, &nb)==-1)
+            return 163;
+    
+        p = partition_cle(type_cle, hash, taille_hash, nb_tables);
+    
+        for(; nb > 0; nb--)
+        {
+            if((adresse=lire_octets(&pos, fin, 1))==NULL)
+                return 163;
+            type_adresse = *adresse;
+            if(lire_16(&pos, fin, &taille_adresse)==-1 ||
+               (adresse=lire_octets(&pos, fin, taille_adresse))==NULL ||
+               lire_16(&pos, fin, &age)==-1)
+                return 163;
+    
+            err=add_hash(&tables[p], type_cle, hash, taille_hash,
+                         type_adresse, adresse, taille_adresse,
+                         maintenant-age);
+            if(err!=0)
+                return err;
+            if(j!=NULL)
+                journaliser_put(j, maintenant-age, type_cle, hash,
+                                taille_hash, type_adresse, adresse,
+                                taille_adresse);
+            stats->adresses++;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Ajoute aux serveurs connus les serveurs d'une trame reçue.
+ *
+ * @param pos le contenu de la trame.
+ * @param fin la fin du contenu.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int lire_trame_serveurs(donnees *pos, donnees *fin,
+                                serveurs_connus *st)
+{
+    int err;
+    uint16_t lg;
+    donnees *octets;
+    struct sockaddr_storage serveur;
+    
+    while(pos < fin)
+    {
+        if(lire_16(&pos, fin, &lg)==-1 || lg > sizeof(serveur) ||
+           (octets=lire_octets(&pos, fin, lg))==NULL)
+            return 163;
+    
+        /* Copie alignee de l'adresse */
+        memcpy(&serveur, octets, lg);
+        if((err=add_a_serveurs(st, (struct sockaddr *) &serveur, lg))!=0)
+            return err;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Reçoit l'etat d'un serveur sur un flux et l'ajoute aux partitions
+ *        et aux serveurs connus.
+ *
+ * Les trames de type inconnu sont ignorees. Le nombre d'adresses annonce
+ * par la trame de fin doit etre celui des adresses reçues.
+ *
+ * @param fd le flux ouvert vers le serveur contacte (demande envoyee).
+ * @param tables les partitions de la table.
+ * @param nb_tables le nombre de partitions.
+ * @param st un pointeur sur l'ensemble des serveurs connus.
+ * @param j le journal des put (NULL s'il est desactive).
+ * @param stats les statistiques du transfert (valeur de retour par effet de
+ *        bord).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int recevoir_synchro(int fd, table_hash *tables, unsigned int nb_tables,
+                        serveurs_connus *st, journal *j,
+                        stats_synchro *stats)
+{
+    int err = 0;
+    uint32_t lg;
+    donnees entete[SYNCHRO_ENTETE], *contenu;
+    
+    commencer_stats(stats);
+    contenu = malloc(SYNCHRO_TRAME);
+    if(contenu==NULL)
+    {
+        perror("Error malloc");
+        return 160;
+    }
+    
+    while(err==0)
+    {
+        if(lire_tout(fd, entete, SYNCHRO_ENTETE)==-1)
+        {
+            err = 162;
+            break;
+        }
+        memcpy(&lg, entete, sizeof(lg));
+        lg = ntohl(lg)-1;
+        if(lg > SYNCHRO_TRAME)
+        {
+            err = 163;
+            break;
+        }
+        if(lire_tout(fd, contenu, lg)==-1)
+        {
+            err = 162;
+            break;
+        }
+    
+        stats->trames++;
+        stats->octets += SYNCHRO_ENTETE+lg;
+        
+        if(entete[4]==SYNCHRO_FIN)
+        {
+            if(lg!=8)
+                err = 163;
+            else if(lire_64(contenu)!=stats->adresses)
+                err = 165;
+            break;
+        }
+        if(entete[4]==SYNCHRO_POSITION && lg==2*sizeof(uint64_t)+1)
+        {
+            stats->position.epoque = lire_64(contenu);
+            stats->position.sequence = lire_64(contenu+8);
+            stats->delta = contenu[16];
+        }
+        else if(entete[4]==SYNCHRO_HASH)
+            err=lire_trame_hash(contenu, contenu+lg, tables, nb_tables, j,
+                                stats);
+        else if(entete[4]==SYNCHRO_SERVEURS)
+            err=lire_trame_serveurs(contenu, contenu+lg, st);
+    }
+    
+    if(err==162)
+        fprintf(stderr, "Erreur : flux de synchronisation interrompu\n");
+    else if(err==163)
+        fprintf(stderr, "Erreur : trame de synchronisation invalide\n");
+    else if(err==165)
+        fprintf(stderr, "Erreur : synchronisation incomplete\n");
+    terminer_stats(stats, fd);
+    free(contenu);
+    
+    return err;
+}
@@ -0,0 +1,126 @@
+#ifndef __SYNCHRO_H__
+#define __SYNCHRO_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "messages.h"
+#include "stockage_serveur.h"
+#include "journal.h"
+#include "historique.h"
+
+/* Taille maximale du contenu d'une trame : un hash et une adresse de taille
+   maximale doivent y tenir */
+#define SYNCHRO_TRAME (256*1024)
+
+/* Delai (en secondes) d'attente de la demande, et de chaque lecture ou
+   ecriture du flux */
+#define SYNCHRO_DELAI 5
+
+/* Nombre maximal de demandes de synchronisation reçues en meme temps */
+#define SYNCHRO_DEMANDES_MAX 8
+
+/* Taille de l'entete d'une trame : longueur puis type */
+#define SYNCHRO_ENTETE 5
+
+/* Taille maximale d'une demande : entete, extremite puis positions */
+#define SYNCHRO_DEMANDE_MAX (SYNCHRO_ENTETE+TAILLE_CLE_SERVEUR+\
+                             POSITIONS_MAX*2*sizeof(uint64_t))
+
+/* Types de trames */
+#define SYNCHRO_DEMANDE 'n'     // Demande du nouveau serveur
+#define SYNCHRO_HASH 'h'        // Hash et leurs adresses
+#define SYNCHRO_SERVEURS 's'    // Serveurs connus
+#define SYNCHRO_FIN 'f'         // Fin de l'etat
+#define SYNCHRO_POSITION 'q'    // Position de l'etat envoye
+
+/*
+ Flux de synchronisation d'un nouveau serveur (connexion TCP sur l'adresse et
+ le port du serveur contacte). Entiers dans l'ordre du reseau.
+
+ Chaque trame est formee de la longueur de la suite (4 octets), de son type
+ (1 octet) puis de son contenu :
+ - SYNCHRO_DEMANDE (du nouveau serveur) : adresse de sa socket de
+   datagrammes en extremite binaire (IP puis port, 6 ou 18 octets) ; une IP
+   nulle (ecoute sur toutes les adresses) est remplacee par celle de la
+   connexion. Un serveur qui revient y ajoute ses positions dans l'historique
+   des serveurs qu'il connaissait : epoque puis sequence (8 octets chacune) ;
+ - SYNCHRO_POSITION : epoque et sequence de l'historique de l'envoyeur
+   (8 octets chacune) a la date de l'etat envoye, puis 1 si seules les
+   modifications posterieures a la position du nouveau serveur suivent,
+   0 pour l'etat complet (1 octet) ;
+ - SYNCHRO_HASH : une suite de hash, chacun forme de son type de cle
+   (1 octet), de sa taille (2 octets), de la cle, du nombre d'adresses qui
+   suivent (2 octets) puis, pour chaque adresse : type (1 octet), taille
+   (2 octets), octets et age de la derniere annonce en secondes (2 octets).
+   Les adresses d'un hash peuvent etre reparties sur plusieurs trames ; pour
+   un delta, chaque modification de l'historique est un hash et une
+   adresse ;
+ - SYNCHRO_SERVEURS : une suite de serveurs, chacun forme de la taille de
+   son adresse (2 octets) puis de l'adresse (struct sockaddr) ;
+ - SYNCHRO_FIN : nombre d'adresses envoyees (8 octets), termine le flux ;
+   le nouveau serveur verifie qu'il les a toutes reçues.
+
+ La fiabilite (numeros de sequence, acquittements cumulatifs et selectifs,
+ retransmissions) et le controle de congestion sont ceux de TCP : ses
+ compteurs sont releves (TCP_INFO) pour les statistiques du transfert.
+*/
+
+/* Statistiques d'un transfert d'etat */
+typedef struct stats_synchro{
+    unsigned long adresses;     // Adresses envoyees ou reçues
+    unsigned long trames;       // Trames envoyees ou reçues
+    unsigned long long octets;  // Octets envoyes ou reçus
+    double secondes;            // Duree du transfert
+    unsigned int retransmissions; // Segments retransmis par TCP
+    unsigned int rtt;           // Temps d'aller-retour lisse (microsecondes)
+    position position;          // Position de l'etat dans l'historique de
+                                // l'envoyeur
+    int delta;                  // TRUE si seules les modifications
+                                // posterieures a la position du nouveau
+                                // serveur ont ete transferees
+    struct timespec debut;      // Debut du transfert
+} stats_synchro;
+
+/* Demande de synchronisation d'un nouveau serveur en cours de reception */
+typedef struct demande_synchro{
+    int fd;                     // Flux du nouveau serveur (-1 si libre)
+    struct sockaddr_storage adresse; // Adresse du nouveau serveur
+    socklen_t addrlen;          // Longueur de l'adresse
+    time_t debut;               // Date de la connexion
+    size_t lu;                  // Nombre d'octets reçus
+    donnees octets[SYNCHRO_DEMANDE_MAX]; // Octets reçus
+} demande_synchro;
+
+/* Envoie la demande de synchronisation d'un nouveau serveur */
+int demander_synchro(int fd, const struct sockaddr *adresse,
+                        position *positions, unsigned int nb_positions);
+
+/* Lit la suite de la demande de synchronisation d'un nouveau serveur */
+int lire_demande_synchro(demande_synchro *d, uint64_t epoque,
+                            position *depuis);
+
+/* Envoie l'etat du serveur (partitions, ou modifications depuis la position
+   du nouveau serveur, et serveurs connus) sur le flux */
+int envoyer_synchro(int fd, table_hash *tables, unsigned int nb_tables,
+                    l_serveur *serveurs, historique *h, position depuis,
+                    stats_synchro *stats);
+
+/* Reçoit l'etat d'un serveur et l'ajoute aux partitions */
+int recevoir_synchro(int fd, table_hash *tables, unsigned int nb_tables,
+                        serveurs_connus *st, journal *j,
+                        stats_synchro *stats);
+
+/* Affiche les statistiques d'un transfert d'etat */
+void afficher_stats_synchro(stats_synchro *stats, const char *sens,
+                            FILE *f);
+
+#endif
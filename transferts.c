@@ -0,0 +1,159 @@
+#include "transferts.h"
+
+/* Taille de l'entete d'un enregistrement : taille totale et longueur de
+   l'adresse de l'emetteur */
+#define TRANSFERTS_ENTETE (2*sizeof(uint32_t))
+
+/**
+ * @brief Copie des octets dans l'anneau a partir d'une position.
+ *
+ * @param f un pointeur sur la file.
+ * @param position la position (non reduite) du premier octet.
+ * @param data les octets a copier.
+ * @param lg le nombre d'octets.
+*/
+static void copier_vers_anneau(file_transferts *f, uint64_t position,
+                                const void *data, size_t lg)
+{
+    size_t debut = position & (TRANSFERTS_TAILLE_ANNEAU-1);
+    size_t morceau = TRANSFERTS_TAILLE_ANNEAU-debut;
+    
+    if(morceau > lg)
+        morceau = lg;
+    memcpy(f->anneau+debut, data, morceau);
+    memcpy(f->anneau, (const donnees *)data+morceau, lg-morceau);
+}
+
+/**
+ * @brief Copie des octets de l'anneau a partir d'une position.
+ *
+ * @param f un pointeur sur la file.
+ * @param position la position (non reduite) du premier octet.
+ * @param data la destination des octets.
+ * @param lg le nombre d'octets.
+*/
+static void copier_depuis_anneau(file_transferts *f, uint64_t position,
+                                    void *data, size_t lg)
+{
+    size_t debut = position & (TRANSFERTS_TAILLE_ANNEAU-1);
+    size_t morceau = TRANSFERTS_TAILLE_ANNEAU-debut;
+    
+    if(morceau > lg)
+        morceau = lg;
+    memcpy(data, f->anneau+debut, morceau);
+    memcpy((donnees *)data+morceau, f->anneau, lg-morceau);
+}
+
+/**
+ * @brief Alloue une file de transferts vide.
+ *
+ * @param f un pointeur sur la file a initialiser.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int init_file_transferts(file_transferts *f)
+{
+    memset(f, 0, sizeof(file_transferts));
+    f->anneau = malloc(TRANSFERTS_TAILLE_ANNEAU);
+    if(f->anneau==NULL)
+    {
+        perror("Error malloc");
+        return 140;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Libere une file de transferts (les messages en attente sont perdus).
+ *
+ * @param f un pointeur sur la file.
+*/
+void delete_file_transferts(file_transferts *f)
+{
+    free(f->anneau);
+    f->anneau = NULL;
+}
+
+/**
+ * @brief Depose une copie d'un message et de son emetteur dans la file.
+ *
+ * Appelee uniquement par le thread producteur de la file. Si la file est
+ * pleine, le message est perdu (comme un datagramme) : le producteur
+ * n'attend jamais le consommateur.
+ *
+ * @param f un pointeur sur la file.
+ * @param m un pointeur sur le message.
+ * @param emetteur l'adresse de l'emetteur du message.
+ * @param addrlen la longueur de l'adresse.
+ * @return 0 en cas de reussite, -1 si la file est pleine.
+*/
+int deposer_transfert(file_transferts *f, message *m,
+                        const struct sockaddr *emetteur, socklen_t addrlen)
+{
+    uint32_t entete[2];
+    uint64_t tete, queue = f->queue;
+    size_t lg;
+    
+    entete[0] = TRANSFERTS_ENTETE+addrlen+m->lg_message;
+    entete[1] = addrlen;
+    lg = (entete[0]+TRANSFERTS_ALIGNEMENT-1) & ~(TRANSFERTS_ALIGNEMENT-1);
+    
+    /* La tete n'avance que si le consommateur a fini de lire les octets */
+    tete = __atomic_load_n(&f->tete, __ATOMIC_ACQUIRE);
+    if(queue+lg-tete > TRANSFERTS_TAILLE_ANNEAU)
+    {
+        f->perdus++;
+        return -1;
+    }
+    
+    copier_vers_anneau(f, queue, entete, sizeof(entete));
+    copier_vers_anneau(f, queue+sizeof(entete), emetteur, addrlen);
+    copier_vers_anneau(f, queue+sizeof(entete)+addrlen, m->contenu,
+                       m->lg_message);
+    
+    /* Publie l'enregistrement une fois ses octets ecrits */
+    __atomic_store_n(&f->queue, queue+lg, __ATOMIC_RELEASE);
+    f->deposes++;
+    
+    return 0;
+}
+
+/**
+ * @brief Retire le message le plus ancien de la file.
+ *
+ * Appelee uniquement par le thread consommateur de la file. Le message est
+ * copie dans un tampon de reception, dont il devient le message (comme par
+ * vue_message).
+ *
+ * @param f un pointeur sur la file.
+ * @param t le tampon recevant le message.
+ * @param emetteur une structure pouvant contenir l'adresse de l'emetteur
+ *        (valeur de retour par effet de bord).
+ * @param addrlen la longueur de l'adresse de l'emetteur
+ *        (valeur de retour par effet de bord).
+ * @return 0 si un message a ete retire, -1 si la file est vide.
+*/
+int retirer_transfert(file_transferts *f, tampon_message *t,
+                        struct sockaddr *emetteur, socklen_t *addrlen)
+{
+    uint32_t entete[2];
+    uint64_t queue, tete = f->tete;
+    size_t lg;
+    
+    queue = __atomic_load_n(&f->queue, __ATOMIC_ACQUIRE);
+    if(tete==queue)
+        return -1;
+    
+    copier_depuis_anneau(f, tete, entete, sizeof(entete));
+    copier_depuis_anneau(f, tete+sizeof(entete), emetteur, entete[1]);
+    *addrlen = entete[1];
+    lg = entete[0]-TRANSFERTS_ENTETE-entete[1];
+    copier_depuis_anneau(f, tete+sizeof(entete)+entete[1], t->octets, lg);
+    vue_message(t, lg);
+    
+    /* Rend la place au producteur une fois les octets copies */
+    lg = (entete[0]+TRANSFERTS_ALIGNEMENT-1) & ~(TRANSFERTS_ALIGNEMENT-1);
+    __atomic_store_n(&f->tete, tete+lg, __ATOMIC_RELEASE);
+    
+    return 0;
+}
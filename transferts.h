@@ -0,0 +1,53 @@
+#ifndef __TRANSFERTS_H__
+#define __TRANSFERTS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "messages.h"
+
+/* Taille de l'anneau d'une file de transferts (puissance de 2, superieure a
+   la taille d'un enregistrement contenant un message de taille maximale) */
+#define TRANSFERTS_TAILLE_ANNEAU (128*1024)
+
+/* Alignement des enregistrements dans l'anneau */
+#define TRANSFERTS_ALIGNEMENT 8
+
+/*
+ File de messages d'un thread producteur vers un thread consommateur, sans
+ verrou : seul le producteur ecrit la queue, seul le consommateur ecrit la
+ tete. Un enregistrement est forme de sa taille totale (4 octets), de la
+ longueur de l'adresse de l'emetteur (4 octets), de l'adresse puis du
+ message, et commence a une position multiple de TRANSFERTS_ALIGNEMENT.
+ Les deux positions sont sur des lignes de cache differentes.
+*/
+typedef struct file_transferts{
+    donnees *anneau;            // Enregistrements en attente
+    uint64_t queue __attribute__((aligned(64)));
+                                // Position du prochain octet a remplir
+                                // (ecrite par le producteur)
+    unsigned long deposes;      // Nombre de messages deposes
+    unsigned long perdus;       // Nombre de messages perdus (file pleine)
+    uint64_t tete __attribute__((aligned(64)));
+                                // Position du premier octet non lu (ecrite
+                                // par le consommateur)
+} file_transferts;
+
+/* Alloue une file de transferts vide */
+int init_file_transferts(file_transferts *f);
+
+/* Libere une file de transferts */
+void delete_file_transferts(file_transferts *f);
+
+/* Depose une copie d'un message et de son emetteur dans la file */
+int deposer_transfert(file_transferts *f, message *m,
+                        const struct sockaddr *emetteur, socklen_t addrlen);
+
+/* Retire le message le plus ancien de la file */
+int retirer_transfert(file_transferts *f, tampon_message *t,
+                        struct sockaddr *emetteur, socklen_t *addrlen);
+
+#endif
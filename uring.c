@@ -0,0 +1,510 @@
+#include "uring.h"
+
+/* Identifiants des operations, rendus dans les completions */
+#define URING_RECEPTION 1
+#define URING_ENVOI 2
+
+/**
+ * @brief Appel systeme io_uring_setup (sans liburing).
+*/
+static int io_uring_setup(unsigned int entrees, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entrees, p);
+}
+
+/**
+ * @brief Appel systeme io_uring_enter (sans liburing).
+*/
+static int io_uring_enter(int fd, unsigned int a_soumettre,
+                            unsigned int min_completions, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, a_soumettre, min_completions,
+                   flags, NULL, 0);
+}
+
+/**
+ * @brief Appel systeme io_uring_register (sans liburing).
+*/
+static int io_uring_register(int fd, unsigned int code, void *arg,
+                                unsigned int nb)
+{
+    return syscall(__NR_io_uring_register, fd, code, arg, nb);
+}
+
+/**
+ * @brief Cree une instance io_uring et projette ses anneaux.
+ *
+ * @param a un pointeur sur l'anneau a initialiser.
+ * @param entrees le nombre minimal d'entrees de soumission.
+ * @param completions le nombre minimal d'entrees de completion (0 pour le
+ *        double des entrees de soumission).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int ouvrir_anneau(anneau_uring *a, unsigned int entrees,
+                            unsigned int completions)
+{
+    struct io_uring_params p;
+    donnees *sq, *cq;
+    
+    memset(a, 0, sizeof(anneau_uring));
+    memset(&p, 0, sizeof(p));
+    if(completions > 0)
+    {
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = completions;
+    }
+    
+    a->fd = io_uring_setup(entrees, &p);
+    if(a->fd==-1)
+    {
+        perror("Error io_uring_setup");
+        return 150;
+    }
+    
+    a->sq_taille = p.sq_off.array+p.sq_entries*sizeof(unsigned int);
+    a->cq_taille = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    a->sqes_taille = p.sq_entries*sizeof(struct io_uring_sqe);
+    
+    /* Les deux anneaux peuvent partager une seule projection */
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(a->cq_taille > a->sq_taille)
+            a->sq_taille = a->cq_taille;
+        a->cq_taille = 0;
+    }
+    
+    a->sq_zone = mmap(NULL, a->sq_taille, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, a->fd, IORING_OFF_SQ_RING);
+    a->cq_zone = a->cq_taille==0 ? a->sq_zone :
+                 mmap(NULL, a->cq_taille, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, a->fd, IORING_OFF_CQ_RING);
+    a->sqes = mmap(NULL, a->sqes_taille, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, a->fd, IORING_OFF_SQES);
+    if(a->sq_zone==MAP_FAILED || a->cq_zone==MAP_FAILED ||
+       a->sqes==MAP_FAILED)
+    {
+        perror("Error mmap");
+        return 151;
+    }
+    
+    sq = a->sq_zone;
+    cq = a->cq_zone;
+    a->sq_drapeaux = (unsigned int *)(sq+p.sq_off.flags);
+    a->sq_tete = (unsigned int *)(sq+p.sq_off.head);
+    a->sq_queue = (unsigned int *)(sq+p.sq_off.tail);
+    a->sq_masque = (unsigned int *)(sq+p.sq_off.ring_mask);
+    a->sq_tableau = (unsigned int *)(sq+p.sq_off.array);
+    a->cq_tete = (unsigned int *)(cq+p.cq_off.head);
+    a->cq_queue = (unsigned int *)(cq+p.cq_off.tail);
+    a->cq_masque = (unsigned int *)(cq+p.cq_off.ring_mask);
+    a->cqes = (struct io_uring_cqe *)(cq+p.cq_off.cqes);
+    
+    return 0;
+}
+
+/**
+ * @brief Libere une instance io_uring et ses projections.
+ *
+ * @param a un pointeur sur l'anneau.
+*/
+static void fermer_anneau(anneau_uring *a)
+{
+    if(a->sqes!=NULL && a->sqes!=MAP_FAILED)
+        munmap(a->sqes, a->sqes_taille);
+    if(a->cq_taille!=0 && a->cq_zone!=NULL && a->cq_zone!=MAP_FAILED)
+        munmap(a->cq_zone, a->cq_taille);
+    if(a->sq_zone!=NULL && a->sq_zone!=MAP_FAILED)
+        munmap(a->sq_zone, a->sq_taille);
+    if(a->fd>0)
+        close(a->fd);
+    memset(a, 0, sizeof(anneau_uring));
+}
+
+/**
+ * @brief Reserve la prochaine entree de soumission d'un anneau.
+ *
+ * L'entree n'est visible du noyau qu'apres publier_soumissions. L'appelant
+ * ne soumet jamais plus d'entrees que l'anneau n'en contient.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param rang le nombre d'entrees deja reservees depuis la derniere
+ *        publication.
+ * @return l'entree, remise a zero.
+*/
+static struct io_uring_sqe *entree_soumission(anneau_uring *a,
+                                                unsigned int rang)
+{
+    unsigned int i = (*a->sq_queue+rang) & *a->sq_masque;
+    
+    a->sq_tableau[i] = i;
+    memset(&a->sqes[i], 0, sizeof(struct io_uring_sqe));
+    
+    return &a->sqes[i];
+}
+
+/**
+ * @brief Publie les entrees reservees au noyau.
+ *
+ * @param a un pointeur sur l'anneau.
+ * @param nb le nombre d'entrees reservees.
+*/
+static void publier_soumissions(anneau_uring *a, unsigned int nb)
+{
+    __atomic_store_n(a->sq_queue, *a->sq_queue+nb, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Rend un tampon fourni au noyau.
+ *
+ * @param u un pointeur sur le backend.
+ * @param id l'identifiant du tampon.
+*/
+static void rendre_tampon_fourni(uring *u, unsigned int id)
+{
+    uint16_t queue = u->fournis->tail;
+    struct io_uring_buf *b = &u->fournis->bufs[queue & (URING_TAMPONS-1)];
+    
+    b->addr = (uint64_t)(uintptr_t)(u->tampons+id*URING_TAILLE_TAMPON);
+    b->len = URING_TAILLE_TAMPON;
+    b->bid = id;
+    __atomic_store_n(&u->fournis->tail, queue+1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Soumet une reception multishot sur la socket.
+ *
+ * La reception produit une completion par datagramme, chacun dans un tampon
+ * fourni, jusqu'a ce que les tampons fournis viennent a manquer.
+ *
+ * @param u un pointeur sur le backend.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+static int armer_reception(uring *u)
+{
+    struct io_uring_sqe *sqe = entree_soumission(&u->reception, 0);
+    
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = u->sfd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->modele;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUPE;
+    sqe->user_data = URING_RECEPTION;
+    publier_soumissions(&u->reception, 1);
+    
+    while(io_uring_enter(u->reception.fd, 1, 0, 0)==-1)
+    {
+        if(errno!=EINTR)
+        {
+            perror("Error io_uring_enter");
+            return 154;
+        }
+    }
+    
+    u->arme = TRUE;
+    u->rearmements++;
+    
+    return 0;
+}
+
+/**
+ * @brief Prepare le backend io_uring d'une socket.
+ *
+ * Les tampons fournis sont projetes sans etre touches : seules les pages
+ * effectivement remplies par des datagrammes occupent de la memoire. La
+ * reception n'est soumise que par demarrer_uring.
+ *
+ * @param u un pointeur sur le backend a initialiser.
+ * @param sfd l'identifiant de la socket.
+ * @param capacite le nombre maximal de datagrammes d'un lot d'envoi.
+ * @return 0 en cas de reussite, un code d'erreur sinon (le backend doit
+ *         alors etre libere par delete_uring).
+*/
+int init_uring(uring *u, int sfd, unsigned int capacite)
+{
+    int err;
+    unsigned int i;
+    struct io_uring_buf_reg enregistrement;
+    
+    memset(u, 0, sizeof(uring));
+    u->sfd = sfd;
+    u->modele.msg_namelen = sizeof(sockaddr_in);
+    
+    /* Chaque tampon fourni donne au plus une completion en attente */
+    if((err=ouvrir_anneau(&u->reception, 4, 2*URING_TAMPONS))!=0 ||
+       (err=ouvrir_anneau(&u->envoi, capacite, 0))!=0)
+        return err;
+    
+    u->fournis = mmap(NULL, URING_TAMPONS*sizeof(struct io_uring_buf),
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    u->tampons = mmap(NULL, URING_TAMPONS*URING_TAILLE_TAMPON,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if(u->fournis==MAP_FAILED || u->tampons==MAP_FAILED)
+    {
+        perror("Error mmap");
+        return 152;
+    }
+    
+    memset(&enregistrement, 0, sizeof(enregistrement));
+    enregistrement.ring_addr = (uint64_t)(uintptr_t)u->fournis;
+    enregistrement.ring_entries = URING_TAMPONS;
+    enregistrement.bgid = URING_GROUPE;
+    if(io_uring_register(u->reception.fd, IORING_REGISTER_PBUF_RING,
+                         &enregistrement, 1)==-1)
+    {
+        perror("Error io_uring_register");
+        return 153;
+    }
+    
+    for(i=0; i<URING_TAMPONS; i++)
+        rendre_tampon_fourni(u, i);
+    
+    return 0;
+}
+
+/**
+ * @brief Soumet la reception multishot du backend.
+ *
+ * Doit etre appelee par le thread qui utilisera le backend : c'est ce thread
+ * que le noyau charge de produire les completions de la reception.
+ *
+ * @param u un pointeur sur le backend.
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int demarrer_uring(uring *u)
+{
+    return armer_reception(u);
+}
+
+/**
+ * @brief Libere le backend io_uring (la reception en cours est annulee par
+ *        la fermeture de son instance).
+ *
+ * @param u un pointeur sur le backend.
+*/
+void delete_uring(uring *u)
+{
+    fermer_anneau(&u->reception);
+    fermer_anneau(&u->envoi);
+    if(u->fournis!=NULL && u->fournis!=MAP_FAILED)
+        munmap(u->fournis, URING_TAMPONS*sizeof(struct io_uring_buf));
+    if(u->tampons!=NULL && u->tampons!=MAP_FAILED)
+        munmap(u->tampons, URING_TAMPONS*URING_TAILLE_TAMPON);
+    u->fournis = NULL;
+    u->tampons = NULL;
+}
+
+/**
+ * @brief Copie un datagramme reçu dans un tampon fourni vers une place du
+ *        lot de reception.
+ *
+ * @param u un pointeur sur le backend.
+ * @param lot un pointeur sur le lot.
+ * @param cqe la completion de la reception.
+ * @return 0 en cas de reussite, -1 si le datagramme est ignore, un code
+ *         d'erreur sinon.
+*/
+static int copier_datagramme(uring *u, lot_reception *lot,
+                                struct io_uring_cqe *cqe)
+{
+    unsigned int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    donnees *tampon = u->tampons+id*URING_TAILLE_TAMPON;
+    struct io_uring_recvmsg_out *sortie = (void *)tampon;
+    donnees *adresse = tampon+sizeof(struct io_uring_recvmsg_out);
+    donnees *contenu = adresse+u->modele.msg_namelen;
+    unsigned int i = lot->nb;
+    socklen_t addrlen;
+    
+    if(sortie->flags & MSG_TRUNC)
+    {
+        u->tronques++;
+        rendre_tampon_fourni(u, id);
+        return -1;
+    }
+    
+    if(lot->tampons[i]==NULL)
+    {
+        lot->tampons[i] = emprunter_tampon(&lot->reserve);
+        if(lot->tampons[i]==NULL)
+        {
+            rendre_tampon_fourni(u, id);
+            return 58;
+        }
+        lot->vecteurs[i].iov_base = lot->tampons[i]->octets;
+    }
+    
+    addrlen = sortie->namelen;
+    if(addrlen > sizeof(sockaddr_in))
+        addrlen = sizeof(sockaddr_in);
+    memcpy(&lot->emetteurs[i], adresse, addrlen);
+    lot->entetes[i].msg_hdr.msg_namelen = addrlen;
+    memcpy(lot->tampons[i]->octets, contenu, sortie->payloadlen);
+    lot->entetes[i].msg_len = sortie->payloadlen;
+    
+    rendre_tampon_fourni(u, id);
+    lot->nb++;
+    
+    return 0;
+}
+
+/**
+ * @brief Reçoit les datagrammes deja arrives dans un lot, sans attendre.
+ *
+ * Chaque completion de la reception multishot donne un datagramme, copie
+ * dans une place du lot (comme par recvmmsg) puis son tampon fourni est
+ * rendu au noyau. La reception est resoumise si elle s'est arretee.
+ *
+ * @param u un pointeur sur le backend.
+ * @param lot un pointeur sur le lot (lot->nb recoit le nombre de
+ *        datagrammes lus, eventuellement 0).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int recevoir_lot_uring(uring *u, lot_reception *lot)
+{
+    int err = 0;
+    anneau_uring *a = &u->reception;
+    unsigned int tete = *a->cq_tete, queue;
+    struct io_uring_cqe *cqe;
+    
+    lot->nb = 0;
+    
+    /* Des completions ayant deborde de l'anneau sont gardees par le noyau
+       jusqu'au prochain io_uring_enter */
+    if(__atomic_load_n(a->sq_drapeaux, __ATOMIC_RELAXED) &
+       IORING_SQ_CQ_OVERFLOW)
+    {
+        if(io_uring_enter(a->fd, 0, 0, IORING_ENTER_GETEVENTS)==-1 &&
+           errno!=EINTR)
+        {
+            perror("Error io_uring_enter");
+            return 154;
+        }
+        u->debordements++;
+    }
+    
+    queue = __atomic_load_n(a->cq_queue, __ATOMIC_ACQUIRE);
+    
+    while(tete!=queue && lot->nb<lot->capacite && err!=58)
+    {
+        cqe = &a->cqes[tete & *a->cq_masque];
+        tete++;
+    
+        if(!(cqe->flags & IORING_CQE_F_MORE))
+            u->arme = FALSE;
+    
+        if(cqe->res<0)
+        {
+            if(cqe->res==-ENOBUFS)
+                u->epuisements++;
+            else
+            {
+                errno = -cqe->res;
+                perror("Error recvmsg");
+            }
+            continue;
+        }
+    
+        if(cqe->flags & IORING_CQE_F_BUFFER)
+            err=copier_datagramme(u, lot, cqe);
+    }
+    
+    __atomic_store_n(a->cq_tete, tete, __ATOMIC_RELEASE);
+    
+    if(err==58)
+        return err;
+    
+    if(!u->arme)
+        return armer_reception(u);
+    
+    return 0;
+}
+
+/**
+ * @brief Envoie les datagrammes d'un lot d'envoi par des sendmsg lies.
+ *
+ * Les envois sont lies pour partir dans l'ordre du lot, et soumis par un
+ * seul appel qui attend leurs completions : les messages peuvent ensuite
+ * etre liberes. Comme avec sendmmsg, un echec arrete les envois suivants.
+ *
+ * @param u un pointeur sur le backend.
+ * @param lot un pointeur sur le lot (lot->datagrammes compte les envois
+ *        reussis).
+ * @return 0 en cas de reussite, un code d'erreur sinon.
+*/
+int envoyer_lot_uring(uring *u, lot_envoi *lot)
+{
+    anneau_uring *a = &u->envoi;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned int i, tete, queue, attendues = lot->nb;
+    int err = 0, nb;
+    
+    for(i=0; i<lot->nb; i++)
+    {
+        sqe = entree_soumission(a, i);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = u->sfd;
+        sqe->addr = (uint64_t)(uintptr_t)&lot->entetes[i].msg_hdr;
+        sqe->len = 1;
+        sqe->flags = i+1<lot->nb ? IOSQE_IO_LINK : 0;
+        sqe->user_data = URING_ENVOI;
+    }
+    publier_soumissions(a, lot->nb);
+    
+    /* Soumission et attente des completions : la premiere entree peut
+       avoir ete soumise meme si l'attente est interrompue */
+    nb = lot->nb;
+    while(attendues > 0)
+    {
+        if(io_uring_enter(a->fd, nb, attendues,
+                          IORING_ENTER_GETEVENTS)==-1)
+        {
+            if(errno==EINTR)
+            {
+                nb = *a->sq_queue-__atomic_load_n(a->sq_tete,
+                                                 __ATOMIC_ACQUIRE);
+                continue;
+            }
+            perror("Error io_uring_enter");
+            return 155;
+        }
+        nb = 0;
+    
+        tete = *a->cq_tete;
+        queue = __atomic_load_n(a->cq_queue, __ATOMIC_ACQUIRE);
+        while(tete!=queue)
+        {
+            cqe = &a->cqes[tete & *a->cq_masque];
+            if(cqe->res>=0)
+                lot->datagrammes++;
+            else if(cqe->res!=-ECANCELED && err==0)
+            {
+                errno = -cqe->res;
+                perror("Error sendmsg");
+                err = 60;
+            }
+            tete++;
+            attendues--;
+        }
+        __atomic_store_n(a->cq_tete, tete, __ATOMIC_RELEASE);
+    }
+    
+    return err;
+}
+
+/**
+ * @brief Affiche les statistiques du backend io_uring.
+ *
+ * @param u un pointeur sur le backend.
+ * @param f le flux sur lequel ecrire.
+*/
+void afficher_stats_uring(uring *u, FILE *f)
+{
+    fprintf(f, "io_uring : %lu receptions multishot soumises, %lu arrets "\
+               "faute de tampon fourni, %lu debordements, %lu datagrammes "\
+               "trop longs\n", u->rearmements, u->epuisements,
+            u->debordements, u->tronques);
+}
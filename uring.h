@@ -0,0 +1,86 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "lots.h"
+
+/* Nombre de tampons fournis au noyau pour la reception (puissance de 2) */
+#define URING_TAMPONS 256
+
+/* Identifiant du groupe de tampons fournis */
+#define URING_GROUPE 0
+
+/* Taille d'un tampon fourni : entete de recvmsg multishot, adresse de
+   l'emetteur puis datagramme */
+#define URING_TAILLE_TAMPON (sizeof(struct io_uring_recvmsg_out)+\
+                             sizeof(sockaddr_in)+MAX_MESS_SIZE)
+
+/* Anneaux de soumission et de completion d'une instance io_uring */
+typedef struct anneau_uring{
+    int fd;                     // Instance io_uring
+    unsigned int *sq_drapeaux;  // Etat de l'instance (debordement, ...)
+    unsigned int *sq_tete;      // Tete de l'anneau de soumission (noyau)
+    unsigned int *sq_queue;     // Queue de l'anneau de soumission
+    unsigned int *sq_masque;    // Masque des indices de soumission
+    unsigned int *sq_tableau;   // Indices des entrees soumises
+    struct io_uring_sqe *sqes;  // Entrees de soumission
+    unsigned int *cq_tete;      // Tete de l'anneau de completion
+    unsigned int *cq_queue;     // Queue de l'anneau de completion (noyau)
+    unsigned int *cq_masque;    // Masque des indices de completion
+    struct io_uring_cqe *cqes;  // Entrees de completion
+    void *sq_zone;              // Projection de l'anneau de soumission
+    size_t sq_taille;
+    void *cq_zone;              // Projection de l'anneau de completion
+    size_t cq_taille;           // (0 si partagee avec la soumission)
+    size_t sqes_taille;         // Taille de la projection des entrees
+} anneau_uring;
+
+/*
+ Backend io_uring d'un thread de reception : une instance reçoit les
+ datagrammes de la socket par un recvmsg multishot dans des tampons fournis
+ au noyau, une autre envoie les lots de datagrammes par des sendmsg lies.
+ Le descripteur de l'instance de reception (reception.fd) est surveille a
+ la place de la socket.
+*/
+typedef struct uring{
+    int sfd;                    // Socket du thread
+    anneau_uring reception;     // Reception multishot
+    anneau_uring envoi;         // Envois lies
+    struct io_uring_buf_ring *fournis; // Anneau des tampons fournis
+    donnees *tampons;           // Memoire des tampons fournis
+    struct msghdr modele;       // Format de reception (taille de l'adresse)
+    int arme;                   // Une reception multishot est en cours
+    unsigned long rearmements;  // Nombre de receptions multishot soumises
+    unsigned long epuisements;  // Arrets faute de tampon fourni
+    unsigned long debordements; // Completions ayant deborde de l'anneau
+    unsigned long tronques;     // Datagrammes trop longs ignores
+} uring;
+
+/* Prepare le backend io_uring d'une socket */
+int init_uring(uring *u, int sfd, unsigned int capacite);
+
+/* Soumet la reception multishot du backend */
+int demarrer_uring(uring *u);
+
+/* Libere le backend io_uring */
+void delete_uring(uring *u);
+
+/* Reçoit les datagrammes deja arrives dans un lot */
+int recevoir_lot_uring(uring *u, lot_reception *lot);
+
+/* Envoie les datagrammes d'un lot d'envoi */
+int envoyer_lot_uring(uring *u, lot_envoi *lot);
+
+/* Affiche les statistiques du backend */
+void afficher_stats_uring(uring *u, FILE *f);
+
+#endif